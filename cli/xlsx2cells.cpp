@@ -0,0 +1,533 @@
+// xlsx2cells: the cells of the worksheets of an xlsx file, one row per cell,
+// like xlsx_cells() in R, written to standard output as CSV or as an Arrow IPC
+// stream.  It uses the same parsers as the R package, without R, so that they
+// can be profiled, and used from other programs.
+//
+//   xlsx2cells file.xlsx [--format=csv|arrow] [--no-blank-cells]
+//                        [--chunk-size=n]
+//
+// The cells are read a chunk at a time, as by xlsx_cells_chunked(), so shared
+// formulas are expanded, and merged cells aren't looked up.  The columns are
+// those of xlsx_cells(), except character_formatted.  Blank cells are included
+// unless --no-blank-cells is given, as by include_blank_cells = TRUE in R.
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "zip.h"
+#include "cellsink.h"
+#include "sheetfiles.h"
+#include "xlsxbook.h"
+#include "date.h"
+
+#ifdef XLSX2CELLS_ARROW
+#include <arrow/c/bridge.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/record_batch.h>
+#include "arrowexport.h"
+#endif
+
+// Missing values are as arrowexport takes them: INT_MIN for logicals and
+// integers, NaN for doubles, and missing strings are flagged.
+struct textcolumn {
+  std::vector<std::string> text_;
+  std::vector<char> missing_;
+
+  void resize(size_t n) {
+    text_.resize(n);
+    missing_.assign(n, 1);
+  }
+  void set(size_t i, const char* x) {
+    if (x != NULL) {
+      text_[i] = x;
+      missing_[i] = 0;
+    }
+  }
+};
+
+// One chunk of cells at a time, in columns
+class cellbuffer: public cellsink {
+
+  public:
+
+    size_t n_;
+    unsigned long long int impossible_; // 1900-02-29 dates, which are missing
+    textcolumn sheet_;
+    textcolumn address_;
+    std::vector<int> row_;
+    std::vector<int> col_;
+    std::vector<int> is_blank_;
+    textcolumn content_;
+    textcolumn data_type_;
+    textcolumn error_;
+    std::vector<int> logical_;
+    std::vector<double> numeric_;
+    std::vector<double> date_; // seconds since the epoch
+    textcolumn character_;
+    textcolumn formula_;
+    std::vector<int> is_array_;
+    textcolumn formula_ref_;
+    std::vector<int> formula_group_;
+    textcolumn comment_;
+    std::vector<double> height_;
+    std::vector<double> width_;
+    std::vector<double> row_outline_level_;
+    std::vector<double> col_outline_level_;
+    textcolumn style_format_;
+    std::vector<int> local_format_id_;
+
+    cellbuffer(): n_(0), impossible_(0), book_(NULL) {}
+
+    void start(const xlsxbook& book) {
+      book_ = &book;
+    }
+
+    void resize(unsigned long long int n) {
+      n_ = n;
+      sheet_.resize(n);
+      address_.resize(n);
+      row_.assign(n, INT_MIN);
+      col_.assign(n, INT_MIN);
+      is_blank_.assign(n, 0);
+      content_.resize(n);
+      data_type_.resize(n);
+      error_.resize(n);
+      logical_.assign(n, INT_MIN);
+      numeric_.assign(n, NAN);
+      date_.assign(n, NAN);
+      character_.resize(n);
+      formula_.resize(n);
+      is_array_.assign(n, 0);
+      formula_ref_.resize(n);
+      formula_group_.assign(n, INT_MIN);
+      comment_.resize(n);
+      height_.assign(n, NAN);
+      width_.assign(n, NAN);
+      row_outline_level_.assign(n, NAN);
+      col_outline_level_.assign(n, NAN);
+      style_format_.resize(n);
+      local_format_id_.assign(n, INT_MIN);
+    }
+
+    void cell(unsigned long long int i, const cellrecord& cell) {
+      sheet_.set(i, cell.sheet_->c_str());
+      address_.set(i, cell.address_.c_str());
+      row_[i] = cell.row_;
+      col_[i] = cell.col_;
+      is_blank_[i] = cell.is_blank_;
+      content_.set(i, cell.content_);
+      data_type_.set(i, cell.data_type_);
+      error_.set(i, cell.error_);
+      if (cell.logical_ != -1) {
+        logical_[i] = cell.logical_;
+      }
+      numeric_[i] = cell.numeric_;
+      if (!std::isnan(cell.date_)) {
+        date_[i] = serialToPOSIX(cell.date_, book_->dateSystem_,
+                                 book_->dateOffset_);
+        impossible_ += std::isnan(date_[i]);
+      }
+      character_.set(i, cell.character_);
+      formula_.set(i, cell.formula_);
+      is_array_[i] = cell.is_array_;
+      formula_ref_.set(i, cell.formula_ref_);
+      if (cell.formula_group_ != -1) {
+        formula_group_[i] = cell.formula_group_;
+      }
+      if (cell.comment_ != NULL) {
+        comment_.set(i, cell.comment_->c_str());
+      }
+      height_[i] = cell.height_;
+      width_[i] = cell.width_;
+      row_outline_level_[i] = cell.row_outline_level_;
+      col_outline_level_[i] = cell.col_outline_level_;
+      if (cell.style_format_ != NULL) {
+        style_format_.set(i, cell.style_format_->c_str());
+      }
+      if (cell.local_format_id_ != -1) {
+        local_format_id_[i] = cell.local_format_id_;
+      }
+    }
+
+    // Give each column to a writer, in the order of xlsx_cells().  Text that
+    // repeats a lot is flagged for dictionary-encoding, as by export_arrow().
+    template <class writer>
+    void columns(writer& out) const {
+      out.text("sheet", sheet_, true);
+      out.text("address", address_, false);
+      out.integer("row", row_);
+      out.integer("col", col_);
+      out.logical("is_blank", is_blank_);
+      out.text("content", content_, false);
+      out.text("data_type", data_type_, true);
+      out.text("error", error_, false);
+      out.logical("logical", logical_);
+      out.real("numeric", numeric_);
+      out.timestamp("date", date_);
+      out.text("character", character_, false);
+      out.text("formula", formula_, false);
+      out.logical("is_array", is_array_);
+      out.text("formula_ref", formula_ref_, false);
+      out.integer("formula_group", formula_group_);
+      out.text("comment", comment_, false);
+      out.real("height", height_);
+      out.real("width", width_);
+      out.real("row_outline_level", row_outline_level_);
+      out.real("col_outline_level", col_outline_level_);
+      out.text("style_format", style_format_, true);
+      out.integer("local_format_id", local_format_id_);
+    }
+
+  private:
+
+    const xlsxbook* book_;
+
+};
+
+class cellwriter {
+
+  public:
+
+    virtual ~cellwriter() {}
+    virtual void write(const cellbuffer& cells) = 0; // a chunk
+    virtual void close() {}
+
+};
+
+// RFC 4180, with missing values as empty fields, logicals as TRUE and FALSE,
+// and dates as ISO 8601 in UTC.  Numbers have as many digits as they need to
+// be read back exactly.
+class csvwriter: public cellwriter {
+
+  public:
+
+    csvwriter(std::ostream& out): out_(out), started_(false) {}
+
+    void write(const cellbuffer& cells) {
+      if (!started_) { // the names of the columns
+        header_ = true;
+        first_ = true;
+        cells.columns(*this);
+        out_ << '\n';
+        header_ = false;
+        started_ = true;
+      }
+      for (i_ = 0; i_ < cells.n_; ++i_) {
+        first_ = true;
+        cells.columns(*this);
+        out_ << '\n';
+      }
+    }
+
+    void close() {
+      out_.flush();
+    }
+
+    void text(const char* name, const textcolumn& x, bool /* dictionary */) {
+      if (field(name) && !x.missing_[i_]) {
+        quote(x.text_[i_]);
+      }
+    }
+
+    void integer(const char* name, const std::vector<int>& x) {
+      if (field(name) && x[i_] != INT_MIN) {
+        out_ << x[i_];
+      }
+    }
+
+    void logical(const char* name, const std::vector<int>& x) {
+      if (field(name) && x[i_] != INT_MIN) {
+        out_ << (x[i_] ? "TRUE" : "FALSE");
+      }
+    }
+
+    void real(const char* name, const std::vector<double>& x) {
+      if (field(name) && !std::isnan(x[i_])) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.15g", x[i_]);
+        if (strtod(buffer, NULL) != x[i_]) {
+          snprintf(buffer, sizeof(buffer), "%.17g", x[i_]);
+        }
+        out_ << buffer;
+      }
+    }
+
+    void timestamp(const char* name, const std::vector<double>& x) {
+      if (field(name) && !std::isnan(x[i_])) {
+        iso8601(x[i_]);
+      }
+    }
+
+  private:
+
+    std::ostream& out_;
+    bool started_;
+    bool header_; // whether the names are being written, rather than values
+    bool first_;  // whether no field of the line has been written yet
+    size_t i_;    // cell being written
+
+    // Separate the field from the last, and write the name if it is the
+    // header.  Returns whether a value is wanted.
+    bool field(const char* name) {
+      if (!first_) {
+        out_ << ',';
+      }
+      first_ = false;
+      if (header_) {
+        out_ << name;
+        return false;
+      }
+      return true;
+    }
+
+    void quote(const std::string& x) {
+      if (x.find_first_of(",\"\r\n") == std::string::npos) {
+        out_ << x;
+        return;
+      }
+      out_ << '"';
+      for (std::string::const_iterator c = x.begin(); c != x.end(); ++c) {
+        if (*c == '"') {
+          out_ << '"';
+        }
+        out_ << *c;
+      }
+      out_ << '"';
+    }
+
+    void iso8601(double seconds) {
+      // Civil from days, by Howard Hinnant, which works for any date, unlike
+      // gmtime() on some platforms.  Milliseconds only if there are any.
+      long long ms = std::llround(seconds * 1000);
+      long long days = ms / 86400000;
+      long long time = ms % 86400000;
+      if (time < 0) {
+        time += 86400000;
+        days -= 1;
+      }
+      long long z = days + 719468;
+      long long era = (z >= 0 ? z : z - 146096) / 146097;
+      long long doe = z - era * 146097;
+      long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+      long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      long long mp = (5 * doy + 2) / 153;
+      long long day = doy - (153 * mp + 2) / 5 + 1;
+      long long month = mp < 10 ? mp + 3 : mp - 9;
+      long long year = yoe + era * 400 + (month <= 2);
+      char buffer[48];
+      int n = snprintf(buffer, sizeof(buffer), "%04lld-%02lld-%02lldT%02lld:%02lld:%02lld",
+                       year, month, day, time / 3600000, time / 60000 % 60,
+                       time / 1000 % 60);
+      if (time % 1000 != 0) {
+        snprintf(buffer + n, sizeof(buffer) - n, ".%03lld", time % 1000);
+      }
+      out_ << buffer << 'Z';
+    }
+
+};
+
+#ifdef XLSX2CELLS_ARROW
+
+// One record batch per chunk, through the Arrow C data interface, written by
+// the Arrow C++ library.  Dictionaries are replaced in each batch.
+class arrowwriter: public cellwriter {
+
+  public:
+
+    arrowwriter(): columns_(NULL) {
+      out_ = check(arrow::io::FileOutputStream::Open(1)); // standard output
+    }
+
+    void write(const cellbuffer& cells) {
+      arrowexport columns(cells.n_);
+      columns_ = &columns;
+      cells.columns(*this);
+      columns_ = NULL;
+      ArrowSchema schema;
+      ArrowArray array;
+      columns.moveTo(&schema, &array);
+      std::shared_ptr<arrow::RecordBatch> batch =
+        check(arrow::ImportRecordBatch(&array, &schema));
+      if (writer_ == NULL) {
+        writer_ = check(arrow::ipc::MakeStreamWriter(out_, batch->schema()));
+      }
+      check(writer_->WriteRecordBatch(*batch));
+    }
+
+    void close() {
+      if (writer_ != NULL) {
+        check(writer_->Close());
+      }
+      check(out_->Close());
+    }
+
+    void text(const char* name, const textcolumn& x, bool dictionary) {
+      strings_.resize(x.text_.size());
+      for (size_t i = 0; i < strings_.size(); ++i) {
+        strings_[i] = x.missing_[i] ? NULL : x.text_[i].c_str();
+      }
+      if (dictionary) {
+        columns_->addDictionary(name, strings_.data());
+      } else {
+        columns_->addString(name, strings_.data());
+      }
+    }
+
+    void integer(const char* name, const std::vector<int>& x) {
+      columns_->addInteger(name, x.data());
+    }
+
+    void logical(const char* name, const std::vector<int>& x) {
+      columns_->addLogical(name, x.data());
+    }
+
+    void real(const char* name, const std::vector<double>& x) {
+      columns_->addDouble(name, x.data());
+    }
+
+    void timestamp(const char* name, const std::vector<double>& x) {
+      columns_->addTimestamp(name, x.data(), "UTC");
+    }
+
+  private:
+
+    arrowexport* columns_; // of the chunk being written
+    std::vector<const char*> strings_;
+    std::shared_ptr<arrow::io::OutputStream> out_;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+
+    static void check(const arrow::Status& status) {
+      if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+      }
+    }
+
+    template <class T>
+    static T check(arrow::Result<T> result) {
+      check(result.status());
+      return result.MoveValueUnsafe();
+    }
+
+};
+
+#endif
+
+static int usage() {
+  std::cerr <<
+    "Usage: xlsx2cells file.xlsx [--format=csv|arrow] [--no-blank-cells]\n"
+    "                            [--chunk-size=n]\n"
+    "\n"
+    "Writes the cells of the worksheets of file.xlsx to standard output, one\n"
+    "row per cell, as CSV (the default) or as an Arrow IPC stream.  Blank\n"
+    "cells are included unless --no-blank-cells is given.\n";
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  std::string path;
+  std::string format("csv");
+  bool include_blank_cells(true);
+  unsigned long long int chunk_size(100000);
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 9, "--format=") == 0) {
+      format = arg.substr(9);
+    } else if (arg == "--no-blank-cells") {
+      include_blank_cells = false;
+    } else if (arg.compare(0, 13, "--chunk-size=") == 0) {
+      char* end;
+      errno = 0;
+      chunk_size = strtoull(arg.c_str() + 13, &end, 10);
+      if (*end != '\0' || errno != 0 || chunk_size == 0) {
+        return usage();
+      }
+    } else if (arg.compare(0, 2, "--") != 0 && path.empty()) {
+      path = arg;
+    } else {
+      return usage();
+    }
+  }
+  if (path.empty()) {
+    return usage();
+  }
+
+  try {
+    std::unique_ptr<cellwriter> writer;
+    if (format == "csv") {
+      std::ios::sync_with_stdio(false);
+      writer.reset(new csvwriter(std::cout));
+#ifdef XLSX2CELLS_ARROW
+    } else if (format == "arrow") {
+      writer.reset(new arrowwriter());
+#else
+    } else if (format == "arrow") {
+      std::cerr << "xlsx2cells: built without Arrow, so only --format=csv is "
+        "available (configure with -DXLSX2CELLS_ARROW=ON)\n";
+      return 2;
+#endif
+    } else {
+      return usage();
+    }
+
+    ziparchive archive(path);
+
+    // Worksheets in the order of their relationships, omitting chartsheets,
+    // like utils_xlsx_sheet_files() in R, which standardises paths such as
+    // /xl/worksheets/sheet1.xml and worksheets/sheet1.xml
+    sheetfiles files(archive);
+    std::vector<size_t> order;
+    for (size_t i = 0; i < files.sheet_path_.size(); ++i) {
+      std::string& sheet_path = files.sheet_path_[i];
+      if (sheet_path.compare(0, 1, "/") == 0) sheet_path.erase(0, 1);
+      if (sheet_path.compare(0, 3, "xl/") == 0) sheet_path.erase(0, 3);
+      sheet_path.insert(0, "xl/");
+      if (sheet_path.compare(0, 13, "xl/worksheets") == 0) {
+        order.push_back(i);
+      }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return files.rId_[a] < files.rId_[b];
+    });
+    std::vector<std::string> sheet_paths;
+    std::vector<std::string> sheet_names;
+    std::vector<std::string> comments_paths;
+    for (std::vector<size_t>::iterator i = order.begin(); i != order.end(); ++i) {
+      sheet_paths.push_back(files.sheet_path_[*i]);
+      sheet_names.push_back(files.name_[*i]);
+      comments_paths.push_back(files.comments_path_[*i]);
+    }
+
+    cellbuffer cells;
+    xlsxbook book(archive, sheet_paths, sheet_names, comments_paths, cells,
+                  include_blank_cells, true, merge_mode::NONE, true);
+    bool any(false);
+    while (book.nextChunk(chunk_size)) {
+      writer->write(cells);
+      any = true;
+    }
+    if (!any) { // so that the columns are still described
+      cells.resize(0);
+      writer->write(cells);
+    }
+    writer->close();
+
+    if (cells.impossible_ > 0) {
+      std::cerr << "xlsx2cells: missing values written for "
+        << cells.impossible_ << " impossible 1900-02-29 datetimes\n";
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "xlsx2cells: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
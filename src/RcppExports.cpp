@@ -1,6 +1,7 @@
 // Generated by using Rcpp::compileAttributes() -> do not edit by hand
 // Generator token: 10BE3573-1514-4C36-9D1C-5A225CD40393
 
+#include "tidyxlcustom_types.h"
 #include <Rcpp.h>
 
 using namespace Rcpp;
@@ -10,50 +11,204 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// cell_index_
+XPtr<cellindex> cell_index_(int n_sheets, IntegerVector sheets, IntegerVector rows, IntegerVector cols);
+RcppExport SEXP _tidyxlcustom_cell_index_(SEXP n_sheetsSEXP, SEXP sheetsSEXP, SEXP rowsSEXP, SEXP colsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n_sheets(n_sheetsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cols(colsSEXP);
+    rcpp_result_gen = Rcpp::wrap(cell_index_(n_sheets, sheets, rows, cols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cell_index_in_
+List cell_index_in_(XPtr<cellindex> index, IntegerVector sheets, CharacterVector refs);
+RcppExport SEXP _tidyxlcustom_cell_index_in_(SEXP indexSEXP, SEXP sheetsSEXP, SEXP refsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<cellindex> >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type refs(refsSEXP);
+    rcpp_result_gen = Rcpp::wrap(cell_index_in_(index, sheets, refs));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cell_index_neighbours_
+List cell_index_neighbours_(XPtr<cellindex> index, IntegerVector sheets, CharacterVector addresses, std::string direction);
+RcppExport SEXP _tidyxlcustom_cell_index_neighbours_(SEXP indexSEXP, SEXP sheetsSEXP, SEXP addressesSEXP, SEXP directionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<cellindex> >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type direction(directionSEXP);
+    rcpp_result_gen = Rcpp::wrap(cell_index_neighbours_(index, sheets, addresses, direction));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cell_index_blocks_
+List cell_index_blocks_(XPtr<cellindex> index);
+RcppExport SEXP _tidyxlcustom_cell_index_blocks_(SEXP indexSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<cellindex> >::type index(indexSEXP);
+    rcpp_result_gen = Rcpp::wrap(cell_index_blocks_(index));
+    return rcpp_result_gen;
+END_RCPP
+}
+// export_arrow_
+SEXP export_arrow_(List x, CharacterVector dictionary);
+RcppExport SEXP _tidyxlcustom_export_arrow_(SEXP xSEXP, SEXP dictionarySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type x(xSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type dictionary(dictionarySEXP);
+    rcpp_result_gen = Rcpp::wrap(export_arrow_(x, dictionary));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_graph_
+XPtr<depgraph> formula_graph_(CharacterVector sheets, IntegerVector cell_sheets, IntegerVector rows, IntegerVector cols, CharacterVector formulas, CharacterVector name_names, IntegerVector name_sheets, CharacterVector name_formulas);
+RcppExport SEXP _tidyxlcustom_formula_graph_(SEXP sheetsSEXP, SEXP cell_sheetsSEXP, SEXP rowsSEXP, SEXP colsSEXP, SEXP formulasSEXP, SEXP name_namesSEXP, SEXP name_sheetsSEXP, SEXP name_formulasSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cell_sheets(cell_sheetsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type formulas(formulasSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type name_names(name_namesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type name_sheets(name_sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type name_formulas(name_formulasSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_graph_(sheets, cell_sheets, rows, cols, formulas, name_names, name_sheets, name_formulas));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_precedents_
+List formula_precedents_(XPtr<depgraph> graph, IntegerVector sheets, CharacterVector addresses);
+RcppExport SEXP _tidyxlcustom_formula_precedents_(SEXP graphSEXP, SEXP sheetsSEXP, SEXP addressesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<depgraph> >::type graph(graphSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_precedents_(graph, sheets, addresses));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_dependents_
+List formula_dependents_(XPtr<depgraph> graph, IntegerVector sheets, CharacterVector addresses, bool recursive);
+RcppExport SEXP _tidyxlcustom_formula_dependents_(SEXP graphSEXP, SEXP sheetsSEXP, SEXP addressesSEXP, SEXP recursiveSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<depgraph> >::type graph(graphSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< bool >::type recursive(recursiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_dependents_(graph, sheets, addresses, recursive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_graph_edges_
+double formula_graph_edges_(XPtr<depgraph> graph);
+RcppExport SEXP _tidyxlcustom_formula_graph_edges_(SEXP graphSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<depgraph> >::type graph(graphSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_graph_edges_(graph));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_order_
+List formula_order_(XPtr<depgraph> graph);
+RcppExport SEXP _tidyxlcustom_formula_order_(SEXP graphSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<depgraph> >::type graph(graphSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_order_(graph));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_evaluate_
+List formula_evaluate_(XPtr<depgraph> graph, CharacterVector formulas, LogicalVector is_array, CharacterVector data_types, CharacterVector content, LogicalVector logical, CharacterVector character, CharacterVector error, double tolerance);
+RcppExport SEXP _tidyxlcustom_formula_evaluate_(SEXP graphSEXP, SEXP formulasSEXP, SEXP is_arraySEXP, SEXP data_typesSEXP, SEXP contentSEXP, SEXP logicalSEXP, SEXP characterSEXP, SEXP errorSEXP, SEXP toleranceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<depgraph> >::type graph(graphSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type formulas(formulasSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type is_array(is_arraySEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type data_types(data_typesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type content(contentSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type logical(logicalSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type character(characterSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type error(errorSEXP);
+    Rcpp::traits::input_parameter< double >::type tolerance(toleranceSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_evaluate_(graph, formulas, is_array, data_types, content, logical, character, error, tolerance));
+    return rcpp_result_gen;
+END_RCPP
+}
 // xlsx_cells_
-List xlsx_cells_(std::string path, CharacterVector sheet_paths, CharacterVector sheet_names, CharacterVector comments_paths, bool include_blank_cells);
-RcppExport SEXP _tidyxlcustom_xlsx_cells_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP, SEXP comments_pathsSEXP, SEXP include_blank_cellsSEXP) {
+List xlsx_cells_(SEXP path, CharacterVector sheet_paths, CharacterVector sheet_names, CharacterVector comments_paths, bool include_blank_cells, bool formatted, bool expand_shared_formulas, std::string merged_cells);
+RcppExport SEXP _tidyxlcustom_xlsx_cells_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP, SEXP comments_pathsSEXP, SEXP include_blank_cellsSEXP, SEXP formattedSEXP, SEXP expand_shared_formulasSEXP, SEXP merged_cellsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type comments_paths(comments_pathsSEXP);
     Rcpp::traits::input_parameter< bool >::type include_blank_cells(include_blank_cellsSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_cells_(path, sheet_paths, sheet_names, comments_paths, include_blank_cells));
+    Rcpp::traits::input_parameter< bool >::type formatted(formattedSEXP);
+    Rcpp::traits::input_parameter< bool >::type expand_shared_formulas(expand_shared_formulasSEXP);
+    Rcpp::traits::input_parameter< std::string >::type merged_cells(merged_cellsSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_cells_(path, sheet_paths, sheet_names, comments_paths, include_blank_cells, formatted, expand_shared_formulas, merged_cells));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_formats_
-List xlsx_formats_(std::string path);
-RcppExport SEXP _tidyxlcustom_xlsx_formats_(SEXP pathSEXP) {
+List xlsx_formats_(SEXP path, bool flat);
+RcppExport SEXP _tidyxlcustom_xlsx_formats_(SEXP pathSEXP, SEXP flatSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_formats_(path));
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< bool >::type flat(flatSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_formats_(path, flat));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_sheet_files_
-List xlsx_sheet_files_(std::string path);
+List xlsx_sheet_files_(SEXP path);
 RcppExport SEXP _tidyxlcustom_xlsx_sheet_files_(SEXP pathSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
     rcpp_result_gen = Rcpp::wrap(xlsx_sheet_files_(path));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_validation_
-List xlsx_validation_(std::string path, CharacterVector sheet_paths, CharacterVector sheet_names);
+List xlsx_validation_(SEXP path, CharacterVector sheet_paths, CharacterVector sheet_names);
 RcppExport SEXP _tidyxlcustom_xlsx_validation_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
     rcpp_result_gen = Rcpp::wrap(xlsx_validation_(path, sheet_paths, sheet_names));
@@ -61,16 +216,31 @@ BEGIN_RCPP
 END_RCPP
 }
 // xlsx_names_
-List xlsx_names_(std::string path);
+List xlsx_names_(SEXP path);
 RcppExport SEXP _tidyxlcustom_xlsx_names_(SEXP pathSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
     rcpp_result_gen = Rcpp::wrap(xlsx_names_(path));
     return rcpp_result_gen;
 END_RCPP
 }
+// xlsx_table_
+List xlsx_table_(SEXP path, std::string sheet_path, int skip, bool col_names, int guess_max);
+RcppExport SEXP _tidyxlcustom_xlsx_table_(SEXP pathSEXP, SEXP sheet_pathSEXP, SEXP skipSEXP, SEXP col_namesSEXP, SEXP guess_maxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sheet_path(sheet_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type skip(skipSEXP);
+    Rcpp::traits::input_parameter< bool >::type col_names(col_namesSEXP);
+    Rcpp::traits::input_parameter< int >::type guess_max(guess_maxSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_table_(path, sheet_path, skip, col_names, guess_max));
+    return rcpp_result_gen;
+END_RCPP
+}
 // is_date_format_
 LogicalVector is_date_format_(CharacterVector formats);
 RcppExport SEXP _tidyxlcustom_is_date_format_(SEXP formatsSEXP) {
@@ -82,17 +252,81 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// format_number_
+CharacterVector format_number_(NumericVector values, CharacterVector formats, int date_system);
+RcppExport SEXP _tidyxlcustom_format_number_(SEXP valuesSEXP, SEXP formatsSEXP, SEXP date_systemSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericVector >::type values(valuesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type formats(formatsSEXP);
+    Rcpp::traits::input_parameter< int >::type date_system(date_systemSEXP);
+    rcpp_result_gen = Rcpp::wrap(format_number_(values, formats, date_system));
+    return rcpp_result_gen;
+END_RCPP
+}
+// shared_formula_offset_
+CharacterVector shared_formula_offset_(std::string formula, int row, int col, IntegerVector rows, IntegerVector cols);
+RcppExport SEXP _tidyxlcustom_shared_formula_offset_(SEXP formulaSEXP, SEXP rowSEXP, SEXP colSEXP, SEXP rowsSEXP, SEXP colsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type formula(formulaSEXP);
+    Rcpp::traits::input_parameter< int >::type row(rowSEXP);
+    Rcpp::traits::input_parameter< int >::type col(colSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cols(colsSEXP);
+    rcpp_result_gen = Rcpp::wrap(shared_formula_offset_(formula, row, col, rows, cols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// format_date_
+CharacterVector format_date_(NumericVector dates, int date_system);
+RcppExport SEXP _tidyxlcustom_format_date_(SEXP datesSEXP, SEXP date_systemSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericVector >::type dates(datesSEXP);
+    Rcpp::traits::input_parameter< int >::type date_system(date_systemSEXP);
+    rcpp_result_gen = Rcpp::wrap(format_date_(dates, date_system));
+    return rcpp_result_gen;
+END_RCPP
+}
 // xlsx_color_theme_
-List xlsx_color_theme_(std::string path);
+List xlsx_color_theme_(SEXP path);
 RcppExport SEXP _tidyxlcustom_xlsx_color_theme_(SEXP pathSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
     rcpp_result_gen = Rcpp::wrap(xlsx_color_theme_(path));
     return rcpp_result_gen;
 END_RCPP
 }
+// zip_buffer_
+RawVector zip_buffer_(SEXP zip_path, std::string file_path);
+RcppExport SEXP _tidyxlcustom_zip_buffer_(SEXP zip_pathSEXP, SEXP file_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type zip_path(zip_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type file_path(file_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(zip_buffer_(zip_path, file_path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// zip_has_file_
+bool zip_has_file_(SEXP zip_path, std::string file_path);
+RcppExport SEXP _tidyxlcustom_zip_has_file_(SEXP zip_pathSEXP, SEXP file_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type zip_path(zip_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type file_path(file_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(zip_has_file_(zip_path, file_path));
+    return rcpp_result_gen;
+END_RCPP
+}
 // xlex_
 List xlex_(CharacterVector x);
 RcppExport SEXP _tidyxlcustom_xlex_(SEXP xSEXP) {
@@ -104,16 +338,117 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// xlex_many_
+List xlex_many_(CharacterVector x, int threads);
+RcppExport SEXP _tidyxlcustom_xlex_many_(SEXP xSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlex_many_(x, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlex_ast_
+List xlex_ast_(CharacterVector x, int threads);
+RcppExport SEXP _tidyxlcustom_xlex_ast_(SEXP xSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlex_ast_(x, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// formula_fingerprints_
+List formula_fingerprints_(CharacterVector x, IntegerVector rows, IntegerVector cols, int threads);
+RcppExport SEXP _tidyxlcustom_formula_fingerprints_(SEXP xSEXP, SEXP rowsSEXP, SEXP colsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(formula_fingerprints_(x, rows, cols, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// is_range_
+LogicalVector is_range_(CharacterVector x, int threads);
+RcppExport SEXP _tidyxlcustom_is_range_(SEXP xSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(is_range_(x, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_chunks_
+XPtr<xlsxchunks> xlsx_chunks_(SEXP path, CharacterVector sheet_paths, CharacterVector sheet_names, CharacterVector comments_paths, bool include_blank_cells, bool formatted);
+RcppExport SEXP _tidyxlcustom_xlsx_chunks_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP, SEXP comments_pathsSEXP, SEXP include_blank_cellsSEXP, SEXP formattedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type comments_paths(comments_pathsSEXP);
+    Rcpp::traits::input_parameter< bool >::type include_blank_cells(include_blank_cellsSEXP);
+    Rcpp::traits::input_parameter< bool >::type formatted(formattedSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_chunks_(path, sheet_paths, sheet_names, comments_paths, include_blank_cells, formatted));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_next_chunk_
+SEXP xlsx_next_chunk_(XPtr<xlsxchunks> chunks, double chunk_size);
+RcppExport SEXP _tidyxlcustom_xlsx_next_chunk_(SEXP chunksSEXP, SEXP chunk_sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< XPtr<xlsxchunks> >::type chunks(chunksSEXP);
+    Rcpp::traits::input_parameter< double >::type chunk_size(chunk_sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_next_chunk_(chunks, chunk_size));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_tidyxlcustom_xlsx_cells_", (DL_FUNC) &_tidyxlcustom_xlsx_cells_, 5},
-    {"_tidyxlcustom_xlsx_formats_", (DL_FUNC) &_tidyxlcustom_xlsx_formats_, 1},
+    {"_tidyxlcustom_cell_index_", (DL_FUNC) &_tidyxlcustom_cell_index_, 4},
+    {"_tidyxlcustom_cell_index_in_", (DL_FUNC) &_tidyxlcustom_cell_index_in_, 3},
+    {"_tidyxlcustom_cell_index_neighbours_", (DL_FUNC) &_tidyxlcustom_cell_index_neighbours_, 4},
+    {"_tidyxlcustom_cell_index_blocks_", (DL_FUNC) &_tidyxlcustom_cell_index_blocks_, 1},
+    {"_tidyxlcustom_export_arrow_", (DL_FUNC) &_tidyxlcustom_export_arrow_, 2},
+    {"_tidyxlcustom_formula_graph_", (DL_FUNC) &_tidyxlcustom_formula_graph_, 8},
+    {"_tidyxlcustom_formula_precedents_", (DL_FUNC) &_tidyxlcustom_formula_precedents_, 3},
+    {"_tidyxlcustom_formula_dependents_", (DL_FUNC) &_tidyxlcustom_formula_dependents_, 4},
+    {"_tidyxlcustom_formula_graph_edges_", (DL_FUNC) &_tidyxlcustom_formula_graph_edges_, 1},
+    {"_tidyxlcustom_formula_order_", (DL_FUNC) &_tidyxlcustom_formula_order_, 1},
+    {"_tidyxlcustom_formula_evaluate_", (DL_FUNC) &_tidyxlcustom_formula_evaluate_, 9},
+    {"_tidyxlcustom_xlsx_cells_", (DL_FUNC) &_tidyxlcustom_xlsx_cells_, 8},
+    {"_tidyxlcustom_xlsx_formats_", (DL_FUNC) &_tidyxlcustom_xlsx_formats_, 2},
     {"_tidyxlcustom_xlsx_sheet_files_", (DL_FUNC) &_tidyxlcustom_xlsx_sheet_files_, 1},
     {"_tidyxlcustom_xlsx_validation_", (DL_FUNC) &_tidyxlcustom_xlsx_validation_, 3},
     {"_tidyxlcustom_xlsx_names_", (DL_FUNC) &_tidyxlcustom_xlsx_names_, 1},
+    {"_tidyxlcustom_xlsx_table_", (DL_FUNC) &_tidyxlcustom_xlsx_table_, 5},
     {"_tidyxlcustom_is_date_format_", (DL_FUNC) &_tidyxlcustom_is_date_format_, 1},
+    {"_tidyxlcustom_format_number_", (DL_FUNC) &_tidyxlcustom_format_number_, 3},
+    {"_tidyxlcustom_shared_formula_offset_", (DL_FUNC) &_tidyxlcustom_shared_formula_offset_, 5},
+    {"_tidyxlcustom_format_date_", (DL_FUNC) &_tidyxlcustom_format_date_, 2},
     {"_tidyxlcustom_xlsx_color_theme_", (DL_FUNC) &_tidyxlcustom_xlsx_color_theme_, 1},
+    {"_tidyxlcustom_zip_buffer_", (DL_FUNC) &_tidyxlcustom_zip_buffer_, 2},
+    {"_tidyxlcustom_zip_has_file_", (DL_FUNC) &_tidyxlcustom_zip_has_file_, 2},
     {"_tidyxlcustom_xlex_", (DL_FUNC) &_tidyxlcustom_xlex_, 1},
+    {"_tidyxlcustom_xlex_many_", (DL_FUNC) &_tidyxlcustom_xlex_many_, 2},
+    {"_tidyxlcustom_xlex_ast_", (DL_FUNC) &_tidyxlcustom_xlex_ast_, 2},
+    {"_tidyxlcustom_formula_fingerprints_", (DL_FUNC) &_tidyxlcustom_formula_fingerprints_, 4},
+    {"_tidyxlcustom_is_range_", (DL_FUNC) &_tidyxlcustom_is_range_, 2},
+    {"_tidyxlcustom_xlsx_chunks_", (DL_FUNC) &_tidyxlcustom_xlsx_chunks_, 6},
+    {"_tidyxlcustom_xlsx_next_chunk_", (DL_FUNC) &_tidyxlcustom_xlsx_next_chunk_, 2},
     {NULL, NULL, 0}
 };
 
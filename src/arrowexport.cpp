@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "arrowexport.h"
+
+// Buffers are vectors of 64-bit words, so that they are aligned for any type.
+typedef std::vector<uint64_t> arrowbuffer;
+
+// What a schema or an array owns, freed by its release callback.  Children and
+// dictionaries are freed too, unless the consumer has moved them out, which
+// leaves their release callbacks NULL.
+struct arrowschemadata {
+  std::string format_;
+  std::string name_;
+  std::vector<ArrowSchema*> children_;
+};
+
+struct arrowarraydata {
+  std::vector<arrowbuffer> buffers_;
+  std::vector<const void*> pointers_; // to buffers_, or NULL if empty
+  std::vector<ArrowArray*> children_;
+};
+
+static void releaseSchema(ArrowSchema* schema) {
+  arrowschemadata* data = static_cast<arrowschemadata*>(schema->private_data);
+  for (size_t j = 0; j < data->children_.size(); ++j) {
+    ArrowSchema* child = data->children_[j];
+    if (child->release != NULL) child->release(child);
+    delete child;
+  }
+  if (schema->dictionary != NULL) {
+    if (schema->dictionary->release != NULL)
+      schema->dictionary->release(schema->dictionary);
+    delete schema->dictionary;
+  }
+  delete data;
+  schema->release = NULL;
+}
+
+static void releaseArray(ArrowArray* array) {
+  arrowarraydata* data = static_cast<arrowarraydata*>(array->private_data);
+  for (size_t j = 0; j < data->children_.size(); ++j) {
+    ArrowArray* child = data->children_[j];
+    if (child->release != NULL) child->release(child);
+    delete child;
+  }
+  if (array->dictionary != NULL) {
+    if (array->dictionary->release != NULL)
+      array->dictionary->release(array->dictionary);
+    delete array->dictionary;
+  }
+  delete data;
+  array->release = NULL;
+}
+
+static void initSchema(
+    ArrowSchema* schema,
+    const std::string& format,
+    const std::string& name,
+    int64_t flags) {
+  arrowschemadata* data = new arrowschemadata;
+  data->format_ = format;
+  data->name_ = name;
+  schema->format = data->format_.c_str();
+  schema->name = data->name_.c_str();
+  schema->metadata = NULL;
+  schema->flags = flags;
+  schema->n_children = 0;
+  schema->children = NULL;
+  schema->dictionary = NULL;
+  schema->release = &releaseSchema;
+  schema->private_data = data;
+}
+
+static ArrowSchema* newSchema(const std::string& format,
+                              const std::string& name) {
+  ArrowSchema* schema = new ArrowSchema;
+  initSchema(schema, format, name, ARROW_FLAG_NULLABLE);
+  return schema;
+}
+
+static void initArray(
+    ArrowArray* array,
+    int64_t length,
+    int64_t null_count,
+    std::vector<arrowbuffer>& buffers) {
+  arrowarraydata* data = new arrowarraydata;
+  data->buffers_.swap(buffers);
+  for (size_t b = 0; b < data->buffers_.size(); ++b) {
+    data->pointers_.push_back(data->buffers_[b].empty()
+                              ? NULL
+                              : data->buffers_[b].data());
+  }
+  array->length = length;
+  array->null_count = null_count;
+  array->offset = 0;
+  array->n_buffers = data->pointers_.size();
+  array->n_children = 0;
+  array->buffers = data->pointers_.data();
+  array->children = NULL;
+  array->dictionary = NULL;
+  array->release = &releaseArray;
+  array->private_data = data;
+}
+
+static ArrowArray* newArray(int64_t length, int64_t null_count,
+                            std::vector<arrowbuffer>& buffers) {
+  ArrowArray* array = new ArrowArray;
+  initArray(array, length, null_count, buffers);
+  return array;
+}
+
+// A buffer of at least one word, zeroed
+static arrowbuffer newBuffer(int64_t bytes) {
+  return arrowbuffer(std::max<int64_t>(1, (bytes + 7) / 8), 0);
+}
+
+static void setBit(arrowbuffer& bitmap, int64_t i) {
+  reinterpret_cast<uint8_t*>(bitmap.data())[i >> 3] |= 1 << (i & 7);
+}
+
+// The validity bitmap of x, which is left empty (so NULL) if nothing is null
+template <typename F>
+static arrowbuffer validity(int64_t length, F is_null, int64_t& null_count) {
+  null_count = 0;
+  for (int64_t i = 0; i < length; ++i) {
+    null_count += is_null(i);
+  }
+  arrowbuffer out;
+  if (null_count > 0) {
+    out = newBuffer((length + 7) / 8);
+    for (int64_t i = 0; i < length; ++i) {
+      if (!is_null(i)) setBit(out, i);
+    }
+  }
+  return out;
+}
+
+static int64_t stringBytes(int64_t length, const char* const* x) {
+  int64_t bytes = 0;
+  for (int64_t i = 0; i < length; ++i) {
+    if (x[i] != NULL) bytes += strlen(x[i]);
+  }
+  return bytes;
+}
+
+// Offsets and data of strings, with offsets of type T
+template <typename T>
+static void fillStrings(int64_t length, const char* const* x, int64_t bytes,
+                        std::vector<arrowbuffer>& buffers) {
+  arrowbuffer offsets = newBuffer((length + 1) * sizeof(T));
+  arrowbuffer data = newBuffer(bytes);
+  T* offset = reinterpret_cast<T*>(offsets.data());
+  char* out = reinterpret_cast<char*>(data.data());
+  offset[0] = 0;
+  for (int64_t i = 0; i < length; ++i) {
+    size_t n = (x[i] != NULL) ? strlen(x[i]) : 0;
+    if (n > 0) memcpy(out + offset[i], x[i], n);
+    offset[i + 1] = offset[i] + n;
+  }
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(offsets);
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(data);
+}
+
+arrowexport::arrowexport(int64_t length): length_(length) {}
+
+arrowexport::~arrowexport() {
+  for (size_t j = 0; j < schemas_.size(); ++j) {
+    if (schemas_[j]->release != NULL) schemas_[j]->release(schemas_[j]);
+    delete schemas_[j];
+    if (arrays_[j]->release != NULL) arrays_[j]->release(arrays_[j]);
+    delete arrays_[j];
+  }
+}
+
+void arrowexport::addColumn(ArrowSchema* schema, ArrowArray* array) {
+  schemas_.push_back(schema);
+  arrays_.push_back(array);
+}
+
+void arrowexport::addLogical(const std::string& name, const int* x) {
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return x[i] == INT_MIN;
+  }, null_count));
+  arrowbuffer values = newBuffer((length_ + 7) / 8);
+  for (int64_t i = 0; i < length_; ++i) {
+    if (x[i] != INT_MIN && x[i] != 0) setBit(values, i);
+  }
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(values);
+  addColumn(newSchema("b", name), newArray(length_, null_count, buffers));
+}
+
+void arrowexport::addInteger(const std::string& name, const int* x) {
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return x[i] == INT_MIN;
+  }, null_count));
+  arrowbuffer values = newBuffer(length_ * sizeof(int32_t));
+  memcpy(values.data(), x, length_ * sizeof(int32_t));
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(values);
+  addColumn(newSchema("i", name), newArray(length_, null_count, buffers));
+}
+
+void arrowexport::addDouble(const std::string& name, const double* x) {
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return std::isnan(x[i]);
+  }, null_count));
+  arrowbuffer values = newBuffer(length_ * sizeof(double));
+  memcpy(values.data(), x, length_ * sizeof(double));
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(values);
+  addColumn(newSchema("g", name), newArray(length_, null_count, buffers));
+}
+
+void arrowexport::addTimestamp(
+    const std::string& name,
+    const double* x,
+    const std::string& timezone) {
+  // Microseconds, because Excel datetimes have fractions of seconds
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return std::isnan(x[i]);
+  }, null_count));
+  arrowbuffer values = newBuffer(length_ * sizeof(int64_t));
+  int64_t* micro = reinterpret_cast<int64_t*>(values.data());
+  for (int64_t i = 0; i < length_; ++i) {
+    micro[i] = std::isnan(x[i]) ? 0 : (int64_t) std::llround(x[i] * 1e6);
+  }
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(values);
+  addColumn(newSchema("tsu:" + timezone, name),
+            newArray(length_, null_count, buffers));
+}
+
+void arrowexport::addString(const std::string& name, const char* const* x) {
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return x[i] == NULL;
+  }, null_count));
+  // 32-bit offsets if they are short enough, which is what most consumers
+  // expect, otherwise 64-bit ones
+  int64_t bytes = stringBytes(length_, x);
+  bool large = bytes > INT32_MAX;
+  if (large) {
+    fillStrings<int64_t>(length_, x, bytes, buffers);
+  } else {
+    fillStrings<int32_t>(length_, x, bytes, buffers);
+  }
+  addColumn(newSchema(large ? "U" : "u", name),
+            newArray(length_, null_count, buffers));
+}
+
+void arrowexport::addDictionary(const std::string& name,
+                                const char* const* x) {
+  // Each distinct string is copied once, into the dictionary, and each value
+  // is its index there.  Strings from R are cached, so equal strings usually
+  // share a pointer, which is looked up before the text is.
+  std::unordered_map<const char*, int32_t> by_pointer;
+  std::unordered_map<std::string, int32_t> by_text;
+  std::vector<const char*> levels;
+  int64_t null_count;
+  std::vector<arrowbuffer> buffers;
+  buffers.push_back(validity(length_, [&](int64_t i) {
+    return x[i] == NULL;
+  }, null_count));
+  arrowbuffer indices = newBuffer(length_ * sizeof(int32_t));
+  int32_t* index = reinterpret_cast<int32_t*>(indices.data());
+  for (int64_t i = 0; i < length_; ++i) {
+    if (x[i] == NULL) {
+      index[i] = 0;
+      continue;
+    }
+    std::unordered_map<const char*, int32_t>::iterator found =
+      by_pointer.find(x[i]);
+    if (found != by_pointer.end()) {
+      index[i] = found->second;
+      continue;
+    }
+    std::pair<std::unordered_map<std::string, int32_t>::iterator, bool> level =
+      by_text.insert({x[i], (int32_t) levels.size()});
+    if (level.second) {
+      levels.push_back(x[i]);
+    }
+    by_pointer[x[i]] = level.first->second;
+    index[i] = level.first->second;
+  }
+  buffers.push_back(arrowbuffer());
+  buffers.back().swap(indices);
+
+  int64_t n_levels = levels.size();
+  std::vector<arrowbuffer> level_buffers(1); // no nulls
+  fillStrings<int32_t>(n_levels, levels.data(),
+                       stringBytes(n_levels, levels.data()), level_buffers);
+
+  ArrowSchema* schema = newSchema("i", name);
+  schema->dictionary = newSchema("u", "");
+  ArrowArray* array = newArray(length_, null_count, buffers);
+  array->dictionary = newArray(n_levels, 0, level_buffers);
+  addColumn(schema, array);
+}
+
+void arrowexport::moveTo(ArrowSchema* schema, ArrowArray* array) {
+  initSchema(schema, "+s", "", 0);
+  arrowschemadata* schema_data =
+    static_cast<arrowschemadata*>(schema->private_data);
+  schema_data->children_.swap(schemas_);
+  schema->n_children = schema_data->children_.size();
+  schema->children = schema_data->children_.data();
+
+  std::vector<arrowbuffer> buffers(1); // no nulls
+  initArray(array, length_, 0, buffers);
+  arrowarraydata* array_data =
+    static_cast<arrowarraydata*>(array->private_data);
+  array_data->children_.swap(arrays_);
+  array->n_children = array_data->children_.size();
+  array->children = array_data->children_.data();
+}
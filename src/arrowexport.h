@@ -0,0 +1,47 @@
+#ifndef ARROWEXPORT_
+#define ARROWEXPORT_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "arrow.h"
+
+// Builds a struct array of columns, and its schema, through the Arrow C data
+// interface.  Columns are added one at a time from plain arrays, and then the
+// whole lot is moved into structs owned by the consumer, who releases them
+// when they are finished with them.  Every array owns its buffers, so it can be
+// released on any thread, after the vectors it was built from are gone.
+//
+// Missing values are given as they are in R: INT_MIN for logicals and
+// integers, NaN for doubles, and NULL for strings.
+class arrowexport {
+
+  public:
+
+    arrowexport(int64_t length);
+    ~arrowexport(); // releases any columns that haven't been moved out
+
+    void addLogical(const std::string& name, const int* x);
+    void addInteger(const std::string& name, const int* x);
+    void addDouble(const std::string& name, const double* x);
+    void addTimestamp(                 // from seconds since the epoch
+        const std::string& name,
+        const double* x,
+        const std::string& timezone);
+    void addString(const std::string& name, const char* const* x);
+    void addDictionary(const std::string& name, const char* const* x);
+
+    // Move the columns into a struct array and its schema, leaving none
+    void moveTo(ArrowSchema* schema, ArrowArray* array);
+
+  private:
+
+    int64_t length_;
+    std::vector<ArrowSchema*> schemas_; // of each column
+    std::vector<ArrowArray*> arrays_;   // of each column
+
+    void addColumn(ArrowSchema* schema, ArrowArray* array);
+
+};
+
+#endif
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <queue>
+#include <Rcpp.h>
+#include "cellcolumns.h"
+#include "xlsxsheet.h"
+#include "formattedstring.h"
+#include "date.h"
+#include "utils.h"
+#include "tibble.h"
+
+using namespace Rcpp;
+
+cellcolumns::cellcolumns(
+    const bool& include_formatted,
+    const merge_mode& merged_cells):
+  book_(NULL),
+  include_formatted_(include_formatted),
+  merge_mode_(merged_cells),
+  n_(0) {}
+
+void cellcolumns::start(const xlsxbook& book) {
+  book_ = &book;
+}
+
+void cellcolumns::sharedString(
+    unsigned long long int i,
+    const rapidxml::xml_node<>* si) {
+  // The strings aren't counted in advance, so grow the list by doubling
+  R_xlen_t n = strings_formatted_.size();
+  if ((R_xlen_t) i >= n) {
+    List grown(std::max(2 * n, (R_xlen_t) 1024));
+    for (R_xlen_t j = 0; j < n; ++j) {
+      grown[j] = strings_formatted_[j];
+    }
+    strings_formatted_ = grown;
+  }
+  strings_formatted_[i] = parseFormattedString(si, book_->styles_);
+}
+
+void cellcolumns::resize(unsigned long long int n) {
+  n_               = n;
+  sheet_           = CharacterVector(n_, NA_STRING);
+  address_         = CharacterVector(n_, NA_STRING);
+  row_             = IntegerVector(n_,   NA_INTEGER);
+  col_             = IntegerVector(n_,   NA_INTEGER);
+  is_blank_        = LogicalVector(n_,   false);
+  content_         = CharacterVector(n_, NA_STRING);
+  data_type_       = CharacterVector(n_, NA_STRING);
+  error_           = CharacterVector(n_, NA_STRING);
+  logical_         = LogicalVector(n_,   NA_LOGICAL);
+  numeric_         = NumericVector(n_,   NA_REAL);
+  date_            = NumericVector(n_,   NA_REAL);
+  date_.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+  date_.attr("tzone") = "UTC";
+  character_       = CharacterVector(n_, NA_STRING);
+  formula_         = CharacterVector(n_, NA_STRING);
+  is_array_        = LogicalVector(n_,   false);
+  formula_ref_     = CharacterVector(n_, NA_STRING);
+  formula_group_   = IntegerVector(n_,   NA_INTEGER);
+  comment_         = CharacterVector(n_, NA_STRING);
+  character_formatted_ = List(n_);
+  height_          = NumericVector(n_,   NA_REAL);
+  width_           = NumericVector(n_,   NA_REAL);
+  rowOutlineLevel_ = NumericVector(n_,   NA_REAL);
+  colOutlineLevel_ = NumericVector(n_,   NA_REAL);
+  style_format_    = CharacterVector(n_, NA_STRING);
+  local_format_id_ = IntegerVector(n_,   NA_INTEGER);
+  if (merge_mode_ != merge_mode::NONE) {
+    merge_anchor_  = CharacterVector(n_, NA_STRING);
+  }
+}
+
+void cellcolumns::cell(unsigned long long int i, const cellrecord& cell) {
+  // The columns are already NA, so only what is present is written
+  SET_STRING_ELT(sheet_, i, Rf_mkCharCE(cell.sheet_->c_str(), CE_UTF8));
+  SET_STRING_ELT(address_, i, Rf_mkCharCE(cell.address_.c_str(), CE_UTF8));
+  row_[i] = cell.row_;
+  col_[i] = cell.col_;
+  is_blank_[i] = cell.is_blank_;
+  if (cell.content_ != NULL) {
+    SET_STRING_ELT(content_, i, Rf_mkCharCE(cell.content_, CE_UTF8));
+  }
+  if (cell.data_type_ != NULL) {
+    SET_STRING_ELT(data_type_, i, Rf_mkCharCE(cell.data_type_, CE_UTF8));
+  }
+  if (cell.error_ != NULL) {
+    SET_STRING_ELT(error_, i, Rf_mkCharCE(cell.error_, CE_UTF8));
+  }
+  if (cell.logical_ != -1) {
+    logical_[i] = cell.logical_;
+  }
+  if (!std::isnan(cell.numeric_)) {
+    numeric_[i] = cell.numeric_;
+  }
+  if (!std::isnan(cell.date_)) {
+    date_[i] = cell.date_;
+  }
+  if (cell.character_ != NULL) {
+    SET_STRING_ELT(character_, i, Rf_mkCharCE(cell.character_, CE_UTF8));
+  }
+  if (cell.inline_string_ != NULL) {
+    character_formatted_[i] =
+      parseFormattedString(cell.inline_string_, book_->styles_);
+  } else if (cell.shared_string_ >= 0) {
+    character_formatted_[i] = strings_formatted_[cell.shared_string_];
+  }
+  if (cell.formula_ != NULL) {
+    SET_STRING_ELT(formula_, i, Rf_mkCharCE(cell.formula_, CE_UTF8));
+  }
+  is_array_[i] = cell.is_array_;
+  if (cell.formula_ref_ != NULL) {
+    SET_STRING_ELT(formula_ref_, i, Rf_mkCharCE(cell.formula_ref_, CE_UTF8));
+  }
+  if (cell.formula_group_ != -1) {
+    formula_group_[i] = cell.formula_group_;
+  }
+  if (cell.comment_ != NULL) {
+    SET_STRING_ELT(comment_, i, Rf_mkCharCE(cell.comment_->c_str(), CE_UTF8));
+  }
+  height_[i] = cell.height_;
+  width_[i] = cell.width_;
+  rowOutlineLevel_[i] = cell.row_outline_level_;
+  colOutlineLevel_[i] = cell.col_outline_level_;
+  if (cell.style_format_ != NULL) {
+    SET_STRING_ELT(style_format_, i,
+                   Rf_mkCharCE(cell.style_format_->c_str(), CE_UTF8));
+  }
+  if (cell.local_format_id_ != -1) {
+    local_format_id_[i] = cell.local_format_id_;
+  }
+}
+
+void cellcolumns::endSheet(
+    xlsxsheet& sheet,
+    unsigned long long int begin,
+    unsigned long long int end) {
+  // Must come before formatValues() and convertDates(), so that filled values
+  // are formatted and converted.
+  if (merge_mode_ != merge_mode::NONE) {
+    applyMergeCells(sheet, begin, end);
+  }
+}
+
+void cellcolumns::checkInterrupt() {
+  checkUserInterrupt();
+}
+
+void cellcolumns::applyMergeCells(
+    xlsxsheet& sheet,
+    unsigned long long int begin,
+    unsigned long long int end) {
+  // Tag the cells of the sheet, from begin to end, that are in merged ranges
+  // with the address of the anchor of the range, and, when filling, copy the
+  // value of the anchor into the others.  The ranges are swept down the sheet
+  // in order of their first rows, keeping those that span the current row by
+  // their first columns.  Ranges don't overlap, so neither do those, and each
+  // cell is in at most one, the last that starts at or before its column.
+  const std::vector<mergedrange>& merged = sheet.merged_;
+  if (merged.empty())
+    return;
+
+  std::vector<int> by_first_row(merged.size());
+  std::vector<std::string> anchors(merged.size());
+  for (size_t m = 0; m < merged.size(); ++m) {
+    by_first_row[m] = m;
+    anchors[m] = asA1(merged[m].first_row_, merged[m].first_col_);
+  }
+  std::stable_sort(by_first_row.begin(), by_first_row.end(),
+                   [&merged](int a, int b) {
+                     return merged[a].first_row_ < merged[b].first_row_;
+                   });
+
+  std::map<int, int> spanning; // first column, range
+  std::priority_queue<std::pair<int, int>,
+                      std::vector<std::pair<int, int> >,
+                      std::greater<std::pair<int, int> > > ending; // last row, range
+  size_t next = 0; // next range in by_first_row to start spanning
+  int sweep_row = 0;
+
+  std::vector<long long int> anchor_cells(merged.size(), -1);
+  std::vector<std::pair<unsigned long long int, int> > members; // cell, range
+  for (unsigned long long int i = begin; i < end; ++i) {
+    int row = row_[i];
+    int col = col_[i];
+    if (row < sweep_row) {
+      // Rows are in order in valid sheets, but if not then start again
+      spanning.clear();
+      ending = decltype(ending)();
+      next = 0;
+    }
+    sweep_row = row;
+    while (!ending.empty() && ending.top().first < row) {
+      int m = ending.top().second;
+      std::map<int, int>::iterator started = spanning.find(merged[m].first_col_);
+      if (started != spanning.end() && started->second == m)
+        spanning.erase(started);
+      ending.pop();
+    }
+    while (next < by_first_row.size()
+           && merged[by_first_row[next]].first_row_ <= row) {
+      int m = by_first_row[next++];
+      if (merged[m].last_row_ >= row) {
+        spanning[merged[m].first_col_] = m;
+        ending.push(std::make_pair(merged[m].last_row_, m));
+      }
+    }
+    std::map<int, int>::const_iterator found = spanning.upper_bound(col);
+    if (found == spanning.begin())
+      continue;
+    --found;
+    int m = found->second;
+    const mergedrange& range = merged[m];
+    if (col <= range.last_col_) {
+      members.push_back(std::make_pair(i, m));
+      if (row == range.first_row_ && col == range.first_col_)
+        anchor_cells[m] = i;
+    }
+  }
+
+  for (std::vector<std::pair<unsigned long long int, int> >::const_iterator
+      member = members.begin(); member != members.end(); ++member) {
+    unsigned long long int i = member->first;
+    int m = member->second;
+    merge_anchor_[i] = anchors[m];
+    long long int anchor = anchor_cells[m];
+    if (merge_mode_ != merge_mode::FILL || anchor < 0 || (unsigned long long int) anchor == i)
+      continue;
+    is_blank_[i] = is_blank_[anchor];
+    SET_STRING_ELT(content_, i, STRING_ELT(content_, anchor));
+    SET_STRING_ELT(data_type_, i, STRING_ELT(data_type_, anchor));
+    SET_STRING_ELT(error_, i, STRING_ELT(error_, anchor));
+    logical_[i] = logical_[anchor];
+    numeric_[i] = numeric_[anchor];
+    date_[i] = date_[anchor];
+    SET_STRING_ELT(character_, i, STRING_ELT(character_, anchor));
+    character_formatted_[i] = character_formatted_[anchor];
+  }
+}
+
+void cellcolumns::formatValues() {
+  // Render each value as Excel would display it, using the number formats that
+  // were compiled once each by xlsxstyleindex.  Must come before convertDates(),
+  // while date_ still holds serial dates.
+  formatted_ = CharacterVector(n_, NA_STRING);
+  const double* numeric = REAL(numeric_);
+  const double* date = REAL(date_);
+  const int* logical = LOGICAL(logical_);
+  const int* local_format_id = INTEGER(local_format_id_);
+  const int dateSystem = book_->dateSystem_;
+  std::string out;
+  for (R_xlen_t i = 0; i < n_; ++i) {
+    int cellXf = local_format_id[i] == NA_INTEGER ? 0 : local_format_id[i] - 1;
+    const numfmt& format = book_->styles_.cellNumFmt(cellXf);
+    out.clear();
+    if (!ISNAN(numeric[i])) {
+      if (!format.format(numeric[i], dateSystem, out)) continue;
+    } else if (!ISNAN(date[i])) {
+      if (!format.format(date[i], dateSystem, out)) continue;
+    } else if (STRING_ELT(character_, i) != NA_STRING) {
+      format.formatText(CHAR(STRING_ELT(character_, i)), out);
+    } else if (logical[i] != NA_LOGICAL) {
+      out = logical[i] ? "TRUE" : "FALSE";
+    } else if (STRING_ELT(error_, i) != NA_STRING) {
+      out = CHAR(STRING_ELT(error_, i));
+    } else {
+      continue;
+    }
+    SET_STRING_ELT(formatted_, i,
+                   Rf_mkCharLenCE(out.data(), out.size(), CE_UTF8));
+  }
+}
+
+void cellcolumns::convertDates() {
+  // Date cells were cached as raw serial dates while parsing the sheets.
+  // Convert them all at once, and then warn about any impossible ones, naming
+  // no more than a few.
+  std::vector<R_xlen_t> impossible;
+  serialsToPOSIX(REAL(date_), date_.size(), book_->dateSystem_,
+                 book_->dateOffset_, impossible, NA_REAL);
+  if (!impossible.empty()) {
+    std::string refs;
+    size_t n = std::min(impossible.size(), (size_t) 10);
+    for (size_t j = 0; j < n; ++j) {
+      if (j > 0) refs += ", ";
+      refs += "'";
+      refs += CHAR(STRING_ELT(sheet_, impossible[j]));
+      refs += "'!";
+      refs += CHAR(STRING_ELT(address_, impossible[j]));
+    }
+    if (impossible.size() > n) {
+      refs += " and " + std::to_string(impossible.size() - n) + " more";
+    }
+    Rcpp::warning("NA inserted for impossible 1900-02-29 datetime: " + refs);
+  }
+}
+
+List cellcolumns::information() {
+  if (include_formatted_) {
+    formatValues();
+  }
+  convertDates();
+
+  // Returns a nested data frame of everything, the data frame itself wrapped in
+  // a list.
+
+  int columns = 24 + include_formatted_ + (merge_mode_ != merge_mode::NONE);
+  List information(columns);
+  information[0] = sheet_;
+  information[1] = address_;
+  information[2] = row_;
+  information[3] = col_;
+  information[4] = is_blank_;
+  information[5] = content_;
+  information[6] = data_type_;
+  information[7] = error_;
+  information[8] = logical_;
+  information[9] = numeric_;
+  information[10] = date_;
+  information[11] = character_;
+  information[12] = character_formatted_;
+  information[13] = formula_;
+  information[14] = is_array_;
+  information[15] = formula_ref_;
+  information[16] = formula_group_;
+  information[17] = comment_;
+  information[18] = height_;
+  information[19] = width_;
+  information[20] = rowOutlineLevel_;
+  information[21] = colOutlineLevel_;
+  information[22] = style_format_;
+  information[23] = local_format_id_;
+
+  std::vector<std::string> names(columns);
+  names[0]  = "sheet";
+  names[1]  = "address";
+  names[2]  = "row";
+  names[3]  = "col";
+  names[4]  = "is_blank";
+  names[5]  = "content";
+  names[6]  = "data_type";
+  names[7]  = "error";
+  names[8]  = "logical";
+  names[9]  = "numeric";
+  names[10]  = "date";
+  names[11] = "character";
+  names[12] = "character_formatted";
+  names[13] = "formula";
+  names[14] = "is_array";
+  names[15] = "formula_ref";
+  names[16] = "formula_group";
+  names[17] = "comment";
+  names[18] = "height";
+  names[19] = "width";
+  names[20] = "row_outline_level";
+  names[21] = "col_outline_level";
+  names[22] = "style_format";
+  names[23] = "local_format_id";
+
+  int column = 24;
+  if (include_formatted_) {
+    information[column] = formatted_;
+    names[column++] = "formatted";
+  }
+  if (merge_mode_ != merge_mode::NONE) {
+    information[column] = merge_anchor_;
+    names[column++] = "merge_anchor";
+  }
+
+  information.attr("names") = names;
+
+  // Turn list of vectors into a data frame without checking anything
+  int n = Rf_length(information[0]);
+  information.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(information, n);
+
+  if (!book_->expand_shared_formulas_) {
+    information.attr("shared_formulas") = sharedFormulas();
+  }
+  if (merge_mode_ != merge_mode::NONE) {
+    information.attr("merged_cells") = mergedCells();
+  }
+
+  return information;
+}
+
+List cellcolumns::sharedFormulas() {
+  // One row per shared formula, with the cell that defines it.  Other cells of
+  // the same formula_group on the same sheet are offset from this one.
+  const std::vector<unsigned long long int>& cells = book_->shared_formula_cells_;
+  R_xlen_t n = cells.size();
+  CharacterVector sheet(n);
+  CharacterVector address(n);
+  IntegerVector   row(n);
+  IntegerVector   col(n);
+  IntegerVector   formula_group(n);
+  CharacterVector formula(n);
+  for (R_xlen_t j = 0; j < n; ++j) {
+    unsigned long long int i = cells[j];
+    SET_STRING_ELT(sheet, j, STRING_ELT(sheet_, i));
+    SET_STRING_ELT(address, j, STRING_ELT(address_, i));
+    row[j] = row_[i];
+    col[j] = col_[i];
+    formula_group[j] = formula_group_[i];
+    SET_STRING_ELT(formula, j, STRING_ELT(formula_, i));
+  }
+
+  List out = List::create(
+      _["sheet"] = sheet,
+      _["address"] = address,
+      _["row"] = row,
+      _["col"] = col,
+      _["formula_group"] = formula_group,
+      _["formula"] = formula);
+
+  // Turn list of vectors into a data frame without checking anything
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, n);
+
+  return out;
+}
+
+List cellcolumns::mergedCells() {
+  // One row per merged range, in the order of the sheets, and of the ranges
+  // within each sheet
+  const std::vector<xlsxsheet>& sheets = book_->sheets_;
+  R_xlen_t n(0);
+  for (std::vector<xlsxsheet>::const_iterator sheet = sheets.begin();
+       sheet != sheets.end(); ++sheet) {
+    n += sheet->merged_.size();
+  }
+  CharacterVector sheet_name(n);
+  CharacterVector ref(n);
+  IntegerVector   first_row(n);
+  IntegerVector   first_col(n);
+  IntegerVector   last_row(n);
+  IntegerVector   last_col(n);
+  R_xlen_t j(0);
+  for (std::vector<xlsxsheet>::const_iterator sheet = sheets.begin();
+       sheet != sheets.end(); ++sheet) {
+    for (std::vector<mergedrange>::const_iterator range = sheet->merged_.begin();
+         range != sheet->merged_.end(); ++range, ++j) {
+      SET_STRING_ELT(sheet_name, j, Rf_mkCharCE(sheet->name_.c_str(), CE_UTF8));
+      ref[j] = range->ref_;
+      first_row[j] = range->first_row_;
+      first_col[j] = range->first_col_;
+      last_row[j] = range->last_row_;
+      last_col[j] = range->last_col_;
+    }
+  }
+
+  List out = List::create(
+      _["sheet"] = sheet_name,
+      _["ref"] = ref,
+      _["first_row"] = first_row,
+      _["first_col"] = first_col,
+      _["last_row"] = last_row,
+      _["last_col"] = last_col);
+
+  // Turn list of vectors into a data frame without checking anything
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, n);
+
+  return out;
+}
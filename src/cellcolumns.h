@@ -0,0 +1,80 @@
+#ifndef CELLCOLUMNS_
+#define CELLCOLUMNS_
+
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "cellsink.h"
+#include "xlsxbook.h"
+#include "mergedrange.h"
+
+// The cells of a workbook written into the columns of a data frame, for
+// xlsx_cells().  Values are rendered as displayed, dates converted, and merged
+// ranges applied here, rather than in xlsxbook, because they are done to the
+// columns.
+class cellcolumns: public cellsink {
+
+  public:
+
+    cellcolumns(
+        const bool& include_formatted, // whether to render values as displayed
+        const merge_mode& merged_cells);
+
+    void start(const xlsxbook& book);
+    void sharedString(unsigned long long int i, const rapidxml::xml_node<>* si);
+    void resize(unsigned long long int n);
+    void cell(unsigned long long int i, const cellrecord& cell);
+    void endSheet(xlsxsheet& sheet,
+                  unsigned long long int begin,
+                  unsigned long long int end);
+    void checkInterrupt();
+
+    Rcpp::List information(); // data frame of the cells written since resize()
+
+  private:
+
+    const xlsxbook* book_;
+    bool include_formatted_;
+    merge_mode merge_mode_;
+    R_xlen_t n_;                   // cells since resize()
+    Rcpp::List strings_formatted_; // strings table with inline formatting,
+                                   // list of data frames
+
+    // Vectors of cell properties, to be wrapped in a data frame
+    Rcpp::CharacterVector sheet_;     // The worksheet that a cell is in
+    Rcpp::CharacterVector address_;   // Value of cell node r
+    Rcpp::IntegerVector   row_;       // Parsed address_ (one-based)
+    Rcpp::IntegerVector   col_;       // Parsed address_ (one-based)
+    Rcpp::LogicalVector   is_blank_;
+    Rcpp::CharacterVector content_;   // Raw cell value before type conversion
+    Rcpp::CharacterVector data_type_; // Type of the parsed value
+    Rcpp::CharacterVector error_;     // Parsed value
+    Rcpp::LogicalVector   logical_;   // Parsed value
+    Rcpp::NumericVector   numeric_;   // Parsed value
+    Rcpp::NumericVector   date_;      // Parsed value
+    Rcpp::CharacterVector character_; // Parsed value
+    Rcpp::CharacterVector formula_;   // If present
+    Rcpp::LogicalVector   is_array_;  // If formulaType is present
+    Rcpp::CharacterVector formula_ref_;   // If present
+    Rcpp::IntegerVector   formula_group_; // If present
+    Rcpp::CharacterVector comment_;
+    Rcpp::List            character_formatted_; // data frame
+    Rcpp::NumericVector   height_;          // Provided to cell constructor
+    Rcpp::NumericVector   width_;           // Provided to cell constructor
+    Rcpp::NumericVector   rowOutlineLevel_; // Provided to cell constructor
+    Rcpp::NumericVector   colOutlineLevel_; // Provided to cell constructor
+    Rcpp::CharacterVector style_format_;    // cellXfs xfId links to cellStyleXfs entry
+    Rcpp::IntegerVector   local_format_id_; // cell 'c' links to cellXfs entry
+    Rcpp::CharacterVector formatted_;       // Value as displayed, if wanted
+    Rcpp::CharacterVector merge_anchor_;    // Anchor of a merged range, if wanted
+
+    void applyMergeCells(xlsxsheet& sheet,
+                         unsigned long long int begin,
+                         unsigned long long int end);
+    void formatValues();
+    void convertDates();
+    Rcpp::List sharedFormulas(); // table of shared formulas, unexpanded
+    Rcpp::List mergedCells();    // table of merged ranges
+
+};
+
+#endif
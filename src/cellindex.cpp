@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <numeric>
+#include "cellindex.h"
+
+cellindex::cellindex(int n_sheets,
+                     const std::vector<int>& sheets,
+                     const std::vector<int>& rows,
+                     const std::vector<int>& cols) {
+  build(n_sheets, sheets, rows, cols, rows_);
+  build(n_sheets, sheets, cols, rows, cols_);
+}
+
+// Orders cells by sheet, major and minor position, and then by index, so that
+// cells at the same position stay in their original order
+struct cellorder {
+  const std::vector<int>& sheets_;
+  const std::vector<int>& majors_;
+  const std::vector<int>& minors_;
+  bool operator()(int a, int b) const {
+    if (sheets_[a] != sheets_[b]) return sheets_[a] < sheets_[b];
+    if (majors_[a] != majors_[b]) return majors_[a] < majors_[b];
+    if (minors_[a] != minors_[b]) return minors_[a] < minors_[b];
+    return a < b;
+  }
+};
+
+void cellindex::build(int n_sheets,
+                      const std::vector<int>& sheets,
+                      const std::vector<int>& majors,
+                      const std::vector<int>& minors,
+                      std::vector<sparse>& out) {
+  std::vector<int> order;
+  order.reserve(sheets.size());
+  for (size_t i = 0; i < sheets.size(); ++i) {
+    if (sheets[i] >= 0 && sheets[i] < n_sheets) {
+      order.push_back(i);
+    }
+  }
+  cellorder less = {sheets, majors, minors};
+  std::sort(order.begin(), order.end(), less);
+
+  out.assign(n_sheets, sparse());
+  for (std::vector<int>::const_iterator i = order.begin(); i != order.end(); ++i) {
+    sparse& index = out[sheets[*i]];
+    if (index.major_.empty() || index.major_.back() != majors[*i]) {
+      index.major_.push_back(majors[*i]);
+      index.start_.push_back(index.cells_.size());
+    }
+    index.minor_.push_back(minors[*i]);
+    index.cells_.push_back(*i);
+  }
+  for (std::vector<sparse>::iterator index = out.begin(); index != out.end(); ++index) {
+    index->start_.push_back(index->cells_.size());
+  }
+}
+
+void cellindex::cellsIn(const cellrect& rect, std::vector<int>& out) const {
+  if (rect.sheet_ < 0 || rect.sheet_ >= (int) rows_.size()) {
+    return;
+  }
+  const sparse& index = rows_[rect.sheet_];
+  std::vector<int>::const_iterator first =
+    std::lower_bound(index.major_.begin(), index.major_.end(), rect.first_row_);
+  std::vector<int>::const_iterator last =
+    std::upper_bound(first, index.major_.end(), rect.last_row_);
+  for (std::vector<int>::const_iterator row = first; row != last; ++row) {
+    size_t i = row - index.major_.begin();
+    std::vector<int>::const_iterator begin = index.minor_.begin() + index.start_[i];
+    std::vector<int>::const_iterator end = index.minor_.begin() + index.start_[i + 1];
+    std::vector<int>::const_iterator from =
+      std::lower_bound(begin, end, rect.first_col_);
+    std::vector<int>::const_iterator to =
+      std::upper_bound(from, end, rect.last_col_);
+    out.insert(out.end(),
+               index.cells_.begin() + (from - index.minor_.begin()),
+               index.cells_.begin() + (to - index.minor_.begin()));
+  }
+}
+
+int cellindex::nearest(const sparse& index, int major, int minor, bool after) {
+  std::vector<int>::const_iterator found =
+    std::lower_bound(index.major_.begin(), index.major_.end(), major);
+  if (found == index.major_.end() || *found != major) {
+    return -1;
+  }
+  size_t i = found - index.major_.begin();
+  std::vector<int>::const_iterator begin = index.minor_.begin() + index.start_[i];
+  std::vector<int>::const_iterator end = index.minor_.begin() + index.start_[i + 1];
+  if (after) {
+    std::vector<int>::const_iterator next = std::upper_bound(begin, end, minor);
+    return next == end ? -1 : index.cells_[next - index.minor_.begin()];
+  }
+  std::vector<int>::const_iterator next = std::lower_bound(begin, end, minor);
+  if (next == begin) {
+    return -1;
+  }
+  // The first of any cells at the same position
+  int position = *--next;
+  next = std::lower_bound(begin, next, position);
+  return index.cells_[next - index.minor_.begin()];
+}
+
+int cellindex::neighbour(int sheet, int row, int col,
+                         xldirection direction) const {
+  if (sheet < 0 || sheet >= (int) rows_.size()) {
+    return -1;
+  }
+  switch (direction) {
+    case xldirection::UP:
+      return nearest(cols_[sheet], col, row, false);
+    case xldirection::DOWN:
+      return nearest(cols_[sheet], col, row, true);
+    case xldirection::LEFT:
+      return nearest(rows_[sheet], row, col, false);
+    case xldirection::RIGHT:
+      return nearest(rows_[sheet], row, col, true);
+  }
+  return -1;
+}
+
+// Union-find of positions in a sparse index, with path halving
+static int findRoot(std::vector<int>& parents, int i) {
+  while (parents[i] != i) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
+  return i;
+}
+
+static void join(std::vector<int>& parents, int a, int b) {
+  a = findRoot(parents, a);
+  b = findRoot(parents, b);
+  if (a != b) {
+    // The earlier root wins, so that roots are the first cells by row
+    parents[std::max(a, b)] = std::min(a, b);
+  }
+}
+
+void cellindex::blocks(std::vector<cellrect>& rects,
+                       std::vector<int>& counts) const {
+  // Positions in rows_ of each cell, to relate the two indexes
+  int n_cells(0);
+  for (size_t sheet = 0; sheet < rows_.size(); ++sheet) {
+    const std::vector<int>& cells = rows_[sheet].cells_;
+    if (!cells.empty()) {
+      n_cells = std::max(n_cells,
+                         *std::max_element(cells.begin(), cells.end()) + 1);
+    }
+  }
+  std::vector<int> position(n_cells);
+
+  for (size_t sheet = 0; sheet < rows_.size(); ++sheet) {
+    const sparse& by_row = rows_[sheet];
+    const sparse& by_col = cols_[sheet];
+    size_t n = by_row.cells_.size();
+    if (n == 0) {
+      continue;
+    }
+    std::vector<int> parents(n);
+    std::iota(parents.begin(), parents.end(), 0);
+    for (size_t k = 0; k < n; ++k) {
+      position[by_row.cells_[k]] = k;
+    }
+
+    // Join cells that are next to each other in a row, or in a column
+    for (size_t i = 0; i < by_row.major_.size(); ++i) {
+      for (size_t k = by_row.start_[i]; k + 1 < by_row.start_[i + 1]; ++k) {
+        if (by_row.minor_[k + 1] - by_row.minor_[k] <= 1) {
+          join(parents, k, k + 1);
+        }
+      }
+    }
+    for (size_t i = 0; i < by_col.major_.size(); ++i) {
+      for (size_t k = by_col.start_[i]; k + 1 < by_col.start_[i + 1]; ++k) {
+        if (by_col.minor_[k + 1] - by_col.minor_[k] <= 1) {
+          join(parents,
+               position[by_col.cells_[k]],
+               position[by_col.cells_[k + 1]]);
+        }
+      }
+    }
+
+    // Bounding rectangles.  The root of each block is its first cell by row
+    // and column, so blocks are created in that order.
+    std::vector<int> block(n, -1);
+    for (size_t i = 0; i < by_row.major_.size(); ++i) {
+      int row = by_row.major_[i];
+      for (size_t k = by_row.start_[i]; k < by_row.start_[i + 1]; ++k) {
+        int root = findRoot(parents, k);
+        int col = by_row.minor_[k];
+        if (block[root] == -1) {
+          block[root] = rects.size();
+          cellrect rect = {(int) sheet, row, col, row, col, -1};
+          rects.push_back(rect);
+          counts.push_back(0);
+        }
+        cellrect& rect = rects[block[root]];
+        rect.last_row_ = row;
+        rect.first_col_ = std::min(rect.first_col_, col);
+        rect.last_col_ = std::max(rect.last_col_, col);
+        ++counts[block[root]];
+      }
+    }
+  }
+}
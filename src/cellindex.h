@@ -0,0 +1,60 @@
+#ifndef CELLINDEX_
+#define CELLINDEX_
+
+#include <vector>
+#include "depgraph.h"
+
+// Directions to look for the nearest cell in
+enum class xldirection : unsigned char {UP, DOWN, LEFT, RIGHT};
+
+// A spatial index of the positions of cells, built once, so that the cells in
+// a rectangle, or next to a position, are found without scanning every cell.
+// Cells are indexed as given, zero-based, and cells whose sheet is -1 are left
+// out.
+class cellindex {
+
+  public:
+
+    cellindex(int n_sheets,
+              const std::vector<int>& sheets,
+              const std::vector<int>& rows,
+              const std::vector<int>& cols);
+
+    // Cells within a rectangle, by row, and by column within each row
+    void cellsIn(const cellrect& rect, std::vector<int>& out) const;
+
+    // The nearest cell in a direction from a position, which needn't be a
+    // cell itself, or -1 if there isn't one
+    int neighbour(int sheet, int row, int col, xldirection direction) const;
+
+    // Blocks of cells that are next to one another, horizontally or
+    // vertically, as their bounding rectangles and their numbers of cells, in
+    // order of their first cells by row and column
+    void blocks(std::vector<cellrect>& rects, std::vector<int>& counts) const;
+
+  private:
+
+    // The cells of a sheet in compressed sparse rows (or columns): the
+    // distinct major positions, sorted, and the cells at each one,
+    // minor_[start_[i]] to minor_[start_[i + 1]], sorted by minor position.
+    struct sparse {
+      std::vector<int> major_;
+      std::vector<size_t> start_;
+      std::vector<int> minor_;
+      std::vector<int> cells_;
+    };
+
+    std::vector<sparse> rows_;   // by row, then column
+    std::vector<sparse> cols_;   // by column, then row
+
+    static void build(int n_sheets,
+                      const std::vector<int>& sheets,
+                      const std::vector<int>& majors,
+                      const std::vector<int>& minors,
+                      std::vector<sparse>& out);
+
+    // The nearest cell along one major position, after or before minor
+    static int nearest(const sparse& index, int major, int minor, bool after);
+};
+
+#endif
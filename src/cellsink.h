@@ -0,0 +1,106 @@
+#ifndef CELLSINK_
+#define CELLSINK_
+
+#include <cmath>
+#include <string>
+#include "rapidxml.h"
+
+class xlsxbook;
+class xlsxsheet;
+
+// A cell as it is read from a sheet, by xlsxsheet and xlsxcell.  One record is
+// reused for every cell, so text is only valid until the next cell, because it
+// points into the xml of the sheet, or into buffers of the sheet and the book.
+// Missing values are NULL, NaN or -1.
+struct cellrecord {
+  const std::string* sheet_;     // name of the sheet
+  std::string address_;          // A1-style
+  int row_;                      // one-based
+  int col_;                      // one-based
+  bool is_blank_;
+  const char* content_;          // raw value before type conversion
+  const char* data_type_;        // type of the parsed value
+  const char* error_;
+  int logical_;                  // 0 or 1
+  double numeric_;
+  double date_;                  // serial date, not yet converted
+  const char* character_;
+  const rapidxml::xml_node<>* inline_string_; // is element, for formatting
+  long long shared_string_;      // index into the strings table
+  const char* formula_;
+  bool is_array_;
+  const char* formula_ref_;
+  int formula_group_;            // si of a shared formula
+  const std::string* comment_;
+  double height_;
+  double width_;
+  int row_outline_level_;
+  int col_outline_level_;
+  const std::string* style_format_; // name of the cell style
+  int local_format_id_;          // one-based index into cellXfs
+
+  cellrecord():
+    sheet_(NULL), row_(0), col_(0), height_(NAN), width_(NAN),
+    row_outline_level_(0), col_outline_level_(0) {
+    clear();
+  }
+
+  void clear() { // everything missing, ready for the next cell
+    is_blank_ = false;
+    content_ = NULL;
+    data_type_ = NULL;
+    error_ = NULL;
+    logical_ = -1;
+    numeric_ = NAN;
+    date_ = NAN;
+    character_ = NULL;
+    inline_string_ = NULL;
+    shared_string_ = -1;
+    formula_ = NULL;
+    is_array_ = false;
+    formula_ref_ = NULL;
+    formula_group_ = -1;
+    comment_ = NULL;
+    style_format_ = NULL;
+    local_format_id_ = -1;
+  }
+};
+
+// Where xlsxbook writes the cells of a workbook, so that the parsers don't
+// depend on what the cells are written into.  The R binding writes them into
+// the columns of a data frame (see cellcolumns), and the xlsx2cells tool
+// writes them to a file.
+//
+// resize() is called with the number of cells before they are written, and
+// then cell() is called once for each, with its position from zero.  When
+// reading a chunk at a time, positions start from zero in each chunk.
+class cellsink {
+
+  public:
+
+    virtual ~cellsink() {}
+
+    // Before anything else, once the styles of the book are known
+    virtual void start(const xlsxbook& /* book */) {}
+
+    // Each shared string, while the strings table is parsed, for sinks that
+    // want its formatting
+    virtual void sharedString(unsigned long long int /* i */,
+                              const rapidxml::xml_node<>* /* si */) {}
+
+    virtual void resize(unsigned long long int n) = 0;
+    virtual void cell(unsigned long long int i, const cellrecord& cell) = 0;
+
+    // After the cells from begin to end of a sheet have been written, while
+    // its merged ranges are known
+    virtual void endSheet(xlsxsheet& /* sheet */,
+                          unsigned long long int /* begin */,
+                          unsigned long long int /* end */) {}
+
+    // Called every thousand cells or so, to give the user a chance to
+    // interrupt, by throwing
+    virtual void checkInterrupt() {}
+
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "rapidxml.h"
 #include "color.h"
 #include "xlsxstyles.h"
+#include "rstring.h"
 
 using namespace Rcpp;
 
@@ -35,14 +36,14 @@ color::color(rapidxml::xml_node<>* color, xlsxstyles* styles) {
       if (theme != NULL) {
         int theme_int = strtol(theme->value(), NULL, 10) ;
         theme_ = styles->theme_name_[theme_int];
-        rgb_ = styles->theme_[theme_int];
+        rgb_ = naIfEmpty(styles->theme_[theme_int]);
       }
 
       rapidxml::xml_attribute<>* indexed = color->first_attribute("indexed");
       if (indexed != NULL) {
         int indexed_int = strtol(indexed->value(), NULL, 10) + 1;
         indexed_ = indexed_int;
-        rgb_ = styles->indexed_[indexed_int - 1];
+        rgb_ = naIfEmpty(styles->indexed_[indexed_int - 1]);
       }
 
       rapidxml::xml_attribute<>* tint = color->first_attribute("tint");
@@ -1,7 +1,10 @@
 #ifndef TIDYXL_DATE_
 #define TIDYXL_DATE_
 
-#include <Rcpp.h>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
 
 // Follow tidyverse/readxl
 // https://github.com/tidyverse/readxl/commit/63ef215f57322dd5d7a27799a2a3fe463bd39fc7
@@ -25,89 +28,139 @@ inline double dateRound(double date) {
 // How we address this: If date is *prior* to the non-existent leap day: add a
 // day If date is on the non-existent leap day: make negative and, in due
 // course, NA Otherwise: do nothing
-inline double checkDate(double& date, int& dateSystem, int& dateOffset, std::string ref) {
+inline double lotusCorrect(double date, const int dateSystem) {
   if (dateSystem == 1900 && date < 61) {
-    date = (date < 60) ? date + 1 : -1;
+    return (date < 60) ? date + 1 : -1;
   }
+  return date;
+}
+
+// Convert a serial date to POSIX seconds, or NaN if it is impossible.
+inline double serialToPOSIX(double date, const int dateSystem,
+                            const int dateOffset) {
+  date = lotusCorrect(date, dateSystem);
   if (date < 0) {
-    Rcpp::warning("NA inserted for impossible 1900-02-29 datetime: " + ref);
-    return NA_REAL;
-  } else {
-    return dateRound((date - dateOffset) * 86400);
+    return NAN;
+  }
+  return dateRound((date - dateOffset) * 86400);
+}
+
+// Convert a whole vector of serial dates to POSIX seconds in place, skipping
+// missing ones, which are NaN.  Cells are cached as raw serials while the
+// sheets are parsed, and then converted here in one pass, which also collects
+// the indices of impossible dates in 'impossible', so that the caller can warn
+// about them all at once.  Missing and impossible dates become 'na', which R
+// callers give as NA_REAL.
+inline void serialsToPOSIX(double* dates, const std::ptrdiff_t n,
+                           const int dateSystem, const int dateOffset,
+                           std::vector<std::ptrdiff_t>& impossible,
+                           const double na = NAN) {
+  for (std::ptrdiff_t i = 0; i < n; ++i) {
+    double date = lotusCorrect(dates[i], dateSystem);
+    if (date < 0) {
+      impossible.push_back(i);
+      dates[i] = na;
+    } else if (std::isnan(date)) {
+      dates[i] = na;
+    } else {
+      dates[i] = dateRound((date - dateOffset) * 86400);
+    }
+  }
+}
+
+// Days since 1970-01-01 to a civil year, month and day in the proleptic
+// Gregorian calendar, valid for dates before 1970 too.  From Howard Hinnant's
+// public-domain date algorithms
+// http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+inline void civilFromDays(long long z, long long& y, int& m, int& d) {
+  z += 719468;
+  const long long era = (z >= 0 ? z : z - 146096) / 146097;
+  const long long doe = z - era * 146097;                               // [0, 146096]
+  const long long yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365; // [0, 399]
+  const long long doy = doe - (365*yoe + yoe/4 - yoe/100);               // [0, 365]
+  const long long mp = (5*doy + 2)/153;                                  // [0, 11]
+  d = doy - (153*mp + 2)/5 + 1;                                          // [1, 31]
+  m = mp < 10 ? mp + 3 : mp - 9;                                         // [1, 12]
+  y = yoe + era * 400 + (m <= 2);
+}
+
+// Write n digits of x, zero-padded, to out
+inline char* writeDigits(char* out, long long x, int n) {
+  for (int i = n - 1; i >= 0; --i) {
+    out[i] = '0' + (x % 10);
+    x /= 10;
   }
+  return out + n;
 }
 
-// Convert datetime doubles to strings "%Y-%m-%d %H:%M:%S"
+// Format a serial date as "%Y-%m-%d %H:%M:%S", or as "%H:%M:%S" if it is less
+// than one (a time only, in Excel's format).  Subseconds are truncated, as by
+// format.POSIXlt().  Writes at most 24 bytes to out, and returns the number
+// written, or -1 if the date is impossible, or outside Excel's range of serials
+// (0 to 2958465, which is 9999-12-31 in the 1900 system), as arbitrary numbers
+// from files can be.  Can be called from any thread.
 // TODO: Support subseconds
-inline std::string formatDate(double& date, int& dateSystem, int& dateOffset) {
-  const char* format;
-  if (date < 1) {                      // time only (in Excel's formuat)
-    format = "%H:%M:%S";
-  } else {                             // date and maybe time
-    /* double intpart; */
-    /* if (modf(date, &intpart) == 0.0) { // date only, not time */
-    /*   format = "%Y-%m-%d"; */
-    /* } else {                           // date and time */
-      format = "%Y-%m-%d %H:%M:%S";
-    /* } */
+inline int formatDate(char* out, double date, const int dateSystem,
+                      const int dateOffset) {
+  if (!(date >= 0 && date < 2958466)) { // also NaN
+    return -1;
+  }
+  bool time_only = date < 1;
+  double posix = serialToPOSIX(date, dateSystem, dateOffset);
+  if (std::isnan(posix)) {
+    return -1;
+  }
+  long long seconds = (long long) std::floor(posix);
+  long long days = seconds / 86400;
+  long long second_of_day = seconds % 86400;
+  if (second_of_day < 0) {
+    second_of_day += 86400;
+    --days;
+  }
+  char* p = out;
+  if (!time_only) {
+    long long year;
+    int month;
+    int day;
+    civilFromDays(days, year, month, day);
+    p = writeDigits(p, year, year > 9999 ? 5 : 4); // 1904 system
+    *p++ = '-';
+    p = writeDigits(p, month, 2);
+    *p++ = '-';
+    p = writeDigits(p, day, 2);
+    *p++ = ' ';
+  }
+  p = writeDigits(p, second_of_day / 3600, 2);
+  *p++ = ':';
+  p = writeDigits(p, (second_of_day / 60) % 60, 2);
+  *p++ = ':';
+  p = writeDigits(p, second_of_day % 60, 2);
+  return p - out;
+}
+
+// Convenience wrapper of formatDate() for a single date, returning "NA" if the
+// date is impossible.
+inline std::string formatDate(double date, const int dateSystem,
+                              const int dateOffset) {
+  char out[24];
+  int n = formatDate(out, date, dateSystem, dateOffset);
+  if (n < 0) {
+    return "NA";
   }
-  /* // This doesn't work on Windows before 1970, so use R functions instead */
-  /* char out[charsize]; */
-  /* date = checkDate(date, dateSystem, dateOffset, ""); // Convert to POSIX */
-  /* std::time_t date_time_t(date); */
-  /* std::tm date_tm = *std::gmtime(&date_time_t); */
-  /* std::strftime(out, sizeof(out), format, &date_tm); */
-  // Use R functions instead of C++ strftime, which doesn't work before 1970 on
-  // Windows
-  date = checkDate(date, dateSystem, dateOffset, ""); // Convert to POSIX
-  std::string out;
-  Rcpp::Function r_as_POSIXlt("as.POSIXlt");
-  Rcpp::Function r_format_POSIXlt("format.POSIXlt");
-  out =  Rcpp::as<std::string>(r_format_POSIXlt(r_as_POSIXlt(date,
-                                                             "GMT",
-                                                             "1970-01-01"),
-                                                format,
-                                                false));
-  return out;
+  return std::string(out, n);
 }
 
-// Adapted from @reviewher https://github.com/tidyverse/readxl/issues/388
-// See also ECMA Part 1 page 1785 (actual page 1795) section 18.8.31 "numFmts
-// (Number Formats)"
-#define CASEI(c) case c: case (c | 0x20)
-#define CMPLC(j,n) if(x[i+j] | (0x20 == n))
-inline bool isDateFormat(std::string x) {
-  char escaped = 0;
-  char bracket = 0;
-  for (size_t i = 0; i < x.size(); ++i) switch (x[i]) {
-    CASEI('D'):
-    CASEI('H'):
-    CASEI('M'):
-    CASEI('S'):
-    CASEI('Y'):
-      if(!escaped && !bracket) return true;
-      break;
-    case '"':
-      escaped = 1 - escaped; break;
-    case '\\':
-    case '_':
-      ++i;
-      break;
-    case '[': if(!escaped) bracket = 1; break;
-    case ']': if(!escaped) bracket = 0; break;
-    CASEI('G'):
-      if(i + 6 < x.size())
-      CMPLC(1,'e')
-      CMPLC(2,'n')
-      CMPLC(3,'e')
-      CMPLC(4,'r')
-      CMPLC(5,'a')
-      CMPLC(6,'l')
-        return false;
+// Batch version of formatDate(), for whole vectors.  Record i is written to
+// out + 24 * i, which must have room for 24 * n bytes, and its length (or -1
+// if the date is NA or impossible) to lengths[i].
+inline void formatDates(char* out, int* lengths, const double* dates,
+                        const std::ptrdiff_t n, const int dateSystem,
+                        const int dateOffset) {
+  for (std::ptrdiff_t i = 0; i < n; ++i) {
+    lengths[i] = std::isnan(dates[i])
+      ? -1
+      : formatDate(out + 24 * i, dates[i], dateSystem, dateOffset);
   }
-  return false;
 }
-#undef CMPLC
-#undef CASEI
 
 #endif
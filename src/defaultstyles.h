@@ -0,0 +1,60 @@
+#ifndef TIDYXL_DEFAULTSTYLES_
+#define TIDYXL_DEFAULTSTYLES_
+
+#include <string>
+
+// xl/styles.xml of inst/extdata/default.xlsx, a blank workbook saved by Excel,
+// for workbooks whose stylesheets leave out parts that are needed.  It is
+// compiled in, rather than read from the installed package, so that the
+// parsers don't need R to find it.  Returned as a copy, because rapidxml
+// parses in place.
+inline std::string defaultStyles() {
+  return
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\r\n"
+    "<styleSheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" xmlns:mc=\"http://schemas.openxmlformats.org/markup-compatibility/2006\" mc:Ignorable=\"x14ac\" xmlns:x14ac=\"http://schemas.microsoft.com/office/spreadsheetml/2009/9/ac\">"
+    "<fonts count=\"1\" x14ac:knownFonts=\"1\">"
+    "<font>"
+    "<sz val=\"11\"/>"
+    "<color theme=\"1\"/>"
+    "<name val=\"Calibri\"/>"
+    "<family val=\"2\"/>"
+    "<scheme val=\"minor\"/>"
+    "</font>"
+    "</fonts>"
+    "<fills count=\"2\">"
+    "<fill>"
+    "<patternFill patternType=\"none\"/>"
+    "</fill>"
+    "<fill>"
+    "<patternFill patternType=\"gray125\"/>"
+    "</fill>"
+    "</fills>"
+    "<borders count=\"1\">"
+    "<border>"
+    "<left/>"
+    "<right/>"
+    "<top/>"
+    "<bottom/>"
+    "<diagonal/>"
+    "</border>"
+    "</borders>"
+    "<cellStyleXfs count=\"1\">"
+    "<xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/>"
+    "</cellStyleXfs>"
+    "<cellXfs count=\"1\">"
+    "<xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/>"
+    "</cellXfs>"
+    "<cellStyles count=\"1\">"
+    "<cellStyle name=\"Normal\" xfId=\"0\" builtinId=\"0\"/>"
+    "</cellStyles>"
+    "<dxfs count=\"0\"/>"
+    "<tableStyles count=\"0\" defaultTableStyle=\"TableStyleMedium2\" defaultPivotStyle=\"PivotStyleLight16\"/>"
+    "<extLst>"
+    "<ext uri=\"{EB79DEF2-80B8-43e5-95BD-54CBDDF9020C}\" xmlns:x14=\"http://schemas.microsoft.com/office/spreadsheetml/2009/9/main\">"
+    "<x14:slicerStyles defaultSlicerStyle=\"SlicerStyleLight1\"/>"
+    "</ext>"
+    "</extLst>"
+    "</styleSheet>";
+}
+
+#endif
@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <climits>
+#include <unordered_set>
+#include "depgraph.h"
+#include "ref.h"
+
+// Excel's limits, for whole-row and whole-column references like A:A and 1:1
+static const int MAX_ROW = 1048576;
+static const int MAX_COL = 16384;
+
+static std::string lowercase(const char* text, size_t length) {
+  std::string out(text, length);
+  for (std::string::iterator c = out.begin(); c != out.end(); ++c) {
+    if (*c >= 'A' && *c <= 'Z') {
+      *c = *c - 'A' + 'a';
+    }
+  }
+  return out;
+}
+
+depgraph::depgraph(const std::vector<std::string>& sheets,
+                   const std::vector<int>& cell_sheets,
+                   const std::vector<int>& cell_rows,
+                   const std::vector<int>& cell_cols,
+                   const std::vector<std::string>& formulas,
+                   const std::vector<std::string>& name_names,
+                   const std::vector<int>& name_sheets,
+                   const std::vector<std::string>& name_formulas):
+  sheets_(sheets),
+  cell_sheets_(cell_sheets),
+  cell_rows_(cell_rows),
+  cell_cols_(cell_cols),
+  name_names_(name_names),
+  name_sheets_(name_sheets),
+  name_formulas_(name_formulas) {
+
+  for (size_t i = 0; i < sheets_.size(); ++i) {
+    sheet_index_[lowercase(sheets_[i].data(), sheets_[i].size())] = i;
+  }
+
+  // Index the cells, and note which have formulas
+  cell_formulas_.assign(cell_sheets_.size(), -1);
+  for (size_t i = 0; i < cell_sheets_.size(); ++i) {
+    cell_index_[cellKey(cell_sheets_[i], cell_rows_[i], cell_cols_[i])] = i;
+    if (!formulas[i].empty()) {
+      cell_formulas_[i] = formula_cells_.size();
+      formula_cells_.push_back(i);
+    }
+  }
+
+  // Tokenise the defined names once, however often they are used.  Names that
+  // can't be tokenised refer to nothing.
+  name_tokens_.resize(name_formulas_.size());
+  for (size_t i = 0; i < name_formulas_.size(); ++i) {
+    name_index_[lowercase(name_names[i].data(), name_names[i].size())]
+      .push_back(i);
+    try {
+      tokenize_formula(name_formulas_[i], name_tokens_[i]);
+    } catch (std::exception& e) {
+      name_tokens_[i].clear();
+    }
+  }
+
+  // Resolve the precedents of each formula
+  std::vector<xltoken_span> tokens;
+  std::vector<bool> visiting(name_formulas_.size(), false);
+  prec_start_.reserve(formula_cells_.size() + 1);
+  prec_start_.push_back(0);
+  for (size_t f = 0; f < formula_cells_.size(); ++f) {
+    int cell = formula_cells_[f];
+    tokens.clear();
+    try {
+      tokenize_formula(formulas[cell], tokens);
+    } catch (std::exception& e) {
+      tokens.clear();
+    }
+    collectRefs(formulas[cell], tokens, cell_sheets_[cell], -1, visiting, prec_);
+    prec_start_.push_back(prec_.size());
+  }
+
+  // Index the formula cells by column, and the rectangles by sheet
+  columns_.resize(sheets_.size());
+  for (size_t f = 0; f < formula_cells_.size(); ++f) {
+    int cell = formula_cells_[f];
+    int sheet = cell_sheets_[cell];
+    if (sheet >= 0 && (size_t) sheet < sheets_.size()) {
+      columns_[sheet][cell_cols_[cell]].rows_
+        .push_back(std::make_pair(cell_rows_[cell], (int) f));
+    }
+  }
+
+  // Number the inner nodes of the segment tree of each column.  With m
+  // formulas, the tree has nodes 1 to 2m - 1, where node i has children 2i
+  // and 2i + 1, and the formulas are the leaves m to 2m - 1.
+  node_parent_.assign(formula_cells_.size(), -1);
+  for (size_t sheet = 0; sheet < columns_.size(); ++sheet) {
+    for (std::map<int, formulacolumn>::iterator column = columns_[sheet].begin();
+         column != columns_[sheet].end();
+         ++column) {
+      std::vector<std::pair<int, int> >& rows = column->second.rows_;
+      std::sort(rows.begin(), rows.end());
+      int m = rows.size();
+      int first = node_parent_.size() - 1; // node i is first + i
+      column->second.first_node_ = first;
+      for (int i = 1; i < m; ++i) {
+        node_parent_.push_back(i == 1 ? -1 : first + i / 2);
+      }
+      for (int i = 0; i < m; ++i) {
+        node_parent_[rows[i].second] = m + i == 1 ? -1 : first + (m + i) / 2;
+      }
+    }
+  }
+
+  sheet_rects_.resize(sheets_.size());
+  for (size_t f = 0; f < formula_cells_.size(); ++f) {
+    for (size_t i = prec_start_[f]; i < prec_start_[f + 1]; ++i) {
+      sheet_rects_[prec_[i].sheet_].push_back(std::make_pair(i, (int) f));
+    }
+  }
+  sheet_last_rows_.resize(sheets_.size());
+  for (size_t sheet = 0; sheet < sheet_rects_.size(); ++sheet) {
+    std::vector<std::pair<size_t, int> >& rects = sheet_rects_[sheet];
+    std::stable_sort(rects.begin(), rects.end(),
+                     [this](const std::pair<size_t, int>& a,
+                            const std::pair<size_t, int>& b) {
+                       return prec_[a.first].first_row_ < prec_[b.first].first_row_;
+                     });
+    if (!rects.empty()) {
+      sheet_last_rows_[sheet].resize(4 * rects.size());
+      buildLastRows(sheet_last_rows_[sheet], sheet, 1, 0, rects.size());
+    }
+  }
+
+  // Edges from each formula to the nodes that cover its rectangles, and back
+  std::vector<size_t> dep_count(node_parent_.size(), 0);
+  up_start_.reserve(formula_cells_.size() + 1);
+  up_start_.push_back(0);
+  for (size_t f = 0; f < formula_cells_.size(); ++f) {
+    for (size_t i = prec_start_[f]; i < prec_start_[f + 1]; ++i) {
+      nodesIn(prec_[i], up_);
+    }
+    for (size_t i = up_start_.back(); i < up_.size(); ++i) {
+      ++dep_count[up_[i]];
+    }
+    up_start_.push_back(up_.size());
+  }
+  dep_start_.assign(node_parent_.size() + 1, 0);
+  for (size_t node = 0; node < node_parent_.size(); ++node) {
+    dep_start_[node + 1] = dep_start_[node] + dep_count[node];
+  }
+  dep_.resize(up_.size());
+  std::vector<size_t> fill(dep_start_.begin(), dep_start_.end() - 1);
+  for (size_t f = 0; f < formula_cells_.size(); ++f) {
+    for (size_t i = up_start_[f]; i < up_start_[f + 1]; ++i) {
+      dep_[fill[up_[i]]++] = f;
+    }
+  }
+}
+
+unsigned long long int depgraph::cellKey(int sheet, int row, int col) const {
+  // Rows need 21 bits and columns 15
+  return ((unsigned long long int) sheet << 36)
+    | ((unsigned long long int) row << 15)
+    | (unsigned long long int) col;
+}
+
+int depgraph::findSheet(const std::string& name) const {
+  std::unordered_map<std::string, int>::const_iterator found =
+    sheet_index_.find(lowercase(name.data(), name.size()));
+  return found == sheet_index_.end() ? -1 : found->second;
+}
+
+int depgraph::findCell(int sheet, int row, int col) const {
+  std::unordered_map<unsigned long long int, int>::const_iterator found =
+    cell_index_.find(cellKey(sheet, row, col));
+  return found == cell_index_.end() ? -1 : found->second;
+}
+
+int depgraph::findName(const char* text, size_t length, int sheet) const {
+  std::unordered_map<std::string, std::vector<int> >::const_iterator found =
+    name_index_.find(lowercase(text, length));
+  if (found == name_index_.end()) {
+    return -1;
+  }
+  int global(-1);
+  for (std::vector<int>::const_iterator i = found->second.begin();
+       i != found->second.end();
+       ++i) {
+    if (name_sheets_[*i] == sheet) {
+      return *i;
+    }
+    if (name_sheets_[*i] == -1) {
+      global = *i;
+    }
+  }
+  return global;
+}
+
+// Sheets may be quoted, e.g. 'My Sheet'!, or prefixed by the index of this
+// workbook, e.g. [0]Sheet1!
+bool depgraph::parseSheets(const char* text, size_t length,
+                           int& first, int& last) const {
+  std::string sheet(text, length);
+  if (!sheet.empty() && sheet[sheet.size() - 1] == '!') {
+    sheet.erase(sheet.size() - 1);
+  }
+  if (sheet.size() >= 2 && sheet[0] == '\'' && sheet[sheet.size() - 1] == '\'') {
+    std::string unquoted;
+    for (size_t i = 1; i + 1 < sheet.size(); ++i) {
+      unquoted.push_back(sheet[i]);
+      if (sheet[i] == '\'' && sheet[i + 1] == '\'') {
+        ++i; // quotes are escaped by doubling
+      }
+    }
+    sheet.swap(unquoted);
+  }
+  size_t bracket = sheet.rfind(']');
+  if (bracket != std::string::npos) {
+    if (sheet.compare(0, bracket + 1, "[0]") != 0) {
+      return false; // another workbook
+    }
+    sheet.erase(0, bracket + 1);
+  }
+  size_t colon = sheet.find(':');
+  first = findSheet(sheet.substr(0, colon));
+  last = colon == std::string::npos ? first : findSheet(sheet.substr(colon + 1));
+  if (first < 0 || last < 0) {
+    return false;
+  }
+  if (first > last) {
+    std::swap(first, last);
+  }
+  return true;
+}
+
+cellrect depgraph::refRect(const char* text, size_t length) {
+  ref reference(std::string(text, length));
+  cellrect rect;
+  rect.sheet_ = -1;
+  rect.first_row_ = reference.row1_;
+  rect.first_col_ = reference.col1_;
+  rect.last_row_ = reference.colon_ ? reference.row2_ : reference.row1_;
+  rect.last_col_ = reference.colon_ ? reference.col2_ : reference.col1_;
+  rect.name_ = -1;
+  if (rect.first_row_ == 0) { // whole columns A:A
+    rect.first_row_ = 1;
+    rect.last_row_ = MAX_ROW;
+  }
+  if (rect.first_col_ == 0) { // whole rows 1:1
+    rect.first_col_ = 1;
+    rect.last_col_ = MAX_COL;
+  }
+  if (rect.first_row_ > rect.last_row_) {
+    std::swap(rect.first_row_, rect.last_row_);
+  }
+  if (rect.first_col_ > rect.last_col_) {
+    std::swap(rect.first_col_, rect.last_col_);
+  }
+  return rect;
+}
+
+// Resolve the refs and names in a tokenised formula into rectangles.  Names are
+// resolved recursively, skipping any that are already being resolved, in case
+// of cycles.
+void depgraph::collectRefs(const std::string& formula,
+                           const std::vector<xltoken_span>& tokens,
+                           int context_sheet, int via_name,
+                           std::vector<bool>& visiting,
+                           std::vector<cellrect>& out) const {
+  int first(context_sheet);
+  int last(context_sheet);
+  bool qualified(false); // by a preceding sheet token
+  bool valid(true);      // the sheet exists, in this workbook
+  for (std::vector<xltoken_span>::const_iterator token = tokens.begin();
+       token != tokens.end();
+       ++token) {
+    const char* text = formula.data() + token->offset_;
+    if (token->type_ == xltoken_type::SHEET) {
+      valid = parseSheets(text, token->length_, first, last);
+      qualified = true;
+      continue;
+    }
+    if (token->type_ == xltoken_type::REF && valid && first >= 0) {
+      cellrect rect = refRect(text, token->length_);
+      rect.name_ = via_name;
+      for (int sheet = first; sheet <= last; ++sheet) {
+        rect.sheet_ = sheet;
+        out.push_back(rect);
+      }
+    } else if (token->type_ == xltoken_type::NAME && valid) {
+      int name = findName(text, token->length_,
+                          qualified ? first : context_sheet);
+      if (name >= 0 && !visiting[name]) {
+        visiting[name] = true;
+        collectRefs(name_formulas_[name], name_tokens_[name], context_sheet,
+                    via_name == -1 ? name : via_name, visiting, out);
+        visiting[name] = false;
+      }
+    }
+    first = last = context_sheet;
+    qualified = false;
+    valid = true;
+  }
+}
+
+// Formula cells (indexes into formula_cells_) within a rectangle
+void depgraph::formulasIn(const cellrect& rect, std::vector<int>& out) const {
+  if (rect.sheet_ < 0 || (size_t) rect.sheet_ >= columns_.size()) {
+    return;
+  }
+  const std::map<int, formulacolumn>& columns = columns_[rect.sheet_];
+  for (std::map<int, formulacolumn>::const_iterator column =
+         columns.lower_bound(rect.first_col_);
+       column != columns.end() && column->first <= rect.last_col_;
+       ++column) {
+    const std::vector<std::pair<int, int> >& rows = column->second.rows_;
+    for (std::vector<std::pair<int, int> >::const_iterator row =
+           std::lower_bound(rows.begin(), rows.end(),
+                            std::make_pair(rect.first_row_, INT_MIN));
+         row != rows.end() && row->first <= rect.last_row_;
+         ++row) {
+      out.push_back(row->second);
+    }
+  }
+}
+
+// Fewest nodes of the segment trees that cover the formula cells within a
+// rectangle, two at most for each level of the tree of each column
+void depgraph::nodesIn(const cellrect& rect, std::vector<int>& out) const {
+  if (rect.sheet_ < 0 || (size_t) rect.sheet_ >= columns_.size()) {
+    return;
+  }
+  const std::map<int, formulacolumn>& columns = columns_[rect.sheet_];
+  for (std::map<int, formulacolumn>::const_iterator column =
+         columns.lower_bound(rect.first_col_);
+       column != columns.end() && column->first <= rect.last_col_;
+       ++column) {
+    const std::vector<std::pair<int, int> >& rows = column->second.rows_;
+    int m = rows.size();
+    int first = column->second.first_node_;
+    int begin = std::lower_bound(rows.begin(), rows.end(),
+                                 std::make_pair(rect.first_row_, INT_MIN))
+      - rows.begin();
+    int end = std::upper_bound(rows.begin(), rows.end(),
+                               std::make_pair(rect.last_row_, INT_MAX))
+      - rows.begin();
+    for (int l = begin + m, r = end + m; l < r; l /= 2, r /= 2) {
+      if (l & 1) {
+        out.push_back(l >= m ? rows[l - m].second : first + l);
+        ++l;
+      }
+      if (r & 1) {
+        --r;
+        out.push_back(r >= m ? rows[r - m].second : first + r);
+      }
+    }
+  }
+}
+
+// Greatest last row of the rectangles from begin to end of a sheet, stored at
+// node of the tree, whose children are 2 * node and 2 * node + 1
+int depgraph::buildLastRows(std::vector<int>& tree, int sheet, int node,
+                            size_t begin, size_t end) const {
+  if (end - begin == 1) {
+    tree[node] = prec_[sheet_rects_[sheet][begin].first].last_row_;
+  } else {
+    size_t middle = begin + (end - begin) / 2;
+    tree[node] = std::max(buildLastRows(tree, sheet, 2 * node, begin, middle),
+                          buildLastRows(tree, sheet, 2 * node + 1, middle, end));
+  }
+  return tree[node];
+}
+
+// Formulas (indexes into formula_cells_) of the rectangles from begin to end
+// of a sheet that contain a cell, skipping ranges of rectangles that begin
+// below it or end above it
+void depgraph::rectsContaining(int sheet, int row, int col, int node,
+                               size_t begin, size_t end,
+                               std::vector<int>& out) const {
+  const std::vector<std::pair<size_t, int> >& rects = sheet_rects_[sheet];
+  if (sheet_last_rows_[sheet][node] < row
+      || prec_[rects[begin].first].first_row_ > row) {
+    return;
+  }
+  if (end - begin == 1) {
+    if (prec_[rects[begin].first].contains(sheet, row, col)) {
+      out.push_back(rects[begin].second);
+    }
+    return;
+  }
+  size_t middle = begin + (end - begin) / 2;
+  rectsContaining(sheet, row, col, 2 * node, begin, middle, out);
+  rectsContaining(sheet, row, col, 2 * node + 1, middle, end, out);
+}
+
+void depgraph::precedents(int cell, std::vector<cellrect>& out) const {
+  int f = cell_formulas_[cell];
+  if (f < 0) {
+    return;
+  }
+  out.insert(out.end(),
+             prec_.begin() + prec_start_[f],
+             prec_.begin() + prec_start_[f + 1]);
+}
+
+void depgraph::formulaPrecedents(int cell, std::vector<int>& out) const {
+  int f = cell_formulas_[cell];
+  if (f < 0) {
+    return;
+  }
+  std::vector<int> found;
+  for (size_t i = prec_start_[f]; i < prec_start_[f + 1]; ++i) {
+    formulasIn(prec_[i], found);
+  }
+  for (std::vector<int>::iterator g = found.begin(); g != found.end(); ++g) {
+    out.push_back(formula_cells_[*g]);
+  }
+}
+
+void depgraph::dependents(int sheet, int row, int col, bool recursive,
+                          std::vector<int>& out) const {
+  if (sheet < 0 || (size_t) sheet >= sheet_rects_.size()
+      || sheet_rects_[sheet].empty()) {
+    return;
+  }
+  std::vector<int> direct;
+  rectsContaining(sheet, row, col, 1, 0, sheet_rects_[sheet].size(), direct);
+  std::unordered_set<int> seen;          // formulas
+  std::vector<int> found;                // formulas, in the order found
+  for (std::vector<int>::iterator f = direct.begin(); f != direct.end(); ++f) {
+    if (seen.insert(*f).second) {
+      found.push_back(*f);
+    }
+  }
+  if (recursive) {
+    // The formulas that use a formula are those that use the nodes above it.
+    // A node that has been visited has had its ancestors visited too.
+    std::unordered_set<int> visited;     // nodes
+    for (size_t i = 0; i < found.size(); ++i) { // found grows as it goes
+      for (int node = found[i];
+           node != -1 && visited.insert(node).second;
+           node = node_parent_[node]) {
+        for (size_t j = dep_start_[node]; j < dep_start_[node + 1]; ++j) {
+          if (seen.insert(dep_[j]).second) {
+            found.push_back(dep_[j]);
+          }
+        }
+      }
+    }
+  }
+  for (std::vector<int>::iterator f = found.begin(); f != found.end(); ++f) {
+    out.push_back(formula_cells_[*f]);
+  }
+}
+
+void depgraph::topologicalOrder(std::vector<int>& order,
+                                std::vector<int>& cyclic) const {
+  // Kahn's algorithm, taking formulas in their original order when there is a
+  // choice.  Once a formula is ordered, so is any node above it whose other
+  // children are, and the formulas that use those nodes are released.
+  size_t n = formula_cells_.size();
+  std::vector<size_t> waiting(node_parent_.size()); // not yet ordered
+  std::vector<int> ready;
+  for (size_t f = 0; f < n; ++f) {
+    waiting[f] = up_start_[f + 1] - up_start_[f];
+    if (waiting[f] == 0) {
+      ready.push_back(f);
+    }
+  }
+  for (size_t node = n; node < waiting.size(); ++node) {
+    waiting[node] = 2; // its children
+  }
+  std::vector<int> released;
+  for (size_t i = 0; i < ready.size(); ++i) { // ready grows as it goes
+    int f = ready[i];
+    order.push_back(formula_cells_[f]);
+    released.clear();
+    int node = f;
+    do {
+      for (size_t j = dep_start_[node]; j < dep_start_[node + 1]; ++j) {
+        if (--waiting[dep_[j]] == 0) {
+          released.push_back(dep_[j]);
+        }
+      }
+      node = node_parent_[node];
+    } while (node != -1 && --waiting[node] == 0);
+    std::sort(released.begin(), released.end());
+    ready.insert(ready.end(), released.begin(), released.end());
+  }
+  for (size_t f = 0; f < n; ++f) {
+    if (waiting[f] != 0) {
+      cyclic.push_back(formula_cells_[f]);
+    }
+  }
+}
@@ -0,0 +1,178 @@
+#ifndef DEPGRAPH_
+#define DEPGRAPH_
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "token_grammar.h"
+
+// A rectangle of cells on one sheet that a formula refers to.  Ranges are kept
+// as rectangles, rather than expanded into their cells.
+struct cellrect {
+  int sheet_;       // index into depgraph::sheets()
+  int first_row_;   // one-based and inclusive, as are the others
+  int first_col_;
+  int last_row_;
+  int last_col_;
+  int name_;        // index of the defined name it was reached through, or -1
+
+  bool contains(int sheet, int row, int col) const {
+    return sheet == sheet_
+      && row >= first_row_ && row <= last_row_
+      && col >= first_col_ && col <= last_col_;
+  }
+};
+
+// Dependency graph of the formulas of a workbook.
+//
+// Every formula, and the formula of every defined name, is tokenised once.
+// Each formula's precedents -- the cells, ranges and names that it refers to --
+// are resolved to rectangles and stored contiguously (compressed sparse rows).
+// The formula cells of each column, sorted by row, are the leaves of a
+// segment tree, so the formulas in a rectangle are covered by a few nodes of
+// the trees of its columns.  Edges go from each formula to those nodes, rather
+// than to every formula in the rectangle, so that a running sum filled down a
+// column, or a range like A:A, costs a few edges per formula rather than one
+// per formula in the range.  The dependents of a cell are found through an
+// interval index of the rectangles of each sheet.
+//
+// Nothing here calls R.
+class depgraph {
+
+  public:
+
+    // Cells are given by parallel vectors; formulas are empty for cells
+    // without one.  Sheets are zero-based indexes into sheets.  Defined names
+    // are scoped to a sheet, or to the workbook if their sheet is -1.
+    depgraph(const std::vector<std::string>& sheets,
+             const std::vector<int>& cell_sheets,
+             const std::vector<int>& cell_rows,
+             const std::vector<int>& cell_cols,
+             const std::vector<std::string>& formulas,
+             const std::vector<std::string>& name_names,
+             const std::vector<int>& name_sheets,
+             const std::vector<std::string>& name_formulas);
+
+    const std::vector<std::string>& sheets() const { return sheets_; }
+    const std::vector<std::string>& names() const { return name_names_; }
+    size_t cellCount() const { return cell_sheets_.size(); }
+    size_t formulaCount() const { return formula_cells_.size(); }
+    size_t edgeCount() const { return up_.size(); }
+
+    // Index of a sheet, matched case-insensitively like Excel, or -1
+    int findSheet(const std::string& name) const;
+
+    // Index of a cell, or -1 if it wasn't given
+    int findCell(int sheet, int row, int col) const;
+
+    int cellSheet(int cell) const { return cell_sheets_[cell]; }
+    int cellRow(int cell) const { return cell_rows_[cell]; }
+    int cellCol(int cell) const { return cell_cols_[cell]; }
+
+    // Index of a defined name, matched case-insensitively, that is scoped to
+    // the sheet, or failing that to the workbook, or -1
+    int findName(const char* text, size_t length, int sheet) const;
+    const std::string& nameFormula(int name) const { return name_formulas_[name]; }
+    const std::vector<xltoken_span>& nameTokens(int name) const {
+      return name_tokens_[name];
+    }
+
+    // Parse a sheet token, e.g. Sheet1! or Sheet1:Sheet3!, into the first and
+    // last sheets that it spans.  Returns false for sheets in other workbooks,
+    // and sheets that don't exist.
+    bool parseSheets(const char* text, size_t length,
+                     int& first, int& last) const;
+
+    // The rectangle of a ref token like A1, $A$1:B2, A:A or 1:1, whose sheet
+    // and name are left to the caller
+    static cellrect refRect(const char* text, size_t length);
+
+    // Rectangles that the formula of a cell refers to, directly
+    void precedents(int cell, std::vector<cellrect>& out) const;
+
+    // Cells whose formulas refer to a given cell, directly, or also indirectly
+    // if recursive.  The cell needn't exist, e.g. a blank in a range.
+    void dependents(int sheet, int row, int col, bool recursive,
+                    std::vector<int>& out) const;
+
+    // Cells with formulas, ordered so that every formula comes after the
+    // formulas that it refers to.  Cells in, or dependent on, a cycle are put
+    // in cyclic instead, in their original order.
+    void topologicalOrder(std::vector<int>& order,
+                          std::vector<int>& cyclic) const;
+
+    // Formula cells (indexes into the cells) that formula cell `cell` refers
+    // to, directly, found in its rectangles when asked for
+    void formulaPrecedents(int cell, std::vector<int>& out) const;
+
+  private:
+
+    std::vector<std::string> sheets_;
+    std::unordered_map<std::string, int> sheet_index_; // lowercase name
+
+    std::vector<int> cell_sheets_;
+    std::vector<int> cell_rows_;
+    std::vector<int> cell_cols_;
+    std::unordered_map<unsigned long long int, int> cell_index_;
+
+    std::vector<int> formula_cells_;     // cells with formulas
+    std::vector<int> cell_formulas_;     // index into formula_cells_, or -1
+
+    // Precedents of formula_cells_[i] are prec_[prec_start_[i]] up to
+    // prec_[prec_start_[i + 1]]
+    std::vector<size_t> prec_start_;
+    std::vector<cellrect> prec_;
+
+    // Nodes of the graph are the formulas, numbered like formula_cells_, and
+    // then the inner nodes of the segment tree of each column.  Each inner
+    // node is complete when both of its children are.
+    std::vector<int> node_parent_;       // or -1 for roots
+
+    // Edges both ways between formulas and the nodes that cover their
+    // rectangles, in compressed sparse rows
+    std::vector<size_t> up_start_;       // formula -> nodes that it uses
+    std::vector<int> up_;
+    std::vector<size_t> dep_start_;      // node -> formulas that use it
+    std::vector<int> dep_;
+
+    // Formula cells of each column of each sheet, sorted by row, as
+    // (row, index into formula_cells_), and the first of the inner nodes of
+    // its segment tree
+    struct formulacolumn {
+      std::vector<std::pair<int, int> > rows_;
+      int first_node_;
+    };
+    std::vector<std::map<int, formulacolumn> > columns_;
+
+    // Precedent rectangles of each sheet, sorted by first row, as indexes
+    // into prec_, and the formula that each belongs to.  The greatest last row
+    // of each range of them is kept in a segment tree, to find the ones that
+    // contain a cell without looking at those that end above it.
+    std::vector<std::vector<std::pair<size_t, int> > > sheet_rects_;
+    std::vector<std::vector<int> > sheet_last_rows_;
+
+    // Defined names, tokenised once
+    std::vector<std::string> name_names_;
+    std::unordered_map<std::string, std::vector<int> > name_index_; // lowercase
+    std::vector<int> name_sheets_;
+    std::vector<std::string> name_formulas_;
+    std::vector<std::vector<xltoken_span> > name_tokens_;
+
+    unsigned long long int cellKey(int sheet, int row, int col) const;
+    void collectRefs(const std::string& formula,
+                     const std::vector<xltoken_span>& tokens,
+                     int context_sheet, int via_name,
+                     std::vector<bool>& visiting,
+                     std::vector<cellrect>& out) const;
+    void formulasIn(const cellrect& rect, std::vector<int>& out) const;
+    void nodesIn(const cellrect& rect, std::vector<int>& out) const;
+    int buildLastRows(std::vector<int>& tree, int sheet, int node,
+                      size_t begin, size_t end) const;
+    void rectsContaining(int sheet, int row, int col, int node,
+                         size_t begin, size_t end,
+                         std::vector<int>& out) const;
+};
+
+#endif
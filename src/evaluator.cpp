@@ -0,0 +1,1301 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include "evaluator.h"
+
+// Thrown by anything that can't be evaluated, such as an unsupported function,
+// so that the formula is reported as unsupported rather than wrong.
+class xlunsupported : public std::runtime_error {
+  public:
+    xlunsupported(const std::string& what): std::runtime_error(what) {}
+};
+
+// Names may refer to names, but not without end
+static const int MAX_NAME_DEPTH = 32;
+
+// Ranges larger than this aren't expanded into arrays, e.g. by array formulas
+static const long long int MAX_ARRAY_SIZE = 4 * 1048576LL;
+
+cellstore::cellstore(const depgraph& graph,
+                     const std::vector<xlvalue_type>& types,
+                     const std::vector<double>& numbers,
+                     const std::vector<std::string>& texts):
+  graph_(graph),
+  types_(types),
+  numbers_(numbers),
+  texts_(texts) {
+  columns_.resize(graph_.sheets().size());
+  for (size_t i = 0; i < graph_.cellCount(); ++i) {
+    int sheet = graph_.cellSheet(i);
+    if (sheet >= 0 && (size_t) sheet < columns_.size()) {
+      columns_[sheet][graph_.cellCol(i)]
+        .push_back(std::make_pair(graph_.cellRow(i), (int) i));
+    }
+  }
+  for (size_t sheet = 0; sheet < columns_.size(); ++sheet) {
+    for (std::map<int, std::vector<std::pair<int, int> > >::iterator column =
+           columns_[sheet].begin();
+         column != columns_[sheet].end();
+         ++column) {
+      std::sort(column->second.begin(), column->second.end());
+    }
+  }
+}
+
+xlvalue cellstore::value(int cell) const {
+  return xlvalue(types_[cell], numbers_[cell], texts_[cell]);
+}
+
+xlvalue cellstore::value(int sheet, int row, int col) const {
+  int cell = graph_.findCell(sheet, row, col);
+  return cell < 0 ? xlvalue() : value(cell);
+}
+
+void cellstore::set(int cell, const xlvalue& value) {
+  types_[cell] = value.type_;
+  numbers_[cell] = value.number_;
+  texts_[cell] = value.text_;
+}
+
+void cellstore::cellsIn(const cellrect& rect, std::vector<int>& out) const {
+  if (rect.sheet_ < 0 || (size_t) rect.sheet_ >= columns_.size()) {
+    return;
+  }
+  const std::map<int, std::vector<std::pair<int, int> > >& columns =
+    columns_[rect.sheet_];
+  for (std::map<int, std::vector<std::pair<int, int> > >::const_iterator column =
+         columns.lower_bound(rect.first_col_);
+       column != columns.end() && column->first <= rect.last_col_;
+       ++column) {
+    const std::vector<std::pair<int, int> >& rows = column->second;
+    for (std::vector<std::pair<int, int> >::const_iterator row =
+           std::lower_bound(rows.begin(), rows.end(),
+                            std::make_pair(rect.first_row_, INT_MIN));
+         row != rows.end() && row->first <= rect.last_row_;
+         ++row) {
+      out.push_back(row->second);
+    }
+  }
+}
+
+// Coercion and comparison of values, as Excel does it -----------------------
+
+static std::string uppercase(const char* text, size_t length) {
+  std::string out(text, length);
+  for (std::string::iterator c = out.begin(); c != out.end(); ++c) {
+    if (*c >= 'a' && *c <= 'z') {
+      *c = *c - 'a' + 'A';
+    }
+  }
+  return out;
+}
+
+static bool parseNumber(const std::string& text, double& out) {
+  size_t begin = text.find_first_not_of(' ');
+  size_t end = text.find_last_not_of(' ');
+  if (begin == std::string::npos) {
+    return false;
+  }
+  std::string trimmed = text.substr(begin, end - begin + 1);
+  // strtod would also accept hex, inf and nan, which Excel doesn't
+  if (trimmed.find_first_not_of("0123456789.+-eE") != std::string::npos) {
+    return false;
+  }
+  char* stop;
+  out = strtod(trimmed.c_str(), &stop);
+  return *stop == '\0';
+}
+
+// Numbers as text, like the General format, e.g. 0.5, 1E+20
+static std::string formatNumber(double x) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.15g", x);
+  std::string out(buffer);
+  size_t e = out.find('e');
+  if (e != std::string::npos) {
+    std::string exponent = out.substr(e + 2);
+    exponent.erase(0, std::min(exponent.find_first_not_of('0'),
+                               exponent.size() - 1));
+    out = out.substr(0, e) + "E" + out[e + 1] + exponent;
+  }
+  return out;
+}
+
+static xlvalue asNumber(const xlvalue& x) {
+  double number;
+  switch (x.type_) {
+    case xlvalue_type::NUMBER:
+    case xlvalue_type::ERROR_CODE:
+      return x;
+    case xlvalue_type::BOOL:
+    case xlvalue_type::BLANK:
+      return xlvalue::number(x.number_);
+    case xlvalue_type::TEXT:
+      if (parseNumber(x.text_, number)) {
+        return xlvalue::number(number);
+      }
+      break;
+  }
+  return xlvalue::error("#VALUE!");
+}
+
+static xlvalue asText(const xlvalue& x) {
+  switch (x.type_) {
+    case xlvalue_type::NUMBER:
+      return xlvalue::text(formatNumber(x.number_));
+    case xlvalue_type::BOOL:
+      return xlvalue::text(x.number_ != 0 ? "TRUE" : "FALSE");
+    case xlvalue_type::BLANK:
+      return xlvalue::text("");
+    default:
+      return x;
+  }
+}
+
+static xlvalue asBool(const xlvalue& x) {
+  switch (x.type_) {
+    case xlvalue_type::NUMBER:
+    case xlvalue_type::BOOL:
+    case xlvalue_type::BLANK:
+      return xlvalue::boolean(x.number_ != 0);
+    case xlvalue_type::TEXT: {
+      std::string text = uppercase(x.text_.data(), x.text_.size());
+      if (text == "TRUE" || text == "FALSE") {
+        return xlvalue::boolean(text == "TRUE");
+      }
+      return xlvalue::error("#VALUE!");
+    }
+    default:
+      return x;
+  }
+}
+
+// Rank of types when comparing values of different types
+static int typeRank(xlvalue_type type) {
+  switch (type) {
+    case xlvalue_type::TEXT:
+      return 1;
+    case xlvalue_type::BOOL:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+// Compare two values that aren't errors: numbers < text < FALSE < TRUE, and
+// text case-insensitively.  A blank is compared as if it were the other type.
+static int compareValues(xlvalue a, xlvalue b) {
+  if (a.type_ == xlvalue_type::BLANK) {
+    a.type_ = b.type_ == xlvalue_type::BLANK ? xlvalue_type::NUMBER : b.type_;
+  }
+  if (b.type_ == xlvalue_type::BLANK) {
+    b.type_ = a.type_;
+  }
+  int rank_a = typeRank(a.type_);
+  int rank_b = typeRank(b.type_);
+  if (rank_a != rank_b) {
+    return rank_a < rank_b ? -1 : 1;
+  }
+  if (a.type_ == xlvalue_type::TEXT) {
+    std::string text_a = uppercase(a.text_.data(), a.text_.size());
+    std::string text_b = uppercase(b.text_.data(), b.text_.size());
+    return text_a.compare(text_b) < 0 ? -1 : (text_a == text_b ? 0 : 1);
+  }
+  return a.number_ < b.number_ ? -1 : (a.number_ == b.number_ ? 0 : 1);
+}
+
+// Match text against a pattern with wildcards * and ?, escaped by ~
+static bool wildcardMatch(const std::string& text, const std::string& pattern) {
+  size_t t(0), p(0);
+  size_t star_p(std::string::npos), star_t(0);
+  while (t < text.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star_p = p++;
+      star_t = t;
+    } else if (p < pattern.size()
+               && (pattern[p] == '?'
+                   || (pattern[p] == '~' && p + 1 < pattern.size()
+                       && pattern[p + 1] == text[t])
+                   || (pattern[p] != '~' && pattern[p] == text[t]))) {
+      p += pattern[p] == '~' ? 2 : 1;
+      ++t;
+    } else if (star_p != std::string::npos) {
+      p = star_p + 1;
+      t = ++star_t;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+enum class xlop : unsigned char {
+  ADD, SUBTRACT, MULTIPLY, DIVIDE, POWER, CONCAT, EQ, NE, LT, LE, GT, GE
+};
+
+static xlvalue checkFinite(double x) {
+  return std::isfinite(x) ? xlvalue::number(x) : xlvalue::error("#NUM!");
+}
+
+static xlvalue applyOp(xlop op, const xlvalue& a, const xlvalue& b) {
+  if (a.isError()) {
+    return a;
+  }
+  if (b.isError()) {
+    return b;
+  }
+  if (op == xlop::CONCAT) {
+    return xlvalue::text(asText(a).text_ + asText(b).text_);
+  }
+  if (op >= xlop::EQ) {
+    int comparison = compareValues(a, b);
+    switch (op) {
+      case xlop::EQ: return xlvalue::boolean(comparison == 0);
+      case xlop::NE: return xlvalue::boolean(comparison != 0);
+      case xlop::LT: return xlvalue::boolean(comparison < 0);
+      case xlop::LE: return xlvalue::boolean(comparison <= 0);
+      case xlop::GT: return xlvalue::boolean(comparison > 0);
+      default: return xlvalue::boolean(comparison >= 0);
+    }
+  }
+  xlvalue x = asNumber(a);
+  if (x.isError()) {
+    return x;
+  }
+  xlvalue y = asNumber(b);
+  if (y.isError()) {
+    return y;
+  }
+  switch (op) {
+    case xlop::ADD:
+      return checkFinite(x.number_ + y.number_);
+    case xlop::SUBTRACT:
+      return checkFinite(x.number_ - y.number_);
+    case xlop::MULTIPLY:
+      return checkFinite(x.number_ * y.number_);
+    case xlop::DIVIDE:
+      if (y.number_ == 0) {
+        return xlvalue::error("#DIV/0!");
+      }
+      return checkFinite(x.number_ / y.number_);
+    default:
+      if (x.number_ == 0 && y.number_ <= 0) {
+        return xlvalue::error(y.number_ == 0 ? "#NUM!" : "#DIV/0!");
+      }
+      return checkFinite(std::pow(x.number_, y.number_));
+  }
+}
+
+// Operands -------------------------------------------------------------------
+
+// An operand: a single value, a range of cells, or an array of values
+struct xloperand {
+  enum class kind : unsigned char {VALUE, RANGE, ARRAY};
+
+  kind kind_;
+  bool missing_;                 // an omitted argument, e.g. IF(A1,,1)
+  xlvalue value_;
+  cellrect range_;
+  std::vector<xlvalue> array_;   // row by row
+  int rows_;                     // of an array
+  int cols_;
+
+  xloperand(): kind_(kind::VALUE), missing_(false), rows_(1), cols_(1) {}
+  xloperand(const xlvalue& value):
+    kind_(kind::VALUE), missing_(false), value_(value), rows_(1), cols_(1) {}
+  xloperand(const cellrect& range):
+    kind_(kind::RANGE), missing_(false), range_(range), rows_(1), cols_(1) {}
+
+  int rows() const {
+    return kind_ == kind::RANGE ? range_.last_row_ - range_.first_row_ + 1 : rows_;
+  }
+  int cols() const {
+    return kind_ == kind::RANGE ? range_.last_col_ - range_.first_col_ + 1 : cols_;
+  }
+  bool isScalar() const { return rows() == 1 && cols() == 1; }
+};
+
+// Evaluates one tokenised formula by recursive descent over its tokens,
+// computing as it goes rather than building a tree.  Each rule takes `eval`,
+// which is false when parsing the branch of an IF() that isn't taken, so that
+// it is skipped without being computed.
+class xlformula {
+
+  public:
+
+    xlformula(const cellstore& store,
+              const std::string& formula,
+              const std::vector<xltoken_span>& tokens,
+              int sheet, int row, int col, bool is_array, int depth);
+
+    // The formula as an operand, e.g. the range that a name refers to
+    xloperand operand();
+
+    // The value of the formula in its cell
+    xlvalue evaluate();
+
+  private:
+
+    const cellstore& store_;
+    const depgraph& graph_;
+    const std::string& formula_;
+    std::vector<xltoken_span> tokens_; // without whitespace
+    size_t pos_;
+    int sheet_;                        // the cell of the formula
+    int row_;
+    int col_;
+    bool is_array_;                    // whether it is an array formula
+    int depth_;                        // of names within names
+
+    bool atEnd() const { return pos_ >= tokens_.size(); }
+    bool at(xltoken_type type) const {
+      return !atEnd() && tokens_[pos_].type_ == type;
+    }
+    bool atOperator(const char* op) const;
+    bool atSeparator(char separator) const;
+    const char* text(const xltoken_span& token) const {
+      return formula_.data() + token.offset_;
+    }
+
+    xloperand comparison(bool eval);
+    xloperand concatenation(bool eval);
+    xloperand additive(bool eval);
+    xloperand multiplicative(bool eval);
+    xloperand power(bool eval);
+    xloperand percent(bool eval);
+    xloperand unary(bool eval);
+    xloperand reference(bool eval);
+    xloperand primary(bool eval);
+    xloperand name(const xltoken_span& token, int sheet, bool eval);
+    xloperand array();
+    xloperand function(bool eval);
+    xloperand argument(bool eval);
+    bool endOfArguments();
+    void arguments(bool eval, std::vector<xloperand>& args);
+
+    xloperand binary(xlop op, const xloperand& a, const xloperand& b, bool eval);
+    template <typename F> xloperand elementwise(const xloperand& x, F f,
+                                                bool eval);
+    xlvalue scalar(const xloperand& x) const;
+    void values(const xloperand& x, std::vector<xlvalue>& out) const;
+    void lookupValues(const xloperand& x, bool first_column,
+                      std::vector<std::pair<int, xlvalue> >& out) const;
+
+    xloperand functionIf(bool eval);
+    xlvalue aggregate(const std::vector<xloperand>& args,
+                      std::vector<double>& numbers) const;
+    xlvalue count(const std::vector<xloperand>& args) const;
+    xloperand index(const std::vector<xloperand>& args) const;
+    xlvalue match(const std::vector<xloperand>& args) const;
+    xlvalue vlookup(const std::vector<xloperand>& args) const;
+};
+
+xlformula::xlformula(const cellstore& store,
+                     const std::string& formula,
+                     const std::vector<xltoken_span>& tokens,
+                     int sheet, int row, int col, bool is_array, int depth):
+  store_(store),
+  graph_(store.graph()),
+  formula_(formula),
+  tokens_(tokens),
+  pos_(0),
+  sheet_(sheet),
+  row_(row),
+  col_(col),
+  is_array_(is_array),
+  depth_(depth) {
+  strip_whitespace(formula_, tokens_);
+}
+
+bool xlformula::atOperator(const char* op) const {
+  if (!at(xltoken_type::OPERATOR)) {
+    return false;
+  }
+  const xltoken_span& token = tokens_[pos_];
+  return formula_.compare(token.offset_, token.length_, op) == 0;
+}
+
+bool xlformula::atSeparator(char separator) const {
+  return at(xltoken_type::SEPARATOR) && formula_[tokens_[pos_].offset_] == separator;
+}
+
+xloperand xlformula::operand() {
+  if (tokens_.empty()) {
+    throw xlunsupported("empty formula");
+  }
+  xloperand out = comparison(true);
+  if (!atEnd()) {
+    throw xlunsupported("unexpected token");
+  }
+  return out;
+}
+
+xlvalue xlformula::evaluate() {
+  xlvalue out = scalar(operand());
+  if (out.type_ == xlvalue_type::BLANK) {
+    return xlvalue::number(0); // e.g. =A1 where A1 is blank
+  }
+  return out;
+}
+
+// Operators, from the lowest precedence to the highest
+
+xloperand xlformula::comparison(bool eval) {
+  xloperand left = concatenation(eval);
+  while (true) {
+    xlop op;
+    if (atOperator("=")) {
+      op = xlop::EQ;
+    } else if (atOperator("<>")) {
+      op = xlop::NE;
+    } else if (atOperator("<")) {
+      op = xlop::LT;
+    } else if (atOperator("<=")) {
+      op = xlop::LE;
+    } else if (atOperator(">")) {
+      op = xlop::GT;
+    } else if (atOperator(">=")) {
+      op = xlop::GE;
+    } else {
+      return left;
+    }
+    ++pos_;
+    xloperand right = concatenation(eval);
+    left = binary(op, left, right, eval);
+  }
+}
+
+xloperand xlformula::concatenation(bool eval) {
+  xloperand left = additive(eval);
+  while (atOperator("&")) {
+    ++pos_;
+    xloperand right = additive(eval);
+    left = binary(xlop::CONCAT, left, right, eval);
+  }
+  return left;
+}
+
+xloperand xlformula::additive(bool eval) {
+  xloperand left = multiplicative(eval);
+  while (atOperator("+") || atOperator("-")) {
+    xlop op = atOperator("+") ? xlop::ADD : xlop::SUBTRACT;
+    ++pos_;
+    xloperand right = multiplicative(eval);
+    left = binary(op, left, right, eval);
+  }
+  return left;
+}
+
+xloperand xlformula::multiplicative(bool eval) {
+  xloperand left = power(eval);
+  while (atOperator("*") || atOperator("/")) {
+    xlop op = atOperator("*") ? xlop::MULTIPLY : xlop::DIVIDE;
+    ++pos_;
+    xloperand right = power(eval);
+    left = binary(op, left, right, eval);
+  }
+  return left;
+}
+
+xloperand xlformula::power(bool eval) {
+  xloperand left = percent(eval);
+  while (atOperator("^")) {
+    ++pos_;
+    xloperand right = percent(eval);
+    left = binary(xlop::POWER, left, right, eval);
+  }
+  return left;
+}
+
+xloperand xlformula::percent(bool eval) {
+  xloperand x = unary(eval);
+  while (atOperator("%")) {
+    ++pos_;
+    x = binary(xlop::DIVIDE, x, xloperand(xlvalue::number(100)), eval);
+  }
+  return x;
+}
+
+struct negation {
+  xlvalue operator()(const xlvalue& x) const {
+    xlvalue number = asNumber(x);
+    return number.isError() ? number : xlvalue::number(-number.number_);
+  }
+};
+
+// Negation binds more tightly than anything but references, so -2^2 is 4
+xloperand xlformula::unary(bool eval) {
+  if (atOperator("-")) {
+    ++pos_;
+    return elementwise(unary(eval), negation(), eval);
+  }
+  if (atOperator("+")) {
+    ++pos_;
+    return unary(eval);
+  }
+  return reference(eval);
+}
+
+// The range operator, e.g. A1:INDEX(B:B,2), and intersection, e.g. A:A 1:1
+xloperand xlformula::reference(bool eval) {
+  xloperand left = primary(eval);
+  while (atOperator(":") || atOperator(" ")) {
+    bool range = atOperator(":");
+    ++pos_;
+    xloperand right = primary(eval);
+    if (!eval) {
+      continue;
+    }
+    if (left.kind_ != xloperand::kind::RANGE
+        || right.kind_ != xloperand::kind::RANGE) {
+      if (left.kind_ == xloperand::kind::VALUE && left.value_.isError()) {
+        continue;
+      }
+      if (right.kind_ == xloperand::kind::VALUE && right.value_.isError()) {
+        left = right;
+        continue;
+      }
+      throw xlunsupported("reference operator on values");
+    }
+    cellrect& a = left.range_;
+    const cellrect& b = right.range_;
+    if (a.sheet_ != b.sheet_) {
+      left = xloperand(xlvalue::error("#VALUE!"));
+    } else if (range) {
+      a.first_row_ = std::min(a.first_row_, b.first_row_);
+      a.first_col_ = std::min(a.first_col_, b.first_col_);
+      a.last_row_ = std::max(a.last_row_, b.last_row_);
+      a.last_col_ = std::max(a.last_col_, b.last_col_);
+    } else {
+      a.first_row_ = std::max(a.first_row_, b.first_row_);
+      a.first_col_ = std::max(a.first_col_, b.first_col_);
+      a.last_row_ = std::min(a.last_row_, b.last_row_);
+      a.last_col_ = std::min(a.last_col_, b.last_col_);
+      if (a.first_row_ > a.last_row_ || a.first_col_ > a.last_col_) {
+        left = xloperand(xlvalue::error("#NULL!"));
+      }
+    }
+  }
+  return left;
+}
+
+xloperand xlformula::primary(bool eval) {
+  if (atEnd()) {
+    throw xlunsupported("incomplete formula");
+  }
+  const xltoken_span& token = tokens_[pos_];
+  const char* begin = text(token);
+  switch (token.type_) {
+    case xltoken_type::NUMBER:
+      ++pos_;
+      return xloperand(xlvalue::number(strtod(std::string(begin, token.length_).c_str(),
+                                              NULL)));
+    case xltoken_type::TEXT: {
+      ++pos_;
+      std::string unquoted;
+      for (size_t i = 1; i + 1 < token.length_; ++i) {
+        unquoted.push_back(begin[i]);
+        if (begin[i] == '"') {
+          ++i; // quotes are escaped by doubling
+        }
+      }
+      return xloperand(xlvalue::text(unquoted));
+    }
+    case xltoken_type::BOOL:
+      ++pos_;
+      return xloperand(xlvalue::boolean(begin[0] == 'T'));
+    case xltoken_type::ERROR_CODE:
+      ++pos_;
+      return xloperand(xlvalue::error(std::string(begin, token.length_)));
+    case xltoken_type::REF: {
+      ++pos_;
+      cellrect rect = depgraph::refRect(begin, token.length_);
+      rect.sheet_ = sheet_;
+      return xloperand(rect);
+    }
+    case xltoken_type::SHEET: {
+      int first, last;
+      if (!graph_.parseSheets(begin, token.length_, first, last)) {
+        throw xlunsupported("another workbook, or a sheet that wasn't given");
+      }
+      if (first != last) {
+        throw xlunsupported("3D reference");
+      }
+      ++pos_;
+      if (at(xltoken_type::REF)) {
+        const xltoken_span& ref = tokens_[pos_++];
+        cellrect rect = depgraph::refRect(text(ref), ref.length_);
+        rect.sheet_ = first;
+        return xloperand(rect);
+      }
+      if (at(xltoken_type::NAME)) {
+        return name(tokens_[pos_++], first, eval);
+      }
+      if (at(xltoken_type::ERROR_CODE)) {
+        const xltoken_span& error = tokens_[pos_++];
+        return xloperand(xlvalue::error(std::string(text(error), error.length_)));
+      }
+      throw xlunsupported("sheet without a reference");
+    }
+    case xltoken_type::NAME:
+      ++pos_;
+      return name(token, sheet_, eval);
+    case xltoken_type::FUNCTION:
+      return function(eval);
+    case xltoken_type::PAREN_OPEN: {
+      ++pos_;
+      xloperand out = comparison(eval);
+      if (!at(xltoken_type::PAREN_CLOSE)) {
+        throw xlunsupported("union operator"); // e.g. (A1,B1)
+      }
+      ++pos_;
+      return out;
+    }
+    case xltoken_type::OPEN_ARRAY:
+      return array();
+    default:
+      throw xlunsupported("unsupported token");
+  }
+}
+
+// A defined name is evaluated as a formula in its own right, in the context of
+// this one, so that it may be a range or an array
+xloperand xlformula::name(const xltoken_span& token, int sheet, bool eval) {
+  int name = graph_.findName(text(token), token.length_, sheet);
+  if (name < 0) {
+    return xloperand(xlvalue::error("#NAME?"));
+  }
+  if (!eval) {
+    return xloperand();
+  }
+  if (depth_ >= MAX_NAME_DEPTH) {
+    throw xlunsupported("circular name");
+  }
+  xlformula formula(store_, graph_.nameFormula(name), graph_.nameTokens(name),
+                    sheet_, row_, col_, is_array_, depth_ + 1);
+  return formula.operand();
+}
+
+// Array constants, e.g. {1,2;3,4}
+xloperand xlformula::array() {
+  ++pos_;
+  xloperand out;
+  out.kind_ = xloperand::kind::ARRAY;
+  out.rows_ = 1;
+  int col(0);
+  while (true) {
+    xloperand element = primary(true);
+    if (element.kind_ != xloperand::kind::VALUE) {
+      throw xlunsupported("reference in an array constant");
+    }
+    out.array_.push_back(element.value_);
+    ++col;
+    if (at(xltoken_type::CLOSE_ARRAY)) {
+      ++pos_;
+      break;
+    } else if (atSeparator(';')) {
+      if (out.rows_ == 1) {
+        out.cols_ = col;
+      } else if (col != out.cols_) {
+        throw xlunsupported("ragged array constant");
+      }
+      ++out.rows_;
+      col = 0;
+      ++pos_;
+    } else if (atSeparator(',')) {
+      ++pos_;
+    } else {
+      throw xlunsupported("malformed array constant");
+    }
+  }
+  if (out.rows_ == 1) {
+    out.cols_ = col;
+  } else if (col != out.cols_) {
+    throw xlunsupported("ragged array constant");
+  }
+  return out;
+}
+
+// Functions ------------------------------------------------------------------
+
+xloperand xlformula::argument(bool eval) {
+  if (at(xltoken_type::SEPARATOR) || at(xltoken_type::FUN_CLOSE)) {
+    xloperand missing;
+    missing.missing_ = true;
+    return missing;
+  }
+  return comparison(eval);
+}
+
+// Consumes a separator or the closing parenthesis, returning true for the
+// latter
+bool xlformula::endOfArguments() {
+  if (at(xltoken_type::FUN_CLOSE)) {
+    ++pos_;
+    return true;
+  }
+  if (at(xltoken_type::SEPARATOR)) {
+    ++pos_;
+    return false;
+  }
+  throw xlunsupported("malformed arguments");
+}
+
+void xlformula::arguments(bool eval, std::vector<xloperand>& args) {
+  if (at(xltoken_type::FUN_CLOSE)) {
+    ++pos_;
+    return;
+  }
+  do {
+    args.push_back(argument(eval));
+  } while (!endOfArguments());
+}
+
+xloperand xlformula::function(bool eval) {
+  const xltoken_span& token = tokens_[pos_];
+  std::string name = uppercase(text(token), token.length_);
+  if (name.compare(0, 6, "_XLFN.") == 0) {
+    name.erase(0, 6);
+  }
+  pos_ += 2; // the name and the opening parenthesis
+  if (name == "IF") {
+    return functionIf(eval);
+  }
+  std::vector<xloperand> args;
+  arguments(eval, args);
+  if (!eval) {
+    return xloperand();
+  }
+  std::vector<double> numbers;
+  if (name == "SUM" || name == "AVERAGE" || name == "MIN" || name == "MAX") {
+    xlvalue error = aggregate(args, numbers);
+    if (error.isError()) {
+      return xloperand(error);
+    }
+    if (name == "SUM" || name == "AVERAGE") {
+      double sum(0);
+      for (std::vector<double>::iterator x = numbers.begin(); x != numbers.end(); ++x) {
+        sum += *x;
+      }
+      if (name == "SUM") {
+        return xloperand(checkFinite(sum));
+      }
+      if (numbers.empty()) {
+        return xloperand(xlvalue::error("#DIV/0!"));
+      }
+      return xloperand(checkFinite(sum / numbers.size()));
+    }
+    if (numbers.empty()) {
+      return xloperand(xlvalue::number(0));
+    }
+    return xloperand(xlvalue::number(name == "MIN"
+                                     ? *std::min_element(numbers.begin(), numbers.end())
+                                     : *std::max_element(numbers.begin(), numbers.end())));
+  }
+  if (name == "COUNT") {
+    return xloperand(count(args));
+  }
+  if (name == "INDEX") {
+    return index(args);
+  }
+  if (name == "MATCH") {
+    return xloperand(match(args));
+  }
+  if (name == "VLOOKUP") {
+    return xloperand(vlookup(args));
+  }
+  throw xlunsupported("function " + name);
+}
+
+// IF() evaluates only the branch that is taken
+xloperand xlformula::functionIf(bool eval) {
+  xloperand condition = argument(eval);
+  if (endOfArguments()) {
+    throw xlunsupported("IF() needs at least two arguments");
+  }
+  xlvalue test;
+  if (eval) {
+    if (is_array_ && !condition.isScalar()) {
+      throw xlunsupported("IF() of an array");
+    }
+    test = asBool(scalar(condition));
+  }
+  bool failed = test.isError();
+  bool truth = test.number_ != 0;
+  xloperand yes = argument(eval && !failed && truth);
+  xloperand no;
+  bool has_no(false);
+  if (!endOfArguments()) {
+    no = argument(eval && !failed && !truth);
+    has_no = true;
+    if (!endOfArguments()) {
+      throw xlunsupported("IF() has at most three arguments");
+    }
+  }
+  if (!eval) {
+    return xloperand();
+  }
+  if (failed) {
+    return xloperand(test);
+  }
+  if (truth) {
+    return yes.missing_ ? xloperand(xlvalue::number(0)) : yes;
+  }
+  if (!has_no) {
+    return xloperand(xlvalue::boolean(false));
+  }
+  return no.missing_ ? xloperand(xlvalue::number(0)) : no;
+}
+
+// The numbers of the arguments of SUM(), AVERAGE(), MIN() and MAX().  Values in
+// ranges and arrays are taken only if they are numbers, but values given
+// directly are coerced, e.g. SUM("1", TRUE) is 2.  Returns the first error.
+xlvalue xlformula::aggregate(const std::vector<xloperand>& args,
+                             std::vector<double>& numbers) const {
+  std::vector<int> cells;
+  for (std::vector<xloperand>::const_iterator arg = args.begin();
+       arg != args.end();
+       ++arg) {
+    if (arg->missing_) {
+      numbers.push_back(0);
+    } else if (arg->kind_ == xloperand::kind::VALUE) {
+      xlvalue number = asNumber(arg->value_);
+      if (number.isError()) {
+        return number;
+      }
+      numbers.push_back(number.number_);
+    } else if (arg->kind_ == xloperand::kind::ARRAY) {
+      for (std::vector<xlvalue>::const_iterator x = arg->array_.begin();
+           x != arg->array_.end();
+           ++x) {
+        if (x->isError()) {
+          return *x;
+        }
+        if (x->type_ == xlvalue_type::NUMBER) {
+          numbers.push_back(x->number_);
+        }
+      }
+    } else {
+      cells.clear();
+      store_.cellsIn(arg->range_, cells);
+      for (std::vector<int>::iterator cell = cells.begin(); cell != cells.end(); ++cell) {
+        xlvalue x = store_.value(*cell);
+        if (x.isError()) {
+          return x;
+        }
+        if (x.type_ == xlvalue_type::NUMBER) {
+          numbers.push_back(x.number_);
+        }
+      }
+    }
+  }
+  return xlvalue();
+}
+
+// COUNT() ignores errors, and anything else that isn't a number, except that
+// values given directly are counted if they can be coerced to numbers.
+xlvalue xlformula::count(const std::vector<xloperand>& args) const {
+  double n(0);
+  std::vector<int> cells;
+  for (std::vector<xloperand>::const_iterator arg = args.begin();
+       arg != args.end();
+       ++arg) {
+    if (arg->missing_) {
+      continue;
+    } else if (arg->kind_ == xloperand::kind::VALUE) {
+      n += !asNumber(arg->value_).isError();
+    } else if (arg->kind_ == xloperand::kind::ARRAY) {
+      for (std::vector<xlvalue>::const_iterator x = arg->array_.begin();
+           x != arg->array_.end();
+           ++x) {
+        n += x->type_ == xlvalue_type::NUMBER;
+      }
+    } else {
+      cells.clear();
+      store_.cellsIn(arg->range_, cells);
+      for (std::vector<int>::iterator cell = cells.begin(); cell != cells.end(); ++cell) {
+        n += store_.value(*cell).type_ == xlvalue_type::NUMBER;
+      }
+    }
+  }
+  return xlvalue::number(n);
+}
+
+// An integer argument, or an error
+static xlvalue integerArgument(const xlvalue& x, int& out) {
+  xlvalue number = asNumber(x);
+  if (number.isError()) {
+    return number;
+  }
+  if (std::fabs(number.number_) >= INT_MAX) {
+    return xlvalue::error("#VALUE!");
+  }
+  out = (int) number.number_; // truncated, like Excel
+  return xlvalue();
+}
+
+xloperand xlformula::index(const std::vector<xloperand>& args) const {
+  if (args.size() < 2 || args.size() > 3) {
+    throw xlunsupported("INDEX() of more than one area");
+  }
+  const xloperand& x = args[0];
+  if (x.kind_ == xloperand::kind::VALUE && x.value_.isError()) {
+    return x;
+  }
+  int row(0), col(0);
+  xlvalue error = integerArgument(scalar(args[1]), row);
+  if (error.isError()) {
+    return xloperand(error);
+  }
+  if (args.size() == 3) {
+    error = integerArgument(scalar(args[2]), col);
+    if (error.isError()) {
+      return xloperand(error);
+    }
+  } else if (x.rows() == 1) { // the only index is of a column
+    std::swap(row, col);
+  }
+  if (row < 0 || col < 0) {
+    return xloperand(xlvalue::error("#VALUE!"));
+  }
+  if (row > x.rows() || col > x.cols()) {
+    return xloperand(xlvalue::error("#REF!"));
+  }
+  // Zero means the whole row or column
+  int first_row = row == 0 ? 0 : row - 1;
+  int last_row = row == 0 ? x.rows() - 1 : row - 1;
+  int first_col = col == 0 ? 0 : col - 1;
+  int last_col = col == 0 ? x.cols() - 1 : col - 1;
+  if (x.kind_ == xloperand::kind::RANGE) {
+    cellrect rect = x.range_;
+    rect.first_row_ = x.range_.first_row_ + first_row;
+    rect.last_row_ = x.range_.first_row_ + last_row;
+    rect.first_col_ = x.range_.first_col_ + first_col;
+    rect.last_col_ = x.range_.first_col_ + last_col;
+    return xloperand(rect);
+  }
+  std::vector<xlvalue> all;
+  values(x, all);
+  xloperand out;
+  out.kind_ = xloperand::kind::ARRAY;
+  out.rows_ = last_row - first_row + 1;
+  out.cols_ = last_col - first_col + 1;
+  for (int i = first_row; i <= last_row; ++i) {
+    for (int j = first_col; j <= last_col; ++j) {
+      out.array_.push_back(all[i * x.cols() + j]);
+    }
+  }
+  if (out.isScalar()) {
+    return xloperand(out.array_[0]);
+  }
+  return out;
+}
+
+// Values in a one-dimensional range or array, or in the first column of a
+// table, that aren't blank, as (position, value)
+void xlformula::lookupValues(const xloperand& x, bool first_column,
+                             std::vector<std::pair<int, xlvalue> >& out) const {
+  if (x.kind_ == xloperand::kind::RANGE) {
+    cellrect rect = x.range_;
+    if (first_column) {
+      rect.last_col_ = rect.first_col_;
+    }
+    bool by_col = rect.first_row_ == rect.last_row_;
+    std::vector<int> cells;
+    store_.cellsIn(rect, cells);
+    for (std::vector<int>::iterator cell = cells.begin(); cell != cells.end(); ++cell) {
+      xlvalue value = store_.value(*cell);
+      if (value.type_ != xlvalue_type::BLANK) {
+        int position = by_col
+          ? graph_.cellCol(*cell) - rect.first_col_
+          : graph_.cellRow(*cell) - rect.first_row_;
+        out.push_back(std::make_pair(position, value));
+      }
+    }
+    return;
+  }
+  std::vector<xlvalue> all;
+  values(x, all);
+  int step = first_column ? x.cols() : 1;
+  for (size_t i = 0; i < all.size(); i += step) {
+    if (all[i].type_ != xlvalue_type::BLANK) {
+      out.push_back(std::make_pair((int) (i / step), all[i]));
+    }
+  }
+}
+
+// Position of a value among (position, value) pairs, or -1.  Type 0 is an
+// exact match, allowing wildcards in text; 1 is the largest value not greater
+// and -1 the smallest value not less, assuming that the values are sorted
+// ascending or descending, as Excel does.
+static int lookup(const xlvalue& key,
+                  const std::vector<std::pair<int, xlvalue> >& values,
+                  int type) {
+  int found(-1);
+  std::string pattern;
+  if (type == 0 && key.type_ == xlvalue_type::TEXT) {
+    pattern = uppercase(key.text_.data(), key.text_.size());
+  }
+  for (std::vector<std::pair<int, xlvalue> >::const_iterator value = values.begin();
+       value != values.end();
+       ++value) {
+    if (value->second.type_ != key.type_) {
+      continue;
+    }
+    if (type == 0) {
+      bool equal = key.type_ == xlvalue_type::TEXT
+        ? wildcardMatch(uppercase(value->second.text_.data(),
+                                  value->second.text_.size()),
+                        pattern)
+        : value->second.number_ == key.number_;
+      if (equal) {
+        return value->first;
+      }
+      continue;
+    }
+    int comparison = compareValues(value->second, key);
+    if (comparison * type > 0) {
+      break;
+    }
+    found = value->first;
+  }
+  return found;
+}
+
+xlvalue xlformula::match(const std::vector<xloperand>& args) const {
+  if (args.size() < 2 || args.size() > 3) {
+    throw xlunsupported("MATCH() takes two or three arguments");
+  }
+  xlvalue key = scalar(args[0]);
+  if (key.isError()) {
+    return key;
+  }
+  const xloperand& x = args[1];
+  if (x.kind_ == xloperand::kind::VALUE && x.value_.isError()) {
+    return x.value_;
+  }
+  if (x.rows() != 1 && x.cols() != 1) {
+    return xlvalue::error("#N/A");
+  }
+  int type(1);
+  if (args.size() == 3 && !args[2].missing_) {
+    xlvalue number = asNumber(scalar(args[2]));
+    if (number.isError()) {
+      return number;
+    }
+    type = number.number_ > 0 ? 1 : (number.number_ < 0 ? -1 : 0);
+  } else if (args.size() == 3) {
+    type = 0;
+  }
+  std::vector<std::pair<int, xlvalue> > candidates;
+  lookupValues(x, false, candidates);
+  int found = lookup(key, candidates, type);
+  if (found < 0) {
+    return xlvalue::error("#N/A");
+  }
+  return xlvalue::number(found + 1);
+}
+
+xlvalue xlformula::vlookup(const std::vector<xloperand>& args) const {
+  if (args.size() < 3 || args.size() > 4) {
+    throw xlunsupported("VLOOKUP() takes three or four arguments");
+  }
+  xlvalue key = scalar(args[0]);
+  if (key.isError()) {
+    return key;
+  }
+  const xloperand& table = args[1];
+  if (table.kind_ == xloperand::kind::VALUE && table.value_.isError()) {
+    return table.value_;
+  }
+  int col(0);
+  xlvalue error = integerArgument(scalar(args[2]), col);
+  if (error.isError()) {
+    return error;
+  }
+  if (col < 1) {
+    return xlvalue::error("#VALUE!");
+  }
+  if (col > table.cols()) {
+    return xlvalue::error("#REF!");
+  }
+  bool approximate(true);
+  if (args.size() == 4) {
+    xlvalue range_lookup = asBool(scalar(args[3]));
+    if (range_lookup.isError()) {
+      return range_lookup;
+    }
+    approximate = range_lookup.number_ != 0;
+  }
+  std::vector<std::pair<int, xlvalue> > candidates;
+  lookupValues(table, true, candidates);
+  int row = lookup(key, candidates, approximate ? 1 : 0);
+  if (row < 0) {
+    return xlvalue::error("#N/A");
+  }
+  if (table.kind_ == xloperand::kind::RANGE) {
+    return store_.value(table.range_.sheet_,
+                        table.range_.first_row_ + row,
+                        table.range_.first_col_ + col - 1);
+  }
+  std::vector<xlvalue> all;
+  values(table, all);
+  return all[row * table.cols() + col - 1];
+}
+
+// Operands as values ---------------------------------------------------------
+
+// A single value: the value of a single cell, the top-left value of an array,
+// or the cell of a range in the same row or column as the formula (implicit
+// intersection)
+xlvalue xlformula::scalar(const xloperand& x) const {
+  switch (x.kind_) {
+    case xloperand::kind::VALUE:
+      return x.value_;
+    case xloperand::kind::ARRAY:
+      return x.array_.empty() ? xlvalue() : x.array_[0];
+    default:
+      break;
+  }
+  const cellrect& rect = x.range_;
+  if (x.isScalar() || is_array_) {
+    return store_.value(rect.sheet_, rect.first_row_, rect.first_col_);
+  }
+  if (rect.first_col_ == rect.last_col_
+      && row_ >= rect.first_row_ && row_ <= rect.last_row_) {
+    return store_.value(rect.sheet_, row_, rect.first_col_);
+  }
+  if (rect.first_row_ == rect.last_row_
+      && col_ >= rect.first_col_ && col_ <= rect.last_col_) {
+    return store_.value(rect.sheet_, rect.first_row_, col_);
+  }
+  return xlvalue::error("#VALUE!");
+}
+
+// Every value of an operand, row by row
+void xlformula::values(const xloperand& x, std::vector<xlvalue>& out) const {
+  switch (x.kind_) {
+    case xloperand::kind::VALUE:
+      out.push_back(x.value_);
+      return;
+    case xloperand::kind::ARRAY:
+      out.insert(out.end(), x.array_.begin(), x.array_.end());
+      return;
+    default:
+      break;
+  }
+  if ((long long int) x.rows() * x.cols() > MAX_ARRAY_SIZE) {
+    throw xlunsupported("range too large for an array");
+  }
+  const cellrect& rect = x.range_;
+  out.reserve(out.size() + x.rows() * x.cols());
+  for (int row = rect.first_row_; row <= rect.last_row_; ++row) {
+    for (int col = rect.first_col_; col <= rect.last_col_; ++col) {
+      out.push_back(store_.value(rect.sheet_, row, col));
+    }
+  }
+}
+
+// Apply a function to every value of an array formula, or to the single value
+// of any other formula
+template <typename F>
+xloperand xlformula::elementwise(const xloperand& x, F f, bool eval) {
+  if (!eval) {
+    return xloperand();
+  }
+  if (!is_array_ || x.isScalar()) {
+    return xloperand(f(scalar(x)));
+  }
+  xloperand out;
+  out.kind_ = xloperand::kind::ARRAY;
+  out.rows_ = x.rows();
+  out.cols_ = x.cols();
+  values(x, out.array_);
+  for (std::vector<xlvalue>::iterator value = out.array_.begin();
+       value != out.array_.end();
+       ++value) {
+    *value = f(*value);
+  }
+  return out;
+}
+
+// In array formulas, operators apply to each pair of values, a single row or
+// column being repeated to match the other operand, e.g. A1:A3*B1:B3 or
+// A1:A3*{1,2}.  Positions beyond a smaller operand are #N/A.
+xloperand xlformula::binary(xlop op, const xloperand& a, const xloperand& b,
+                            bool eval) {
+  if (!eval) {
+    return xloperand();
+  }
+  if (!is_array_ || (a.isScalar() && b.isScalar())) {
+    return xloperand(applyOp(op, scalar(a), scalar(b)));
+  }
+  std::vector<xlvalue> values_a, values_b;
+  values(a, values_a);
+  values(b, values_b);
+  xloperand out;
+  out.kind_ = xloperand::kind::ARRAY;
+  out.rows_ = std::max(a.rows(), b.rows());
+  out.cols_ = std::max(a.cols(), b.cols());
+  out.array_.reserve(out.rows_ * out.cols_);
+  for (int i = 0; i < out.rows_; ++i) {
+    for (int j = 0; j < out.cols_; ++j) {
+      int row_a = a.rows() == 1 ? 0 : i;
+      int col_a = a.cols() == 1 ? 0 : j;
+      int row_b = b.rows() == 1 ? 0 : i;
+      int col_b = b.cols() == 1 ? 0 : j;
+      if (row_a >= a.rows() || col_a >= a.cols()
+          || row_b >= b.rows() || col_b >= b.cols()) {
+        out.array_.push_back(xlvalue::error("#N/A"));
+      } else {
+        out.array_.push_back(applyOp(op,
+                                     values_a[row_a * a.cols() + col_a],
+                                     values_b[row_b * b.cols() + col_b]));
+      }
+    }
+  }
+  return out;
+}
+
+void evaluate_formulas(cellstore& store,
+                       const std::vector<std::string>& formulas,
+                       const std::vector<bool>& is_array,
+                       std::vector<xlresult>& results) {
+  const depgraph& graph = store.graph();
+  std::vector<int> order;
+  std::vector<int> cyclic;
+  graph.topologicalOrder(order, cyclic);
+  std::vector<xltoken_span> tokens;
+  for (std::vector<int>::iterator cell = order.begin(); cell != order.end(); ++cell) {
+    xlresult result;
+    result.cell_ = *cell;
+    result.status_ = xlresult_status::UNSUPPORTED;
+    tokens.clear();
+    try {
+      tokenize_formula(formulas[*cell], tokens);
+      xlformula formula(store, formulas[*cell], tokens,
+                        graph.cellSheet(*cell), graph.cellRow(*cell),
+                        graph.cellCol(*cell), is_array[*cell], 0);
+      result.value_ = formula.evaluate();
+      result.status_ = xlresult_status::EVALUATED;
+      store.set(*cell, result.value_);
+    } catch (std::exception& e) {
+      // Unsupported, or couldn't be tokenised, so the cell keeps its value
+    }
+    results.push_back(result);
+  }
+  for (std::vector<int>::iterator cell = cyclic.begin(); cell != cyclic.end(); ++cell) {
+    xlresult result;
+    result.cell_ = *cell;
+    result.status_ = xlresult_status::CYCLIC;
+    results.push_back(result);
+  }
+  std::sort(results.begin(), results.end(),
+            [](const xlresult& a, const xlresult& b) { return a.cell_ < b.cell_; });
+}
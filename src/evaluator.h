@@ -0,0 +1,95 @@
+#ifndef EVALUATOR_
+#define EVALUATOR_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "depgraph.h"
+
+// Types of value, like the data_type of xlsx_cells()
+enum class xlvalue_type : unsigned char {
+  BLANK,
+  NUMBER,
+  TEXT,
+  BOOL,
+  ERROR_CODE   // not ERROR, which some versions of R define as a macro
+};
+
+// A single value of a cell, or of an expression
+struct xlvalue {
+  xlvalue_type type_;
+  double number_;     // numbers, and bools as 0 or 1
+  std::string text_;  // text, and error codes like #DIV/0!
+
+  xlvalue(): type_(xlvalue_type::BLANK), number_(0) {}
+  xlvalue(xlvalue_type type, double number, const std::string& text):
+    type_(type), number_(number), text_(text) {}
+
+  static xlvalue number(double x) { return xlvalue(xlvalue_type::NUMBER, x, ""); }
+  static xlvalue text(const std::string& x) { return xlvalue(xlvalue_type::TEXT, 0, x); }
+  static xlvalue boolean(bool x) { return xlvalue(xlvalue_type::BOOL, x, ""); }
+  static xlvalue error(const std::string& code) {
+    return xlvalue(xlvalue_type::ERROR_CODE, 0, code);
+  }
+
+  bool isError() const { return type_ == xlvalue_type::ERROR_CODE; }
+};
+
+// The values of the cells of a depgraph, in columns, indexed like its cells.
+// The cells of each column of each sheet are indexed by row, so that ranges
+// are visited by the cells in them, not every position.
+class cellstore {
+
+  public:
+
+    cellstore(const depgraph& graph,
+              const std::vector<xlvalue_type>& types,
+              const std::vector<double>& numbers,
+              const std::vector<std::string>& texts);
+
+    const depgraph& graph() const { return graph_; }
+
+    xlvalue value(int cell) const;
+
+    // The value at a position, blank if there is no cell there
+    xlvalue value(int sheet, int row, int col) const;
+
+    void set(int cell, const xlvalue& value);
+
+    // Cells within a rectangle, column by column, and by row within each
+    // column
+    void cellsIn(const cellrect& rect, std::vector<int>& out) const;
+
+  private:
+
+    const depgraph& graph_;
+    std::vector<xlvalue_type> types_;
+    std::vector<double> numbers_;
+    std::vector<std::string> texts_;
+    std::vector<std::map<int, std::vector<std::pair<int, int> > > > columns_;
+};
+
+// Whether a formula could be evaluated
+enum class xlresult_status : unsigned char {
+  EVALUATED,
+  UNSUPPORTED,  // an unsupported function, operator or reference
+  CYCLIC        // in, or dependent on, a circular reference
+};
+
+struct xlresult {
+  int cell_;
+  xlresult_status status_;
+  xlvalue value_;
+};
+
+// Evaluate every formula in dependency order, storing each result in the
+// store, so that later formulas use it.  Formulas that can't be evaluated
+// leave their cells' values as they were.  Results are in the order of the
+// cells.
+void evaluate_formulas(cellstore& store,
+                       const std::vector<std::string>& formulas,
+                       const std::vector<bool>& is_array,
+                       std::vector<xlresult>& results);
+
+#endif
@@ -0,0 +1,109 @@
+#include <set>
+#include <Rcpp.h>
+#include "arrowexport.h"
+
+using namespace Rcpp;
+
+// R bindings of arrowexport.  The struct array and its schema are returned as
+// external pointers of the classes that the nanoarrow package uses, with the
+// schema as the tag of the array, so that nanoarrow, and through it arrow, can
+// use or move them without copying.  The finalizers release them unless they
+// have been moved out already.
+
+static void finalize_schema(SEXP xptr) {
+  ArrowSchema* schema = static_cast<ArrowSchema*>(R_ExternalPtrAddr(xptr));
+  if (schema == NULL) return;
+  if (schema->release != NULL) schema->release(schema);
+  delete schema;
+  R_ClearExternalPtr(xptr);
+}
+
+static void finalize_array(SEXP xptr) {
+  ArrowArray* array = static_cast<ArrowArray*>(R_ExternalPtrAddr(xptr));
+  if (array == NULL) return;
+  if (array->release != NULL) array->release(array);
+  delete array;
+  R_ClearExternalPtr(xptr);
+}
+
+// Strings as UTF-8, with NA as NULL.  Strings that are already UTF-8 or ASCII,
+// as those of cells are, aren't copied.
+static void utf8_pointers(SEXP x, std::vector<const char*>& out) {
+  R_xlen_t n = Rf_xlength(x);
+  out.resize(n);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    SEXP s = STRING_ELT(x, i);
+    out[i] = (s == NA_STRING) ? NULL : Rf_translateCharUTF8(s);
+  }
+}
+
+// [[Rcpp::export]]
+SEXP export_arrow_(List x, CharacterVector dictionary) {
+  CharacterVector names = x.attr("names");
+  R_xlen_t n = (x.size() == 0) ? 0 : Rf_xlength(x[0]);
+  std::set<std::string> encode;
+  for (R_xlen_t j = 0; j < dictionary.size(); ++j) {
+    encode.insert(Rf_translateCharUTF8(dictionary[j]));
+  }
+
+  arrowexport columns(n);
+  std::vector<const char*> strings;
+  for (R_xlen_t j = 0; j < x.size(); ++j) {
+    SEXP column = x[j];
+    std::string name(Rf_translateCharUTF8(names[j]));
+    if (Rf_isFactor(column)) { // by the text of its levels
+      std::vector<const char*> levels;
+      utf8_pointers(Rf_getAttrib(column, R_LevelsSymbol), levels);
+      strings.resize(n);
+      const int* codes = INTEGER(column);
+      for (R_xlen_t i = 0; i < n; ++i) {
+        strings[i] = (codes[i] == NA_INTEGER) ? NULL : levels[codes[i] - 1];
+      }
+      columns.addDictionary(name, strings.data());
+      continue;
+    }
+    switch (TYPEOF(column)) {
+      case LGLSXP:
+        columns.addLogical(name, LOGICAL(column));
+        break;
+      case INTSXP:
+        columns.addInteger(name, INTEGER(column));
+        break;
+      case REALSXP:
+        if (Rf_inherits(column, "POSIXct")) {
+          SEXP tzone = Rf_getAttrib(column, Rf_install("tzone"));
+          std::string timezone;
+          if (TYPEOF(tzone) == STRSXP && Rf_xlength(tzone) > 0) {
+            timezone = Rf_translateCharUTF8(STRING_ELT(tzone, 0));
+          }
+          columns.addTimestamp(name, REAL(column), timezone);
+        } else {
+          columns.addDouble(name, REAL(column));
+        }
+        break;
+      case STRSXP:
+        utf8_pointers(column, strings);
+        if (encode.count(name)) {
+          columns.addDictionary(name, strings.data());
+        } else {
+          columns.addString(name, strings.data());
+        }
+        break;
+      default: // such as character_formatted, a list of data frames
+        break;
+    }
+  }
+
+  ArrowSchema* schema = new ArrowSchema;
+  ArrowArray* array = new ArrowArray;
+  columns.moveTo(schema, array);
+
+  SEXP schema_xptr = PROTECT(R_MakeExternalPtr(schema, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(schema_xptr, &finalize_schema, TRUE);
+  Rf_setAttrib(schema_xptr, R_ClassSymbol, Rf_mkString("nanoarrow_schema"));
+  SEXP array_xptr = PROTECT(R_MakeExternalPtr(array, schema_xptr, R_NilValue));
+  R_RegisterCFinalizerEx(array_xptr, &finalize_array, TRUE);
+  Rf_setAttrib(array_xptr, R_ClassSymbol, Rf_mkString("nanoarrow_array"));
+  UNPROTECT(2);
+  return array_xptr;
+}
@@ -0,0 +1,37 @@
+#include <vector>
+#include "fingerprint.h"
+#include "token_grammar.h"
+#include "ref.h"
+
+void r1c1_formula(const std::string& formula, int row, int col,
+                  std::string& out) {
+  std::vector<xltoken_span> tokens;
+  tokenize_formula(formula, tokens);
+  strip_whitespace(formula, tokens);
+
+  out.clear();
+  out.reserve(formula.size() + 16);
+  for (std::vector<xltoken_span>::const_iterator token = tokens.begin();
+       token != tokens.end(); ++token) {
+    if (token->type_ == xltoken_type::REF) {
+      ref(formula.substr(token->offset_, token->length_)).r1c1(row, col, out);
+    } else {
+      out.append(formula, token->offset_, token->length_);
+    }
+  }
+}
+
+std::string fingerprint(const std::string& x) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (std::string::const_iterator i = x.begin(); i != x.end(); ++i) {
+    hash ^= static_cast<unsigned char>(*i);
+    hash *= 1099511628211ULL;
+  }
+  static const char digits[] = "0123456789abcdef";
+  std::string out(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    out[i] = digits[hash & 15];
+    hash >>= 4;
+  }
+  return out;
+}
@@ -0,0 +1,17 @@
+#ifndef FINGERPRINT_
+#define FINGERPRINT_
+
+#include <string>
+
+// Render a formula in R1C1 notation, relative to the cell at row, col, so that
+// formulas that differ only by the offset of their relative references are
+// rendered the same, e.g. A1+$B$1 in A2 and B1+$B$1 in B2 are both
+// R[-1]C+R1C2.  Spaces that aren't intersections are dropped.  Doesn't touch
+// R, so it can be called from any thread.
+void r1c1_formula(const std::string& formula, int row, int col,
+                  std::string& out);
+
+// A 64-bit FNV-1a hash of a string, as 16 hexadecimal digits
+std::string fingerprint(const std::string& x);
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef TIDYXL_FORMATTEDSTRING_
+#define TIDYXL_FORMATTEDSTRING_
+
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "xlsxstyleindex.h"
+#include "rstring.h"
+#include "tibble.h"
+
+// Return a dataframe, one row per substring, columns for formatting
+inline Rcpp::List parseFormattedString(
+    const rapidxml::xml_node<>* string,
+    const xlsxstyleindex& styles) {
+
+  int n(0); // number of substrings
+  for (rapidxml::xml_node<>* node = string->first_node();
+       node != NULL;
+       node = node->next_sibling()) {
+    ++n;
+  }
+
+  Rcpp::CharacterVector character(n, NA_STRING);
+  Rcpp::LogicalVector bold(n, NA_LOGICAL);
+  Rcpp::LogicalVector italic(n, NA_LOGICAL);
+  Rcpp::CharacterVector underline(n, NA_STRING);
+  Rcpp::LogicalVector strike(n, NA_LOGICAL);
+  Rcpp::CharacterVector vertAlign(n, NA_STRING);
+  Rcpp::NumericVector size(n, NA_REAL);
+  Rcpp::CharacterVector color_rgb(n, NA_STRING);
+  Rcpp::IntegerVector color_theme(n, NA_INTEGER);
+  Rcpp::NumericVector color_tint(n, NA_REAL);
+  Rcpp::IntegerVector color_indexed(n, NA_INTEGER);
+  Rcpp::CharacterVector font(n, NA_STRING);
+  Rcpp::IntegerVector family(n, NA_INTEGER);
+  Rcpp::CharacterVector scheme(n, NA_STRING);
+
+  int i(0); // ith substring
+  for (rapidxml::xml_node<>* node = string->first_node();
+       node != NULL;
+       node = node->next_sibling()) {
+
+    std::string node_name = node->name();
+    if (node_name == "t") {
+
+      SET_STRING_ELT(character, i, Rf_mkCharCE(node->value(), CE_UTF8));
+
+    } else if (node_name == "r") {
+
+      SET_STRING_ELT(character, i, Rf_mkCharCE(node->first_node("t")->value(), CE_UTF8));
+      rapidxml::xml_node<>* rPr = node->first_node("rPr");
+
+      if (rPr != NULL) {
+
+        bold[i] = rPr->first_node("b") != NULL;
+        italic[i] = rPr->first_node("i") != NULL;
+
+        rapidxml::xml_node<>* u = rPr->first_node("u");
+        if (u != NULL) {
+          rapidxml::xml_attribute<>* u_val = u->first_attribute("val");
+          if (u_val != NULL) {
+            underline[i] = u_val->value();
+          } else {
+            underline[i] = "single";
+          }
+        }
+
+        strike[i] = rPr->first_node("strike") != NULL;
+
+        rapidxml::xml_node<>* vertAlign_node = rPr->first_node("vertAlign");
+        if (vertAlign_node != NULL) {
+          vertAlign[i] = vertAlign_node->first_attribute("val")->value();
+        }
+
+        rapidxml::xml_node<>* sz = rPr->first_node("sz");
+        if (sz != NULL) {
+          size[i] = strtod(sz->value(), NULL);
+        }
+
+        rapidxml::xml_node<>* color = rPr->first_node("color");
+        if (color != NULL) {
+
+          rapidxml::xml_attribute<>* rgb_attr = color->first_attribute("rgb");
+          if (rgb_attr != NULL) {
+
+            color_rgb[i] = rgb_attr->value();
+
+          } else {
+
+            rapidxml::xml_attribute<>* theme_attr = color->first_attribute("theme");
+            if (theme_attr != NULL) {
+
+              int theme_int = strtol(theme_attr->value(), NULL, 10) + 1;
+              color_rgb[i] = naIfEmpty(styles.theme_[theme_int - 1]);
+              color_theme[i] = theme_int;
+
+              rapidxml::xml_attribute<>* tint_attr = color->first_attribute("tint");
+              if (tint_attr != NULL) {
+                color_tint[i] = strtod(tint_attr->value(), NULL);
+              }
+
+            } else {
+
+              // no known case
+              // # nocov start
+              rapidxml::xml_attribute<>* indexed_attr = color->first_attribute("indexed");
+              if (indexed_attr != NULL) {
+                int indexed_int = strtol(indexed_attr->value(), NULL, 10) + 1;
+                color_rgb[i] = naIfEmpty(styles.indexed_[indexed_int - 1]);
+                color_indexed[i] = indexed_int;
+              }
+              // # nocov end
+
+            }
+          }
+        }
+
+        rapidxml::xml_node<>* rFont = rPr->first_node("rFont");
+        if (rFont != NULL) {
+          font[i] = rFont->first_attribute("val")->value();
+        }
+
+        rapidxml::xml_node<>* family_node = rPr->first_node("family");
+        if (family_node != NULL) {
+          family[i] = strtol(family_node->first_attribute("val")->value(), NULL, 10);
+        }
+
+        rapidxml::xml_node<>* scheme_node = rPr->first_node("scheme");
+        if (scheme_node != NULL) {
+          scheme[i] = scheme_node->first_attribute("val")->value();
+        }
+
+      }
+    }
+    ++i;
+  }
+
+  Rcpp::List out = Rcpp::List::create(
+      Rcpp::_["character"] = character,
+      Rcpp::_["bold"] = bold,
+      Rcpp::_["italic"] = italic,
+      Rcpp::_["underline"] = underline,
+      Rcpp::_["strike"] = strike,
+      Rcpp::_["vertAlign"] = vertAlign,
+      Rcpp::_["size"] = size,
+      Rcpp::_["color_rgb"] = color_rgb,
+      Rcpp::_["color_theme"] = color_theme,
+      Rcpp::_["color_indexed"] = color_indexed,
+      Rcpp::_["color_tint"] = color_tint,
+      Rcpp::_["font"] = font,
+      Rcpp::_["family"] = family,
+      Rcpp::_["scheme"] = scheme);
+
+  // Turn list of vectors into a data frame without checking anything
+  out.attr("class") = Rcpp::CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, n);
+
+  return out;
+}
+
+#endif
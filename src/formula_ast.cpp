@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <stdexcept>
+#include "formula_ast.h"
+
+// Binding power of the infix and postfix operators.  Prefix operators bind
+// more tightly than any but the reference operators.
+static const int PREFIX_PRECEDENCE = 7;
+
+// Builds the nodes of one formula by precedence climbing.  Nodes are created
+// bottom-up, so they are put into preorder at the end.
+class xlast_builder {
+
+  public:
+
+    xlast_builder(const std::string& formula,
+                  const std::vector<xltoken_span>& tokens):
+      formula_(formula), tokens_(tokens), pos_(0) {
+      strip_whitespace(formula_, tokens_);
+    }
+
+    // Returns the root
+    int parse() {
+      if (tokens_.empty()) {
+        throw std::runtime_error("empty formula");
+      }
+      int root = expression(0);
+      if (pos_ != tokens_.size()) {
+        throw std::runtime_error("unexpected token");
+      }
+      return root;
+    }
+
+    std::vector<xlnode> nodes_;
+
+  private:
+
+    const std::string& formula_;
+    std::vector<xltoken_span> tokens_;
+    size_t pos_;
+    std::vector<int> last_child_;
+
+    bool at(xltoken_type type) const {
+      return pos_ < tokens_.size() && tokens_[pos_].type_ == type;
+    }
+
+    int node(xlnode_type type, size_t offset, size_t length) {
+      xlnode out = {type, -1, -1, -1, offset, length, offset, length};
+      nodes_.push_back(out);
+      last_child_.push_back(-1);
+      return nodes_.size() - 1;
+    }
+
+    int node(xlnode_type type, const xltoken_span& token) {
+      return node(type, token.offset_, token.length_);
+    }
+
+    // Append a child, widening the span of the parent to include it
+    void adopt(int parent, int child) {
+      xlnode& p = nodes_[parent];
+      const xlnode& c = nodes_[child];
+      nodes_[child].parent_ = parent;
+      if (last_child_[parent] == -1) {
+        p.first_child_ = child;
+      } else {
+        nodes_[last_child_[parent]].next_sibling_ = child;
+      }
+      last_child_[parent] = child;
+      size_t end = std::max(p.offset_ + p.length_, c.offset_ + c.length_);
+      p.offset_ = std::min(p.offset_, c.offset_);
+      p.length_ = end - p.offset_;
+    }
+
+    // Precedence of the infix operator at pos_, or -1 if there isn't one
+    int infixPrecedence() const {
+      if (!at(xltoken_type::OPERATOR)) {
+        return -1;
+      }
+      const xltoken_span& token = tokens_[pos_];
+      switch (formula_[token.offset_]) {
+        case '=':
+        case '<':
+        case '>':
+          return 1;
+        case '&':
+          return 2;
+        case '+':
+        case '-':
+          return 3;
+        case '*':
+        case '/':
+          return 4;
+        case '^':
+          return 5;
+        case ',':
+          return 8;
+        case ' ':
+          return 9;
+        case ':':
+          return 10;
+        default:
+          return -1; // % is postfix
+      }
+    }
+
+    bool atPostfix() const {
+      return at(xltoken_type::OPERATOR) && formula_[tokens_[pos_].offset_] == '%';
+    }
+
+    int expression(int min_precedence) {
+      int left = prefix();
+      while (true) {
+        if (atPostfix() && 6 >= min_precedence) {
+          int op = node(xlnode_type::POSTFIX, tokens_[pos_++]);
+          adopt(op, left);
+          left = op;
+          continue;
+        }
+        int precedence = infixPrecedence();
+        if (precedence < 0 || precedence < min_precedence) {
+          return left;
+        }
+        int op = node(xlnode_type::INFIX, tokens_[pos_++]);
+        int right = expression(precedence + 1); // left-associative
+        adopt(op, left);
+        adopt(op, right);
+        left = op;
+      }
+    }
+
+    int prefix() {
+      if (at(xltoken_type::OPERATOR)
+          && (formula_[tokens_[pos_].offset_] == '-'
+              || formula_[tokens_[pos_].offset_] == '+')) {
+        int op = node(xlnode_type::PREFIX, tokens_[pos_++]);
+        adopt(op, expression(PREFIX_PRECEDENCE + 1));
+        return op;
+      }
+      return primary();
+    }
+
+    int primary() {
+      if (pos_ >= tokens_.size()) {
+        throw std::runtime_error("incomplete formula");
+      }
+      const xltoken_span& token = tokens_[pos_++];
+      switch (token.type_) {
+        case xltoken_type::REF:
+          return node(xlnode_type::REF, token);
+        case xltoken_type::NAME:
+          return node(xlnode_type::NAME, token);
+        case xltoken_type::NUMBER:
+          return node(xlnode_type::NUMBER, token);
+        case xltoken_type::TEXT:
+          return node(xlnode_type::TEXT, token);
+        case xltoken_type::BOOL:
+          return node(xlnode_type::BOOL, token);
+        case xltoken_type::ERROR_CODE:
+          return node(xlnode_type::ERROR_CODE, token);
+        case xltoken_type::STRUCTURED_REF:
+          return node(xlnode_type::STRUCTURED_REF, token);
+        case xltoken_type::DDE:
+          return node(xlnode_type::DDE, token);
+        case xltoken_type::SHEET:
+          return qualified(token);
+        case xltoken_type::FUNCTION:
+          return function(token);
+        case xltoken_type::PAREN_OPEN: {
+          int out = node(xlnode_type::PARENS, token);
+          adopt(out, expression(0));
+          if (!at(xltoken_type::PAREN_CLOSE)) {
+            throw std::runtime_error("unclosed parenthesis");
+          }
+          close(out, tokens_[pos_++]);
+          return out;
+        }
+        case xltoken_type::OPEN_ARRAY:
+          return array(token);
+        default:
+          throw std::runtime_error("unexpected token");
+      }
+    }
+
+    // Widen a node to its closing parenthesis or brace
+    void close(int parent, const xltoken_span& token) {
+      xlnode& p = nodes_[parent];
+      p.length_ = token.offset_ + token.length_ - p.offset_;
+    }
+
+    // A sheet and the ref, name or error that follows it, as one node
+    int qualified(const xltoken_span& sheet) {
+      xlnode_type type;
+      if (at(xltoken_type::REF)) {
+        type = xlnode_type::REF;
+      } else if (at(xltoken_type::NAME)) {
+        type = xlnode_type::NAME;
+      } else if (at(xltoken_type::ERROR_CODE)) {
+        type = xlnode_type::ERROR_CODE;
+      } else {
+        throw std::runtime_error("sheet without a reference");
+      }
+      const xltoken_span& token = tokens_[pos_++];
+      return node(type, sheet.offset_,
+                  token.offset_ + token.length_ - sheet.offset_);
+    }
+
+    int function(const xltoken_span& name) {
+      int out = node(xlnode_type::FUNCTION, name);
+      ++pos_; // the opening parenthesis
+      if (at(xltoken_type::FUN_CLOSE)) {
+        close(out, tokens_[pos_++]);
+        return out;
+      }
+      while (true) {
+        if (at(xltoken_type::SEPARATOR) || at(xltoken_type::FUN_CLOSE)) {
+          size_t offset = tokens_[pos_].offset_;
+          adopt(out, node(xlnode_type::MISSING, offset, 0));
+        } else {
+          adopt(out, expression(0));
+        }
+        if (at(xltoken_type::FUN_CLOSE)) {
+          close(out, tokens_[pos_++]);
+          return out;
+        }
+        if (!at(xltoken_type::SEPARATOR)) {
+          throw std::runtime_error("unclosed function");
+        }
+        ++pos_;
+      }
+    }
+
+    // Arrays like {1,2;3,4}, as rows of elements
+    int array(const xltoken_span& open) {
+      int out = node(xlnode_type::ARRAY, open);
+      if (pos_ >= tokens_.size()) {
+        throw std::runtime_error("unclosed array");
+      }
+      int row = node(xlnode_type::ARRAY_ROW, tokens_[pos_].offset_, 0);
+      nodes_[row].token_length_ = 0;
+      while (true) {
+        adopt(row, expression(0));
+        if (at(xltoken_type::CLOSE_ARRAY)) {
+          adopt(out, row);
+          close(out, tokens_[pos_++]);
+          return out;
+        }
+        if (!at(xltoken_type::SEPARATOR)) {
+          throw std::runtime_error("unclosed array");
+        }
+        if (formula_[tokens_[pos_].offset_] == ';') {
+          adopt(out, row);
+          row = node(xlnode_type::ARRAY_ROW, tokens_[pos_ + 1 < tokens_.size()
+                                                     ? pos_ + 1 : pos_].offset_, 0);
+          nodes_[row].token_length_ = 0;
+        }
+        ++pos_;
+      }
+    }
+};
+
+void parse_formula(const std::string& formula,
+                   const std::vector<xltoken_span>& tokens,
+                   std::vector<xlnode>& nodes) {
+  xlast_builder builder(formula, tokens);
+  int root;
+  try {
+    root = builder.parse();
+  } catch (std::exception& e) {
+    xlnode other = {xlnode_type::OTHER, -1, -1, -1, 0, formula.size(),
+                    0, formula.size()};
+    nodes.push_back(other);
+    return;
+  }
+
+  // Renumber the nodes in preorder, which puts the root first and each node
+  // before its children
+  const std::vector<xlnode>& built = builder.nodes_;
+  std::vector<int> order;        // preorder position -> built index
+  std::vector<int> position(built.size(), -1);
+  std::vector<int> stack(1, root);
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+    position[i] = order.size();
+    order.push_back(i);
+    // Push the children in reverse, so that the first is visited first
+    size_t before = stack.size();
+    for (int child = built[i].first_child_; child != -1;
+         child = built[child].next_sibling_) {
+      stack.push_back(child);
+    }
+    std::reverse(stack.begin() + before, stack.end());
+  }
+  size_t base = nodes.size();
+  for (std::vector<int>::iterator i = order.begin(); i != order.end(); ++i) {
+    xlnode node = built[*i];
+    node.parent_ = node.parent_ == -1 ? -1 : base + position[node.parent_];
+    node.first_child_ =
+      node.first_child_ == -1 ? -1 : base + position[node.first_child_];
+    node.next_sibling_ =
+      node.next_sibling_ == -1 ? -1 : base + position[node.next_sibling_];
+    nodes.push_back(node);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef FORMULA_AST_
+#define FORMULA_AST_
+
+#include <string>
+#include <vector>
+#include "token_grammar.h"
+
+// Types of node of a formula's syntax tree.  The order is that of the levels of
+// the factor `type` returned by xlex_ast().
+enum class xlnode_type : unsigned char {
+  FUNCTION,        // children are the arguments
+  INFIX,           // an operator between two children, e.g. 1+2, A1:B2
+  PREFIX,          // e.g. -A1
+  POSTFIX,         // e.g. 50%
+  PARENS,          // e.g. (1+2), whose child is 1+2
+  ARRAY,           // children are rows
+  ARRAY_ROW,       // children are elements
+  MISSING,         // an omitted argument, e.g. IF(A1,,1)
+  REF,             // optionally with a sheet, e.g. Sheet1!A1
+  NAME,            // optionally with a sheet
+  NUMBER,
+  TEXT,
+  BOOL,
+  ERROR_CODE,      // not ERROR, which some versions of R define as a macro
+  STRUCTURED_REF,
+  DDE,
+  OTHER            // the whole of a formula that couldn't be parsed
+};
+
+const int XLNODE_TYPES = 17; // number of xlnode_types
+
+inline const char* xlnodeTypeName(xlnode_type type) {
+  static const char* names[XLNODE_TYPES] = {
+    "function", "infix", "prefix", "postfix", "parens", "array", "array_row",
+    "missing", "ref", "name", "number", "text", "bool", "error",
+    "structured_ref", "DDE", "other"
+  };
+  return names[static_cast<int>(type)];
+}
+
+// A node of a syntax tree, which is stored as an array of nodes in preorder,
+// so the root is first, and each node comes before its children.  Links are
+// indexes into the array, or -1.
+struct xlnode {
+  xlnode_type type_;
+  int parent_;
+  int first_child_;
+  int next_sibling_;
+  size_t offset_;         // span of the node and its children, in bytes
+  size_t length_;
+  size_t token_offset_;   // span of the node's own token, e.g. the name of a
+  size_t token_length_;   // function, or an operator
+};
+
+// Parse a tokenised formula into a syntax tree, appending to nodes.  Operators
+// have Excel's precedence, from the lowest: comparison, &, + and -, * and /,
+// ^, %, negation, and then the reference operators union, intersection and
+// range.  A formula that can't be parsed is a single node of type OTHER.
+// Doesn't touch R, so it can be called from any thread.
+void parse_formula(const std::string& formula,
+                   const std::vector<xltoken_span>& tokens,
+                   std::vector<xlnode>& nodes);
+
+#endif
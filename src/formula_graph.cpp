@@ -0,0 +1,342 @@
+#include <Rcpp.h>
+#include "depgraph.h"
+#include "evaluator.h"
+#include "ref.h"
+#include "utils.h"
+#include "tibble.h"
+
+using namespace Rcpp;
+
+// R bindings of depgraph.  The graph is held by an external pointer, so it is
+// built once and can be queried many times.
+
+// Strings as UTF-8, with NA as empty
+std::vector<std::string> utf8_strings(CharacterVector x) {
+  std::vector<std::string> out(x.size());
+  for (R_xlen_t i = 0; i < x.size(); ++i) {
+    if (x[i] != NA_STRING) {
+      out[i] = Rf_translateCharUTF8(x[i]);
+    }
+  }
+  return out;
+}
+
+// One-based indexes as zero-based, with NA as -1
+std::vector<int> zero_based(IntegerVector x) {
+  std::vector<int> out(x.size());
+  for (R_xlen_t i = 0; i < x.size(); ++i) {
+    out[i] = x[i] == NA_INTEGER ? -1 : x[i] - 1;
+  }
+  return out;
+}
+
+inline SEXP utf8_string(const std::string& x) {
+  return Rf_mkCharLenCE(x.data(), x.size(), CE_UTF8);
+}
+
+inline void as_tibble(List& out, R_xlen_t n) {
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, n);
+}
+
+// [[Rcpp::export]]
+XPtr<depgraph> formula_graph_(CharacterVector sheets,
+                              IntegerVector cell_sheets,
+                              IntegerVector rows,
+                              IntegerVector cols,
+                              CharacterVector formulas,
+                              CharacterVector name_names,
+                              IntegerVector name_sheets,
+                              CharacterVector name_formulas) {
+  depgraph* graph = new depgraph(utf8_strings(sheets),
+                                 zero_based(cell_sheets),
+                                 as<std::vector<int> >(rows),
+                                 as<std::vector<int> >(cols),
+                                 utf8_strings(formulas),
+                                 utf8_strings(name_names),
+                                 zero_based(name_sheets),
+                                 utf8_strings(name_formulas));
+  return XPtr<depgraph>(graph, true);
+}
+
+// Parse addresses like A1 into rows and columns, NA if they aren't addresses
+void parse_addresses(CharacterVector addresses,
+                     std::vector<int>& rows,
+                     std::vector<int>& cols) {
+  rows.assign(addresses.size(), NA_INTEGER);
+  cols.assign(addresses.size(), NA_INTEGER);
+  for (R_xlen_t i = 0; i < addresses.size(); ++i) {
+    if (addresses[i] == NA_STRING) {
+      continue;
+    }
+    std::string address(addresses[i]);
+    address.erase(std::remove(address.begin(), address.end(), '$'),
+                  address.end());
+    ref reference(address);
+    if (reference.row1_ > 0 && reference.col1_ > 0 && !reference.colon_) {
+      rows[i] = reference.row1_;
+      cols[i] = reference.col1_;
+    }
+  }
+}
+
+// [[Rcpp::export]]
+List formula_precedents_(XPtr<depgraph> graph,
+                         IntegerVector sheets,
+                         CharacterVector addresses) {
+  std::vector<int> rows, cols;
+  parse_addresses(addresses, rows, cols);
+  std::vector<int> query;
+  std::vector<cellrect> rects;
+  for (R_xlen_t i = 0; i < sheets.size(); ++i) {
+    if (sheets[i] == NA_INTEGER || rows[i] == NA_INTEGER) {
+      continue;
+    }
+    int cell = graph->findCell(sheets[i] - 1, rows[i], cols[i]);
+    if (cell < 0) {
+      continue;
+    }
+    size_t before = rects.size();
+    graph->precedents(cell, rects);
+    query.insert(query.end(), rects.size() - before, i + 1);
+  }
+
+  int n = rects.size();
+  CharacterVector sheet(n);
+  CharacterVector range(n);
+  IntegerVector first_row(n);
+  IntegerVector first_col(n);
+  IntegerVector last_row(n);
+  IntegerVector last_col(n);
+  CharacterVector name(n);
+  for (int i = 0; i < n; ++i) {
+    const cellrect& rect = rects[i];
+    SET_STRING_ELT(sheet, i, utf8_string(graph->sheets()[rect.sheet_]));
+    std::string text = asA1(rect.first_row_, rect.first_col_);
+    if (rect.last_row_ != rect.first_row_ || rect.last_col_ != rect.first_col_) {
+      text += ":" + asA1(rect.last_row_, rect.last_col_);
+    }
+    range[i] = text;
+    first_row[i] = rect.first_row_;
+    first_col[i] = rect.first_col_;
+    last_row[i] = rect.last_row_;
+    last_col[i] = rect.last_col_;
+    if (rect.name_ == -1) {
+      name[i] = NA_STRING;
+    } else {
+      SET_STRING_ELT(name, i, utf8_string(graph->names()[rect.name_]));
+    }
+  }
+
+  List out = List::create(
+      _["query"] = query,
+      _["sheet"] = sheet,
+      _["ref"] = range,
+      _["first_row"] = first_row,
+      _["first_col"] = first_col,
+      _["last_row"] = last_row,
+      _["last_col"] = last_col,
+      _["name"] = name);
+  as_tibble(out, n);
+  return out;
+}
+
+// [[Rcpp::export]]
+List formula_dependents_(XPtr<depgraph> graph,
+                         IntegerVector sheets,
+                         CharacterVector addresses,
+                         bool recursive) {
+  std::vector<int> rows, cols;
+  parse_addresses(addresses, rows, cols);
+  std::vector<int> query;
+  std::vector<int> cells;
+  for (R_xlen_t i = 0; i < sheets.size(); ++i) {
+    if (sheets[i] == NA_INTEGER || rows[i] == NA_INTEGER) {
+      continue;
+    }
+    size_t before = cells.size();
+    graph->dependents(sheets[i] - 1, rows[i], cols[i], recursive, cells);
+    query.insert(query.end(), cells.size() - before, i + 1);
+  }
+  for (std::vector<int>::iterator cell = cells.begin();
+       cell != cells.end();
+       ++cell) {
+    ++*cell; // one-based
+  }
+  List out = List::create(
+      _["query"] = query,
+      _["cell"] = cells);
+  as_tibble(out, cells.size());
+  return out;
+}
+
+// Number of edges of the graph, for testing that ranges aren't expanded
+// [[Rcpp::export]]
+double formula_graph_edges_(XPtr<depgraph> graph) {
+  return graph->edgeCount();
+}
+
+// [[Rcpp::export]]
+List formula_order_(XPtr<depgraph> graph) {
+  std::vector<int> order;
+  std::vector<int> cyclic;
+  graph->topologicalOrder(order, cyclic);
+  int n = order.size() + cyclic.size();
+  IntegerVector cell(n);
+  LogicalVector is_cyclic(n);
+  int i(0);
+  for (std::vector<int>::iterator it = order.begin(); it != order.end(); ++it, ++i) {
+    cell[i] = *it + 1;
+    is_cyclic[i] = false;
+  }
+  for (std::vector<int>::iterator it = cyclic.begin(); it != cyclic.end(); ++it, ++i) {
+    cell[i] = *it + 1;
+    is_cyclic[i] = true;
+  }
+  List out = List::create(
+      _["cell"] = cell,
+      _["cyclic"] = is_cyclic);
+  as_tibble(out, n);
+  return out;
+}
+
+// Cached values, from the columns of xlsx_cells().  Numbers and dates are read
+// from the content, which holds dates as Excel's serial numbers.
+void cached_values(CharacterVector data_types,
+                   CharacterVector content,
+                   LogicalVector logical,
+                   CharacterVector character,
+                   CharacterVector error,
+                   std::vector<xlvalue_type>& types,
+                   std::vector<double>& numbers,
+                   std::vector<std::string>& texts) {
+  R_xlen_t n = data_types.size();
+  types.assign(n, xlvalue_type::BLANK);
+  numbers.assign(n, 0);
+  texts.assign(n, std::string());
+  for (R_xlen_t i = 0; i < n; ++i) {
+    if (data_types[i] == NA_STRING) {
+      continue;
+    }
+    std::string data_type(data_types[i]);
+    if ((data_type == "numeric" || data_type == "date")
+        && content[i] != NA_STRING) {
+      types[i] = xlvalue_type::NUMBER;
+      numbers[i] = strtod(content[i], NULL);
+    } else if (data_type == "character" && character[i] != NA_STRING) {
+      types[i] = xlvalue_type::TEXT;
+      texts[i] = Rf_translateCharUTF8(character[i]);
+    } else if (data_type == "date (ISO8601)" && content[i] != NA_STRING) {
+      types[i] = xlvalue_type::TEXT;
+      texts[i] = Rf_translateCharUTF8(content[i]);
+    } else if (data_type == "logical" && logical[i] != NA_LOGICAL) {
+      types[i] = xlvalue_type::BOOL;
+      numbers[i] = logical[i];
+    } else if (data_type == "error" && error[i] != NA_STRING) {
+      types[i] = xlvalue_type::ERROR_CODE;
+      texts[i] = Rf_translateCharUTF8(error[i]);
+    }
+  }
+}
+
+// Whether a computed value is the cached one, or NA if there is no cached value
+int same_value(const xlvalue& computed, const xlvalue& cached, double tolerance) {
+  if (cached.type_ == xlvalue_type::BLANK) {
+    return NA_LOGICAL;
+  }
+  if (computed.type_ != cached.type_) {
+    return false;
+  }
+  switch (computed.type_) {
+    case xlvalue_type::NUMBER:
+      return std::fabs(computed.number_ - cached.number_)
+        <= tolerance * std::max(1.0, std::fabs(cached.number_));
+    case xlvalue_type::BOOL:
+      return computed.number_ == cached.number_;
+    default:
+      return computed.text_ == cached.text_;
+  }
+}
+
+// [[Rcpp::export]]
+List formula_evaluate_(XPtr<depgraph> graph,
+                       CharacterVector formulas,
+                       LogicalVector is_array,
+                       CharacterVector data_types,
+                       CharacterVector content,
+                       LogicalVector logical,
+                       CharacterVector character,
+                       CharacterVector error,
+                       double tolerance) {
+  std::vector<xlvalue_type> types;
+  std::vector<double> numbers;
+  std::vector<std::string> texts;
+  cached_values(data_types, content, logical, character, error,
+                types, numbers, texts);
+  cellstore store(*graph, types, numbers, texts);
+  std::vector<bool> arrays(is_array.size());
+  for (R_xlen_t i = 0; i < is_array.size(); ++i) {
+    arrays[i] = is_array[i] == TRUE;
+  }
+  std::vector<xlresult> results;
+  evaluate_formulas(store, utf8_strings(formulas), arrays, results);
+
+  int n = results.size();
+  IntegerVector cell(n);
+  CharacterVector status(n);
+  CharacterVector out_type(n);
+  CharacterVector out_error(n, NA_STRING);
+  LogicalVector out_logical(n, NA_LOGICAL);
+  NumericVector out_numeric(n, NA_REAL);
+  CharacterVector out_character(n, NA_STRING);
+  LogicalVector matches(n, NA_LOGICAL);
+  for (int i = 0; i < n; ++i) {
+    const xlresult& result = results[i];
+    const xlvalue& value = result.value_;
+    cell[i] = result.cell_ + 1;
+    if (result.status_ != xlresult_status::EVALUATED) {
+      status[i] = result.status_ == xlresult_status::CYCLIC
+        ? "cyclic" : "unsupported";
+      out_type[i] = NA_STRING;
+      continue;
+    }
+    status[i] = "evaluated";
+    switch (value.type_) {
+      case xlvalue_type::NUMBER:
+        out_type[i] = "numeric";
+        out_numeric[i] = value.number_;
+        break;
+      case xlvalue_type::TEXT:
+        out_type[i] = "character";
+        SET_STRING_ELT(out_character, i, utf8_string(value.text_));
+        break;
+      case xlvalue_type::BOOL:
+        out_type[i] = "logical";
+        out_logical[i] = value.number_ != 0;
+        break;
+      case xlvalue_type::ERROR_CODE:
+        out_type[i] = "error";
+        out_error[i] = value.text_;
+        break;
+      default:
+        out_type[i] = "blank";
+    }
+    matches[i] = same_value(value,
+                            xlvalue(types[result.cell_],
+                                    numbers[result.cell_],
+                                    texts[result.cell_]),
+                            tolerance);
+  }
+
+  List out = List::create(
+      _["cell"] = cell,
+      _["status"] = status,
+      _["data_type"] = out_type,
+      _["error"] = out_error,
+      _["logical"] = out_logical,
+      _["numeric"] = out_numeric,
+      _["character"] = out_character,
+      _["matches"] = matches);
+  as_tibble(out, n);
+  return out;
+}
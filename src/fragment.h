@@ -0,0 +1,159 @@
+#ifndef FRAGMENT_
+#define FRAGMENT_
+
+#include <cstring>
+#include <string>
+
+// Locate small sheet-level elements, such as <mergeCells>, <dataValidations>
+// and <extLst>, in the raw xml of a worksheet, without parsing the rest of it,
+// and particularly not <sheetData>, which is almost all of it.  In ECMA's
+// schema, these elements come after <sheetData>, so they are searched for in
+// sheetTail(), and the bytes of <sheetData> itself are never scanned.
+//
+// A fragment can be copied with str() and parsed with rapidxml on its own.
+
+struct fragment {
+  const char* begin_;
+  size_t size_;
+  fragment(): begin_(NULL), size_(0) {}
+  fragment(const char* begin, size_t size): begin_(begin), size_(size) {}
+  bool empty() const { return size_ == 0; }
+  const char* end() const { return begin_ + size_; }
+  std::string str() const { return std::string(begin_, size_); }
+};
+
+inline bool isNameEnd(char c) {
+  return c == ' ' || c == '/' || c == '>' || c == '\t' || c == '\r'
+    || c == '\n';
+}
+
+// Whether the tag beginning at p (just after '<' or '</') has the given local
+// name, with or without a namespace prefix.  Sets qname_size to the length of
+// the qualified name.
+inline bool matchesName(const char* p, const char* end, const char* name,
+                        size_t& qname_size) {
+  const char* q = p;
+  const char* local = p;
+  while (q < end && !isNameEnd(*q)) {
+    if (*q == ':') local = q + 1;
+    ++q;
+  }
+  qname_size = q - p;
+  size_t n = strlen(name);
+  return (size_t) (q - local) == n && memcmp(local, name, n) == 0;
+}
+
+// The end of the tag containing p, skipping quoted attribute values, i.e. a
+// pointer to its '>', or end.
+inline const char* tagEnd(const char* p, const char* end) {
+  char quote = 0;
+  for (; p < end; ++p) {
+    if (quote) {
+      if (*p == quote) quote = 0;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (*p == '>') {
+      return p;
+    }
+  }
+  return end;
+}
+
+// The start of the first start tag called name in [begin, end), or end
+inline const char* findStartTag(const char* begin, const char* end,
+                                const char* name) {
+  const char* p = begin;
+  size_t qname_size;
+  while ((p = (const char*) memchr(p, '<', end - p)) != NULL) {
+    if (p + 1 < end && matchesName(p + 1, end, name, qname_size)) {
+      return p;
+    }
+    ++p;
+  }
+  return end;
+}
+
+// The first element called name in [begin, end), including its start and end
+// tags, or an empty fragment if there isn't one.
+inline fragment findElement(const char* begin, const char* end,
+                            const char* name) {
+  const char* start = findStartTag(begin, end, name);
+  if (start == end) {
+    return fragment();
+  }
+  size_t qname_size;
+  matchesName(start + 1, end, name, qname_size);
+  std::string qname(start + 1, qname_size);
+  const char* close = tagEnd(start + 1 + qname_size, end);
+  if (close == end) {
+    return fragment(); // # nocov
+  }
+  if (*(close - 1) == '/') { // self-closing
+    return fragment(start, close + 1 - start);
+  }
+  // Find the matching end tag, allowing for nested elements of the same name
+  int depth = 1;
+  const char* p = close + 1;
+  while ((p = (const char*) memchr(p, '<', end - p)) != NULL) {
+    bool closing = p + 1 < end && p[1] == '/';
+    const char* q = p + 1 + closing;
+    if (q + qname_size < end
+        && memcmp(q, qname.data(), qname_size) == 0
+        && isNameEnd(q[qname_size])) {
+      const char* e = tagEnd(q + qname_size, end);
+      if (e == end) {
+        break; // # nocov
+      }
+      if (closing) {
+        if (--depth == 0) {
+          return fragment(start, e + 1 - start);
+        }
+      } else if (*(e - 1) != '/') {
+        ++depth;
+      }
+      p = e;
+    }
+    ++p;
+  }
+  return fragment(); // # nocov
+}
+
+inline fragment findElement(const fragment& within, const char* name) {
+  return findElement(within.begin_, within.end(), name);
+}
+
+// The part of a worksheet after </sheetData> (or <sheetData/>), searching
+// backwards from the end, or the whole sheet if there isn't a <sheetData>
+inline fragment sheetTail(const std::string& xml) {
+  size_t pos = xml.size();
+  while (pos > 0 && (pos = xml.rfind("sheetData", pos - 1)) != std::string::npos) {
+    size_t start = pos;
+    while (start > 0 && xml[start - 1] != '<' && xml[start - 1] != '/'
+           && !isNameEnd(xml[start - 1])) {
+      --start; // over a namespace prefix
+    }
+    if (start != pos && xml[pos - 1] != ':') {
+      continue;
+    }
+    if (pos + 9 >= xml.size() || !isNameEnd(xml[pos + 9])) {
+      continue;
+    }
+    bool closing = start >= 2 && xml[start - 1] == '/' && xml[start - 2] == '<';
+    bool opening = start >= 1 && xml[start - 1] == '<';
+    if (!closing && !opening) {
+      continue;
+    }
+    const char* end = xml.data() + xml.size();
+    const char* e = tagEnd(xml.data() + pos + 9, end);
+    if (e == end) {
+      break; // # nocov
+    }
+    if (opening && *(e - 1) != '/') {
+      break; // an unclosed <sheetData>, so no tail # nocov
+    }
+    return fragment(e + 1, end - (e + 1));
+  }
+  return fragment(xml.data(), xml.size());
+}
+
+#endif
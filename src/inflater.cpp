@@ -0,0 +1,64 @@
+#include <system_error>
+#include "inflater.h"
+
+inflater::inflater(): archive_(NULL), buffers_(NULL), cancelled_(false) {}
+
+inflater::~inflater() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cancelled_ = true;
+    }
+    thread_.join();
+  }
+}
+
+void inflater::start(const ziparchive& archive,
+                     const std::vector<const zipentry*>& entries,
+                     std::vector<std::string>& buffers) {
+  archive_ = &archive;
+  buffers_ = &buffers;
+  states_.assign(entries.size(), entry_state::PENDING);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i] == NULL) {
+      states_[i] = entry_state::READY;
+    }
+  }
+  try {
+    thread_ = std::thread(&inflater::run, this, entries);
+  } catch (const std::system_error&) { // no threads, so inflate them all now
+    run(entries);
+  }
+}
+
+void inflater::run(std::vector<const zipentry*> entries) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i] == NULL) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cancelled_) return;
+    }
+    std::string& buffer = (*buffers_)[i];
+    bool ok = true;
+    try { // std::bad_alloc mustn't escape the thread
+      buffer.resize(entries[i]->uncompressed_size_ + 1);
+      ok = archive_->inflate(*entries[i], &buffer[0]);
+      buffer[buffer.size() - 1] = '\0';
+    } catch (...) {
+      ok = false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      states_[i] = ok ? entry_state::READY : entry_state::FAILED;
+    }
+    ready_.notify_all();
+  }
+}
+
+char* inflater::wait(size_t i) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_.wait(lock, [&]{ return states_[i] != entry_state::PENDING; });
+  return states_[i] == entry_state::READY ? &(*buffers_)[i][0] : NULL;
+}
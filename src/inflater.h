@@ -0,0 +1,50 @@
+#ifndef INFLATER_
+#define INFLATER_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "zip.h"
+
+// Inflates entries of an archive in order on a background thread, so that each
+// can be parsed as soon as it is ready, while the next ones are inflated.
+// Doesn't touch R.
+class inflater {
+
+  public:
+
+    inflater();
+    ~inflater(); // abandons any entries not yet inflated
+
+    // Inflate each of entries that isn't NULL into the buffer of the same
+    // index.  The archive and the buffers must outlive the inflater, and the
+    // buffers mustn't be touched until they have been waited for.
+    void start(const ziparchive& archive,
+               const std::vector<const zipentry*>& entries,
+               std::vector<std::string>& buffers);
+
+    // Block until entry i has been inflated, and return its buffer, or NULL if
+    // it couldn't be inflated.
+    char* wait(size_t i);
+
+  private:
+
+    enum class entry_state {PENDING, READY, FAILED};
+
+    const ziparchive* archive_;
+    std::vector<std::string>* buffers_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::vector<entry_state> states_;
+    bool cancelled_;
+
+    inflater(const inflater&) = delete;
+    inflater& operator=(const inflater&) = delete;
+
+    void run(std::vector<const zipentry*> entries);
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MERGEDRANGE_
+#define MERGEDRANGE_
+
+#include <string>
+
+// How xlsx_cells() returns cells in merged ranges
+enum class merge_mode : unsigned char {
+  NONE,    // as any other cell
+  ANCHOR,  // tagged with the address of the top-left cell of the range
+  FILL     // tagged, and given the value of the top-left cell
+};
+
+// A range of merged cells, which displays the value of its top-left cell, the
+// anchor
+struct mergedrange {
+  std::string ref_;
+  int first_row_;
+  int first_col_;
+  int last_row_;
+  int last_col_;
+};
+
+#endif
@@ -0,0 +1,1116 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "numfmt.h"
+#include "date.h"
+
+static const char* month_names[] = {
+  "January", "February", "March", "April", "May", "June", "July", "August",
+  "September", "October", "November", "December"};
+
+static const char* day_names[] = {
+  "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday",
+  "Saturday"};
+
+numfmt_section::numfmt_section():
+  has_condition_(false),
+  condition_value_(0),
+  scale_(1),
+  thousands_(false),
+  subsecond_digits_(0),
+  is_date_(false),
+  is_elapsed_(false),
+  is_text_(false),
+  is_general_(false),
+  has_ampm_(false) {
+    for (int i = 0; i < 5; ++i) {
+      digits_[i] = 0;
+    }
+  }
+
+// Append a literal to the section, merging it with a preceding literal
+static void addLiteral(numfmt_section& section, const char* text, int n) {
+  if (n <= 0) {
+    return;
+  }
+  std::vector<numfmt_token>& tokens = section.tokens_;
+  if (!tokens.empty()
+      && tokens.back().op_ == numfmt_op::LITERAL
+      && tokens.back().pos_ + tokens.back().len_
+         == (int) section.literals_.size()) {
+    tokens.back().len_ += n;
+  } else {
+    tokens.push_back(numfmt_token(numfmt_op::LITERAL, 0,
+                                  section.literals_.size(), n));
+  }
+  section.literals_.append(text, n);
+}
+
+static bool isPlaceholder(char c) {
+  return c == '0' || c == '#' || c == '?';
+}
+
+// Number of consecutive occurrences of the letter at x[i], in either case
+static int runLength(const std::string& x, size_t i) {
+  char c = x[i] | 0x20;
+  size_t j = i;
+  while (j < x.size() && (x[j] | 0x20) == c) {
+    ++j;
+  }
+  return j - i;
+}
+
+static bool matchesCaseless(const std::string& x, size_t i, const char* word) {
+  size_t n = strlen(word);
+  if (i + n > x.size()) {
+    return false;
+  }
+  for (size_t j = 0; j < n; ++j) {
+    if ((x[i + j] | 0x20) != (word[j] | 0x20)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void numfmt::compileSection(const std::string& x, numfmt_section& section) {
+  std::vector<numfmt_token>& tokens = section.tokens_;
+  int group = INTEGER_GROUP;
+  bool decimal = false;
+  size_t i = 0;
+  while (i < x.size()) {
+    char c = x[i];
+    switch (c) {
+      case '"': { // quoted literal
+        size_t end = x.find('"', i + 1);
+        if (end == std::string::npos) {
+          end = x.size();
+        }
+        addLiteral(section, x.data() + i + 1, end - i - 1);
+        i = end + 1;
+        break;
+      }
+      case '\\': // escaped literal
+        if (i + 1 < x.size()) {
+          addLiteral(section, x.data() + i + 1, 1);
+        }
+        i += 2;
+        break;
+      case '_': // space the width of the next character
+        addLiteral(section, " ", 1);
+        i += 2;
+        break;
+      case '*': // repeat the next character to fill the cell, so ignore it
+        i += 2;
+        break;
+      case '[': {
+        size_t end = x.find(']', i + 1);
+        if (end == std::string::npos) {
+          end = x.size();
+        }
+        std::string inside = x.substr(i + 1, end - i - 1);
+        i = end + 1;
+        if (inside.empty()) {
+          break;
+        }
+        char first = inside[0] | 0x20;
+        if ((first == 'h' || first == 'm' || first == 's')
+            && (int) inside.size() == runLength(inside, 0)) {
+          numfmt_op op = first == 'h'
+            ? numfmt_op::ELAPSED_HOURS
+            : (first == 'm' ? numfmt_op::ELAPSED_MINUTES
+                            : numfmt_op::ELAPSED_SECONDS);
+          tokens.push_back(numfmt_token(op, inside.size()));
+          section.is_date_ = true;
+          section.is_elapsed_ = true;
+        } else if (inside[0] == '$') { // currency and/or locale, [$€-407]
+          size_t dash = inside.find('-');
+          if (dash == std::string::npos) {
+            dash = inside.size();
+          }
+          addLiteral(section, inside.data() + 1, dash - 1);
+        } else if (inside[0] == '<' || inside[0] == '>' || inside[0] == '=') {
+          size_t j = 1;
+          while (j < inside.size()
+                 && (inside[j] == '<' || inside[j] == '>' || inside[j] == '=')) {
+            ++j;
+          }
+          section.has_condition_ = true;
+          section.condition_op_ = inside.substr(0, j);
+          section.condition_value_ = strtod(inside.c_str() + j, NULL);
+        }
+        // Otherwise a colour like [Red] or [Color10], or something like
+        // [DBNum1] that doesn't affect the text.
+        break;
+      }
+      case '0': case '#': case '?':
+        tokens.push_back(numfmt_token(numfmt_op::DIGIT, c, 0, group));
+        ++section.digits_[group];
+        ++i;
+        break;
+      case '.':
+        if (!tokens.empty() && tokens.back().op_ == numfmt_op::SECOND) {
+          // subseconds, e.g. ss.000
+          int n = 0;
+          ++i;
+          while (i < x.size() && x[i] == '0') {
+            ++n;
+            ++i;
+          }
+          if (n > 3) {
+            n = 3;
+          }
+          tokens.push_back(numfmt_token(numfmt_op::SUBSECOND, n));
+          section.subsecond_digits_ = n;
+        } else if (!decimal && group == INTEGER_GROUP) {
+          tokens.push_back(numfmt_token(numfmt_op::DECIMAL));
+          decimal = true;
+          group = FRACTION_GROUP;
+          ++i;
+        } else {
+          addLiteral(section, ".", 1);
+          ++i;
+        }
+        break;
+      case ',': {
+        bool after = !tokens.empty() && tokens.back().op_ == numfmt_op::DIGIT;
+        bool before = i + 1 < x.size() && isPlaceholder(x[i + 1]);
+        if (after && before) {
+          section.thousands_ = true;
+        } else if (after) { // trailing commas scale by a thousand each
+          section.scale_ /= 1000;
+        } else {
+          addLiteral(section, ",", 1);
+        }
+        ++i;
+        break;
+      }
+      case '%':
+        tokens.push_back(numfmt_token(numfmt_op::PERCENT));
+        section.scale_ *= 100;
+        ++i;
+        break;
+      case 'E': case 'e':
+        if (i + 1 < x.size() && (x[i + 1] == '+' || x[i + 1] == '-')) {
+          tokens.push_back(numfmt_token(numfmt_op::EXPONENT, x[i + 1] == '+'));
+          group = EXPONENT_GROUP;
+          i += 2;
+        } else {
+          addLiteral(section, x.data() + i, 1);
+          ++i;
+        }
+        break;
+      case '/':
+        if (!tokens.empty()
+            && tokens.back().op_ == numfmt_op::DIGIT
+            && i + 1 < x.size()
+            && (isPlaceholder(x[i + 1]) || (x[i + 1] >= '1' && x[i + 1] <= '9'))) {
+          // The placeholders immediately before the slash are the numerator
+          for (std::vector<numfmt_token>::reverse_iterator it = tokens.rbegin();
+               it != tokens.rend() && it->op_ == numfmt_op::DIGIT;
+               ++it) {
+            --section.digits_[it->len_];
+            it->len_ = NUMERATOR_GROUP;
+            ++section.digits_[NUMERATOR_GROUP];
+          }
+          tokens.push_back(numfmt_token(numfmt_op::FRACTION));
+          ++i;
+          if (x[i] >= '1' && x[i] <= '9') {
+            int denominator = 0;
+            while (i < x.size() && x[i] >= '0' && x[i] <= '9') {
+              denominator = 10 * denominator + (x[i] - '0');
+              ++i;
+            }
+            tokens.push_back(numfmt_token(numfmt_op::DENOMINATOR, denominator));
+          } else {
+            group = DENOMINATOR_GROUP;
+          }
+        } else {
+          addLiteral(section, "/", 1);
+          ++i;
+        }
+        break;
+      case 'Y': case 'y': {
+        int n = runLength(x, i);
+        tokens.push_back(numfmt_token(numfmt_op::YEAR, n <= 2 ? 2 : 4));
+        section.is_date_ = true;
+        i += n;
+        break;
+      }
+      case 'M': case 'm': {
+        int n = runLength(x, i);
+        tokens.push_back(numfmt_token(numfmt_op::MONTH, n > 5 ? 5 : n));
+        section.is_date_ = true;
+        i += n;
+        break;
+      }
+      case 'D': case 'd': {
+        int n = runLength(x, i);
+        tokens.push_back(numfmt_token(numfmt_op::DAY, n > 4 ? 4 : n));
+        section.is_date_ = true;
+        i += n;
+        break;
+      }
+      case 'H': case 'h': {
+        int n = runLength(x, i);
+        tokens.push_back(numfmt_token(numfmt_op::HOUR, n > 2 ? 2 : n));
+        section.is_date_ = true;
+        i += n;
+        break;
+      }
+      case 'S': case 's': {
+        int n = runLength(x, i);
+        tokens.push_back(numfmt_token(numfmt_op::SECOND, n > 2 ? 2 : n));
+        section.is_date_ = true;
+        i += n;
+        break;
+      }
+      case 'A': case 'a':
+        if (matchesCaseless(x, i, "AM/PM")) {
+          tokens.push_back(numfmt_token(numfmt_op::AMPM, c == 'a'));
+          section.has_ampm_ = true;
+          i += 5;
+        } else if (matchesCaseless(x, i, "A/P")) {
+          tokens.push_back(numfmt_token(numfmt_op::AMPM, 2 + (c == 'a')));
+          section.has_ampm_ = true;
+          i += 3;
+        } else {
+          addLiteral(section, x.data() + i, 1);
+          ++i;
+        }
+        break;
+      case 'G': case 'g':
+        if (matchesCaseless(x, i, "General")) {
+          tokens.push_back(numfmt_token(numfmt_op::GENERAL));
+          section.is_general_ = true;
+          i += 7;
+        } else {
+          addLiteral(section, x.data() + i, 1);
+          ++i;
+        }
+        break;
+      case 'B': case 'b': // calendar, B1 or B2
+        if (i + 1 < x.size() && (x[i + 1] == '1' || x[i + 1] == '2')) {
+          i += 2;
+        } else {
+          addLiteral(section, x.data() + i, 1);
+          ++i;
+        }
+        break;
+      case '@':
+        tokens.push_back(numfmt_token(numfmt_op::TEXT));
+        section.is_text_ = true;
+        ++i;
+        break;
+      default:
+        addLiteral(section, x.data() + i, 1);
+        ++i;
+    }
+  }
+  resolveMinutes(section);
+}
+
+// 'm' and 'mm' mean minutes rather than months when they follow an hour or
+// precede a second, ignoring literals in between.
+void numfmt::resolveMinutes(numfmt_section& section) {
+  std::vector<numfmt_token>& tokens = section.tokens_;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i].op_ != numfmt_op::MONTH || tokens[i].arg_ > 2) {
+      continue;
+    }
+    bool minute = false;
+    for (size_t j = i; j-- > 0;) {
+      numfmt_op op = tokens[j].op_;
+      if (op == numfmt_op::LITERAL) {
+        continue;
+      }
+      minute = op == numfmt_op::HOUR || op == numfmt_op::ELAPSED_HOURS;
+      break;
+    }
+    for (size_t j = i + 1; !minute && j < tokens.size(); ++j) {
+      numfmt_op op = tokens[j].op_;
+      if (op == numfmt_op::LITERAL) {
+        continue;
+      }
+      minute = op == numfmt_op::SECOND || op == numfmt_op::ELAPSED_SECONDS;
+      break;
+    }
+    if (minute) {
+      tokens[i].op_ = numfmt_op::MINUTE;
+    }
+  }
+}
+
+numfmt::numfmt(): kind_(numfmt_kind::NUMBER), text_section_(-1) {
+  sections_.push_back(numfmt_section());
+  sections_.back().tokens_.push_back(numfmt_token(numfmt_op::GENERAL));
+  sections_.back().is_general_ = true;
+}
+
+numfmt::numfmt(const std::string& code): text_section_(-1) {
+  // Split into sections at semicolons that aren't quoted, escaped or
+  // bracketed.
+  size_t begin = 0;
+  bool quoted = false;
+  bool bracketed = false;
+  for (size_t i = 0; i <= code.size(); ++i) {
+    if (i == code.size() || (code[i] == ';' && !quoted && !bracketed)) {
+      sections_.push_back(numfmt_section());
+      compileSection(code.substr(begin, i - begin), sections_.back());
+      begin = i + 1;
+      if (sections_.size() == 4) {
+        break;
+      }
+      continue;
+    }
+    char c = code[i];
+    if (quoted) {
+      quoted = c != '"';
+    } else if (bracketed) {
+      bracketed = c != ']';
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == '[') {
+      bracketed = true;
+    } else if (c == '\\' || c == '_' || c == '*') {
+      ++i;
+    }
+  }
+  if (sections_.size() == 4) {
+    text_section_ = 3;
+  } else {
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      if (sections_[i].is_text_) {
+        text_section_ = i;
+      }
+    }
+  }
+
+  // Classify by the sections that format numbers
+  bool is_date = false;
+  bool is_elapsed = false;
+  bool is_number = false;
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    const numfmt_section& section = sections_[i];
+    if ((int) i == text_section_ && section.is_text_) {
+      continue;
+    }
+    if (section.is_date_) {
+      is_date = true;
+      is_elapsed = is_elapsed || section.is_elapsed_;
+    } else {
+      is_number = true;
+    }
+  }
+  if (is_date) {
+    kind_ = is_elapsed ? numfmt_kind::DURATION : numfmt_kind::DATE;
+  } else if (is_number || text_section_ < 0) {
+    kind_ = numfmt_kind::NUMBER;
+  } else {
+    kind_ = numfmt_kind::TEXT;
+  }
+}
+
+numfmt_kind numfmt::kind() const {
+  return kind_;
+}
+
+bool numfmt::isDate() const {
+  return kind_ == numfmt_kind::DATE || kind_ == numfmt_kind::DURATION;
+}
+
+static bool testCondition(const numfmt_section& section, double value) {
+  const std::string& op = section.condition_op_;
+  double x = section.condition_value_;
+  if (op == "<")  return value < x;
+  if (op == "<=" || op == "=<") return value <= x;
+  if (op == ">")  return value > x;
+  if (op == ">=" || op == "=>") return value >= x;
+  if (op == "<>") return value != x;
+  return value == x;
+}
+
+// Choose the section for a number.  Sets negative if the sign must be
+// written, because the section doesn't imply it.
+const numfmt_section* numfmt::chooseSection(double& value,
+                                            bool& negative) const {
+  // Sections that aren't only for text
+  size_t n = sections_.size();
+  if (text_section_ == (int) n - 1 && sections_[n - 1].is_text_ && n > 1) {
+    --n;
+  }
+  negative = false;
+  if (sections_[0].has_condition_
+      || (n > 1 && sections_[1].has_condition_)) {
+    const numfmt_section* chosen;
+    if (sections_[0].has_condition_ && testCondition(sections_[0], value)) {
+      chosen = &sections_[0];
+    } else if (n > 1 && sections_[1].has_condition_
+               && testCondition(sections_[1], value)) {
+      chosen = &sections_[1];
+    } else if (n > 2) {
+      chosen = &sections_[2];
+    } else if (n > 1 && !sections_[1].has_condition_) {
+      chosen = &sections_[1];
+    } else {
+      chosen = &sections_[0];
+    }
+    if (value < 0) {
+      negative = !(chosen != &sections_[0] && chosen->has_condition_
+                   && chosen->condition_op_[0] == '<'
+                   && chosen->condition_value_ <= 0);
+      value = -value;
+    }
+    return chosen;
+  }
+  if (value > 0 || n == 1 || (value == 0 && n == 2)) {
+    if (value < 0) {
+      negative = true;
+      value = -value;
+    }
+    return &sections_[0];
+  }
+  if (value < 0) {
+    value = -value;
+    return &sections_[1];
+  }
+  return &sections_[2];
+}
+
+// Digits of a value to a given number of decimal places, rounded half away
+// from zero on its (up to) 15 significant decimal digits, as Excel does, rather
+// than on its binary representation, as printf() does.
+static void decimalDigits(double value, int decimals, std::string& integer,
+                          std::string& fraction) {
+  integer.clear();
+  fraction.clear();
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.14e", value);
+  std::string digits;
+  digits.reserve(16);
+  char* p = buffer;
+  for (; *p != 'e'; ++p) {
+    if (*p >= '0' && *p <= '9') {
+      digits.push_back(*p);
+    }
+  }
+  int point = atoi(p + 1) + 1; // number of digits before the decimal point
+  if (value == 0) {
+    point = 1;
+  }
+  int keep = point + decimals;
+  if (keep < 0) {
+    digits.clear();
+    point = 0;
+  } else if (keep < (int) digits.size()) {
+    bool up = digits[keep] >= '5';
+    digits.resize(keep);
+    int j = keep - 1;
+    while (up && j >= 0) {
+      if (digits[j] == '9') {
+        digits[j] = '0';
+        --j;
+      } else {
+        ++digits[j];
+        up = false;
+      }
+    }
+    if (up) {
+      digits.insert(digits.begin(), '1');
+      ++point;
+    }
+  }
+  // Integer digits, without leading zeros
+  for (int j = 0; j < point; ++j) {
+    char d = j < (int) digits.size() ? digits[j] : '0';
+    if (!(integer.empty() && d == '0')) {
+      integer.push_back(d);
+    }
+  }
+  for (int j = point; j < point + decimals; ++j) {
+    fraction.push_back(j >= 0 && j < (int) digits.size() ? digits[j] : '0');
+  }
+}
+
+static void trimZeros(char* buffer) {
+  char* point = strchr(buffer, '.');
+  if (point == NULL) {
+    return;
+  }
+  char* end = point + strlen(point) - 1;
+  while (end > point && *end == '0') {
+    *end-- = '\0';
+  }
+  if (end == point) {
+    *end = '\0';
+  }
+}
+
+// Excel's "General" format, of up to eleven characters besides any sign
+static void formatGeneral(double value, std::string& out) {
+  if (value == 0) {
+    out.push_back('0');
+    return;
+  }
+  char buffer[40];
+  double magnitude = std::fabs(value);
+  if (magnitude >= 1e11 || magnitude < 1e-9) {
+    snprintf(buffer, sizeof(buffer), "%.5E", value);
+    char* e = strchr(buffer, 'E');
+    std::string exponent(e);
+    *e = '\0';
+    trimZeros(buffer);
+    out.append(buffer);
+    out.append(exponent);
+    return;
+  }
+  int integer_digits = magnitude < 1 ? 1 : (int) std::floor(std::log10(magnitude)) + 1;
+  int decimals = 10 - integer_digits;
+  if (decimals < 0) {
+    decimals = 0;
+  }
+  std::string integer;
+  std::string fraction;
+  decimalDigits(magnitude, decimals, integer, fraction);
+  if (value < 0) {
+    out.push_back('-');
+  }
+  out.append(integer.empty() ? "0" : integer);
+  size_t n = fraction.find_last_not_of('0');
+  if (n != std::string::npos) {
+    out.push_back('.');
+    out.append(fraction, 0, n + 1);
+  }
+}
+
+// Best rational approximation with a denominator no greater than limit, by
+// continued fractions (as Python's fractions.Fraction.limit_denominator)
+// x zero-padded to at least width digits.  The width of elapsed time, e.g.
+// [hhhh], is as many letters as the format has, so isn't bounded by a buffer.
+static void appendDigits(long long x, int width, std::string& out) {
+  if (x < 0) {
+    out.push_back('-');
+    x = -x;
+  }
+  std::string digits = std::to_string(x);
+  if ((int) digits.size() < width) {
+    out.append(width - digits.size(), '0');
+  }
+  out.append(digits);
+}
+
+static void approximate(double x, long long limit, long long& numerator,
+                        long long& denominator) {
+  long long p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+  double remainder = x;
+  for (int i = 0; i < 64; ++i) {
+    long long a = (long long) std::floor(remainder);
+    long long q2 = q0 + a * q1;
+    if (q2 > limit) {
+      break;
+    }
+    long long p2 = p0 + a * p1;
+    p0 = p1; q0 = q1; p1 = p2; q1 = q2;
+    double f = remainder - a;
+    if (f < 1e-12) {
+      break;
+    }
+    remainder = 1 / f;
+  }
+  // Compare the last convergent with the best semiconvergent within the limit
+  long long k = q1 == 0 ? 0 : (limit - q0) / q1;
+  long long ps = p0 + k * p1;
+  long long qs = q0 + k * q1;
+  if (q1 == 0
+      || (qs > 0 && std::fabs(x - (double) ps / qs) < std::fabs(x - (double) p1 / q1))) {
+    numerator = ps;
+    denominator = qs;
+  } else {
+    numerator = p1;
+    denominator = q1;
+  }
+}
+
+// Fill the placeholders of a group, right-aligned, the leftmost taking any
+// surplus digits.  Returns one string per placeholder.
+static void fillRight(const std::vector<char>& placeholders,
+                      const std::string& digits,
+                      std::vector<std::string>& cells) {
+  size_t n = placeholders.size();
+  cells.assign(n, std::string());
+  int k = digits.size() - 1;
+  for (size_t t = n; t-- > 0;) {
+    if (k >= 0) {
+      cells[t].push_back(digits[k--]);
+    } else if (placeholders[t] == '0') {
+      cells[t].push_back('0');
+    } else if (placeholders[t] == '?') {
+      cells[t].push_back(' ');
+    }
+  }
+  if (n > 0 && k >= 0) {
+    cells[0].insert(0, digits, 0, k + 1);
+  }
+}
+
+void numfmt::formatNumber(const numfmt_section& section, double value,
+                          bool negative, std::string& out) const {
+  const std::vector<numfmt_token>& tokens = section.tokens_;
+  const int* digits = section.digits_;
+
+  if (negative) {
+    out.push_back('-');
+  }
+
+  bool any_digits = false;
+  for (int g = 0; g < 5; ++g) {
+    any_digits = any_digits || digits[g] > 0;
+  }
+
+  double scaled = value * section.scale_;
+
+  // Placeholders of each group, in order
+  std::vector<char> placeholders[5];
+  bool has_exponent = false;
+  bool has_fraction = false;
+  int fixed_denominator = 0;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i].op_ == numfmt_op::DIGIT) {
+      placeholders[tokens[i].len_].push_back(tokens[i].arg_);
+    } else if (tokens[i].op_ == numfmt_op::EXPONENT) {
+      has_exponent = true;
+    } else if (tokens[i].op_ == numfmt_op::FRACTION) {
+      has_fraction = true;
+    } else if (tokens[i].op_ == numfmt_op::DENOMINATOR) {
+      fixed_denominator = tokens[i].arg_;
+    }
+  }
+
+  std::vector<std::string> cells[5];
+  std::string integer;
+  std::string fraction;
+  std::string exponent;
+  bool exponent_negative = false;
+
+  if (has_fraction) {
+    double whole = 0;
+    double part = scaled;
+    if (digits[INTEGER_GROUP] > 0) {
+      whole = std::floor(scaled);
+      part = scaled - whole;
+    }
+    long long numerator;
+    long long denominator;
+    if (fixed_denominator > 0) {
+      denominator = fixed_denominator;
+      numerator = (long long) std::floor(part * denominator + 0.5);
+    } else {
+      long long limit = 1;
+      for (int j = 0; j < digits[DENOMINATOR_GROUP]; ++j) {
+        limit *= 10;
+      }
+      approximate(part, limit - 1, numerator, denominator);
+    }
+    if (numerator == denominator && digits[INTEGER_GROUP] > 0) {
+      whole += 1;
+      numerator = 0;
+    }
+    char buffer[32];
+    bool blank = numerator == 0 && digits[INTEGER_GROUP] > 0;
+    if (whole > 0 || blank) {
+      snprintf(buffer, sizeof(buffer), "%.0f", whole);
+      integer = buffer;
+    }
+    fillRight(placeholders[INTEGER_GROUP], integer, cells[INTEGER_GROUP]);
+    if (blank) {
+      // Blank the fraction entirely, e.g. "3    " for "# ?/?"
+      cells[NUMERATOR_GROUP].assign(placeholders[NUMERATOR_GROUP].size(), " ");
+      cells[DENOMINATOR_GROUP].assign(placeholders[DENOMINATOR_GROUP].size(), " ");
+      numerator = -1;
+    } else {
+      snprintf(buffer, sizeof(buffer), "%lld", numerator);
+      fillRight(placeholders[NUMERATOR_GROUP], buffer, cells[NUMERATOR_GROUP]);
+      snprintf(buffer, sizeof(buffer), "%lld", denominator);
+      std::string d(buffer);
+      // Denominators are left-aligned, padded to the right
+      const std::vector<char>& ph = placeholders[DENOMINATOR_GROUP];
+      cells[DENOMINATOR_GROUP].assign(ph.size(), std::string());
+      for (size_t t = 0; t < ph.size(); ++t) {
+        if (t < d.size()) {
+          cells[DENOMINATOR_GROUP][t].push_back(d[t]);
+        } else if (ph[t] != '#') {
+          cells[DENOMINATOR_GROUP][t].push_back(ph[t] == '0' ? '0' : ' ');
+        }
+      }
+      if (!ph.empty() && d.size() > ph.size()) {
+        cells[DENOMINATOR_GROUP].back().append(d, ph.size(), std::string::npos);
+      }
+    }
+    std::vector<size_t> next(5, 0); // next placeholder of each group
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      const numfmt_token& token = tokens[i];
+      switch (token.op_) {
+        case numfmt_op::LITERAL:
+          out.append(section.literals_, token.pos_, token.len_);
+          break;
+        case numfmt_op::DIGIT: {
+          int g = token.len_;
+          if (next[g] < cells[g].size()) {
+            out.append(cells[g][next[g]]);
+          }
+          ++next[g];
+          break;
+        }
+        case numfmt_op::FRACTION:
+          out.push_back(numerator < 0 ? ' ' : '/');
+          break;
+        case numfmt_op::DENOMINATOR:
+          if (numerator < 0) {
+            out.append(std::to_string(token.arg_).size(), ' ');
+          } else {
+            out.append(std::to_string(token.arg_));
+          }
+          break;
+        case numfmt_op::PERCENT:
+          out.push_back('%');
+          break;
+        case numfmt_op::GENERAL:
+          formatGeneral(scaled, out);
+          break;
+        default:
+          break;
+      }
+    }
+    return;
+  }
+
+  if (has_exponent) {
+    int e = 0;
+    if (scaled != 0) {
+      e = (int) std::floor(std::log10(scaled));
+      int n = digits[INTEGER_GROUP];
+      if (n > 1 && placeholders[INTEGER_GROUP][0] == '#') {
+        // Engineering notation, e.g. ##0.0E+0 has exponents in multiples of 3
+        e = e >= 0 ? (e / n) * n : -(((-e + n - 1) / n) * n);
+      } else if (n > 1) {
+        e -= n - 1;
+      }
+    }
+    double mantissa = scaled / std::pow(10.0, e);
+    decimalDigits(mantissa, digits[FRACTION_GROUP], integer, fraction);
+    if (integer.size() > (size_t) (digits[INTEGER_GROUP] > 0 ? digits[INTEGER_GROUP] : 1)
+        && placeholders[INTEGER_GROUP].size() <= 1) {
+      // Rounding overflowed the mantissa, e.g. 9.99 to 10.0
+      ++e;
+      decimalDigits(scaled / std::pow(10.0, e), digits[FRACTION_GROUP],
+                    integer, fraction);
+    }
+    exponent_negative = e < 0;
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%d", e < 0 ? -e : e);
+    exponent = buffer;
+    int width = digits[EXPONENT_GROUP];
+    if ((int) exponent.size() < width) {
+      exponent.insert(0, width - exponent.size(), '0');
+    }
+  } else {
+    decimalDigits(scaled, digits[FRACTION_GROUP], integer, fraction);
+  }
+
+  // Integer part
+  if (section.thousands_) {
+    // The whole integer, with separators, goes to the first placeholder
+    int minimum = 0;
+    bool counting = false;
+    for (size_t t = 0; t < placeholders[INTEGER_GROUP].size(); ++t) {
+      counting = counting || placeholders[INTEGER_GROUP][t] == '0';
+      minimum += counting;
+    }
+    std::string padded(integer);
+    if ((int) padded.size() < minimum) {
+      padded.insert(0, minimum - padded.size(), '0');
+    }
+    std::string separated;
+    for (size_t j = 0; j < padded.size(); ++j) {
+      if (j > 0 && (padded.size() - j) % 3 == 0) {
+        separated.push_back(',');
+      }
+      separated.push_back(padded[j]);
+    }
+    cells[INTEGER_GROUP].assign(placeholders[INTEGER_GROUP].size(), std::string());
+    if (!cells[INTEGER_GROUP].empty()) {
+      cells[INTEGER_GROUP][0] = separated;
+    }
+  } else {
+    fillRight(placeholders[INTEGER_GROUP], integer, cells[INTEGER_GROUP]);
+  }
+
+  // Fractional part, with trailing zeros dropped or blanked for '#' and '?'
+  const std::vector<char>& ph = placeholders[FRACTION_GROUP];
+  cells[FRACTION_GROUP].assign(ph.size(), std::string());
+  bool trailing = true;
+  for (size_t t = ph.size(); t-- > 0;) {
+    char d = t < fraction.size() ? fraction[t] : '0';
+    if (trailing && d == '0' && ph[t] != '0') {
+      if (ph[t] == '?') {
+        cells[FRACTION_GROUP][t].push_back(' ');
+      }
+    } else {
+      trailing = false;
+      cells[FRACTION_GROUP][t].push_back(d);
+    }
+  }
+
+  std::vector<size_t> next(5, 0); // next placeholder of each group
+  bool exponent_written = false;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const numfmt_token& token = tokens[i];
+    switch (token.op_) {
+      case numfmt_op::LITERAL:
+        out.append(section.literals_, token.pos_, token.len_);
+        break;
+      case numfmt_op::DIGIT: {
+        int g = token.len_;
+        if (g == EXPONENT_GROUP) {
+          if (!exponent_written) {
+            out.append(exponent);
+            exponent_written = true;
+          }
+        } else if (next[g] < cells[g].size()) {
+          out.append(cells[g][next[g]]);
+        }
+        ++next[g];
+        break;
+      }
+      case numfmt_op::DECIMAL:
+        out.push_back('.');
+        break;
+      case numfmt_op::PERCENT:
+        out.push_back('%');
+        break;
+      case numfmt_op::EXPONENT:
+        out.push_back('E');
+        if (exponent_negative) {
+          out.push_back('-');
+        } else if (token.arg_) {
+          out.push_back('+');
+        }
+        break;
+      case numfmt_op::GENERAL:
+        if (!any_digits) {
+          formatGeneral(scaled, out);
+        }
+        break;
+      case numfmt_op::TEXT:
+        formatGeneral(scaled, out);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+bool numfmt::formatDateTime(const numfmt_section& section, double value,
+                            const int dateSystem, std::string& out) const {
+  if (value < 0 || value >= 2958466) { // after 9999-12-31
+    return false;
+  }
+  // Round to the precision that is displayed
+  long long unit = 1;
+  for (int i = 0; i < section.subsecond_digits_; ++i) {
+    unit *= 10;
+  }
+  long long per_day = 86400 * unit;
+  long long total = (long long) std::floor(value * per_day + 0.5);
+  long long serial = total / per_day;
+  long long rest = total % per_day;
+  long long subsecond = rest % unit;
+  long long second_of_day = rest / unit;
+  long long hour = second_of_day / 3600;
+  long long minute = (second_of_day / 60) % 60;
+  long long second = second_of_day % 60;
+
+  // Excel's calendar, including the 29th of February 1900
+  long long year;
+  int month;
+  int day;
+  int weekday;
+  if (dateSystem == 1904) {
+    civilFromDays(serial - 24107, year, month, day);
+    weekday = (serial + 5) % 7;
+  } else {
+    if (serial == 60) {
+      year = 1900;
+      month = 2;
+      day = 29;
+    } else if (serial == 0) { // displayed as 1900-01-00
+      year = 1900;
+      month = 1;
+      day = 0;
+    } else {
+      civilFromDays(serial - (serial < 60 ? 25568 : 25569), year, month, day);
+    }
+    weekday = (serial + 6) % 7;
+  }
+
+  char buffer[32];
+  const std::vector<numfmt_token>& tokens = section.tokens_;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const numfmt_token& token = tokens[i];
+    switch (token.op_) {
+      case numfmt_op::LITERAL:
+        out.append(section.literals_, token.pos_, token.len_);
+        break;
+      case numfmt_op::YEAR:
+        if (token.arg_ == 2) {
+          snprintf(buffer, sizeof(buffer), "%02lld", year % 100);
+        } else {
+          snprintf(buffer, sizeof(buffer), "%04lld", year);
+        }
+        out.append(buffer);
+        break;
+      case numfmt_op::MONTH:
+        switch (token.arg_) {
+          case 1: out.append(std::to_string(month)); break;
+          case 2: snprintf(buffer, sizeof(buffer), "%02d", month);
+                  out.append(buffer);
+                  break;
+          case 3: out.append(month_names[month - 1], 3); break;
+          case 4: out.append(month_names[month - 1]); break;
+          default: out.push_back(month_names[month - 1][0]);
+        }
+        break;
+      case numfmt_op::DAY:
+        switch (token.arg_) {
+          case 1: out.append(std::to_string(day)); break;
+          case 2: snprintf(buffer, sizeof(buffer), "%02d", day);
+                  out.append(buffer);
+                  break;
+          case 3: out.append(day_names[weekday], 3); break;
+          default: out.append(day_names[weekday]);
+        }
+        break;
+      case numfmt_op::HOUR: {
+        long long h = hour;
+        if (section.has_ampm_) {
+          h = h % 12 == 0 ? 12 : h % 12;
+        }
+        snprintf(buffer, sizeof(buffer), token.arg_ == 2 ? "%02lld" : "%lld", h);
+        out.append(buffer);
+        break;
+      }
+      case numfmt_op::MINUTE:
+        snprintf(buffer, sizeof(buffer), token.arg_ == 2 ? "%02lld" : "%lld", minute);
+        out.append(buffer);
+        break;
+      case numfmt_op::SECOND:
+        snprintf(buffer, sizeof(buffer), token.arg_ == 2 ? "%02lld" : "%lld", second);
+        out.append(buffer);
+        break;
+      case numfmt_op::SUBSECOND:
+        if (token.arg_ > 0) {
+          out.push_back('.');
+          appendDigits(subsecond, token.arg_, out);
+        } else {
+          out.push_back('.');
+        }
+        break;
+      case numfmt_op::AMPM: {
+        bool pm = hour >= 12;
+        switch (token.arg_) {
+          case 0: out.append(pm ? "PM" : "AM"); break;
+          case 1: out.append(pm ? "pm" : "am"); break;
+          case 2: out.push_back(pm ? 'P' : 'A'); break;
+          default: out.push_back(pm ? 'p' : 'a');
+        }
+        break;
+      }
+      case numfmt_op::ELAPSED_HOURS:
+        appendDigits(serial * 24 + hour, token.arg_, out);
+        break;
+      case numfmt_op::ELAPSED_MINUTES:
+        appendDigits((serial * 24 + hour) * 60 + minute, token.arg_, out);
+        break;
+      case numfmt_op::ELAPSED_SECONDS:
+        appendDigits(serial * 86400 + second_of_day, token.arg_, out);
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+bool numfmt::format(double value, const int dateSystem,
+                    std::string& out) const {
+  bool negative;
+  const numfmt_section* section = chooseSection(value, negative);
+  if (section->is_date_) {
+    return formatDateTime(*section, negative ? -value : value, dateSystem, out);
+  }
+  formatNumber(*section, value, negative, out);
+  return true;
+}
+
+void numfmt::formatText(const char* value, std::string& out) const {
+  if (text_section_ < 0) {
+    out.append(value);
+    return;
+  }
+  const numfmt_section& section = sections_[text_section_];
+  for (size_t i = 0; i < section.tokens_.size(); ++i) {
+    const numfmt_token& token = section.tokens_[i];
+    if (token.op_ == numfmt_op::LITERAL) {
+      out.append(section.literals_, token.pos_, token.len_);
+    } else if (token.op_ == numfmt_op::TEXT) {
+      out.append(value);
+    }
+  }
+}
+
+std::string builtinNumFmt(int id) {
+  switch (id) {
+    case 1:  return "0";
+    case 2:  return "0.00";
+    case 3:  return "#,##0";
+    case 4:  return "#,##0.00";
+    case 5:  return "$#,##0_);($#,##0)";
+    case 6:  return "$#,##0_);[Red]($#,##0)";
+    case 7:  return "$#,##0.00_);($#,##0.00)";
+    case 8:  return "$#,##0.00_);[Red]($#,##0.00)";
+    case 9:  return "0%";
+    case 10: return "0.00%";
+    case 11: return "0.00E+00";
+    case 12: return "# ?/?";
+    case 13: return "# ?\?/??";
+    case 14: return "mm-dd-yy";
+    case 15: return "d-mmm-yy";
+    case 16: return "d-mmm";
+    case 17: return "mmm-yy";
+    case 18: return "h:mm AM/PM";
+    case 19: return "h:mm:ss AM/PM";
+    case 20: return "h:mm";
+    case 21: return "h:mm:ss";
+    case 22: return "m/d/yy h:mm";
+    case 37: return "#,##0 ;(#,##0)";
+    case 38: return "#,##0 ;[Red](#,##0)";
+    case 39: return "#,##0.00;(#,##0.00)";
+    case 40: return "#,##0.00;[Red](#,##0.00)";
+    case 45: return "mm:ss";
+    case 46: return "[h]:mm:ss";
+    case 47: return "mmss.0";
+    case 48: return "##0.0E+0";
+    case 49: return "@";
+    default: return "General";
+  }
+}
+
+const char* numfmtKindName(numfmt_kind kind) {
+  switch (kind) {
+    case numfmt_kind::DATE:     return "date";
+    case numfmt_kind::DURATION: return "duration";
+    case numfmt_kind::TEXT:     return "text";
+    default:                    return "number";
+  }
+}
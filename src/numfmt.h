@@ -0,0 +1,116 @@
+#ifndef NUMFMT_
+#define NUMFMT_
+
+#include <string>
+#include <vector>
+
+// Number formats, ECMA Part 1 page 1767 (actual page 1777) section 18.8.30
+// "numFmt (Number Format)" and 18.8.31 "numFmts (Number Formats)".
+//
+// A formatCode is compiled once into a small program of tokens for each of its
+// (up to four) sections, which can then be run against any number of values
+// to render the text that Excel would display.  Compiling also classifies the
+// format as a number, date, duration or text format.  Nothing here calls R, so
+// it can be used from any thread.
+
+enum class numfmt_kind {NUMBER, DATE, DURATION, TEXT};
+
+enum class numfmt_op : unsigned char {
+  LITERAL,         // text from the literal pool, at pos_ for len_ bytes
+  DIGIT,           // digit placeholder '0', '#' or '?' (arg_) in group len_
+  DECIMAL,         // decimal point
+  PERCENT,         // percent sign (the value is scaled when compiled)
+  EXPONENT,        // 'E', with an explicit '+' sign if arg_ is 1
+  FRACTION,        // the '/' between numerator and denominator
+  DENOMINATOR,     // a fixed denominator, arg_
+  GENERAL,         // "General"
+  TEXT,            // '@'
+  YEAR,            // yy (arg_ 2) or yyyy (arg_ 4)
+  MONTH,           // m, mm, mmm, mmmm, mmmmm (arg_ 1 to 5)
+  DAY,             // d, dd, ddd, dddd (arg_ 1 to 4)
+  HOUR,            // h, hh (arg_ 1 or 2)
+  MINUTE,          // m, mm after an hour or before a second (arg_ 1 or 2)
+  SECOND,          // s, ss (arg_ 1 or 2)
+  SUBSECOND,       // .0, .00, .000 after seconds (arg_ digits)
+  AMPM,            // AM/PM, am/pm, A/P, a/p (arg_ 0, 1, 2, 3)
+  ELAPSED_HOURS,   // [h] (arg_ width)
+  ELAPSED_MINUTES, // [m] (arg_ width)
+  ELAPSED_SECONDS  // [s] (arg_ width)
+};
+
+// Groups of digit placeholders, stored in numfmt_token::len_
+enum numfmt_group {
+  INTEGER_GROUP,
+  FRACTION_GROUP,
+  EXPONENT_GROUP,
+  NUMERATOR_GROUP,
+  DENOMINATOR_GROUP
+};
+
+struct numfmt_token {
+  numfmt_op op_;
+  int arg_;
+  int pos_;
+  int len_;
+  numfmt_token(numfmt_op op, int arg = 0, int pos = 0, int len = 0):
+    op_(op), arg_(arg), pos_(pos), len_(len) {}
+};
+
+struct numfmt_section {
+  std::vector<numfmt_token> tokens_;
+  std::string literals_;        // pool of literal text referred to by tokens_
+
+  bool has_condition_;          // e.g. [<100]
+  std::string condition_op_;    // "<", "<=", "=", "<>", ">=", ">"
+  double condition_value_;
+
+  double scale_;                // by percent signs and trailing commas
+  bool thousands_;              // comma between digit placeholders
+  int digits_[5];               // number of placeholders in each numfmt_group
+  int subsecond_digits_;
+  bool is_date_;                // has a date or time token
+  bool is_elapsed_;             // has an elapsed time token
+  bool is_text_;                // has '@'
+  bool is_general_;             // has "General"
+  bool has_ampm_;
+
+  numfmt_section();
+};
+
+class numfmt {
+
+  std::vector<numfmt_section> sections_;
+  numfmt_kind kind_;
+  int text_section_; // index of the section that formats text, or -1
+
+  void compileSection(const std::string& code, numfmt_section& section);
+  void resolveMinutes(numfmt_section& section);
+
+  const numfmt_section* chooseSection(double& value, bool& negative) const;
+  void formatNumber(const numfmt_section& section, double value,
+                    bool negative, std::string& out) const;
+  bool formatDateTime(const numfmt_section& section, double value,
+                      const int dateSystem, std::string& out) const;
+
+  public:
+
+    numfmt();                        // "General"
+    numfmt(const std::string& code); // compile a formatCode
+
+    numfmt_kind kind() const;
+    bool isDate() const;             // a date, time or duration format
+
+    // Render the text that Excel would display, appending it to out.  Returns
+    // false if Excel would display #### (e.g. a negative date).
+    bool format(double value, const int dateSystem, std::string& out) const;
+    void formatText(const char* value, std::string& out) const;
+};
+
+// Format codes of the built-in formats, ECMA Part 1 page 1767, and "General"
+// for any that aren't defined there.
+std::string builtinNumFmt(int id);
+
+// Name of a numfmt_kind
+const char* numfmtKindName(numfmt_kind kind);
+
+#endif
@@ -65,55 +65,94 @@ ref::ref(const std::string& text): text_(text) {
   }
 }
 
+// Append a column number as letters, e.g. 28 as AB, without building
+// temporary strings.  Columns below 1 are appended as nothing.
+static void appendColumn(std::string& out, int col) {
+  char buffer[8];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  while (col > 0) {
+    --col;
+    *--p = 'A' + col % 26;
+    col /= 26;
+  }
+  out.append(p, end - p);
+}
+
+// Append a row number, without std::to_string()
+static void appendRow(std::string& out, int row) {
+  char buffer[16];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  unsigned int x = row < 0 ? -(unsigned int) row : row;
+  do {
+    *--p = '0' + x % 10;
+    x /= 10;
+  } while (x > 0);
+  if (row < 0) {
+    *--p = '-';
+  }
+  out.append(p, end - p);
+}
+
 std::string ref::offset(int& rows, int& cols) const {
   std::string out;
+  offset(rows, cols, out);
+  return out;
+}
 
+void ref::offset(int rows, int cols, std::string& out) const {
   if (fixcol1_) {
-    out = out + '$';
-    if (col1_) out = out + int_to_alpha(col1_);
+    out.push_back('$');
+    if (col1_) appendColumn(out, col1_);
   } else {
-    if (col1_) out = out + int_to_alpha(col1_ + cols);
+    if (col1_) appendColumn(out, col1_ + cols);
   }
 
   if (fixrow1_) {
-    out = out + '$';
-    if (row1_) out = out + std::to_string(row1_);
+    out.push_back('$');
+    if (row1_) appendRow(out, row1_);
   } else {
-    if (row1_) out = out + std::to_string(row1_ + rows);
+    if (row1_) appendRow(out, row1_ + rows);
   }
 
-  if (colon_) out = out + ':';
+  if (colon_) out.push_back(':');
 
   if (fixcol2_) {
-    out = out + '$';
-    if (col2_) out = out + int_to_alpha(col2_);
+    out.push_back('$');
+    if (col2_) appendColumn(out, col2_);
   } else {
-    if (col2_) out = out + int_to_alpha(col2_ + cols);
+    if (col2_) appendColumn(out, col2_ + cols);
   }
 
   if (fixrow2_) {
-    out = out + '$';
-    if (row2_) out = out + std::to_string(row2_);
+    out.push_back('$');
+    if (row2_) appendRow(out, row2_);
   } else {
-    if (row2_) out = out + std::to_string(row2_ + rows);
+    if (row2_) appendRow(out, row2_ + rows);
   }
+}
 
-  return out;
+// Append one part of a reference in R1C1 notation: R or C, then the absolute
+// number, or the offset in brackets, omitted when it is zero
+static void appendR1C1(std::string& out, char axis, bool fixed, int x,
+                       int from) {
+  out.push_back(axis);
+  if (fixed) {
+    appendRow(out, x);
+  } else if (x != from) {
+    out.push_back('[');
+    appendRow(out, x - from);
+    out.push_back(']');
+  }
 }
 
-// Adapted from http://blog.bigsmoke.us/2010/12/08/cpp-base10-to-base26
-std::string ref::int_to_alpha(int i) const
-{
-    std::string out;
-    int dividend = i;
-    int modulo;
-
-    while (dividend > 0)
-    {
-        modulo = (dividend - 1) % 26;
-        out = (char)(65 + modulo) + out;
-        dividend = (int)((dividend - modulo) / 26);
-    }
+void ref::r1c1(int row, int col, std::string& out) const {
+  if (row1_) appendR1C1(out, 'R', fixrow1_, row1_, row);
+  if (col1_) appendR1C1(out, 'C', fixcol1_, col1_, col);
+
+  if (colon_) out.push_back(':');
 
-    return out;
+  if (row2_) appendR1C1(out, 'R', fixrow2_, row2_, row);
+  if (col2_) appendR1C1(out, 'C', fixcol2_, col2_, col);
 }
@@ -25,9 +25,11 @@ class ref
     ref(const std::string& text); // parse text into fix/row/col/colon variables
 
     virtual std::string offset(int& rows, int& cols) const; // return offsetted address
+    void offset(int rows, int cols, std::string& out) const; // append it to out
 
-  private:
-    std::string int_to_alpha(int i) const;
+    // Append in R1C1 notation, relative to the cell at row, col, e.g. A1 from
+    // B3 as R[-2]C[-1], and $A$1 as R1C1
+    void r1c1(int row, int col, std::string& out) const;
 };
 
 #endif
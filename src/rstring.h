@@ -0,0 +1,25 @@
+#ifndef TIDYXL_RSTRING_
+#define TIDYXL_RSTRING_
+
+#include <string>
+#include <vector>
+#include <Rcpp.h>
+
+// Strings that aren't known are empty in the parsers, which don't use R, and
+// NA in R
+inline Rcpp::String naIfEmpty(const std::string& x) {
+  return x.empty() ? Rcpp::String(NA_STRING) : Rcpp::String(x);
+}
+
+// And the other way, for paths etc. given from R
+inline std::vector<std::string> emptyIfNA(const Rcpp::CharacterVector& x) {
+  std::vector<std::string> out(x.size());
+  for (R_xlen_t i = 0; i < x.size(); ++i) {
+    if (STRING_ELT(x, i) != NA_STRING) {
+      out[i] = CHAR(STRING_ELT(x, i));
+    }
+  }
+  return out;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef TIDYXL_RZIPARCHIVE_
+#define TIDYXL_RZIPARCHIVE_
+
+#include <Rcpp.h>
+#include "zip.h"
+
+// A ziparchive of a workbook given from R, either as a path or as a raw vector,
+// which is borrowed rather than copied, and must outlive the archive.
+class rziparchive: public ziparchive {
+
+  public:
+
+    explicit rziparchive(SEXP path):
+      ziparchive(
+          TYPEOF(path) == RAWSXP ? std::string("<raw vector>")
+                                 : Rcpp::as<std::string>(path),
+          TYPEOF(path) == RAWSXP ? reinterpret_cast<const char*>(RAW(path))
+                                 : NULL,
+          TYPEOF(path) == RAWSXP ? XLENGTH(path) : 0) {}
+
+};
+
+#endif
@@ -1,4 +1,3 @@
-#include <Rcpp.h>
 #include "shared_formula.h"
 #include "ref_grammar.h"
 #include "ref.h"
@@ -7,36 +6,50 @@ shared_formula::shared_formula(
     std::string& text,
     int& row,
     int& col
-    ): text_(text), row_(row), col_(col) {
+    ): text_(text), row_(row), col_(col), size_(0) {
+  std::vector<token_type> types;
+  std::vector<std::string> tokens;
   memory_input<> in_mem(text_, "original-formula");
-  parse< xlref::root, xlref::tokenize >(in_mem, types_, tokens_, refs_);
-}
-
-std::string shared_formula::offset(int& row, int& col) const {
-  std::string out;
-
-  // Size of offset
-  int rows = row - row_;
-  int cols = col - col_;
+  parse< xlref::root, xlref::tokenize >(in_mem, types, tokens, refs_);
 
-  std::vector<std::string>::const_iterator i_token = tokens_.begin();
-  std::vector<ref>::const_iterator i_ref = refs_.begin();
-
-  for(std::vector<token_type>::const_iterator i_type = types_.begin();
-      i_type != types_.end(); ++i_type) {
+  // Concatenate runs of text between references, once
+  std::vector<std::string>::const_iterator i_token = tokens.begin();
+  literals_.push_back(std::string());
+  for(std::vector<token_type>::const_iterator i_type = types.begin();
+      i_type != types.end(); ++i_type) {
     switch (*i_type) {
       case token_type::REF:
-        out = out + (*i_ref).offset(rows, cols);
-        ++i_ref;
+        literals_.push_back(std::string());
         break;
 
       default:
-        out = out + *i_token;
+        literals_.back() += *i_token;
+        size_ += i_token->size();
         ++i_token;
         break;
     }
   }
+}
 
+std::string shared_formula::offset(int& row, int& col) const {
+  std::string out;
+  offset(row, col, out);
   return out;
 }
 
+void shared_formula::offset(int row, int col, std::string& out) const {
+  // Size of offset
+  int rows = row - row_;
+  int cols = col - col_;
+
+  out.clear();
+  out.reserve(size_ + 16 * refs_.size());
+
+  std::vector<std::string>::const_iterator i_literal = literals_.begin();
+  out += *i_literal;
+  for(std::vector<ref>::const_iterator i_ref = refs_.begin();
+      i_ref != refs_.end(); ++i_ref) {
+    i_ref->offset(rows, cols, out);
+    out += *++i_literal;
+  }
+}
@@ -1,7 +1,8 @@
 #ifndef SHARED_FORMULA_
 #define SHARED_FORMULA_
 
-#include <Rcpp.h>
+#include <string>
+#include <vector>
 #include "ref_grammar.h"
 #include "ref.h"
 
@@ -13,15 +14,23 @@ class shared_formula {
   int row_;
   int col_;
 
-  std::vector<token_type> types_;
-  std::vector<std::string> tokens_;
+  // The formula is pre-tokenised into references and the literal text around
+  // them, so that it is rendered as literals_[0] refs_[0] literals_[1] ...
+  // refs_[n - 1] literals_[n].
+  std::vector<std::string> literals_;
   std::vector<ref> refs_;
+  size_t size_; // total length of the literals, to reserve for output
 
   public:
 
     shared_formula(std::string& text, int& row, int& col);
 
     std::string offset(int& row, int& col) const; // return offsetted address
+
+    // Render the offsetted formula into out, replacing its contents but
+    // reusing its memory, so that many dependent formulas can be rendered
+    // without allocating.
+    void offset(int row, int col, std::string& out) const;
 };
 
 #endif
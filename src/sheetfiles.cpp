@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include "zip.h"
+#include "rapidxml.h"
+#include "sheetfiles.h"
+
+static std::string commentsPath(ziparchive& archive, std::string sheet_target) {
+  // Given a sheet id, return the path to the comments file, should one exist
+  std::string sheet_rels = "xl/worksheets/_rels/" + sheet_target.replace(0, 11, "") + ".rels";
+  if (archive.has_file(sheet_rels)) {
+    std::string targets_text = zip_buffer(archive, sheet_rels);
+    rapidxml::xml_document<> targets_xml;
+    targets_xml.parse<rapidxml::parse_strip_xml_namespaces>(&targets_text[0]);
+    rapidxml::xml_node<>* relationships = targets_xml.first_node("Relationships");
+    for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
+        relationship; relationship = relationship->next_sibling()) {
+      std::string target = relationship->first_attribute("Target")->value();
+      if (target.substr(0, 11) == "../comments") {
+        // Return the comments file path
+        return(target.replace(0, 2, "xl"));
+      }
+    }
+  }
+  return std::string();
+}
+
+sheetfiles::sheetfiles(ziparchive& archive) {
+  // primary key of two 'tables' of worksheets and other objects
+  // e.g. workbook.xml.rels Id="rId1" target = "worksheets/sheet1.xml"
+  std::string id;
+  std::vector<std::string> ids;
+
+  // Get the filenames of worksheets, indexed by rId, and the same of any
+  // comments files
+  std::map<std::string, std::string> sheet_paths;
+  std::map<std::string, std::string> comments_paths;
+  std::string rels_text = zip_buffer(archive, "xl/_rels/workbook.xml.rels");
+  rapidxml::xml_document<> rels_xml;
+  rels_xml.parse<rapidxml::parse_strip_xml_namespaces>(&rels_text[0]);
+  rapidxml::xml_node<>* relationships = rels_xml.first_node("Relationships");
+  for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
+      relationship; relationship = relationship->next_sibling()) {
+    std::string target = relationship->first_attribute("Target")->value();
+    if ((target.find("worksheet") != std::string::npos)
+        || (target.find("chartsheet") != std::string::npos))  {
+      // Only store worksheets and chartsheets -- requests for chartsheets are
+      // handled in the R wrapper
+      id = relationship->first_attribute("Id")->value();
+      ids.push_back(id);
+      sheet_paths.insert({id, target}) ;
+      comments_paths.insert({id, commentsPath(archive, target)});
+    }
+  }
+
+  // Get the name and sheetId (display order) of all sheets/charts/etc, indexed
+  // by rId
+  std::map<std::string, std::string> names;
+  std::map<std::string, int> sheetIds;
+  std::string workbook_text = zip_buffer(archive, "xl/workbook.xml");
+  rapidxml::xml_document<> workbook_xml;
+  workbook_xml.parse<rapidxml::parse_strip_xml_namespaces>(&workbook_text[0]);
+  rapidxml::xml_node<>* workbook = workbook_xml.first_node("workbook");
+  rapidxml::xml_node<>* sheets = workbook->first_node("sheets");
+  for (rapidxml::xml_node<>* sheet = sheets->first_node("sheet");
+      sheet; sheet = sheet->next_sibling()) {
+    rapidxml::xml_attribute<>* r_id = sheet->first_attribute("id");
+    if (r_id != NULL) {
+      id = r_id->value();
+    } else {
+      throw std::runtime_error("Invalid xl/workbook.xml: sheet element lacks id attribute"); // # nocov
+    }
+    names[id] = sheet->first_attribute("name")->value();
+    sheetIds[id] = strtol(sheet->first_attribute("sheetId")->value(), NULL, 10);
+  }
+
+  // Join by id
+  for(std::vector<std::string>::iterator it = ids.begin(); it != ids.end(); ++it) {
+    std::string key(*it);
+    name_.push_back(names[key]);
+    rId_.push_back(std::strtol(key.substr(3, std::string::npos).c_str(), NULL, 10));
+    sheetId_.push_back(sheetIds[key]);
+    sheet_path_.push_back(sheet_paths[key]);
+    comments_path_.push_back(comments_paths[key]);
+  }
+}
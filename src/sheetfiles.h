@@ -0,0 +1,28 @@
+#ifndef SHEETFILES_
+#define SHEETFILES_
+
+#include <string>
+#include <vector>
+#include "zip.h"
+
+// The worksheets and chartsheets of a workbook, from xl/_rels/workbook.xml.rels
+// joined to xl/workbook.xml, in the order of the relationships.  Paths are as
+// given in the relationships, and comments paths are empty where a sheet has
+// none.  The R wrapper utils_xlsx_sheet_files() standardises the paths, orders
+// the sheets and omits chartsheets.
+
+class sheetfiles {
+
+  public:
+
+    std::vector<std::string> name_;
+    std::vector<int> rId_;
+    std::vector<int> sheetId_;       // display order
+    std::vector<std::string> sheet_path_;
+    std::vector<std::string> comments_path_;
+
+    sheetfiles(ziparchive& archive);
+
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef TIDYXL_TIBBLE_
+#define TIDYXL_TIBBLE_
+
+#include <climits>
+#include <Rcpp.h>
+
+// Give a list of columns of n rows the row names of a data frame, in R's
+// compact form c(NA, -n), which stands for 1:n without storing it.  R only
+// recognises the compact form as integers, so no data frame can have more
+// than INT_MAX rows.
+inline void setCompactRowNames(Rcpp::List& out, R_xlen_t n) {
+  if (n > INT_MAX) {
+    Rcpp::stop("Too many rows for a data frame");
+  }
+  out.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -(int) n);
+}
+
+#endif
@@ -1,13 +1,22 @@
 // [[Rcpp::plugins("cpp11")]]
 
 #include <algorithm>
+#include <cstring>
 #include <Rcpp.h>
 #include "zip.h"
+#include "rziparchive.h"
 #include "xlsxnames.h"
 #include "xlsxvalidation.h"
 #include "xlsxbook.h"
+#include "cellcolumns.h"
+#include "rstring.h"
+#include "sheetfiles.h"
 #include "xlsxstyles.h"
+#include "xlsxtable.h"
 #include "date.h"
+#include "numfmt.h"
+#include "shared_formula.h"
+#include "tibble.h"
 
 using namespace Rcpp;
 
@@ -15,161 +24,190 @@ using namespace Rcpp;
 // instantiates the xlsxbook class, and then passes that by reference to one or
 // more xlsxsheet instances, iterating through them and returning a list of
 // 'sheets'.
+//
+// Each entry-point takes a workbook as either a path or a raw vector (which is
+// borrowed, not copied), opens it once as a ziparchive, and passes that down.
 
 // [[Rcpp::export]]
 List xlsx_cells_(
-    std::string path,
+    SEXP path,
     CharacterVector sheet_paths,
     CharacterVector sheet_names,
     CharacterVector comments_paths,
-    bool include_blank_cells
+    bool include_blank_cells,
+    bool formatted,
+    bool expand_shared_formulas,
+    std::string merged_cells
     ) {
-  xlsxbook book(path, sheet_paths, sheet_names, comments_paths,
-      include_blank_cells);
-  return book.information_;
+  merge_mode mode(merge_mode::NONE);
+  if (merged_cells == "anchor") {
+    mode = merge_mode::ANCHOR;
+  } else if (merged_cells == "fill") {
+    mode = merge_mode::FILL;
+  }
+  rziparchive archive(path);
+  cellcolumns columns(formatted, mode);
+  xlsxbook book(archive, emptyIfNA(sheet_paths), emptyIfNA(sheet_names),
+      emptyIfNA(comments_paths), columns, include_blank_cells,
+      expand_shared_formulas, mode);
+  return columns.information();
 }
 
 // [[Rcpp::export]]
-List xlsx_formats_(std::string path) {
-  xlsxstyles styles(path);
-  return List::create(
-    _["local"] = styles.local_,
-    _["style"] = styles.style_);
-}
-
-inline String comments_path_(std::string path, std::string sheet_target) {
-  // Given a sheet id, return the path to the comments file, should one exist
-  std::string sheet_rels = "xl/worksheets/_rels/" + sheet_target.replace(0, 11, "") + ".rels";
-  if (zip_has_file(path, sheet_rels)) {
-    std::string targets_text = zip_buffer(path, sheet_rels);
-    rapidxml::xml_document<> targets_xml;
-    targets_xml.parse<rapidxml::parse_strip_xml_namespaces>(&targets_text[0]);
-    rapidxml::xml_node<>* relationships = targets_xml.first_node("Relationships");
-    for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
-        relationship; relationship = relationship->next_sibling()) {
-      std::string target = relationship->first_attribute("Target")->value();
-      if (target.substr(0, 11) == "../comments") {
-        // Return the comments file path
-        return(target.replace(0, 2, "xl"));
-      }
-    }
+List xlsx_formats_(SEXP path, bool flat) {
+  rziparchive archive(path);
+  xlsxstyles styles(archive);
+  if (flat) {
+    return styles.flatFormats();
   }
-  return NA_STRING;
+  return List::create(
+    _["local"] = styles.zipFormats(styles.local_formats_, false),
+    _["style"] = styles.zipFormats(styles.style_formats_, true));
 }
 
 // [[Rcpp::export]]
-List xlsx_sheet_files_(std::string path) {
+List xlsx_sheet_files_(SEXP path) {
   // Return a list of worksheets,  their index numbers, names, and comments
   // paths.
-
-  // primary key of two 'tables' of worksheets and other objects
-  // e.g. workbook.xml.rels Id="rId1" target = "worksheets/sheet1.xml"
-  std::string id;
-  std::vector<std::string> ids;
-
-  // Get the filenames of worksheets, indexed by rId, and the same of any
-  // comments files
-  std::map<std::string, std::string> sheet_paths;
-  std::map<std::string, String> comments_paths;
-  std::string rels_text = zip_buffer(path, "xl/_rels/workbook.xml.rels");
-  rapidxml::xml_document<> rels_xml;
-  rels_xml.parse<rapidxml::parse_strip_xml_namespaces>(&rels_text[0]);
-  rapidxml::xml_node<>* relationships = rels_xml.first_node("Relationships");
-  for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
-      relationship; relationship = relationship->next_sibling()) {
-    std::string target = relationship->first_attribute("Target")->value();
-    if ((target.find("worksheet") != std::string::npos)
-        || (target.find("chartsheet") != std::string::npos))  {
-      // Only store worksheets and chartsheets -- requests for chartsheets are
-      // handled in the R wrapper
-      id = relationship->first_attribute("Id")->value();
-      ids.push_back(id);
-      sheet_paths.insert({id, target}) ;
-      comments_paths.insert({id, comments_path_(path, target)});
-    }
-  }
-
-  // Get the name and sheetId (display order) of all sheets/charts/etc, indexed
-  // by rId
-  std::map<std::string, std::string> names;
-  std::map<std::string, int> sheetIds;
-  std::string workbook_text = zip_buffer(path, "xl/workbook.xml");
-  rapidxml::xml_document<> workbook_xml;
-  workbook_xml.parse<rapidxml::parse_strip_xml_namespaces>(&workbook_text[0]);
-  rapidxml::xml_node<>* workbook = workbook_xml.first_node("workbook");
-  rapidxml::xml_node<>* sheets = workbook->first_node("sheets");
-  for (rapidxml::xml_node<>* sheet = sheets->first_node("sheet");
-      sheet; sheet = sheet->next_sibling()) {
-    rapidxml::xml_attribute<>* r_id = sheet->first_attribute("id");
-    if (r_id != NULL) {
-      id = r_id->value();
-    } else {
-      stop("Invalid xl/workbook.xml: sheet element lacks id attribute"); // # nocov
-    }
-    names[id] = sheet->first_attribute("name")->value();
-    sheetIds[id] = strtol(sheet->first_attribute("sheetId")->value(), NULL, 10);
-  }
-
-  // Join by id
-  std::vector<std::string> out_name;
-  std::vector<int> out_rId;
-  std::vector<int> out_sheetId;
-  std::vector<std::string> out_sheet_path;
-  CharacterVector out_comments_path;
-  for(std::vector<std::string>::iterator it = ids.begin(); it != ids.end(); ++it) {
-    std::string key(*it);
-    out_name.push_back(names[key]);
-    out_rId.push_back(std::strtol(key.substr(3, std::string::npos).c_str(), NULL, 10));
-    out_sheetId.push_back(sheetIds[key]);
-    out_sheet_path.push_back(sheet_paths[key]);
-    out_comments_path.push_back(comments_paths[key]);
+  rziparchive archive(path);
+  sheetfiles files(archive);
+  CharacterVector out_comments_path(files.comments_path_.size());
+  for (size_t i = 0; i < files.comments_path_.size(); ++i) {
+    out_comments_path[i] = naIfEmpty(files.comments_path_[i]);
   }
 
   // Return a data frame
   List out = List::create(
-      _["name"] = out_name,
-      _["rId"] = out_rId,
-      _["sheetId"] = out_sheetId,
-      _["sheet_path"] = out_sheet_path,
+      _["name"] = files.name_,
+      _["rId"] = files.rId_,
+      _["sheetId"] = files.sheetId_,
+      _["sheet_path"] = files.sheet_path_,
       _["comments_path"] = out_comments_path);
 
   // Turn list of vectors into a data frame without checking anything
   int n = Rf_length(out[0]);
   out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  setCompactRowNames(out, n);
 
   return out;
 }
 
 // [[Rcpp::export]]
 List xlsx_validation_(
-    std::string path,
+    SEXP path,
     CharacterVector sheet_paths,
     CharacterVector sheet_names
     ) {
-  return xlsxvalidation(path, sheet_paths, sheet_names).information();
+  rziparchive archive(path);
+  return xlsxvalidation(archive, sheet_paths, sheet_names).information();
+}
+
+// [[Rcpp::export]]
+List xlsx_names_(SEXP path) {
+  rziparchive archive(path);
+  return xlsxnames(archive).information();
 }
 
 // [[Rcpp::export]]
-List xlsx_names_(std::string path) {
-  return xlsxnames(path).information();
+List xlsx_table_(
+    SEXP path,
+    std::string sheet_path,
+    int skip,
+    bool col_names,
+    int guess_max
+    ) {
+  // Only the strings, styles and date system of the book, not its sheets
+  rziparchive archive(path);
+  xlsxbook book(archive);
+  return xlsxtable(book, sheet_path, skip, col_names, guess_max).information();
 }
 
 // [[Rcpp::export]]
 LogicalVector is_date_format_(CharacterVector formats) {
+  // Compile each distinct format only once, because the same few formats tend
+  // to be repeated many times.
+  std::map<std::string, bool> cache;
   CharacterVector::iterator it;
   std::vector<bool> out(formats.size());
   size_t i(0);
   for(it = formats.begin(); it != formats.end(); ++it) {
     std::string format(*it);
-    out[i] = isDateFormat(format);
+    std::map<std::string, bool>::iterator found = cache.find(format);
+    if (found == cache.end()) {
+      found = cache.insert({format, numfmt(format).isDate()}).first;
+    }
+    out[i] = found->second;
     ++i;
   }
   return wrap(out);
 }
 
 // [[Rcpp::export]]
-List xlsx_color_theme_(std::string path) {
+CharacterVector format_number_(NumericVector values, CharacterVector formats,
+                               int date_system) {
+  // Render numbers as Excel would display them in the given number formats,
+  // recycling the formats, which are compiled once each.
+  std::map<std::string, numfmt> cache;
+  R_xlen_t n = values.size();
+  R_xlen_t m = formats.size();
+  CharacterVector out(n, NA_STRING);
+  std::string text;
+  for (R_xlen_t i = 0; i < n && m > 0; ++i) {
+    if (ISNAN(values[i]) || STRING_ELT(formats, i % m) == NA_STRING) {
+      continue;
+    }
+    std::string format(CHAR(STRING_ELT(formats, i % m)));
+    std::map<std::string, numfmt>::iterator found = cache.find(format);
+    if (found == cache.end()) {
+      found = cache.insert({format, numfmt(format)}).first;
+    }
+    text.clear();
+    if (found->second.format(values[i], date_system, text)) {
+      SET_STRING_ELT(out, i, Rf_mkCharLenCE(text.data(), text.size(), CE_UTF8));
+    }
+  }
+  return out;
+}
+
+// [[Rcpp::export]]
+CharacterVector shared_formula_offset_(std::string formula, int row, int col,
+                                       IntegerVector rows, IntegerVector cols) {
+  // Offset a shared formula, defined at (row, col), to each of (rows, cols),
+  // reusing one buffer, as xlsxcell does for each cell of a shared formula.
+  shared_formula shared(formula, row, col);
+  R_xlen_t n = rows.size();
+  CharacterVector out(n);
+  std::string buffer;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    shared.offset(rows[i], cols[i], buffer);
+    SET_STRING_ELT(out, i,
+                   Rf_mkCharLenCE(buffer.data(), buffer.size(), CE_UTF8));
+  }
+  return out;
+}
+
+// [[Rcpp::export]]
+CharacterVector format_date_(NumericVector dates, int date_system) {
+  // Format serial dates natively, without round-tripping through
+  // format.POSIXlt(), as when formatting data validation rules.
+  int date_offset = (date_system == 1904) ? 24107 : 25569;
+  R_xlen_t n = dates.size();
+  std::vector<char> buffer(24 * n);
+  std::vector<int> lengths(n);
+  formatDates(buffer.data(), lengths.data(), REAL(dates), n, date_system,
+              date_offset);
+  CharacterVector out(n, NA_STRING);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    if (lengths[i] >= 0) {
+      SET_STRING_ELT(out, i, Rf_mkCharLenCE(&buffer[24 * i], lengths[i], CE_UTF8));
+    }
+  }
+  return out;
+}
+
+// [[Rcpp::export]]
+List xlsx_color_theme_(SEXP path) {
+  rziparchive archive(path);
   CharacterVector theme_name =
     CharacterVector::create("background1",
                             "text1",
@@ -185,8 +223,8 @@ List xlsx_color_theme_(std::string path) {
                             "followed-hyperlink");
   CharacterVector theme_rgb(12, NA_STRING);
   std::string FF = "FF";
-  if (zip_has_file(path, "xl/theme/theme1.xml")) {
-    std::string theme1 = zip_buffer(path, "xl/theme/theme1.xml");
+  if (archive.has_file("xl/theme/theme1.xml")) {
+    std::string theme1 = zip_buffer(archive, "xl/theme/theme1.xml");
     rapidxml::xml_document<> theme1_xml;
     theme1_xml.parse<0>(&theme1[0]);
     rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
@@ -221,7 +259,24 @@ List xlsx_color_theme_(std::string path) {
   // Turn list of vectors into a data frame without checking anything
   int n = Rf_length(out[0]);
   out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  setCompactRowNames(out, n);
 
   return out;
 }
+
+// [[Rcpp::export]]
+RawVector zip_buffer_(SEXP zip_path, std::string file_path) {
+  rziparchive archive(zip_path);
+  std::string buffer;
+  char* xml = archive.read(file_path, buffer);
+  size_t n = xml == &buffer[0] ? buffer.size() - 1 : strlen(xml);
+  RawVector out(n);
+  memcpy(RAW(out), xml, n);
+  return out;
+}
+
+// [[Rcpp::export]]
+bool zip_has_file_(SEXP zip_path, std::string file_path) {
+  rziparchive archive(zip_path);
+  return archive.has_file(file_path);
+}
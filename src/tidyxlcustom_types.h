@@ -0,0 +1,9 @@
+#ifndef TIDYXLCUSTOM_TYPES_
+#define TIDYXLCUSTOM_TYPES_
+
+// Types in the signatures of exported functions, for RcppExports.cpp
+#include "cellindex.h"
+#include "depgraph.h"
+#include "xlsxchunks.h"
+
+#endif
@@ -3,12 +3,89 @@
 #ifndef TOKEN_GRAMMAR_
 #define TOKEN_GRAMMAR_
 
+#include <string>
+#include <vector>
 #include <pegtl.hpp>
-#include <Rcpp.h>
 #include "paren_type.h"
 
 using namespace tao::TAO_PEGTL_NAMESPACE;
 
+// Types of token.  The order is that of the levels of the factor `type`
+// returned by xlex_many().
+enum class xltoken_type : unsigned char {
+  REF,
+  SHEET,
+  NAME,
+  FUNCTION,
+  ERROR_CODE,  // not ERROR, which some versions of R define as a macro
+  BOOL,
+  NUMBER,
+  TEXT,
+  OPERATOR,
+  PAREN_OPEN,
+  PAREN_CLOSE,
+  OPEN_ARRAY,
+  CLOSE_ARRAY,
+  FUN_OPEN,
+  FUN_CLOSE,
+  SEPARATOR,
+  DDE,
+  STRUCTURED_REF,
+  OTHER
+};
+
+const int XLTOKEN_TYPES = 19; // number of xltoken_types
+
+// Name of an xltoken_type, as returned to R
+inline const char* xltokenTypeName(xltoken_type type) {
+  static const char* names[XLTOKEN_TYPES] = {
+    "ref", "sheet", "name", "function", "error", "bool", "number", "text",
+    "operator", "paren_open", "paren_close", "open_array", "close_array",
+    "fun_open", "fun_close", "separator", "DDE", "structured_ref", "other"
+  };
+  return names[static_cast<int>(type)];
+}
+
+// A token, as a span of the formula that it came from, so that its text is
+// only copied when it is returned to R.
+struct xltoken_span {
+  xltoken_type type_;
+  int level_;                  // level within nested formula
+  size_t offset_;              // of the first byte of the token in the formula
+  size_t length_;              // in bytes
+};
+
+// State of the tokenizer while it parses one formula.
+struct xltoken_state {
+  const char* formula_;               // start of the formula, for offsets
+  int level_;                         // level within nested formula
+  std::vector<paren_type> fun_paren_; // what is the context of a comma?
+                                      // never empty, see closeParen()
+  std::vector<xltoken_span>& tokens_; // tokens are appended here
+
+  xltoken_state(const char* formula, std::vector<xltoken_span>& tokens):
+    formula_(formula), level_(0), tokens_(tokens) {
+    // default context before any '('.  Never required in valid formulas, but
+    // avoids hard crash in the event, e.g. a formula =A1,B2.
+    fun_paren_.push_back(paren_type::PARENTHESES);
+  }
+
+  // Unbalanced closing parentheses or braces, e.g. =A1)) or ={1}}, would
+  // otherwise leave no context for a following comma or ')'.
+  template< typename Input >
+    void closeParen(const Input& in) const {
+      if (fun_paren_.size() <= 1) {
+        throw tao::TAO_PEGTL_NAMESPACE::parse_error(
+            "unbalanced closing parenthesis", in);
+      }
+    }
+
+  void push(xltoken_type type, const char* begin, size_t length) {
+    xltoken_span token = {type, level_, (size_t) (begin - formula_), length};
+    tokens_.push_back(token);
+  }
+};
+
 namespace xltoken
 {
   // Generic rules
@@ -285,334 +362,172 @@ namespace xltoken
   template<typename Rule>
     struct tokenize : nothing<Rule> {};
 
+  // Action that records a token of a fixed type.
+  template< xltoken_type T >
+    struct push_token
+    {
+      template< typename Input >
+        static void apply( const Input & in, xltoken_state & state )
+        {
+          state.push(T, in.begin(), in.size());
+        }
+    };
+
   // Specialisations of the user-defined action to do something when a rule
   // succeeds; is called with the portion of the input that matched the rule.
 
-  template<> struct tokenize< Ref >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("ref");
-        tokens.push_back(in.string());
-      }
-  };
-
-  template<> struct tokenize< Sheet >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("sheet");
-        tokens.push_back(in.string());
-      }
-  };
-
-  template<> struct tokenize< Name >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("name");
-        tokens.push_back(in.string());
-      }
-  };
-
+  template<> struct tokenize< Ref > : push_token< xltoken_type::REF > {};
+  template<> struct tokenize< Sheet > : push_token< xltoken_type::SHEET > {};
+  template<> struct tokenize< Name > : push_token< xltoken_type::NAME > {};
   template<> struct tokenize< DynamicDataExchange >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("DDE");
-        tokens.push_back(in.string());
-      }
-  };
-
+    : push_token< xltoken_type::DDE > {};
   template<> struct tokenize< StructuredReference >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("structured_ref");
-        tokens.push_back(in.string());
-      }
-  };
-
-
-  template<> struct tokenize< Text >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("text");
-        tokens.push_back(in.string());
-      }
-  };
-
-  template<> struct tokenize< notseps >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("other");
-        tokens.push_back(in.string());
-      }
-  };
+    : push_token< xltoken_type::STRUCTURED_REF > {};
+  template<> struct tokenize< Text > : push_token< xltoken_type::TEXT > {};
+  template<> struct tokenize< notseps > : push_token< xltoken_type::OTHER > {};
+  template<> struct tokenize< semicolon >
+    : push_token< xltoken_type::SEPARATOR > {};
+  template<> struct tokenize< Bool > : push_token< xltoken_type::BOOL > {};
+  template<> struct tokenize< Error >
+    : push_token< xltoken_type::ERROR_CODE > {};
+  template<> struct tokenize< Number > : push_token< xltoken_type::NUMBER > {};
+  template<> struct tokenize< Operator >
+    : push_token< xltoken_type::OPERATOR > {};
 
   template<> struct tokenize< comma >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        levels.push_back(level);
-        tokens.push_back(in.string());
-        switch (fun_paren.back()) {
+        switch (state.fun_paren_.back()) {
           case paren_type::PARENTHESES:
-            types.push_back("operator");
+            state.push(xltoken_type::OPERATOR, in.begin(), in.size());
             break;
 
           case paren_type::FUNCTION:
-            types.push_back("separator");
+            state.push(xltoken_type::SEPARATOR, in.begin(), in.size());
             break;
         }
       }
   };
 
-  template<> struct tokenize< semicolon >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("separator");
-        tokens.push_back(in.string());
-      }
-  };
-
   template<> struct tokenize< openparen >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        levels.push_back(level);
-        types.push_back("paren_open");
-        tokens.push_back(in.string());
-        ++level;
-        fun_paren.push_back(paren_type::PARENTHESES);
+        state.push(xltoken_type::PAREN_OPEN, in.begin(), in.size());
+        ++state.level_;
+        state.fun_paren_.push_back(paren_type::PARENTHESES);
       }
   };
 
   template<> struct tokenize< closeparen >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        level--;
-        levels.push_back(level);
-        tokens.push_back(in.string());
-        switch (fun_paren.back()) {
+        state.closeParen(in);
+        state.level_--;
+        switch (state.fun_paren_.back()) {
           case paren_type::PARENTHESES:
-            types.push_back("paren_close");
+            state.push(xltoken_type::PAREN_CLOSE, in.begin(), in.size());
             break;
 
           case paren_type::FUNCTION:
-            types.push_back("fun_close");
+            state.push(xltoken_type::FUN_CLOSE, in.begin(), in.size());
             break;
         }
-        fun_paren.pop_back();
+        state.fun_paren_.pop_back();
       }
   };
 
   template<> struct tokenize< OpenCurlyParen >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        levels.push_back(level);
-        types.push_back("open_array");
-        tokens.push_back(in.string());
-        level++;
-        fun_paren.push_back(paren_type::FUNCTION);
+        state.push(xltoken_type::OPEN_ARRAY, in.begin(), in.size());
+        state.level_++;
+        state.fun_paren_.push_back(paren_type::FUNCTION);
       }
   };
 
   template<> struct tokenize< CloseCurlyParen >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        level--;
-        levels.push_back(level);
-        types.push_back("close_array");
-        tokens.push_back(in.string());
-        fun_paren.pop_back();
-      }
-  };
-
-  template<> struct tokenize< Bool >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("bool");
-        tokens.push_back(in.string());
-      }
-  };
-
-  template<> struct tokenize< Error >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("error");
-        tokens.push_back(in.string());
-      }
-  };
-
-  template<> struct tokenize< Number >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("number");
-        tokens.push_back(in.string());
+        state.closeParen(in);
+        state.level_--;
+        state.push(xltoken_type::CLOSE_ARRAY, in.begin(), in.size());
+        state.fun_paren_.pop_back();
       }
   };
 
   template<> struct tokenize< Function >
   {
     template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+      static void apply( const Input & in, xltoken_state & state )
       {
-        // Handle the function name
-        levels.push_back(level);
-        types.push_back("function");
-        std::string in_string(in.string());
-        in_string.pop_back();               // remove the terminal '('
-        tokens.push_back(in_string);
+        // Handle the function name, without the terminal '('
+        state.push(xltoken_type::FUNCTION, in.begin(), in.size() - 1);
 
         // Handle the open parenthesis
-        levels.push_back(level);
-        types.push_back("fun_open");
-        tokens.push_back("(");
+        state.push(xltoken_type::FUN_OPEN, in.begin() + in.size() - 1, 1);
 
         // Handle the new level and context
-        ++level;
-        fun_paren.push_back(paren_type::FUNCTION);
-      }
-  };
-
-  template<> struct tokenize< Operator >
-  {
-    template< typename Input >
-      static void apply( const Input & in,
-                         int & level,
-                         std::vector<int> & levels,
-                         std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
-      {
-        levels.push_back(level);
-        types.push_back("operator");
-        tokens.push_back(in.string());
+        ++state.level_;
+        state.fun_paren_.push_back(paren_type::FUNCTION);
       }
   };
 
 } // xltoken
 
+// Tokenise one formula, appending to tokens, as spans of the formula.  Doesn't
+// touch R, so it can be called from any thread.
+inline void tokenize_formula(const std::string& formula,
+                             std::vector<xltoken_span>& tokens) {
+  xltoken_state state(formula.data(), tokens);
+  memory_input<> in_mem(formula.data(), formula.size(), "original-formula");
+  parse< xltoken::root, xltoken::tokenize >(in_mem, state);
+}
+
+// Drop the spaces between tokens, which are tokenised as the intersection
+// operator, but are only that between two references, e.g. A:A 1:1.  Elsewhere
+// they are whitespace, e.g. MAX( A1 ).  A run of spaces that is an
+// intersection is kept as its first space.
+inline void strip_whitespace(const std::string& formula,
+                             std::vector<xltoken_span>& tokens) {
+  size_t kept(0);
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const xltoken_span& token = tokens[i];
+    if (token.type_ != xltoken_type::OPERATOR || formula[token.offset_] != ' ') {
+      tokens[kept++] = token;
+      continue;
+    }
+    size_t next = i + 1;
+    while (next < tokens.size()
+           && tokens[next].type_ == xltoken_type::OPERATOR
+           && formula[tokens[next].offset_] == ' ') {
+      ++next;
+    }
+    if (kept > 0 && next < tokens.size()) {
+      xltoken_type before = tokens[kept - 1].type_;
+      xltoken_type after = tokens[next].type_;
+      if ((before == xltoken_type::REF || before == xltoken_type::NAME
+           || before == xltoken_type::PAREN_CLOSE
+           || before == xltoken_type::FUN_CLOSE)
+          && (after == xltoken_type::REF || after == xltoken_type::SHEET
+              || after == xltoken_type::NAME
+              || after == xltoken_type::PAREN_OPEN
+              || after == xltoken_type::FUNCTION)) {
+        tokens[kept++] = token;
+      }
+    }
+    i = next - 1;
+  }
+  tokens.resize(kept);
+}
+
 #endif
@@ -1,19 +1,23 @@
 #pragma once
 
-#include <Rcpp.h>
-
-using namespace Rcpp;
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
 
 // col = 1 --> first column aka column A, so 1-indexed
 inline std::string intToABC(int col) {
-  std::string ret;
+  // Fill a buffer from the end, rather than prepending to a string
+  char buffer[8];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
   while (col > 0) {
     col--;
-    ret = (char)('A' + col % 26) + ret;
+    *--p = (char)('A' + col % 26);
     col /= 26;
   }
-  return ret;
+  return std::string(p, end - p);
 }
 
 // row = 1, col = 1 --> upper left cell aka column A1, so 1-indexed
@@ -33,7 +37,8 @@ inline std::pair<int, int> parseRef(const char* ref) {
     } else if (*cur >= 'A' && *cur <= 'Z') {
       col = 26 * col + (*cur - 'A' + 1);
     } else {
-      stop("Invalid character '%s' in cell ref '%s'", *cur, ref);
+      throw std::runtime_error("Invalid character '" + std::string(1, *cur)
+                               + "' in cell ref '" + ref + "'");
     }
   }
 
@@ -0,0 +1,74 @@
+#include "zip.h"
+#include "rapidxml.h"
+#include "workbookpr.h"
+
+// Find the start tag of workbookPr, with or without a namespace prefix, and
+// return it (as a self-closing element) or an empty string if there isn't one.
+static std::string findWorkbookPr(const std::string& xml) {
+  size_t pos = 0;
+  while ((pos = xml.find("workbookPr", pos)) != std::string::npos) {
+    // Walk back over any prefix to the opening '<'
+    size_t start = pos;
+    while (start > 0 && xml[start - 1] != '<' && xml[start - 1] != '>'
+           && xml[start - 1] != ' ' && xml[start - 1] != '/') {
+      --start;
+    }
+    size_t after = pos + 10; // strlen("workbookPr")
+    bool is_tag = start > 0 && xml[start - 1] == '<'
+      && (start == pos || xml[pos - 1] == ':')
+      && after < xml.size()
+      && (xml[after] == ' ' || xml[after] == '/' || xml[after] == '>'
+          || xml[after] == '\t' || xml[after] == '\r' || xml[after] == '\n');
+    if (!is_tag) {
+      pos = after;
+      continue;
+    }
+    // Find the end of the tag, skipping over quoted attribute values
+    char quote = 0;
+    size_t end = after;
+    for (; end < xml.size(); ++end) {
+      char c = xml[end];
+      if (quote) {
+        if (c == quote) quote = 0;
+      } else if (c == '"' || c == '\'') {
+        quote = c;
+      } else if (c == '>') {
+        break;
+      }
+    }
+    if (end == xml.size()) {
+      return std::string(); // # nocov
+    }
+    std::string tag = xml.substr(start - 1, end - start + 1);
+    if (tag[tag.size() - 1] != '/') {
+      tag += '/';
+    }
+    tag += '>';
+    return tag;
+  }
+  return std::string();
+}
+
+workbookpr::workbookpr(ziparchive& archive):
+  dateSystem_(1900), dateOffset_(25569) {
+  std::string book = zip_buffer(archive, "xl/workbook.xml");
+  std::string tag = findWorkbookPr(book);
+  if (tag.empty()) {
+    return;
+  }
+
+  rapidxml::xml_document<> xml;
+  xml.parse<rapidxml::parse_strip_xml_namespaces>(&tag[0]);
+
+  rapidxml::xml_node<>* workbookPr = xml.first_node("workbookPr");
+  if (workbookPr != NULL) {
+    rapidxml::xml_attribute<>* date1904 = workbookPr->first_attribute("date1904");
+    if (date1904 != NULL) {
+      std::string is1904 = date1904->value();
+      if ((is1904 == "1") || (is1904 == "true")) {
+        dateSystem_ = 1904;
+        dateOffset_ = 24107;
+      }
+    }
+  }
+}
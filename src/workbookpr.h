@@ -0,0 +1,23 @@
+#ifndef WORKBOOKPR_
+#define WORKBOOKPR_
+
+#include <string>
+#include "zip.h"
+
+// Workbook properties, ECMA Part 1 section 18.2.28 "workbookPr (Workbook
+// Properties)".  Only the workbookPr element of xl/workbook.xml is
+// parsed, so that callers that need nothing else, such as xlsx_validation(),
+// don't have to read styles, shared strings or the rest of the workbook.
+
+class workbookpr {
+
+  public:
+
+    int dateSystem_; // 1900 or 1904
+    int dateOffset_; // for converting 1900 or 1904 Excel datetimes to R
+
+    workbookpr(ziparchive& archive);
+
+};
+
+#endif
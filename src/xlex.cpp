@@ -1,34 +1,51 @@
 #include <Rcpp.h>
+#include <unordered_map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "token_grammar.h"
+#include "formula_ast.h"
+#include "fingerprint.h"
 #include "paren_type.h"
+#include "tibble.h"
 
 using namespace Rcpp;
 
+// The text of a token
+inline SEXP token_text(const std::string& formula, const xltoken_span& token) {
+  return Rf_mkCharLenCE(formula.data() + token.offset_, token.length_, CE_UTF8);
+}
+
+// Factor levels of token types
+CharacterVector token_type_levels() {
+  CharacterVector levels(XLTOKEN_TYPES);
+  for (int i = 0; i < XLTOKEN_TYPES; ++i) {
+    levels[i] = xltokenTypeName(static_cast<xltoken_type>(i));
+  }
+  return levels;
+}
+
 // [[Rcpp::export]]
 List xlex_(CharacterVector x)
 {
 
   std::string in_string;                   // the formula from the input x
   List out;                          // wraps types, tokens, levels
-  std::vector<std::string> types;          // bool, number, text, function, etc.
-  std::vector<std::string> tokens;         // the tokens themselves
-  std::vector<int> levels;                 // level within nested formula
-  int level(0);                            // starting level
-  std::vector<paren_type> fun_paren;       // what is the context of a comma?
+  std::vector<xltoken_span> spans;         // the tokens, as spans of in_string
 
   in_string = as<std::string>(x);
 
-  // default context before any '('.  Never required in valid formulas, but
-  // avoids hard crash in the event, e.g. a formula =A1,B2.
-  fun_paren.push_back(paren_type::PARENTHESES);
+  tokenize_formula(in_string, spans);
 
-  memory_input<> in_mem(in_string, "original-formula");
-  parse< xltoken::root, xltoken::tokenize >(in_mem,
-                                            level,
-                                            levels,
-                                            fun_paren,
-                                            types,
-                                            tokens);
+  int n = spans.size();
+  IntegerVector levels(n);                 // level within nested formula
+  CharacterVector types(n);                // bool, number, text, function, etc.
+  CharacterVector tokens(n);               // the tokens themselves
+  for (int i = 0; i < n; ++i) {
+    levels[i] = spans[i].level_;
+    types[i] = xltokenTypeName(spans[i].type_);
+    SET_STRING_ELT(tokens, i, token_text(in_string, spans[i]));
+  }
 
   out = List::create(
       _["level"] = levels,
@@ -36,11 +53,436 @@ List xlex_(CharacterVector x)
       _["token"] = tokens
       );
 
-  int n = tokens.size();
   out.attr("class") = CharacterVector::create("xlex", "tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  setCompactRowNames(out, n);
+
+  return out;
+}
+
+// Tokens of a contiguous chunk of formulas, tokenised by one thread
+struct xlex_chunk {
+  std::vector<int> formulas;               // index of the formula of each token
+  std::vector<xltoken_span> tokens;
+  int failed;                              // index of a formula that failed
+  std::string error;                       // and why
+  xlex_chunk(): failed(-1) {}
+};
+
+// Copy the formulas out of R, as UTF-8, so that threads don't touch R.  NA
+// formulas are empty, and flagged in is_na.
+void read_formulas(CharacterVector x,
+                   std::vector<std::string>& formulas,
+                   std::vector<bool>& is_na) {
+  formulas.resize(x.size());
+  is_na.resize(x.size());
+  for (R_xlen_t i = 0; i < x.size(); ++i) {
+    is_na[i] = x[i] == NA_STRING;
+    if (!is_na[i]) {
+      formulas[i] = Rf_translateCharUTF8(x[i]);
+    }
+  }
+}
+
+// The number of threads to use, at most the number of formulas
+int xlex_threads(int threads, size_t n) {
+  if (threads < 1) {
+    stop("'threads' must be a positive integer");
+  }
+#ifdef _OPENMP
+  if ((size_t) threads > n) {
+    threads = n > 0 ? n : 1;
+  }
+  return threads;
+#else
+  return 1;
+#endif
+}
+
+// [[Rcpp::export]]
+List xlex_many_(CharacterVector x, int threads)
+{
+  std::vector<std::string> formulas;
+  std::vector<bool> is_na;
+  read_formulas(x, formulas, is_na);
+
+  int n = formulas.size();
+  threads = xlex_threads(threads, n);
+
+  // Each thread tokenises a contiguous chunk of formulas, so that the chunks
+  // can simply be concatenated in order.
+  std::vector<xlex_chunk> chunks(threads);
+  int chunk_size = threads > 0 ? (n + threads - 1) / threads : n;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+  for (int chunk = 0; chunk < threads; ++chunk) {
+    xlex_chunk& out = chunks[chunk];
+    int end = std::min(n, (chunk + 1) * chunk_size);
+    for (int i = chunk * chunk_size; i < end; ++i) {
+      if (is_na[i]) {
+        continue;
+      }
+      size_t before = out.tokens.size();
+      try {
+        tokenize_formula(formulas[i], out.tokens);
+      } catch (std::exception& e) {
+        // Exceptions mustn't escape an OpenMP region, so they are rethrown
+        // below.
+        out.failed = i;
+        out.error = e.what();
+        break;
+      }
+      out.formulas.insert(out.formulas.end(), out.tokens.size() - before, i + 1);
+    }
+  }
+
+  R_xlen_t total(0);
+  for (std::vector<xlex_chunk>::iterator chunk = chunks.begin();
+       chunk != chunks.end();
+       ++chunk) {
+    if (chunk->failed != -1) {
+      stop("Failed to tokenise formula %d: %s",
+           chunk->failed + 1, chunk->error);
+    }
+    total += chunk->tokens.size();
+  }
+
+  // Only now are the tokens copied as strings.  The type is a factor, so its
+  // codes are just the enum plus one.
+  IntegerVector formula(total);
+  IntegerVector level(total);
+  IntegerVector type(total);
+  CharacterVector token(total);
+  R_xlen_t j(0);
+  for (std::vector<xlex_chunk>::iterator chunk = chunks.begin();
+       chunk != chunks.end();
+       ++chunk) {
+    for (size_t k = 0; k < chunk->tokens.size(); ++k, ++j) {
+      const xltoken_span& span = chunk->tokens[k];
+      formula[j] = chunk->formulas[k];
+      level[j] = span.level_;
+      type[j] = static_cast<int>(span.type_) + 1;
+      SET_STRING_ELT(token, j, token_text(formulas[formula[j] - 1], span));
+    }
+    // Free each chunk as soon as it has been copied
+    std::vector<int>().swap(chunk->formulas);
+    std::vector<xltoken_span>().swap(chunk->tokens);
+  }
+  type.attr("levels") = token_type_levels();
+  type.attr("class") = "factor";
+
+  List out = List::create(
+      _["formula"] = formula,
+      _["level"] = level,
+      _["type"] = type,
+      _["token"] = token
+      );
+
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, total);
+
+  return out;
+}
+
+// Syntax trees of a contiguous chunk of formulas, built by one thread
+struct ast_chunk {
+  std::vector<int> formulas;               // index of the formula of each node
+  std::vector<xlnode> nodes;
+  int failed;                              // index of a formula that failed
+  std::string error;                       // and why
+  ast_chunk(): failed(-1) {}
+};
+
+// Factor levels of node types
+CharacterVector node_type_levels() {
+  CharacterVector levels(XLNODE_TYPES);
+  for (int i = 0; i < XLNODE_TYPES; ++i) {
+    levels[i] = xlnodeTypeName(static_cast<xlnode_type>(i));
+  }
+  return levels;
+}
+
+// Character positions of the bytes of a UTF-8 string, counting from one, and
+// one more for the end of the string
+void char_positions(const std::string& x, std::vector<int>& out) {
+  out.resize(x.size() + 1);
+  int position(0);
+  for (size_t i = 0; i < x.size(); ++i) {
+    if ((x[i] & 0xC0) != 0x80) { // not a continuation byte
+      ++position;
+    }
+    out[i] = position;
+  }
+  out[x.size()] = position + 1;
+}
+
+// [[Rcpp::export]]
+List xlex_ast_(CharacterVector x, int threads)
+{
+  std::vector<std::string> formulas;
+  std::vector<bool> is_na;
+  read_formulas(x, formulas, is_na);
+
+  int n = formulas.size();
+  threads = xlex_threads(threads, n);
+
+  std::vector<ast_chunk> chunks(threads);
+  int chunk_size = threads > 0 ? (n + threads - 1) / threads : n;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+  for (int chunk = 0; chunk < threads; ++chunk) {
+    ast_chunk& out = chunks[chunk];
+    std::vector<xltoken_span> tokens;
+    int end = std::min(n, (chunk + 1) * chunk_size);
+    for (int i = chunk * chunk_size; i < end; ++i) {
+      if (is_na[i]) {
+        continue;
+      }
+      size_t before = out.nodes.size();
+      tokens.clear();
+      try {
+        tokenize_formula(formulas[i], tokens);
+        parse_formula(formulas[i], tokens, out.nodes);
+      } catch (std::exception& e) {
+        out.failed = i;
+        out.error = e.what();
+        break;
+      }
+      out.formulas.insert(out.formulas.end(), out.nodes.size() - before, i + 1);
+    }
+  }
+
+  R_xlen_t total(0);
+  for (std::vector<ast_chunk>::iterator chunk = chunks.begin();
+       chunk != chunks.end();
+       ++chunk) {
+    if (chunk->failed != -1) {
+      stop("Failed to tokenise formula %d: %s",
+           chunk->failed + 1, chunk->error);
+    }
+    total += chunk->nodes.size();
+  }
+
+  // Links are indexes within each chunk, so they are offset by the rows of
+  // the chunks before, and made one-based.  Spans are in characters.
+  IntegerVector formula(total);
+  IntegerVector parent(total);
+  IntegerVector first_child(total);
+  IntegerVector next_sibling(total);
+  IntegerVector type(total);
+  CharacterVector token(total);
+  IntegerVector start(total);
+  IntegerVector end(total);
+  std::vector<int> positions;
+  R_xlen_t j(0);
+  for (std::vector<ast_chunk>::iterator chunk = chunks.begin();
+       chunk != chunks.end();
+       ++chunk) {
+    int base = j + 1;
+    int previous(-1);
+    for (size_t k = 0; k < chunk->nodes.size(); ++k, ++j) {
+      const xlnode& node = chunk->nodes[k];
+      formula[j] = chunk->formulas[k];
+      const std::string& text = formulas[formula[j] - 1];
+      if (formula[j] != previous) {
+        char_positions(text, positions);
+        previous = formula[j];
+      }
+      parent[j] = node.parent_ == -1 ? NA_INTEGER : base + node.parent_;
+      first_child[j] =
+        node.first_child_ == -1 ? NA_INTEGER : base + node.first_child_;
+      next_sibling[j] =
+        node.next_sibling_ == -1 ? NA_INTEGER : base + node.next_sibling_;
+      type[j] = static_cast<int>(node.type_) + 1;
+      SET_STRING_ELT(token, j, Rf_mkCharLenCE(text.data() + node.token_offset_,
+                                              node.token_length_, CE_UTF8));
+      // Empty spans, of missing arguments, end before they start
+      start[j] = positions[node.offset_];
+      end[j] = positions[node.offset_ + node.length_] - 1;
+      if (node.length_ > 0) {
+        end[j] = positions[node.offset_ + node.length_ - 1];
+      }
+    }
+    std::vector<int>().swap(chunk->formulas);
+    std::vector<xlnode>().swap(chunk->nodes);
+  }
+  type.attr("levels") = node_type_levels();
+  type.attr("class") = "factor";
+
+  List out = List::create(
+      _["formula"] = formula,
+      _["parent"] = parent,
+      _["first_child"] = first_child,
+      _["next_sibling"] = next_sibling,
+      _["type"] = type,
+      _["token"] = token,
+      _["start"] = start,
+      _["end"] = end
+      );
+
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, total);
 
   return out;
 }
 
+// [[Rcpp::export]]
+List formula_fingerprints_(CharacterVector x,
+                           IntegerVector rows,
+                           IntegerVector cols,
+                           int threads)
+{
+  std::vector<std::string> formulas;
+  std::vector<bool> is_na;
+  read_formulas(x, formulas, is_na);
+
+  int n = formulas.size();
+  if (rows.size() != n || cols.size() != n) {
+    stop("'rows' and 'cols' must be the same length as the formulas");
+  }
+  std::vector<int> row(rows.begin(), rows.end());
+  std::vector<int> col(cols.begin(), cols.end());
+  threads = xlex_threads(threads, n);
+  std::vector<std::string> r1c1(n);
+  std::vector<std::string> errors(n);
+
+  // Each formula is rendered in place, so the formulas are copied out only
+  // once
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1024)
+#endif
+  for (int i = 0; i < n; ++i) {
+    if (is_na[i]) {
+      continue;
+    }
+    try {
+      r1c1_formula(formulas[i], row[i], col[i], r1c1[i]);
+    } catch (std::exception& e) {
+      errors[i] = e.what();
+    }
+  }
+
+  // Group by the normalised formula itself, rather than by its hash, so that
+  // groups are exact even if two hashes collide.  Groups are numbered in the
+  // order of their first formula.
+  std::unordered_map<std::string, int> groups;
+  std::vector<int> first;
+  std::vector<int> counts;
+  IntegerVector group(n, NA_INTEGER);
+  for (int i = 0; i < n; ++i) {
+    if (!errors[i].empty()) {
+      stop("Failed to tokenise formula %d: %s", i + 1, errors[i]);
+    }
+    if (is_na[i]) {
+      continue;
+    }
+    std::pair<std::unordered_map<std::string, int>::iterator, bool> found =
+      groups.insert(std::make_pair(r1c1[i], (int) first.size()));
+    if (found.second) {
+      first.push_back(i);
+      counts.push_back(0);
+    }
+    group[i] = found.first->second + 1;
+    ++counts[found.first->second];
+  }
 
+  int n_groups = first.size();
+  CharacterVector group_fingerprint(n_groups);
+  CharacterVector group_r1c1(n_groups);
+  IntegerVector group_first(n_groups);
+  for (int j = 0; j < n_groups; ++j) {
+    group_first[j] = first[j] + 1;
+    const std::string& text = r1c1[first[j]];
+    SET_STRING_ELT(group_r1c1, j,
+                   Rf_mkCharLenCE(text.data(), text.size(), CE_UTF8));
+    group_fingerprint[j] = fingerprint(text);
+  }
+  CharacterVector formula_fingerprint(n, NA_STRING);
+  for (int i = 0; i < n; ++i) {
+    if (group[i] != NA_INTEGER) {
+      formula_fingerprint[i] = group_fingerprint[group[i] - 1];
+    }
+  }
+
+  List out_groups = List::create(
+      _["formula_fingerprint"] = group_fingerprint,
+      _["r1c1"] = group_r1c1,
+      _["n"] = wrap(counts),
+      _["first"] = group_first
+      );
+  out_groups.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out_groups, n_groups);
+
+  return List::create(
+      _["formula_fingerprint"] = formula_fingerprint,
+      _["group"] = group,
+      _["groups"] = out_groups
+      );
+}
+
+// Whether the tokens of a formula are a range: a ref, optionally sheet-qualified,
+// followed by any number of union ',' or intersection ' ' operators and further
+// refs.
+bool tokens_are_range(const std::string& formula,
+                      const std::vector<xltoken_span>& tokens) {
+  bool expect_ref(true);
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i].type_ == xltoken_type::SHEET) {
+      continue;
+    }
+    if (expect_ref) {
+      if (tokens[i].type_ != xltoken_type::REF) {
+        return false;
+      }
+    } else {
+      char op = formula[tokens[i].offset_];
+      if (tokens[i].length_ != 1 || (op != ',' && op != ' ')) {
+        return false;
+      }
+    }
+    expect_ref = !expect_ref;
+  }
+  return !expect_ref; // there was at least one ref, and it came last
+}
+
+// [[Rcpp::export]]
+LogicalVector is_range_(CharacterVector x, int threads)
+{
+  std::vector<std::string> formulas;
+  std::vector<bool> is_na;
+  read_formulas(x, formulas, is_na);
+
+  int n = formulas.size();
+  threads = xlex_threads(threads, n);
+  std::vector<int> out(n, NA_LOGICAL);
+  std::vector<std::string> errors(n);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1024)
+#endif
+  for (int i = 0; i < n; ++i) {
+    if (is_na[i]) {
+      continue;
+    }
+    std::vector<xltoken_span> tokens;
+    try {
+      tokenize_formula(formulas[i], tokens);
+      out[i] = tokens_are_range(formulas[i], tokens);
+    } catch (std::exception& e) {
+      errors[i] = e.what();
+    }
+  }
+
+  LogicalVector result(n);
+  for (int i = 0; i < n; ++i) {
+    if (!errors[i].empty()) {
+      stop("Failed to tokenise formula %d: %s", i + 1, errors[i]);
+    }
+    result[i] = out[i];
+  }
+
+  return result;
+}
@@ -0,0 +1,139 @@
+#include <Rcpp.h>
+#include <cstring>
+#include "cellindex.h"
+#include "utils.h"
+#include "tibble.h"
+
+using namespace Rcpp;
+
+// R bindings of cellindex.  The index is held by an external pointer, so it is
+// built once and can be queried many times.
+
+// [[Rcpp::export]]
+XPtr<cellindex> cell_index_(int n_sheets,
+                            IntegerVector sheets,
+                            IntegerVector rows,
+                            IntegerVector cols) {
+  std::vector<int> cell_sheets(sheets.size());
+  std::vector<int> cell_rows(sheets.size());
+  std::vector<int> cell_cols(sheets.size());
+  for (R_xlen_t i = 0; i < sheets.size(); ++i) {
+    bool missing = sheets[i] == NA_INTEGER
+      || rows[i] == NA_INTEGER
+      || cols[i] == NA_INTEGER;
+    cell_sheets[i] = missing ? -1 : sheets[i] - 1; // zero-based
+    cell_rows[i] = rows[i];
+    cell_cols[i] = cols[i];
+  }
+  cellindex* index = new cellindex(n_sheets, cell_sheets, cell_rows, cell_cols);
+  return XPtr<cellindex>(index, true);
+}
+
+// Rectangles of refs like A1, B2:F900, A:A or 1:3, which have already been
+// checked in R.  NA refs are given the sheet -1.
+std::vector<cellrect> ref_rects(IntegerVector sheets, CharacterVector refs) {
+  std::vector<cellrect> out(refs.size());
+  for (R_xlen_t i = 0; i < refs.size(); ++i) {
+    if (refs[i] == NA_STRING || sheets[i] == NA_INTEGER) {
+      out[i].sheet_ = -1;
+      continue;
+    }
+    const char* text = CHAR(refs[i]);
+    out[i] = depgraph::refRect(text, strlen(text));
+    out[i].sheet_ = sheets[i] - 1;
+  }
+  return out;
+}
+
+// [[Rcpp::export]]
+List cell_index_in_(XPtr<cellindex> index,
+                    IntegerVector sheets,
+                    CharacterVector refs) {
+  std::vector<cellrect> rects = ref_rects(sheets, refs);
+  std::vector<int> query;
+  std::vector<int> cells;
+  for (size_t i = 0; i < rects.size(); ++i) {
+    size_t before = cells.size();
+    index->cellsIn(rects[i], cells);
+    query.insert(query.end(), cells.size() - before, i + 1);
+  }
+  for (std::vector<int>::iterator cell = cells.begin();
+       cell != cells.end();
+       ++cell) {
+    ++*cell; // one-based
+  }
+  return List::create(
+      _["query"] = query,
+      _["cell"] = cells);
+}
+
+// [[Rcpp::export]]
+List cell_index_neighbours_(XPtr<cellindex> index,
+                            IntegerVector sheets,
+                            CharacterVector addresses,
+                            std::string direction) {
+  xldirection to;
+  if (direction == "up") {
+    to = xldirection::UP;
+  } else if (direction == "down") {
+    to = xldirection::DOWN;
+  } else if (direction == "left") {
+    to = xldirection::LEFT;
+  } else if (direction == "right") {
+    to = xldirection::RIGHT;
+  } else {
+    stop("Unknown direction '%s'", direction);
+  }
+  std::vector<cellrect> rects = ref_rects(sheets, addresses);
+  std::vector<int> query;
+  std::vector<int> cells;
+  for (size_t i = 0; i < rects.size(); ++i) {
+    const cellrect& rect = rects[i];
+    int cell = index->neighbour(rect.sheet_, rect.first_row_, rect.first_col_, to);
+    if (cell >= 0) {
+      query.push_back(i + 1);
+      cells.push_back(cell + 1); // one-based
+    }
+  }
+  return List::create(
+      _["query"] = query,
+      _["cell"] = cells);
+}
+
+// [[Rcpp::export]]
+List cell_index_blocks_(XPtr<cellindex> index) {
+  std::vector<cellrect> rects;
+  std::vector<int> counts;
+  index->blocks(rects, counts);
+  int n = rects.size();
+  IntegerVector sheet(n);
+  CharacterVector range(n);
+  IntegerVector first_row(n);
+  IntegerVector first_col(n);
+  IntegerVector last_row(n);
+  IntegerVector last_col(n);
+  for (int i = 0; i < n; ++i) {
+    const cellrect& rect = rects[i];
+    sheet[i] = rect.sheet_ + 1;
+    std::string text = asA1(rect.first_row_, rect.first_col_);
+    if (rect.last_row_ != rect.first_row_ || rect.last_col_ != rect.first_col_) {
+      text += ":" + asA1(rect.last_row_, rect.last_col_);
+    }
+    range[i] = text;
+    first_row[i] = rect.first_row_;
+    first_col[i] = rect.first_col_;
+    last_row[i] = rect.last_row_;
+    last_col[i] = rect.last_col_;
+  }
+  List out = List::create(
+      _["sheet"] = sheet,
+      _["ref"] = range,
+      _["first_row"] = first_row,
+      _["first_col"] = first_col,
+      _["last_row"] = last_row,
+      _["last_col"] = last_col,
+      _["n"] = counts);
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, n);
+  return out;
+}
@@ -0,0 +1,28 @@
+#include <Rcpp.h>
+#include "xlsxchunks.h"
+
+using namespace Rcpp;
+
+// R bindings of xlsxchunks.  The workbook is held by an external pointer, so
+// that each call parses one more chunk of cells from where the last one
+// stopped.  The path is protected by the pointer, so that a raw vector that
+// the archive borrows isn't collected before it is.
+
+// [[Rcpp::export]]
+XPtr<xlsxchunks> xlsx_chunks_(
+    SEXP path,
+    CharacterVector sheet_paths,
+    CharacterVector sheet_names,
+    CharacterVector comments_paths,
+    bool include_blank_cells,
+    bool formatted
+    ) {
+  xlsxchunks* chunks = new xlsxchunks(path, sheet_paths, sheet_names,
+      comments_paths, include_blank_cells, formatted);
+  return XPtr<xlsxchunks>(chunks, true, R_NilValue, path);
+}
+
+// [[Rcpp::export]]
+SEXP xlsx_next_chunk_(XPtr<xlsxchunks> chunks, double chunk_size) {
+  return chunks->nextChunk(chunk_size);
+}
@@ -1,61 +1,70 @@
-#include <Rcpp.h>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxbook.h"
 #include "xlsxsheet.h"
-#include "xlsxstyles.h"
+#include "xlsxstyleindex.h"
 #include "string.h"
+#include "workbookpr.h"
 
-using namespace Rcpp;
-
-xlsxbook::xlsxbook(const std::string& path): path_(path), styles_(path_) {
-  std::string book = zip_buffer(path_, "xl/workbook.xml");
-
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
-
-  rapidxml::xml_node<>* workbook = xml.first_node("workbook");
-
-  cacheDateOffset(workbook); // Must come before cacheSheets
+xlsxbook::xlsxbook(ziparchive& archive):
+  archive_(archive), styles_(archive_), sink_(NULL) {
+  cacheDateOffset(); // Must come before cacheSheets
   cacheStrings();
 }
 
 xlsxbook::xlsxbook(
-    const std::string& path,
-    CharacterVector& sheet_paths,
-    CharacterVector& sheet_names,
-    CharacterVector& comments_paths,
-    const bool& include_blank_cells):
-  path_(path),
+    ziparchive& archive,
+    const std::vector<std::string>& sheet_paths,
+    const std::vector<std::string>& sheet_names,
+    const std::vector<std::string>& comments_paths,
+    cellsink& sink,
+    const bool& include_blank_cells,
+    const bool& expand_shared_formulas,
+    const merge_mode& merged_cells,
+    const bool& chunked):
+  archive_(archive),
   sheet_paths_(sheet_paths),
   sheet_names_(sheet_names),
   comments_paths_(comments_paths),
-  styles_(path_),
-  include_blank_cells_(include_blank_cells) {
-  std::string book = zip_buffer(path_, "xl/workbook.xml");
-
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
-
-  rapidxml::xml_node<>* workbook = xml.first_node("workbook");
-
-  cacheDateOffset(workbook); // Must come before cacheSheets
+  styles_(archive_),
+  sink_(&sink),
+  include_blank_cells_(include_blank_cells),
+  expand_shared_formulas_(expand_shared_formulas),
+  merge_mode_(merged_cells),
+  chunk_sheet_(0),
+  chunk_started_(false),
+  chunk_cells_(0) {
+  sink_->start(*this);
+  cacheDateOffset(); // Must come before cacheSheets
+  if (chunked) {
+    // Sheets are read by nextChunk() when their cells are wanted.  Reserved,
+    // so that the sheets being read don't move when more are added.
+    sheet_xml_.assign(sheet_paths_.size(), NULL);
+    sheet_buffers_.resize(sheet_paths_.size());
+    sheets_.reserve(sheet_paths_.size());
+    cacheStrings();
+    return;
+  }
+  cacheSheetXml();   // Starts inflating sheets in the background
   cacheStrings();
-  cacheSheetXml();
   createSheets();
   countCells();
-  initializeColumns();
-  cacheInformation();
+  sink_->resize(cellcount_);
+  cacheCells();
 }
 
 // Based on tidyverse/readxl
 void xlsxbook::cacheStrings() {
-  if (!zip_has_file(path_, "xl/sharedStrings.xml"))
+  if (!archive_.has_file("xl/sharedStrings.xml"))
     return;
 
-  std::string xml = zip_buffer(path_, "xl/sharedStrings.xml");
+  std::string buffer;
+  char* xml = archive_.read("xl/sharedStrings.xml", buffer);
   rapidxml::xml_document<> sharedStrings;
-  sharedStrings.parse<rapidxml::parse_strip_xml_namespaces>(&xml[0]);
+  sharedStrings.parse<rapidxml::parse_strip_xml_namespaces>(xml);
 
   rapidxml::xml_node<>* sst = sharedStrings.first_node("sst");
 
@@ -70,7 +79,6 @@ void xlsxbook::cacheStrings() {
     }
   }
   strings_.reserve(n);
-  strings_formatted_ = Rcpp::List(n);
 
   // 18.4.8 si (String Item) [p1725]
   unsigned long int i = 0;
@@ -80,65 +88,65 @@ void xlsxbook::cacheStrings() {
     parseString(string, out);    // missing strings are treated as empty ""
     strings_.push_back(out);
 
-    Rcpp::List out_df = parseFormattedString(string, styles_);
-    strings_formatted_[i] = out_df;
+    if (sink_ != NULL) {
+      sink_->sharedString(i, string);
+    }
     i += 1;
   }
 }
 
-void xlsxbook::cacheDateOffset(rapidxml::xml_node<>* workbook) {
-  rapidxml::xml_node<>* workbookPr = workbook->first_node("workbookPr");
-  if (workbookPr != NULL) {
-    rapidxml::xml_attribute<>* date1904 = workbookPr->first_attribute("date1904");
-    if (date1904 != NULL) {
-      std::string is1904 = date1904->value();
-      if ((is1904 == "1") || (is1904 == "true")) {
-        dateSystem_ = 1904;
-        dateOffset_ = 24107;
-        return;
-      }
-    }
-  }
-
-  dateSystem_ = 1900;
-  dateOffset_ = 25569;
+void xlsxbook::cacheDateOffset() {
+  workbookpr properties(archive_);
+  dateSystem_ = properties.dateSystem_;
+  dateOffset_ = properties.dateOffset_;
 }
 
 void xlsxbook::cacheSheetXml() {
-  // Loop through sheets, reading the xml into memory
-  CharacterVector::iterator in_it;
-  for(in_it = sheet_paths_.begin(); in_it != sheet_paths_.end(); ++in_it) {
-    std::string xml(*in_it);
-    sheet_xml_.push_back(zip_buffer(path_, xml));
+  // Stored sheets are parsed in place in the mapped archive.  Deflated ones are
+  // inflated in order on a background thread, while the shared strings and the
+  // earlier sheets are parsed, and are waited for by createSheets().  The
+  // buffers are all created up front, so that they don't move.
+  size_t n = sheet_paths_.size();
+  sheet_xml_.assign(n, NULL);
+  sheet_buffers_.resize(n);
+  std::vector<const zipentry*> deflated(n, NULL);
+  for (size_t i = 0; i < n; ++i) {
+    const std::string& xml = sheet_paths_[i];
+    const zipentry* entry = archive_.find(xml);
+    if (entry != NULL && entry->method_ == 8) {
+      deflated[i] = entry;
+    } else {
+      sheet_xml_[i] = archive_.read(xml, sheet_buffers_[i]);
+    }
   }
+  inflater_.start(archive_, deflated, sheet_buffers_);
 }
 
 void xlsxbook::createSheets() {
   // Loop through sheets
-  std::vector<std::string>::iterator xml;
-  CharacterVector::iterator name;
-  CharacterVector::iterator comments_path;
-  int i = 0;
-  for(xml = sheet_xml_.begin(),
-      name = sheet_names_.begin(),
-      comments_path = comments_paths_.begin();
-      xml != sheet_xml_.end();
-      ++xml, ++name, ++comments_path) {
-    std::string xmlstring(*xml);
-    String namestring(*name);
-    String comments_path_string(*comments_path);
-    sheets_.emplace_back(
-        xlsxsheet(
-          namestring,
-          xmlstring,
-          *this,
-          comments_path_string,
-          include_blank_cells_)
-        );
-    ++i;
+  for (size_t i = 0; i < sheet_xml_.size(); ++i) {
+    if (sheet_xml_[i] == NULL) { // deflated, so wait for it
+      sheet_xml_[i] = inflater_.wait(i);
+      if (sheet_xml_[i] == NULL) {
+        throw std::runtime_error("Couldn't inflate '" + sheet_paths_[i]
+                                 + "' in '" + archive_.path() + "'");
+      }
+    }
+    createSheet(i);
   }
 }
 
+void xlsxbook::createSheet(size_t i) {
+  sheets_.emplace_back(
+      xlsxsheet(
+        sheet_names_[i],
+        sheet_xml_[i],
+        *this,
+        comments_paths_[i],
+        include_blank_cells_)
+      );
+}
+
 void xlsxbook::countCells() {
   // Loop through sheets, adding their cellcounts
   cellcount_ = 0;
@@ -150,116 +158,74 @@ void xlsxbook::countCells() {
   }
 }
 
-void xlsxbook::initializeColumns() {
-  sheet_           = CharacterVector(cellcount_, NA_STRING);
-  address_         = CharacterVector(cellcount_, NA_STRING);
-  row_             = IntegerVector(cellcount_,   NA_INTEGER);
-  col_             = IntegerVector(cellcount_,   NA_INTEGER);
-  is_blank_        = LogicalVector(cellcount_,   false);
-  content_         = CharacterVector(cellcount_, NA_STRING);
-  data_type_       = CharacterVector(cellcount_, NA_STRING);
-  error_           = CharacterVector(cellcount_, NA_STRING);
-  logical_         = LogicalVector(cellcount_,   NA_LOGICAL);
-  numeric_         = NumericVector(cellcount_,   NA_REAL);
-  date_            = NumericVector(cellcount_,   NA_REAL);
-  date_.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
-  date_.attr("tzone") = "UTC";
-  character_       = CharacterVector(cellcount_, NA_STRING);
-  formula_         = CharacterVector(cellcount_, NA_STRING);
-  is_array_        = LogicalVector(cellcount_,   false);
-  formula_ref_     = CharacterVector(cellcount_, NA_STRING);
-  formula_group_   = IntegerVector(cellcount_,   NA_INTEGER);
-  comment_         = CharacterVector(cellcount_, NA_STRING);
-  character_formatted_ = List(cellcount_);
-  height_          = NumericVector(cellcount_,   NA_REAL);
-  width_           = NumericVector(cellcount_,   NA_REAL);
-  rowOutlineLevel_ = NumericVector(cellcount_,   NA_REAL);
-  colOutlineLevel_ = NumericVector(cellcount_,   NA_REAL);
-  style_format_    = CharacterVector(cellcount_, NA_STRING);
-  local_format_id_ = IntegerVector(cellcount_,   NA_INTEGER);
-}
-
-void xlsxbook::cacheInformation() {
+void xlsxbook::cacheCells() {
   // Loop through sheets
-  List sheet_list(sheet_paths_.size());
-
-  std::vector<std::string>::iterator xml;
+  std::vector<char*>::iterator xml;
   std::vector<xlsxsheet>::iterator sheet;
-  List::iterator sheet_list_it;
 
   unsigned long long int i(0); // position of each cell in the output vectors
   for(xml = sheet_xml_.begin(),
-      sheet = sheets_.begin(),
-      sheet_list_it = sheet_list.begin();
+      sheet = sheets_.begin();
       xml != sheet_xml_.end();
-      ++xml, ++sheet, ++sheet_list_it) {
+      ++xml, ++sheet) {
     rapidxml::xml_document<> doc;
-    doc.parse<rapidxml::parse_strip_xml_namespaces>(&(*xml)[0]);
+    doc.parse<rapidxml::parse_strip_xml_namespaces>(*xml);
     rapidxml::xml_node<>* workbook = doc.first_node("worksheet");
     rapidxml::xml_node<>* sheetData = workbook->first_node("sheetData");
+    unsigned long long int begin(i);
     sheet->parseSheetData(sheetData, i);
     sheet->appendComments(i);
+    if (merge_mode_ != merge_mode::NONE) {
+      sheet->cacheMergeCells(workbook); // while the DOM is here
+    }
+    sink_->endSheet(*sheet, begin, i);
   }
+}
 
-  // Returns a nested data frame of everything, the data frame itself wrapped in
-  // a list.
-
-  information_ = List(24);
-  information_[0] = sheet_;
-  information_[1] = address_;
-  information_[2] = row_;
-  information_[3] = col_;
-  information_[4] = is_blank_;
-  information_[5] = content_;
-  information_[6] = data_type_;
-  information_[7] = error_;
-  information_[8] = logical_;
-  information_[9] = numeric_;
-  information_[10] = date_;
-  information_[11] = character_;
-  information_[12] = character_formatted_;
-  information_[13] = formula_;
-  information_[14] = is_array_;
-  information_[15] = formula_ref_;
-  information_[16] = formula_group_;
-  information_[17] = comment_;
-  information_[18] = height_;
-  information_[19] = width_;
-  information_[20] = rowOutlineLevel_;
-  information_[21] = colOutlineLevel_;
-  information_[22] = style_format_;
-  information_[23] = local_format_id_;
-
-  std::vector<std::string> names(24);
-  names[0]  = "sheet";
-  names[1]  = "address";
-  names[2]  = "row";
-  names[3]  = "col";
-  names[4]  = "is_blank";
-  names[5]  = "content";
-  names[6]  = "data_type";
-  names[7]  = "error";
-  names[8]  = "logical";
-  names[9]  = "numeric";
-  names[10]  = "date";
-  names[11] = "character";
-  names[12] = "character_formatted";
-  names[13] = "formula";
-  names[14] = "is_array";
-  names[15] = "formula_ref";
-  names[16] = "formula_group";
-  names[17] = "comment";
-  names[18] = "height";
-  names[19] = "width";
-  names[20] = "row_outline_level";
-  names[21] = "col_outline_level";
-  names[22] = "style_format";
-  names[23] = "local_format_id";
-
-  information_.attr("names") = names;
+bool xlsxbook::nextChunk(unsigned long long int chunk_size) {
+  // Parse the next chunk_size cells, or fewer if fewer are left, resuming
+  // where the last chunk stopped, and moving on to the next sheet when one is
+  // finished.  Only the DOM of one sheet is held at a time.  Shared formulas
+  // are expanded, so that the map of their definitions is all that has to be
+  // kept between chunks.  Returns false when there are no cells left.
+  //
+  // Sheets are read, and their cells counted, only when they are needed to
+  // fill a chunk, so the text of a sheet is held from the first chunk that
+  // has its cells to the last.
+  countCells();
+  while (cellcount_ - chunk_cells_ < chunk_size
+         && sheets_.size() < sheet_paths_.size()) {
+    size_t next = sheets_.size();
+    sheet_xml_[next] = archive_.read(sheet_paths_[next], sheet_buffers_[next]);
+    createSheet(next);
+    cellcount_ += sheets_.back().cellcount_;
+  }
+  unsigned long long int remaining = cellcount_ - chunk_cells_;
+  if (remaining == 0) {
+    return false;
+  }
+  cellcount_ = std::min(chunk_size, remaining);
+  sink_->resize(cellcount_);
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(information_[0]);
-  information_.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  information_.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  unsigned long long int i(0); // position of each cell in the output vectors
+  while (i < cellcount_ && chunk_sheet_ < sheets_.size()) {
+    xlsxsheet& sheet = sheets_[chunk_sheet_];
+    if (!chunk_started_) {
+      chunk_doc_.parse<rapidxml::parse_strip_xml_namespaces>(sheet_xml_[chunk_sheet_]);
+      rapidxml::xml_node<>* worksheet = chunk_doc_.first_node("worksheet");
+      sheet.startSheetData(worksheet->first_node("sheetData"));
+      chunk_started_ = true;
+    }
+    if (sheet.parseSheetData(i, cellcount_)) {
+      sheet.appendComments(i, cellcount_);
+      if (sheet.comments_.empty()) { // finished, so let it go
+        chunk_doc_.clear();
+        std::string().swap(sheet_buffers_[chunk_sheet_]);
+        ++chunk_sheet_;
+        chunk_started_ = false;
+      }
+    }
+  }
+  chunk_cells_ += cellcount_;
+  return true;
 }
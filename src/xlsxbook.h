@@ -1,79 +1,79 @@
 #ifndef XLSXBOOK_
 #define XLSXBOOK_
 
-#include <Rcpp.h>
+#include <string>
+#include <vector>
 #include "rapidxml.h"
+#include "zip.h"
+#include "inflater.h"
+#include "cellsink.h"
 #include "xlsxsheet.h"
-#include "xlsxstyles.h"
+#include "xlsxstyleindex.h"
+#include "mergedrange.h"
 
+// The cells of a workbook, written to a cellsink, one sheet after another.
+// Doesn't use R, so that it can be built into other tools than the R package.
 class xlsxbook {
 
   public:
 
-    const std::string& path_;              // workbook path
-    Rcpp::CharacterVector sheet_paths_;    // worksheet paths
-    Rcpp::CharacterVector sheet_names_;    // worksheet names
-    Rcpp::CharacterVector comments_paths_; // comments files
-    std::vector<std::string> strings_;     // strings table
-    Rcpp::List strings_formatted_;         // strings with inline formatting
-                                                // list of data frames
-    xlsxstyles styles_;
+    ziparchive& archive_;                     // workbook, from a path or memory
+    std::vector<std::string> sheet_paths_;    // worksheet paths
+    std::vector<std::string> sheet_names_;    // worksheet names
+    std::vector<std::string> comments_paths_; // comments files, empty if none
+    std::vector<std::string> strings_;        // strings table
+    xlsxstyleindex styles_; // just what is needed to read cells
 
     int dateSystem_; // 1900 or 1904
     int dateOffset_; // for converting 1900 or 1904 Excel datetimes to R
 
-    std::vector<std::string> sheet_xml_; // xml of worksheets
+    std::vector<char*> sheet_xml_;          // xml of worksheets, either in
+                                            // archive_ or in sheet_buffers_
+    std::vector<std::string> sheet_buffers_; // inflated worksheets
+    inflater inflater_;                     // of sheet_buffers_, in the
+                                            // background.  Must come after
+                                            // sheet_buffers_.
     std::vector<xlsxsheet> sheets_;      // worksheet objects
     unsigned long long int cellcount_;   // total cellcount of all sheets
 
-    Rcpp::List information_;             // dataframes of cells
+    cellsink* sink_;           // where the cells are written
 
     bool include_blank_cells_; // whether to include cells with no value
+    bool expand_shared_formulas_; // whether to offset every shared formula
+    merge_mode merge_mode_;       // whether to cache merged ranges
 
-    // Vectors of cell properties, to be wrapped in a data frame
-    Rcpp::CharacterVector sheet_;     // The worksheet that a cell is in
-    Rcpp::CharacterVector address_;   // Value of cell node r
-    Rcpp::IntegerVector   row_;       // Parsed address_ (one-based)
-    Rcpp::IntegerVector   col_;       // Parsed address_ (one-based)
-    Rcpp::LogicalVector   is_blank_;
-    Rcpp::CharacterVector content_;   // Raw cell value before type conversion
-    Rcpp::CharacterVector data_type_; // Type of the parsed value
-    Rcpp::CharacterVector error_;     // Parsed value
-    Rcpp::LogicalVector   logical_;   // Parsed value
-    Rcpp::NumericVector   numeric_;   // Parsed value
-    Rcpp::NumericVector   date_;      // Parsed value
-    Rcpp::CharacterVector character_; // Parsed value
-    Rcpp::CharacterVector formula_;   // If present
-    Rcpp::LogicalVector   is_array_;  // If formulaType is present
-    Rcpp::CharacterVector formula_ref_;   // If present
-    Rcpp::IntegerVector   formula_group_; // If present
-    Rcpp::CharacterVector comment_;
-    Rcpp::List            character_formatted_; // data frame
-    Rcpp::NumericVector   height_;          // Provided to cell constructor
-    Rcpp::NumericVector   width_;           // Provided to cell constructor
-    Rcpp::NumericVector   rowOutlineLevel_; // Provided to cell constructor
-    Rcpp::NumericVector   colOutlineLevel_; // Provided to cell constructor
-    Rcpp::CharacterVector style_format_;    // cellXfs xfId links to cellStyleXfs entry
-    Rcpp::IntegerVector   local_format_id_; // cell 'c' links to cellXfs entry
+    // Cells that define shared formulas, when they aren't expanded
+    std::vector<unsigned long long int> shared_formula_cells_;
 
-    xlsxbook(const std::string& path);    // constructor
+    // Where nextChunk() got to
+    rapidxml::xml_document<> chunk_doc_;  // DOM of the sheet being read
+    size_t chunk_sheet_;                  // position of that sheet
+    bool chunk_started_;                  // whether it has been parsed
+    unsigned long long int chunk_cells_;  // cells returned so far
+
+    xlsxbook(ziparchive& archive);        // strings, styles and dates only,
+                                          // for xlsxtable
 
     xlsxbook(
-        const std::string& path,
-        Rcpp::CharacterVector& sheet_names,
-        Rcpp::CharacterVector& sheet_paths,
-        Rcpp::CharacterVector& comments_paths,
-        const bool& include_blank_cells
+        ziparchive& archive,
+        const std::vector<std::string>& sheet_paths,
+        const std::vector<std::string>& sheet_names,
+        const std::vector<std::string>& comments_paths,
+        cellsink& sink,
+        const bool& include_blank_cells,
+        const bool& expand_shared_formulas,
+        const merge_mode& merged_cells,
+        const bool& chunked = false // leave the cells to nextChunk()
         );
 
-    void cacheStrings();
-    void cacheDateOffset(rapidxml::xml_node<>* workbook);
+    void cacheStrings(); // and give them to the sink, for their formatting
+    void cacheDateOffset();
     void cacheSheetXml();
     void createSheets();
+    void createSheet(size_t i); // once its xml is in sheet_xml_
     void countCells();
-    void initializeColumns();
     void cacheCells();
-    void cacheInformation();
+    bool nextChunk(unsigned long long int chunk_size); // whether any were left
 
 };
 
@@ -1,26 +1,25 @@
-#include <Rcpp.h>
+#include <cstdlib>
 #include "rapidxml.h"
+#include "cellsink.h"
 #include "xlsxbook.h"
 #include "xlsxcell.h"
 #include "xlsxsheet.h"
 #include "string.h"
-#include "date.h"
 #include "utils.h"
 
-using namespace Rcpp;
-
 xlsxcell::xlsxcell(
     rapidxml::xml_node<>* cell,
     xlsxsheet* sheet,
     xlsxbook& book,
     unsigned long long int& i,
     int& j,
-    int& k
+    int& k,
+    cellrecord& out
     ) {
-    parseAddress(cell, sheet, book, i, j, k);
-    cacheComment(sheet, book, i);
-    cacheValue  (cell, sheet, book, i); // Also caches format, as inextricable
-    cacheFormula(cell, sheet, book, i);
+    parseAddress(cell, sheet, book, i, j, k, out);
+    cacheComment(sheet, book, i, out);
+    cacheValue  (cell, sheet, book, i, out); // Also caches format, as inextricable
+    cacheFormula(cell, sheet, book, i, out);
 }
 
 // Based on tidyverse/readxl
@@ -29,39 +28,38 @@ xlsxcell::xlsxcell(
 // row_ and column_ are one-based
 void xlsxcell::parseAddress(
     rapidxml::xml_node<>* cell,
-    xlsxsheet* sheet,
-    xlsxbook& book,
-    unsigned long long int& i,
+    xlsxsheet* /* sheet */,
+    xlsxbook& /* book */,
+    unsigned long long int& /* i */,
     int& j,
-    int& k
+    int& k,
+    cellrecord& out
     ) {
   rapidxml::xml_attribute<>* ref = cell->first_attribute("r");
 
   if (ref) {
-    address_ = ref->value(); // we need this std::string in a moment
+    out.address_ = ref->value(); // we need this std::string in a moment
   } else {
-    address_ = asA1(j + 1, k + 1).c_str();
+    out.address_ = asA1(j + 1, k + 1);
   }
 
-  book.address_[i] = address_;
-
-  col_ = k + 1;
-  row_ = j + 1;
-
-  book.col_[i] = col_;
-  book.row_[i] = row_;
+  out.col_ = k + 1;
+  out.row_ = j + 1;
 }
 
 void xlsxcell::cacheComment(
     xlsxsheet* sheet,
-    xlsxbook& book,
-    unsigned long long int& i
+    xlsxbook& /* book */,
+    unsigned long long int& /* i */,
+    cellrecord& out
     ) {
-  // Look up any comment using the address, and delete it if found
+  // Look up any comment using the address, and delete it if found, keeping its
+  // text until the cell has been written
   std::map<std::string, std::string>& comments = sheet->comments_;
-  std::map<std::string, std::string>::iterator it = comments.find(address_);
+  std::map<std::string, std::string>::iterator it = comments.find(out.address_);
   if(it != comments.end()) {
-    SET_STRING_ELT(book.comment_, i, Rf_mkCharCE(it->second.c_str(), CE_UTF8));
+    sheet->comment_buffer_.swap(it->second);
+    out.comment_ = &sheet->comment_buffer_;
     comments.erase(it);
   }
 }
@@ -70,16 +68,17 @@ void xlsxcell::cacheValue(
     rapidxml::xml_node<>* cell,
     xlsxsheet* sheet,
     xlsxbook& book,
-    unsigned long long int& i
+    unsigned long long int& /* i */,
+    cellrecord& out
     ) {
   // 'v' for 'value' is either literal (numeric) or an index into a string table
   rapidxml::xml_node<>* v = cell->first_node("v");
   rapidxml::xml_node<>* is = cell->first_node("is");
 
-  std::string vvalue;
+  const char* vvalue = "";
   if (v != NULL) {
     vvalue = v->value();
-    SET_STRING_ELT(book.content_, i, Rf_mkCharCE(vvalue.c_str(), CE_UTF8));
+    out.content_ = vvalue;
   }
 
   // 't' for 'type' defines the meaning of 'v' for value
@@ -98,83 +97,82 @@ void xlsxcell::cacheValue(
   } else {
     svalue = 0;
   }
-  book.local_format_id_[i] = svalue + 1;
-  book.style_format_[i] = book.styles_.cellStyles_map_[book.styles_.cellXfs_[svalue].xfId_];
+  out.local_format_id_ = svalue + 1;
+  out.style_format_ = &book.styles_.cellStyles_map_[book.styles_.cellXfIndex_[svalue].xfId_];
 
   if (t != NULL && tvalue == "inlineStr") {
-    book.data_type_[i] = "character";
+    out.data_type_ = "character";
     if (is != NULL) { // Get the inline string if it's really there
       // Parse it as though it's a simple string
-      std::string inlineString;
+      std::string& inlineString = sheet->string_buffer_;
       parseString(is, inlineString); // value is modified in place
-      // Also parse it as though it's a formatted string
-      SET_STRING_ELT(book.character_, i, Rf_mkCharCE(inlineString.c_str(), CE_UTF8));
-      book.character_formatted_[i] = parseFormattedString(is, book.styles_);
+      // The sink can also parse it as though it's a formatted string
+      out.character_ = inlineString.c_str();
+      out.inline_string_ = is;
     }
     return;
   } else if (v == NULL) {
     // Can't now be an inline string (tested above)
-    book.is_blank_[i] = true;
-    book.data_type_[i] = "blank";
+    out.is_blank_ = true;
+    out.data_type_ = "blank";
     return;
   } else if (t == NULL || tvalue == "n") {
-    if (book.styles_.cellXfs_[svalue].applyNumberFormat_ == 1) {
+    if (book.styles_.cellXfIndex_[svalue].applyNumberFormat_ == 1) {
       // local number format applies
-      if (book.styles_.isDate_[book.styles_.cellXfs_[svalue].numFmtId_]) {
+      if (book.styles_.isDate_[book.styles_.cellXfIndex_[svalue].numFmtId_]) {
         // local number format is a date format
-        book.data_type_[i] = "date";
-        double date = strtod(vvalue.c_str(), NULL);
-        book.date_[i] = checkDate(date, book.dateSystem_, book.dateOffset_,
-                                  "'" + sheet->name_ + "'!" + address_);
+        // Cache the raw serial, for the sink to convert, like
+        // cellcolumns::convertDates() does
+        out.data_type_ = "date";
+        out.date_ = strtod(vvalue, NULL);
         return;
       } else {
-        book.data_type_[i] = "numeric";
-        book.numeric_[i] = strtod(vvalue.c_str(), NULL);
+        out.data_type_ = "numeric";
+        out.numeric_ = strtod(vvalue, NULL);
       }
     } else if ( // no known case # nocov start
           book.styles_.isDate_[
-            book.styles_.cellStyleXfs_[
-              book.styles_.cellXfs_[svalue].xfId_
+            book.styles_.cellStyleXfIndex_[
+              book.styles_.cellXfIndex_[svalue].xfId_
             ].numFmtId_
           ]
         ) {
       // style number format is a date format
-      book.data_type_[i] = "date";
-      double date = strtod(vvalue.c_str(), NULL);
-      book.date_[i] = checkDate(date, book.dateSystem_, book.dateOffset_,
-                                  "'" + sheet->name_ + "'!" + address_);
+      out.data_type_ = "date";
+      out.date_ = strtod(vvalue, NULL);
       return;
     } else {
-      book.data_type_[i] = "numeric";
-      book.numeric_[i] = strtod(vvalue.c_str(), NULL); // # nocov end
+      out.data_type_ = "numeric";
+      out.numeric_ = strtod(vvalue, NULL); // # nocov end
     }
   } else if (tvalue == "s") {
     // the t attribute exists and its value is exactly "s", so v is an index
     // into the string table.
-    book.data_type_[i] = "character";
-    SET_STRING_ELT(book.character_, i, Rf_mkCharCE(book.strings_[strtol(vvalue.c_str(), NULL, 10)].c_str(), CE_UTF8));
-    book.character_formatted_[i] = book.strings_formatted_[strtol(vvalue.c_str(), NULL, 10)];
+    out.data_type_ = "character";
+    long long int string = strtol(vvalue, NULL, 10);
+    out.character_ = book.strings_[string].c_str();
+    out.shared_string_ = string;
     return;
   } else if (tvalue == "str") {
     // Formula, which could have evaluated to anything, so only a string is safe
-    book.data_type_[i] = "character";
-    SET_STRING_ELT(book.character_, i, Rf_mkCharCE(vvalue.c_str(), CE_UTF8));
+    out.data_type_ = "character";
+    out.character_ = vvalue;
     return;
   } else if (tvalue == "b"){
-    book.data_type_[i] = "logical";
-    book.logical_[i] = strtod(vvalue.c_str(), NULL);
+    out.data_type_ = "logical";
+    out.logical_ = strtod(vvalue, NULL);
     return;
   } else if (tvalue == "e") {
-    book.data_type_[i] = "error";
-    book.error_[i] = vvalue;
+    out.data_type_ = "error";
+    out.error_ = vvalue;
     return;
   } else if (tvalue == "d") { // # nocov start
     // Does excel use this date type? Regardless, don't have cross-platform
     // ISO8601 parser (yet) so need to return as text.
-    book.data_type_[i] = "date (ISO8601)";
+    out.data_type_ = "date (ISO8601)";
     return; // # nocov end
   } else { // no known case
-    book.data_type_[i] = "unknown"; // # nocov start
+    out.data_type_ = "unknown"; // # nocov start
     return; // # nocov end
   }
 }
@@ -183,7 +181,8 @@ void xlsxcell::cacheFormula(
     rapidxml::xml_node<>* cell,
     xlsxsheet* sheet,
     xlsxbook& book,
-    unsigned long long int& i
+    unsigned long long int& i,
+    cellrecord& out
     ) {
   rapidxml::xml_node<>* f = cell->first_node("f");
   std::string formula;
@@ -191,18 +190,18 @@ void xlsxcell::cacheFormula(
   std::map<int, shared_formula>::iterator it;
   if (f != NULL) {
     formula = f->value();
-    SET_STRING_ELT(book.formula_, i, Rf_mkCharCE(formula.c_str(), CE_UTF8));
+    out.formula_ = f->value();
     rapidxml::xml_attribute<>* f_t = f->first_attribute("t");
     if (f_t != NULL) {
       std::string ftvalue(f_t->value());
       if (ftvalue == "array") {
-        book.is_array_[i] = true;
+        out.is_array_ = true;
       }
     }
 
     rapidxml::xml_attribute<>* ref = f->first_attribute("ref");
     if (ref != NULL) {
-      book.formula_ref_[i] = ref->value();
+      out.formula_ref_ = ref->value();
     }
 
     // Formulas are sometimes defined once, and then 'shared' with a range
@@ -210,13 +209,30 @@ void xlsxcell::cacheFormula(
     rapidxml::xml_attribute<>* si = f->first_attribute("si");
     if (si != NULL) {
       si_number = strtol(si->value(), NULL, 10);
-      book.formula_group_[i] = si_number;
+      out.formula_group_ = si_number;
       if (formula.length() == 0) { // inherits definition
-        it = sheet->shared_formulas_.find(si_number);
-        SET_STRING_ELT(book.formula_, i, Rf_mkCharCE(it->second.offset(row_, col_).c_str(), CE_UTF8));
+        if (book.expand_shared_formulas_) {
+          it = sheet->shared_formulas_.find(si_number);
+          std::string& buffer = sheet->formula_buffer_;
+          it->second.offset(out.row_, out.col_, buffer);
+          out.formula_ = buffer.c_str();
+        } else {
+          // Share the unexpanded string of the defining cell, to be offset
+          // later, if at all, by expand_shared_formulas().
+          std::map<int, const char*>::iterator defining =
+            sheet->shared_formula_text_.find(si_number);
+          if (defining != sheet->shared_formula_text_.end()) {
+            out.formula_ = defining->second;
+          }
+        }
       } else { // defines shared formula
-        shared_formula new_shared_formula(formula, row_, col_);
-        sheet->shared_formulas_.insert({si_number, new_shared_formula});
+        if (book.expand_shared_formulas_) {
+          shared_formula new_shared_formula(formula, out.row_, out.col_);
+          sheet->shared_formulas_.insert({si_number, new_shared_formula});
+        } else {
+          sheet->shared_formula_text_.insert({si_number, f->value()});
+          book.shared_formula_cells_.push_back(i);
+        }
       }
     }
   }
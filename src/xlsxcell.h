@@ -1,17 +1,15 @@
 #ifndef XLSXCELL_
 #define XLSXCELL_
 
-#include <Rcpp.h>
 #include "rapidxml.h"
+#include "cellsink.h"
 #include "xlsxbook.h"
 #include "xlsxsheet.h"
 
+// Parses a cell element into a cellrecord, which the sheet then gives to the
+// book's cellsink
 class xlsxcell {
 
-  std::string address_;
-  int col_;
-  int row_;
-
   public:
 
     xlsxcell(
@@ -20,7 +18,8 @@ class xlsxcell {
         xlsxbook& book,             // the parent workbook
         unsigned long long int& i,  // the index of the cell
         int& j,  // the index of the row (minus one indexed)
-        int& k   // the index of the column (minus one indexed)
+        int& k,  // the index of the column (minus one indexed)
+        cellrecord& out             // the parsed cell
         );
 
     void parseAddress(
@@ -29,27 +28,31 @@ class xlsxcell {
         xlsxbook& book,
         unsigned long long int& i,
         int& j,
-        int& k
+        int& k,
+        cellrecord& out
         );
 
     void cacheValue(
         rapidxml::xml_node<>* cell,
         xlsxsheet* sheet,
         xlsxbook& book,
-        unsigned long long int& i
+        unsigned long long int& i,
+        cellrecord& out
         );
 
     void cacheFormula(
         rapidxml::xml_node<>* cell,
         xlsxsheet* sheet,
         xlsxbook& book,
-        unsigned long long int& i
+        unsigned long long int& i,
+        cellrecord& out
         );
 
     void cacheComment(
         xlsxsheet* sheet,
         xlsxbook& book,
-        unsigned long long int& i
+        unsigned long long int& i,
+        cellrecord& out
         );
 
 };
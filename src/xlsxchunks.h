@@ -0,0 +1,45 @@
+#ifndef XLSXCHUNKS_
+#define XLSXCHUNKS_
+
+#include <Rcpp.h>
+#include "rziparchive.h"
+#include "rstring.h"
+#include "cellcolumns.h"
+#include "xlsxbook.h"
+
+// A workbook read a chunk of cells at a time, by xlsxbook::nextChunk(), for
+// xlsx_cells_chunked().  It owns the archive and the columns that the book
+// refers to, so that they live as long as it does, between calls from R.
+class xlsxchunks {
+
+  public:
+
+    rziparchive archive_;
+    cellcolumns columns_;
+    xlsxbook book_; // must come after the others
+
+    xlsxchunks(
+        SEXP path,
+        Rcpp::CharacterVector sheet_paths,
+        Rcpp::CharacterVector sheet_names,
+        Rcpp::CharacterVector comments_paths,
+        const bool& include_blank_cells,
+        const bool& include_formatted):
+      archive_(path),
+      columns_(include_formatted, merge_mode::NONE),
+      // Shared formulas are expanded, and merged cells aren't looked up,
+      // because both would need cells of earlier chunks
+      book_(archive_, emptyIfNA(sheet_paths), emptyIfNA(sheet_names),
+            emptyIfNA(comments_paths), columns_, include_blank_cells, true,
+            merge_mode::NONE, true) {}
+
+    SEXP nextChunk(unsigned long long int chunk_size) { // data frame, or NULL
+      if (!book_.nextChunk(chunk_size)) {
+        return R_NilValue;
+      }
+      return columns_.information();
+    }
+
+};
+
+#endif
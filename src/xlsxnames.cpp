@@ -2,12 +2,13 @@
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxnames.h"
+#include "tibble.h"
 
 using namespace Rcpp;
 
-xlsxnames::xlsxnames(const std::string& path) {
+xlsxnames::xlsxnames(ziparchive& archive) {
   // Names are stored at the workbook level, even if scoped to sheets
-  std::string book = zip_buffer(path, "xl/workbook.xml");
+  std::string book = zip_buffer(archive, "xl/workbook.xml");
 
   rapidxml::xml_document<> xml;
   xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
@@ -82,7 +83,7 @@ List& xlsxnames::information() {
   // Turn list of vectors into a data frame without checking anything
   int n = Rf_length(information_[0]);
   information_.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  information_.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  setCompactRowNames(information_, n);
 
   return information_;
 }
@@ -3,6 +3,7 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
+#include "zip.h"
 
 class xlsxnames {
 
@@ -16,7 +17,7 @@ class xlsxnames {
     Rcpp::CharacterVector comment_;
     Rcpp::LogicalVector   hidden_;
 
-    xlsxnames(const std::string& path);
+    xlsxnames(ziparchive& archive);
 
     Rcpp::List& information();       // Validation rules DF wrapped in list
 
@@ -1,4 +1,4 @@
-#include <Rcpp.h>
+#include <cstdlib>
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxcell.h"
@@ -7,20 +7,18 @@
 #include "string.h"
 #include "utils.h"
 
-using namespace Rcpp;
-
 xlsxsheet::xlsxsheet(
     const std::string& name,
-    std::string& sheet_xml,
+    char* sheet_xml,
     xlsxbook& book,
-    String comments_path,
+    const std::string& comments_path,
     const bool& include_blank_cells
     ):
   name_(name),
   book_(book),
   include_blank_cells_(include_blank_cells) {
   rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces | rapidxml::parse_non_destructive | rapidxml::parse_no_string_terminators | rapidxml::parse_no_entity_translation>(&sheet_xml[0]);
+  xml.parse<rapidxml::parse_strip_xml_namespaces | rapidxml::parse_non_destructive | rapidxml::parse_no_string_terminators | rapidxml::parse_no_entity_translation>(sheet_xml);
 
   rapidxml::xml_node<>* worksheet = xml.first_node("worksheet");
   rapidxml::xml_node<>* sheetData = worksheet->first_node("sheetData");
@@ -143,15 +141,18 @@ unsigned long long int xlsxsheet::cacheCellcount(
         ref_val = asA1(j + 1, k + 1);
       }
       
+      // Comments on cells that are left out are appended as blank cells, so
+      // they only match cells that are included.
+      bool included = include_blank_cells_ || c->first_node() != NULL;
       comment = comments_.find(ref_val);
-      if(comment != comments_.end()) {
+      if(included && comment != comments_.end()) {
         ++commentcount;
       }
-      if (include_blank_cells_ || c->first_node() != NULL) {
+      if (included) {
         ++cellcount;
       }
       if ((cellcount + 1) % 1000 == 0) {
-        checkUserInterrupt();
+        book_.sink_->checkInterrupt();
       }
       k++;
     }
@@ -161,14 +162,15 @@ unsigned long long int xlsxsheet::cacheCellcount(
   return(cellcount_);
 }
 
-void xlsxsheet::cacheComments(String comments_path) {
+void xlsxsheet::cacheComments(const std::string& comments_path) {
   // Having constructed the map, they will each be deleted when they are matched
   // to a cell.  That will leave only those comments that are on empty cells.
   // Those are then appended as empty cells with comments.
-  if (comments_path != NA_STRING) {
-    std::string comments_file = zip_buffer(book_.path_, comments_path);
+  if (!comments_path.empty()) {
+    std::string buffer;
+    char* comments_file = book_.archive_.read(comments_path, buffer);
     rapidxml::xml_document<> xml;
-    xml.parse<rapidxml::parse_strip_xml_namespaces>(&comments_file[0]);
+    xml.parse<rapidxml::parse_strip_xml_namespaces>(comments_file);
 
     // Iterate over the comments to store the ref and text
     rapidxml::xml_node<>* comments = xml.first_node("comments");
@@ -189,123 +191,111 @@ void xlsxsheet::cacheComments(String comments_path) {
 void xlsxsheet::parseSheetData(
     rapidxml::xml_node<>* sheetData,
     unsigned long long int& i) {
-  // Iterate through rows and cells in sheetData.  Cell elements are children
-  // of row elements.  Columns are described elswhere in cols->col.
+  startSheetData(sheetData);
+  parseSheetData(i, ULLONG_MAX);
+}
+
+void xlsxsheet::startSheetData(rapidxml::xml_node<>* sheetData) {
   rowHeights_.assign(1048576, defaultRowHeight_); // cache rowHeight while here
   rowOutlineLevels_.assign(1048576, defaultRowOutlineLevel_); // cache rowOutlineLevel while here
-  unsigned long int rowNumber;
-
-  rapidxml::xml_node<> *row = sheetData->first_node("row");
-  if (!row)
-  {
-    return;
+  j_ = 0;
+  row_node_ = sheetData->first_node("row");
+  if (row_node_ != NULL) {
+    startRow();
   }
+}
 
-  int j = 0;
-  for (; row; row = row->next_sibling("row")) {
-
-    // if row declares its number, take this opportunity to update j
-    // when it exists, this row number is 1-indexed, but j is 0-indexed
-    rapidxml::xml_attribute<>* ref = row->first_attribute("r");
-    if (ref) {
-        j = std::atoi(ref->value()) - 1;
-    }
+void xlsxsheet::startRow() {
+  // if row declares its number, take this opportunity to update j
+  // when it exists, this row number is 1-indexed, but j is 0-indexed
+  rapidxml::xml_attribute<>* ref = row_node_->first_attribute("r");
+  if (ref) {
+      j_ = std::atoi(ref->value()) - 1;
+  }
 
-    
-    rowNumber = j + 1;
-    // Check for custom row height
-    double rowHeight = defaultRowHeight_;
-    rapidxml::xml_attribute<>* ht = row->first_attribute("ht");
-    if (ht != NULL) {
-      rowHeight = strtod(ht->value(), NULL);
-      rowHeights_[j] = rowHeight;
-    }
-    // Check for row outline level
-    unsigned int rowOutlineLevel = defaultRowOutlineLevel_;
-    rapidxml::xml_attribute<>* outlineLevel = row->first_attribute("outlineLevel");
-    if (outlineLevel != NULL) {
-      rowOutlineLevel = strtol(outlineLevel->value(), NULL, 10) + 1;
-      rowOutlineLevels_[j] = rowOutlineLevel;
-    }
+  // Check for custom row height
+  rowHeight_ = defaultRowHeight_;
+  rapidxml::xml_attribute<>* ht = row_node_->first_attribute("ht");
+  if (ht != NULL) {
+    rowHeight_ = strtod(ht->value(), NULL);
+    rowHeights_[j_] = rowHeight_;
+  }
+  // Check for row outline level
+  rowOutlineLevel_ = defaultRowOutlineLevel_;
+  rapidxml::xml_attribute<>* outlineLevel = row_node_->first_attribute("outlineLevel");
+  if (outlineLevel != NULL) {
+    rowOutlineLevel_ = strtol(outlineLevel->value(), NULL, 10) + 1;
+    rowOutlineLevels_[j_] = rowOutlineLevel_;
+  }
 
-    int k = 0;
+  k_ = 0;
+  cell_node_ = row_node_->first_node("c");
+}
 
-    if (include_blank_cells_) {
-      for (rapidxml::xml_node<>* c = row->first_node();
-          c; c = c->next_sibling()) {
+bool xlsxsheet::parseSheetData(
+    unsigned long long int& i,
+    unsigned long long int end) {
+  // Iterate through rows and cells in sheetData, from where the last call
+  // stopped, until cell i would be the end.  Cell elements are children of row
+  // elements.  Columns are described elswhere in cols->col.
+  for (; row_node_; ) {
+    for (; cell_node_; cell_node_ = cell_node_->next_sibling("c")) {
+      rapidxml::xml_node<>* c = cell_node_;
+
+      // if cell declares its location, take this opportunity to update j and k
+      rapidxml::xml_attribute<>* ref = c->first_attribute("r");
+      if (ref) {
+        std::pair<int, int> location = parseRef(ref->value());
+        j_ = location.first;
+        k_ = location.second;
+      }
 
-        // if cell declares its location, take this opportunity to update j and k
-        ref = c->first_attribute("r");
-        if (ref) {
-          std::pair<int, int> location = parseRef(ref->value());
-          j = location.first;
-          k = location.second;
+      // If cell has no child nodes then it is empty (no value or formula)
+      // besides maybe formatting (linked to via attributes not child nodes).
+      if (include_blank_cells_ || c->first_node() != NULL) {
+        if (i == end) {
+          return false; // resume from this cell
         }
-        
-        xlsxcell cell(c, this, book_, i, j, k);
+
+        record_.clear();
+        xlsxcell cell(c, this, book_, i, j_, k_, record_);
 
         // Sheet name, row height and col width aren't really determined by
         // the cell, so they're done in this sheet instance
-        book_.sheet_[i] = name_;
-        SET_STRING_ELT(book_.sheet_, i, Rf_mkCharCE(name_.c_str(), CE_UTF8));
-        book_.height_[i] = rowHeight;
-        book_.width_[i] = colWidths_[book_.col_[i] - 1];
-        book_.rowOutlineLevel_[i] = rowOutlineLevel;
-        book_.colOutlineLevel_[i] = colOutlineLevels_[book_.col_[i] - 1];
+        record_.sheet_ = &name_;
+        record_.height_ = rowHeight_;
+        record_.width_ = colWidths_[record_.col_ - 1];
+        record_.row_outline_level_ = rowOutlineLevel_;
+        record_.col_outline_level_ = colOutlineLevels_[record_.col_ - 1];
+        book_.sink_->cell(i, record_);
 
         ++i;
         if ((i + 1) % 1000 == 0)
-          checkUserInterrupt();
-        k++;
-      }
-    } else {
-      for (rapidxml::xml_node<>* c = row->first_node();
-          c; c = c->next_sibling()) {
-        // If cell has no child nodes then it is empty (no value or formula)
-        // besides maybe formatting (linked to via attributes not child nodes).
-        rapidxml::xml_node<>* first_child = c->first_node();
-        if (first_child != NULL) {
-
-          // if cell declares its location, take this opportunity to update j and k
-          ref = c->first_attribute("r");
-          if (ref) {
-            std::pair<int, int> location = parseRef(ref->value());
-            j = location.first;
-            k = location.second;
-          }
-          
-          xlsxcell cell(c, this, book_, i, j, k);
-
-          // TODO: check readxl's method of importing ranges
-
-          // Sheet name, row height and col width aren't really determined by
-          // the cell, so they're done in this sheet instance
-          book_.sheet_[i] = name_;
-          SET_STRING_ELT(book_.sheet_, i, Rf_mkCharCE(name_.c_str(), CE_UTF8));
-          book_.height_[i] = rowHeight;
-          book_.width_[i] = colWidths_[book_.col_[i] - 1];
-          book_.rowOutlineLevel_[i] = colOutlineLevels_[book_.col_[i] - 1];
-          book_.colOutlineLevel_[i] = rowOutlineLevel;
-
-          ++i;
-          if ((i + 1) % 1000 == 0)
-            checkUserInterrupt();
-        }
-        k++;
+          book_.sink_->checkInterrupt();
       }
+      k_++;
+    }
+    j_++;
+    row_node_ = row_node_->next_sibling("row");
+    if (row_node_ != NULL) {
+      startRow();
     }
-    j++;
   }
+  return true;
 }
 
-void xlsxsheet::appendComments(unsigned long long int& i) {
+void xlsxsheet::appendComments(
+    unsigned long long int& i,
+    unsigned long long int end) {
   // Having constructed the comments_ map, they are each be deleted when they
   // are matched to a cell.  That leaves only those comments that are on empty
-  // cells.  This code appends those remaining comments as empty cells.
+  // cells.  This code appends those remaining comments as empty cells, until
+  // cell i would be the end, deleting them as it goes.
   int col;
   int row;
-  for(std::map<std::string, std::string>::iterator it = comments_.begin();
-      it != comments_.end(); ++it) {
+  static const std::string normal("Normal");
+  std::map<std::string, std::string>::iterator it = comments_.begin();
+  while (it != comments_.end() && i < end) {
     // TODO: move address parsing to utils
     std::string address = it->first.c_str(); // we need this std::string in a moment
     // Iterate though the A1-style address string character by character
@@ -319,30 +309,46 @@ void xlsxsheet::appendComments(unsigned long long int& i) {
         col = 26 * col + (*iter - 'A' + 1); // Then do similarly with columns
       }
     }
-    SET_STRING_ELT(book_.sheet_, i, Rf_mkCharCE(name_.c_str(), CE_UTF8));
-    book_.address_[i] = address;
-    book_.row_[i] = row;
-    book_.col_[i] = col;
-    book_.is_blank_[i] = true;
-    book_.content_[i] = NA_STRING;
-    book_.data_type_[i] = "blank";
-    book_.error_[i] = NA_STRING;
-    book_.logical_[i] = NA_LOGICAL;
-    book_.numeric_[i] = NA_REAL;
-    book_.date_[i] = NA_REAL;
-    book_.character_[i] = NA_STRING;
-    book_.formula_[i] = NA_STRING;
-    book_.is_array_[i] = false;
-    book_.formula_ref_[i] = NA_STRING;
-    book_.formula_group_[i] = NA_INTEGER;
-    SET_STRING_ELT(book_.comment_, i, Rf_mkCharCE(it->second.c_str(), CE_UTF8));
-    book_.height_[i] = rowHeights_[row - 1];
-    book_.width_[i] = colWidths_[col - 1];
-    book_.rowOutlineLevel_[i] = rowOutlineLevels_[row - 1];
-    book_.colOutlineLevel_[i] = colOutlineLevels_[col - 1];
-    book_.style_format_[i] = "Normal";
-    book_.local_format_id_[i] = 1;
+    record_.clear();
+    record_.sheet_ = &name_;
+    record_.address_ = address;
+    record_.row_ = row;
+    record_.col_ = col;
+    record_.is_blank_ = true;
+    record_.data_type_ = "blank";
+    record_.comment_ = &it->second;
+    record_.height_ = rowHeights_[row - 1];
+    record_.width_ = colWidths_[col - 1];
+    record_.row_outline_level_ = rowOutlineLevels_[row - 1];
+    record_.col_outline_level_ = colOutlineLevels_[col - 1];
+    record_.style_format_ = &normal;
+    record_.local_format_id_ = 1;
+    book_.sink_->cell(i, record_);
     ++i;
+    it = comments_.erase(it);
+  }
+}
+
+void xlsxsheet::cacheMergeCells(rapidxml::xml_node<>* worksheet) {
+  merged_.clear();
+  rapidxml::xml_node<>* mergeCells = worksheet->first_node("mergeCells");
+  if (mergeCells == NULL)
+    return;
+
+  for (rapidxml::xml_node<>* mergeCell = mergeCells->first_node("mergeCell");
+      mergeCell; mergeCell = mergeCell->next_sibling("mergeCell")) {
+    rapidxml::xml_attribute<>* ref_attribute = mergeCell->first_attribute("ref");
+    if (ref_attribute == NULL)
+      continue;
+    mergedrange range;
+    range.ref_ = std::string(ref_attribute->value(), ref_attribute->value_size());
+    ref reference(range.ref_);
+    if (reference.row1_ == 0 || reference.col1_ == 0)
+      continue; // not a range of cells
+    range.first_row_ = reference.row1_;
+    range.first_col_ = reference.col1_;
+    range.last_row_ = reference.colon_ ? reference.row2_ : reference.row1_;
+    range.last_col_ = reference.colon_ ? reference.col2_ : reference.col1_;
+    merged_.push_back(range);
   }
-  // Iterate though the A1-style address string character by character
 }
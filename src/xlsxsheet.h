@@ -1,10 +1,15 @@
 #ifndef XLSXSHEET_
 #define XLSXSHEET_
 
-#include <Rcpp.h>
+#include <climits>
+#include <map>
+#include <string>
+#include <vector>
 #include "rapidxml.h"
+#include "cellsink.h"
 #include "xlsxbook.h"
 #include "shared_formula.h"
+#include "mergedrange.h"
 
 class xlsxbook;
 
@@ -25,25 +30,50 @@ class xlsxsheet {
     std::vector<int> colOutlineLevels_;
     std::vector<int> rowOutlineLevels_;
     std::map<int, shared_formula> shared_formulas_;
+    std::string formula_buffer_; // reused to render offset shared formulas
+    std::map<int, const char*> shared_formula_text_; // text of each shared
+                                    // formula, when they aren't expanded
     xlsxbook& book_; // reference to parent workbook
     std::map<std::string, std::string> comments_; // lookup table of comments
     bool include_blank_cells_; // whether to include cells with no value
+    std::vector<mergedrange> merged_; // ranges of merged cells
+
+    cellrecord record_;          // reused for each cell
+    std::string string_buffer_;  // reused for inline strings
+    std::string comment_buffer_; // comment of the cell being written
+
+    // Where parseSheetData() stopped, so that it can resume there, for
+    // reading a chunk of cells at a time
+    rapidxml::xml_node<>* row_node_;  // row being parsed
+    rapidxml::xml_node<>* cell_node_; // next cell of row_node_ to parse
+    int j_;                           // zero-based row of cell_node_
+    int k_;                           // zero-based column of cell_node_
+    double rowHeight_;                // of row_node_
+    int rowOutlineLevel_;             // of row_node_
 
     xlsxsheet(
         const std::string& name,
-        std::string& sheet_xml,
+        char* sheet_xml,
         xlsxbook& book,
-        Rcpp::String comments_path,
+        const std::string& comments_path, // empty if none
         const bool& include_blank_cells);
 
     void cacheDefaultRowColAttributes(rapidxml::xml_node<>* worksheet);
     void cacheColAttributes(rapidxml::xml_node<>* worksheet);
     unsigned long long int cacheCellcount(rapidxml::xml_node<>* sheetData);
-    void cacheComments(Rcpp::String comments_path);
+    void cacheComments(const std::string& comments_path);
     void parseSheetData(
         rapidxml::xml_node<>* sheetData,
         unsigned long long int& i);
-    void appendComments(unsigned long long int& i);
+    void startSheetData(rapidxml::xml_node<>* sheetData);
+    void startRow();
+    bool parseSheetData( // whether the sheet is finished
+        unsigned long long int& i,
+        unsigned long long int end);
+    void appendComments(
+        unsigned long long int& i,
+        unsigned long long int end = ULLONG_MAX);
+    void cacheMergeCells(rapidxml::xml_node<>* worksheet);
 
 };
 
@@ -0,0 +1,368 @@
+#include "zip.h"
+#include "rapidxml.h"
+#include "xlsxstyleindex.h"
+#include "defaultstyles.h"
+
+inline std::string unescape_numFmt(const std::string& s) {
+  std::string out;
+  out.reserve(s.size());
+  bool escaping(false);
+  for (size_t i = 0; i < s.size(); i++) {
+    if (escaping) {
+      escaping = false;
+      out.push_back(s[i]);
+    } else if (s[i] == '\\') {
+      escaping = true;
+      // skip
+    } else {
+      out.push_back(s[i]);
+    }
+  }
+  return out;
+}
+
+xfindex::xfindex(rapidxml::xml_node<>* xf) {
+  // As xf::int_value() and xf::bool_value(), without the rest of xf
+  rapidxml::xml_attribute<>* attribute = xf->first_attribute("numFmtId");
+  numFmtId_ = (attribute != NULL) ? strtol(attribute->value(), NULL, 10) : 0;
+  attribute = xf->first_attribute("xfId");
+  xfId_ = (attribute != NULL) ? strtol(attribute->value(), NULL, 10) : 0;
+  attribute = xf->first_attribute("applyNumberFormat");
+  applyNumberFormat_ = true;
+  if (attribute != NULL) {
+    std::string value = attribute->value();
+    applyNumberFormat_ = !(value == "0" || value == "false");
+  }
+}
+
+xlsxstyleindex::xlsxstyleindex(ziparchive& archive) {
+  cacheThemeRgb(archive);
+  cacheIndexedRgb();
+
+  // Try the styles.xml in the file.  If it doesn't define what is needed,
+  // then use the default one, which is only parsed if it is needed.
+  std::string styles1 = zip_buffer(archive, "xl/styles.xml");
+  rapidxml::xml_document<> styles_xml1;
+  styles_xml1.parse<rapidxml::parse_strip_xml_namespaces>(&styles1[0]);
+  rapidxml::xml_node<>* styleSheet1 = styles_xml1.first_node("styleSheet");
+
+  rapidxml::xml_node<>* numFmts = styleSheet1->first_node("numFmts");
+  rapidxml::xml_node<>* cellXfs = styleSheet1->first_node("cellXfs");
+  rapidxml::xml_node<>* cellStyleXfs = styleSheet1->first_node("cellStyleXfs");
+
+  std::string styles2;
+  rapidxml::xml_document<> styles_xml2;
+  rapidxml::xml_node<>* styleSheet2 = NULL;
+  if (numFmts == NULL || cellXfs == NULL || cellStyleXfs == NULL) {
+    styles2 = defaultStyles();
+    styles_xml2.parse<0>(&styles2[0]);
+    styleSheet2 = styles_xml2.first_node("styleSheet");
+  }
+
+  cacheNumFmts(numFmts != NULL ? styleSheet1 : styleSheet2);
+  cacheCellXfIndex(cellXfs != NULL ? styleSheet1 : styleSheet2);
+  if (cellStyleXfs != NULL) {
+    cacheCellStyleXfIndex(styleSheet1);
+    cacheCellStyles(styleSheet1);
+  } else {
+    cacheCellStyleXfIndex(styleSheet2);
+    cacheCellStyles(styleSheet2);
+  }
+}
+
+std::string xlsxstyleindex::rgb_string(rapidxml::xml_node<>* node) {
+  rapidxml::xml_node<>* child = node->first_node();
+  std::string name = child->name();
+  std::string out;
+  if (name == "a:sysClr") {
+    out = child->first_attribute("lastClr")->value();
+  } else { // assume the name is "srgbClr"
+    out = child->first_attribute("val")->value();
+  }
+  return(out);
+}
+
+void xlsxstyleindex::cacheThemeRgb(ziparchive& archive) {
+  theme_name_ = {"background1",
+                 "text1",
+                 "background2",
+                 "text2",
+                 "accent1",
+                 "accent2",
+                 "accent3",
+                 "accent4",
+                 "accent5",
+                 "accent6",
+                 "hyperlink",
+                 "followed-hyperlink"};
+  theme_.assign(12, std::string());
+  std::string FF = "FF";
+  if (archive.has_file("xl/theme/theme1.xml")) {
+    std::string theme1 = zip_buffer(archive, "xl/theme/theme1.xml");
+    rapidxml::xml_document<> theme1_xml;
+    theme1_xml.parse<0>(&theme1[0]);
+    rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
+    rapidxml::xml_node<>* themeElements = theme->first_node("a:themeElements");
+    rapidxml::xml_node<>* clrScheme = themeElements->first_node("a:clrScheme");
+
+    // First, four nodes in the wrong order
+    rapidxml::xml_node<>* color = clrScheme->first_node();
+    theme_[1] = FF + rgb_string(color);
+    color = color->next_sibling();
+    theme_[0] = FF + rgb_string(color);
+    color = color->next_sibling();
+    theme_[3] = FF + rgb_string(color);
+    color = color->next_sibling();
+    theme_[2] = FF + rgb_string(color);
+
+    // Then, eight more nodes in the correct order
+    // Can't reuse 'color' here, so use 'nextcolor'
+    int i = 4;
+    for (rapidxml::xml_node<>* nextcolor = color->next_sibling();
+        nextcolor; nextcolor = nextcolor->next_sibling()) {
+      theme_[i] = FF + rgb_string(nextcolor);
+      i++;
+    }
+  }
+}
+
+void xlsxstyleindex::cacheIndexedRgb() {
+  std::vector<std::string> indexed(82);
+  indexed[0]  = "FF000000";
+  indexed[1]  = "FFFFFFFF";
+  indexed[2]  = "FFFF0000";
+  indexed[3]  = "FF00FF00";
+  indexed[4]  = "FF0000FF";
+  indexed[5]  = "FFFFFF00";
+  indexed[6]  = "FFFF00FF";
+  indexed[7]  = "FF00FFFF";
+  indexed[8]  = "FF000000";
+  indexed[9]  = "FFFFFFFF";
+  indexed[10] = "FFFF0000";
+  indexed[11] = "FF00FF00";
+  indexed[12] = "FF0000FF";
+  indexed[13] = "FFFFFF00";
+  indexed[14] = "FFFF00FF";
+  indexed[15] = "FF00FFFF";
+  indexed[16] = "FF800000";
+  indexed[17] = "FF008000";
+  indexed[18] = "FF000080";
+  indexed[19] = "FF808000";
+  indexed[20] = "FF800080";
+  indexed[21] = "FF008080";
+  indexed[22] = "FFC0C0C0";
+  indexed[23] = "FF808080";
+  indexed[24] = "FF9999FF";
+  indexed[25] = "FF993366";
+  indexed[26] = "FFFFFFCC";
+  indexed[27] = "FFCCFFFF";
+  indexed[28] = "FF660066";
+  indexed[29] = "FFFF8080";
+  indexed[30] = "FF0066CC";
+  indexed[31] = "FFCCCCFF";
+  indexed[32] = "FF000080";
+  indexed[33] = "FFFF00FF";
+  indexed[34] = "FFFFFF00";
+  indexed[35] = "FF00FFFF";
+  indexed[36] = "FF800080";
+  indexed[37] = "FF800000";
+  indexed[38] = "FF008080";
+  indexed[39] = "FF0000FF";
+  indexed[40] = "FF00CCFF";
+  indexed[41] = "FFCCFFFF";
+  indexed[42] = "FFCCFFCC";
+  indexed[43] = "FFFFFF99";
+  indexed[44] = "FF99CCFF";
+  indexed[45] = "FFFF99CC";
+  indexed[46] = "FFCC99FF";
+  indexed[47] = "FFFFCC99";
+  indexed[48] = "FF3366FF";
+  indexed[49] = "FF33CCCC";
+  indexed[50] = "FF99CC00";
+  indexed[51] = "FFFFCC00";
+  indexed[52] = "FFFF9900";
+  indexed[53] = "FFFF6600";
+  indexed[54] = "FF666699";
+  indexed[55] = "FF969696";
+  indexed[56] = "FF003366";
+  indexed[57] = "FF339966";
+  indexed[58] = "FF003300";
+  indexed[59] = "FF333300";
+  indexed[60] = "FF993300";
+  indexed[61] = "FF993366";
+  indexed[62] = "FF333399";
+  indexed[63] = "FF333333";
+  indexed[64] = "FFFFFFFF"; // System foreground
+  indexed[65] = "FF000000"; // System background
+
+  indexed[81] = "FF000000"; // Undocumented comment text in black
+
+  indexed_.swap(indexed);
+}
+
+void xlsxstyleindex::cacheNumFmts(rapidxml::xml_node<>* styleSheet) {
+  rapidxml::xml_node<>* numFmts = styleSheet->first_node("numFmts");
+  // Iterate through custom formats once to get the maximum ID
+  int maxId = 49; // stores the max numFmtId encountered so far.
+  // If no custom formats are defined, then 49 covers the default formats.
+  if (numFmts != NULL) {
+    for (rapidxml::xml_node<>* numFmt = numFmts->first_node("numFmt");
+        numFmt; numFmt = numFmt->next_sibling()) {
+      int id = strtol(numFmt->first_attribute("numFmtId")->value(), NULL, 10);
+      maxId = (id > maxId) ? id : maxId;
+    }
+  }
+
+  // Define vectors the length of the max Id
+  std::vector<std::string> formatCodes(maxId + 1);
+  std::vector<signed char> isDate(maxId + 1, -1);
+
+  // Populate the default formats
+  formatCodes[0]  = "General";
+  formatCodes[1]  = "0";
+  formatCodes[2]  = "0.00";
+  formatCodes[3]  = "#;##0";
+  formatCodes[4]  = "#;##0.00";
+
+  formatCodes[9]  = "0%";
+  formatCodes[10] = "0.00%";
+  formatCodes[11] = "0.00E+00";
+  formatCodes[12] = "# ?/?";
+  formatCodes[13] = "# ?\?/?\?"; // Backslashes to escape the trigraph
+  formatCodes[14] = "mm-dd-yy";
+  formatCodes[15] = "d-mmm-yy";
+  formatCodes[16] = "d-mmm";
+  formatCodes[17] = "mmm-yy";
+  formatCodes[18] = "h:mm AM/PM";
+  formatCodes[19] = "h:mm:ss AM/PM";
+  formatCodes[20] = "h:mm";
+  formatCodes[21] = "h:mm:ss";
+  formatCodes[22] = "m/d/yy h:mm";
+
+  formatCodes[37] = "#;##0 ;(#;##0)";
+  formatCodes[38] = "#;##0 ;[Red](#;##0)";
+  formatCodes[39] = "#;##0.00;(#;##0.00)";
+  formatCodes[40] = "#;##0.00;[Red](#;##0.00)";
+
+  formatCodes[45] = "mm:ss";
+  formatCodes[46] = "[h]:mm:ss";
+  formatCodes[47] = "mmss.0";
+  formatCodes[48] = "##0.0E+0";
+  formatCodes[49] = "@";
+
+  isDate[0]  = false;
+  isDate[1]  = false;
+  isDate[2]  = false;
+  isDate[3]  = false;
+  isDate[4]  = false;
+
+  isDate[9]  = false;
+  isDate[10] = false;
+  isDate[11] = false;
+  isDate[12] = false;
+  isDate[13] = false;
+  isDate[14] = true;
+  isDate[15] = true;
+  isDate[16] = true;
+  isDate[17] = true;
+  isDate[18] = true;
+  isDate[19] = true;
+  isDate[20] = true;
+  isDate[21] = true;
+  isDate[22] = true;
+
+  isDate[37] = false;
+  isDate[38] = false;
+  isDate[39] = false;
+  isDate[40] = false;
+
+  isDate[45] = true;
+  isDate[46] = true;
+  isDate[47] = true;
+  isDate[48] = false;
+  isDate[49] = false;
+
+  // Compile the built-in formats, which can be overridden below
+  std::vector<numfmt> compiled;
+  compiled.reserve(maxId + 1);
+  for (int id = 0; id <= maxId; ++id) {
+    compiled.push_back(numfmt(builtinNumFmt(id)));
+  }
+
+  // Iterate through custom formats again to get the format codes, and compile
+  // them once each to determine which of them are dates.
+  if (numFmts != NULL) {
+    for (rapidxml::xml_node<>* numFmt = numFmts->first_node("numFmt");
+        numFmt; numFmt = numFmt->next_sibling()) {
+      int id = strtol(numFmt->first_attribute("numFmtId")->value(), NULL, 10);
+      std::string formatCode = numFmt->first_attribute("formatCode")->value();
+      formatCodes[id] = unescape_numFmt(formatCode);
+      compiled[id] = numfmt(formatCode);
+      isDate[id] = compiled[id].isDate();
+    }
+  }
+  compiledNumFmts_.swap(compiled);
+  numFmts_.swap(formatCodes);
+  isDate_.swap(isDate);
+}
+
+const numfmt& xlsxstyleindex::cellNumFmt(int cellXf) const {
+  // The local number format applies if applyNumberFormat, otherwise the one
+  // of the cell's style, as in xlsxcell::cacheValue().  Unknown ids are
+  // "General".
+  int id = 0;
+  if (cellXf >= 0 && cellXf < (int) cellXfIndex_.size()) {
+    const xfindex& local = cellXfIndex_[cellXf];
+    if (local.applyNumberFormat_ == 1) {
+      id = local.numFmtId_;
+    } else if (local.xfId_ >= 0 && local.xfId_ < (int) cellStyleXfIndex_.size()) {
+      id = cellStyleXfIndex_[local.xfId_].numFmtId_;
+    }
+  }
+  if (id < 0 || id >= (int) compiledNumFmts_.size()) {
+    id = 0;
+  }
+  return compiledNumFmts_[id];
+}
+
+void xlsxstyleindex::cacheCellXfIndex(rapidxml::xml_node<>* styleSheet) {
+  rapidxml::xml_node<>* cellXfs = styleSheet->first_node("cellXfs");
+  for (rapidxml::xml_node<>* xf_node = cellXfs->first_node("xf");
+      xf_node; xf_node = xf_node->next_sibling()) {
+    cellXfIndex_.push_back(xfindex(xf_node));
+  }
+}
+
+void xlsxstyleindex::cacheCellStyleXfIndex(rapidxml::xml_node<>* styleSheet) {
+  rapidxml::xml_node<>* cellStyleXfs = styleSheet->first_node("cellStyleXfs");
+  for (rapidxml::xml_node<>* xf_node = cellStyleXfs->first_node("xf");
+      xf_node; xf_node = xf_node->next_sibling()) {
+    cellStyleXfIndex_.push_back(xfindex(xf_node));
+  }
+}
+
+void xlsxstyleindex::cacheCellStyles(rapidxml::xml_node<>* styleSheet) {
+  // Get the names of the styles, if available
+  rapidxml::xml_node<>* cellStyles = styleSheet->first_node("cellStyles");
+  if (cellStyles != NULL) {
+    // Get the names, which aren't necessarily in xf order
+    int index;
+    int max_index = 0;
+    for (rapidxml::xml_node<>* cellStyle = cellStyles->first_node("cellStyle");
+        cellStyle; cellStyle = cellStyle->next_sibling()) {
+      index = strtol(cellStyle->first_attribute("xfId")->value(), NULL, 10);
+      cellStyles_map_.insert({index, cellStyle->first_attribute("name")->value()});
+      if (index > max_index) {
+        max_index = index;
+      }
+    }
+    // Sort them
+    for (std::map<int, std::string>::iterator i = cellStyles_map_.begin();
+        i != cellStyles_map_.end(); i++) {
+      cellStyles_.push_back(i->second);
+    }
+  } else {
+    // Gnumeric xlsx files have a single, unnamed style
+    cellStyles_.push_back(std::string());
+  }
+}
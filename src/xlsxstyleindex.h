@@ -0,0 +1,60 @@
+#ifndef XLSXSTYLEINDEX_
+#define XLSXSTYLEINDEX_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "rapidxml.h"
+#include "numfmt.h"
+#include "zip.h"
+
+// The attributes of an xf element that are needed to resolve the style and
+// number format of a cell.  Defaults are the same as in xf.
+struct xfindex {
+  int numFmtId_;
+  int xfId_;
+  int applyNumberFormat_;
+  xfindex(rapidxml::xml_node<>* xf);
+};
+
+// Just enough of the stylesheet to read cells: number formats, the cellXfs and
+// cellStyleXfs that link cells to them, the names of cell styles, and the
+// theme and indexed colours of formatted strings.  Fonts, fills, borders etc.
+// are parsed by xlsxstyles, which builds on this, for xlsx_formats().
+//
+// Strings that aren't known, such as theme colours when there is no theme,
+// are empty, and become NA in R.
+class xlsxstyleindex {
+
+  public:
+
+    std::vector<std::string> theme_name_; // name of theme, e.g. "accent1"
+    std::vector<std::string> theme_;      // rgb equivalent of theme no.
+    std::vector<std::string> indexed_;    // rgb equivalent of index no.
+
+    std::vector<xfindex> cellXfIndex_;      // cellXfs, minimally
+    std::vector<xfindex> cellStyleXfIndex_; // cellStyleXfs, minimally
+    std::vector<std::string> cellStyles_; // names of cell styles, ordered by xfId
+    std::map<int, std::string> cellStyles_map_; // map of cell style names, for lookup by xfId
+
+    std::vector<std::string> numFmts_;
+    std::vector<signed char> isDate_; // 1, 0, or -1 if the id isn't known,
+                                      // which is taken to be a date
+    std::vector<numfmt> compiledNumFmts_; // numFmts_ compiled, by numFmtId
+
+    xlsxstyleindex(ziparchive& archive);
+
+    void cacheThemeRgb(ziparchive& archive);
+    void cacheIndexedRgb();
+
+    void cacheNumFmts(rapidxml::xml_node<>* styleSheet);
+    void cacheCellXfIndex(rapidxml::xml_node<>* styleSheet);
+    void cacheCellStyleXfIndex(rapidxml::xml_node<>* styleSheet);
+    void cacheCellStyles(rapidxml::xml_node<>* styleSheet);
+    const numfmt& cellNumFmt(int cellXf) const; // number format of a cellXfs entry
+
+    std::string rgb_string(rapidxml::xml_node<>* node); // Extract the RGB string from a node that references a colour
+
+};
+
+#endif
@@ -4,41 +4,25 @@
 #include "xlsxstyles.h"
 #include "xf.h"
 #include "color.h"
-#include "date.h"
+#include "defaultstyles.h"
+#include "rstring.h"
+#include "tibble.h"
+#include <cstring>
+#include <unordered_map>
 
 using namespace Rcpp;
 
-inline std::string unescape_numFmt(const std::string& s) {
-  std::string out;
-  out.reserve(s.size());
-  bool escaping(false);
-  for (size_t i = 0; i < s.size(); i++) {
-    if (escaping) {
-      escaping = false;
-      out.push_back(s[i]);
-    } else if (s[i] == '\\') {
-      escaping = true;
-      // skip
-    } else {
-      out.push_back(s[i]);
-    }
-  }
-  return out;
-}
-
-xlsxstyles::xlsxstyles(const std::string& path) {
-  cacheThemeRgb(path);
-  cacheIndexedRgb();
-
+// Theme and indexed colours, number formats and the names of cell styles are
+// cached by xlsxstyleindex.  This parses the rest of the stylesheet.
+xlsxstyles::xlsxstyles(ziparchive& archive): xlsxstyleindex(archive) {
   // Try the styles.xml in the file.  If it doesn't define what is needed,
-  // then use a default file
-  std::string styles1 = zip_buffer(path, "xl/styles.xml");
+  // then use the default one
+  std::string styles1 = zip_buffer(archive, "xl/styles.xml");
   rapidxml::xml_document<> styles_xml1;
   styles_xml1.parse<rapidxml::parse_strip_xml_namespaces>(&styles1[0]);
   rapidxml::xml_node<>* styleSheet1 = styles_xml1.first_node("styleSheet");
 
   // Find elements of the stylesheet, if they exist
-  rapidxml::xml_node<>* numFmts = styleSheet1->first_node("numFmts");
   rapidxml::xml_node<>* cellXfs = styleSheet1->first_node("cellXfs");
   rapidxml::xml_node<>* cellStyleXfs = styleSheet1->first_node("cellStyleXfs");
   rapidxml::xml_node<>* fonts = styleSheet1->first_node("fonts");
@@ -46,18 +30,12 @@ xlsxstyles::xlsxstyles(const std::string& path) {
   rapidxml::xml_node<>* borders = styleSheet1->first_node("borders");
 
   // Prepare to parse default styles
-  std::string styles2 = zip_buffer(extdata() + "/default.xlsx", "xl/styles.xml");
+  std::string styles2 = defaultStyles();
   rapidxml::xml_document<> styles_xml2;
   styles_xml2.parse<0>(&styles2[0]);
   rapidxml::xml_node<>* styleSheet2 = styles_xml2.first_node("styleSheet");
 
   // Parse styles from either the given stylesheet or the default stylesheet
-  if (numFmts != NULL) {
-    cacheNumFmts(styleSheet1);
-  } else {
-    cacheNumFmts(styleSheet2);
-  }
-
   if (cellXfs != NULL) {
     cacheCellXfs(styleSheet1);
   } else {
@@ -88,237 +66,12 @@ xlsxstyles::xlsxstyles(const std::string& path) {
     cacheBorders(styleSheet2);
   }
 
-  applyFormats();
-  style_ = zipFormats(style_formats_, true);
-  local_ = zipFormats(local_formats_, false);
-}
-
-std::string xlsxstyles::rgb_string(rapidxml::xml_node<>* node) {
-  rapidxml::xml_node<>* child = node->first_node();
-  std::string name = child->name();
-  std::string out;
-  if (name == "a:sysClr") {
-    out = child->first_attribute("lastClr")->value();
-  } else { // assume the name is "srgbClr"
-    out = child->first_attribute("val")->value();
+  style_names_ = CharacterVector(cellStyles_.size());
+  for (size_t i = 0; i < cellStyles_.size(); ++i) {
+    style_names_[i] = naIfEmpty(cellStyles_[i]);
   }
-  return(out);
-}
 
-void xlsxstyles::cacheThemeRgb(const std::string& path) {
-  theme_name_ =
-    CharacterVector::create("background1",
-                            "text1",
-                            "background2",
-                            "text2",
-                            "accent1",
-                            "accent2",
-                            "accent3",
-                            "accent4",
-                            "accent5",
-                            "accent6",
-                            "hyperlink",
-                            "followed-hyperlink");
-  theme_ = CharacterVector(12, NA_STRING);
-  std::string FF = "FF";
-  if (zip_has_file(path, "xl/theme/theme1.xml")) {
-    std::string theme1 = zip_buffer(path, "xl/theme/theme1.xml");
-    rapidxml::xml_document<> theme1_xml;
-    theme1_xml.parse<0>(&theme1[0]);
-    rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
-    rapidxml::xml_node<>* themeElements = theme->first_node("a:themeElements");
-    rapidxml::xml_node<>* clrScheme = themeElements->first_node("a:clrScheme");
-
-    // First, four nodes in the wrong order
-    rapidxml::xml_node<>* color = clrScheme->first_node();
-    theme_[1] = FF + rgb_string(color);
-    color = color->next_sibling();
-    theme_[0] = FF + rgb_string(color);
-    color = color->next_sibling();
-    theme_[3] = FF + rgb_string(color);
-    color = color->next_sibling();
-    theme_[2] = FF + rgb_string(color);
-
-    // Then, eight more nodes in the correct order
-    // Can't reuse 'color' here, so use 'nextcolor'
-    int i = 4;
-    for (rapidxml::xml_node<>* nextcolor = color->next_sibling();
-        nextcolor; nextcolor = nextcolor->next_sibling()) {
-      theme_[i] = FF + rgb_string(nextcolor);
-      i++;
-    }
-  }
-}
-
-void xlsxstyles::cacheIndexedRgb() {
-  CharacterVector indexed(82, NA_STRING);
-  indexed[0]  = "FF000000";
-  indexed[1]  = "FFFFFFFF";
-  indexed[2]  = "FFFF0000";
-  indexed[3]  = "FF00FF00";
-  indexed[4]  = "FF0000FF";
-  indexed[5]  = "FFFFFF00";
-  indexed[6]  = "FFFF00FF";
-  indexed[7]  = "FF00FFFF";
-  indexed[8]  = "FF000000";
-  indexed[9]  = "FFFFFFFF";
-  indexed[10] = "FFFF0000";
-  indexed[11] = "FF00FF00";
-  indexed[12] = "FF0000FF";
-  indexed[13] = "FFFFFF00";
-  indexed[14] = "FFFF00FF";
-  indexed[15] = "FF00FFFF";
-  indexed[16] = "FF800000";
-  indexed[17] = "FF008000";
-  indexed[18] = "FF000080";
-  indexed[19] = "FF808000";
-  indexed[20] = "FF800080";
-  indexed[21] = "FF008080";
-  indexed[22] = "FFC0C0C0";
-  indexed[23] = "FF808080";
-  indexed[24] = "FF9999FF";
-  indexed[25] = "FF993366";
-  indexed[26] = "FFFFFFCC";
-  indexed[27] = "FFCCFFFF";
-  indexed[28] = "FF660066";
-  indexed[29] = "FFFF8080";
-  indexed[30] = "FF0066CC";
-  indexed[31] = "FFCCCCFF";
-  indexed[32] = "FF000080";
-  indexed[33] = "FFFF00FF";
-  indexed[34] = "FFFFFF00";
-  indexed[35] = "FF00FFFF";
-  indexed[36] = "FF800080";
-  indexed[37] = "FF800000";
-  indexed[38] = "FF008080";
-  indexed[39] = "FF0000FF";
-  indexed[40] = "FF00CCFF";
-  indexed[41] = "FFCCFFFF";
-  indexed[42] = "FFCCFFCC";
-  indexed[43] = "FFFFFF99";
-  indexed[44] = "FF99CCFF";
-  indexed[45] = "FFFF99CC";
-  indexed[46] = "FFCC99FF";
-  indexed[47] = "FFFFCC99";
-  indexed[48] = "FF3366FF";
-  indexed[49] = "FF33CCCC";
-  indexed[50] = "FF99CC00";
-  indexed[51] = "FFFFCC00";
-  indexed[52] = "FFFF9900";
-  indexed[53] = "FFFF6600";
-  indexed[54] = "FF666699";
-  indexed[55] = "FF969696";
-  indexed[56] = "FF003366";
-  indexed[57] = "FF339966";
-  indexed[58] = "FF003300";
-  indexed[59] = "FF333300";
-  indexed[60] = "FF993300";
-  indexed[61] = "FF993366";
-  indexed[62] = "FF333399";
-  indexed[63] = "FF333333";
-  indexed[64] = "FFFFFFFF"; // System foreground
-  indexed[65] = "FF000000"; // System background
-
-  indexed[81] = "FF000000"; // Undocumented comment text in black
-
-  indexed_ = indexed;
-}
-
-void xlsxstyles::cacheNumFmts(rapidxml::xml_node<>* styleSheet) {
-  rapidxml::xml_node<>* numFmts = styleSheet->first_node("numFmts");
-  // Iterate through custom formats once to get the maximum ID
-  int maxId = 49; // stores the max numFmtId encountered so far.
-  // If no custom formats are defined, then 49 covers the default formats.
-  if (numFmts != NULL) {
-    for (rapidxml::xml_node<>* numFmt = numFmts->first_node("numFmt");
-        numFmt; numFmt = numFmt->next_sibling()) {
-      int id = strtol(numFmt->first_attribute("numFmtId")->value(), NULL, 10);
-      maxId = (id > maxId) ? id : maxId;
-    }
-  }
-
-  // Define vectors the length of the max Id
-  CharacterVector formatCodes(maxId + 1, NA_STRING);
-  LogicalVector   isDate(maxId + 1, NA_LOGICAL);
-
-  // Populate the default formats
-  formatCodes[0]  = "General";
-  formatCodes[1]  = "0";
-  formatCodes[2]  = "0.00";
-  formatCodes[3]  = "#;##0";
-  formatCodes[4]  = "#;##0.00";
-
-  formatCodes[9]  = "0%";
-  formatCodes[10] = "0.00%";
-  formatCodes[11] = "0.00E+00";
-  formatCodes[12] = "# ?/?";
-  formatCodes[13] = "# ?\?/?\?"; // Backslashes to escape the trigraph
-  formatCodes[14] = "mm-dd-yy";
-  formatCodes[15] = "d-mmm-yy";
-  formatCodes[16] = "d-mmm";
-  formatCodes[17] = "mmm-yy";
-  formatCodes[18] = "h:mm AM/PM";
-  formatCodes[19] = "h:mm:ss AM/PM";
-  formatCodes[20] = "h:mm";
-  formatCodes[21] = "h:mm:ss";
-  formatCodes[22] = "m/d/yy h:mm";
-
-  formatCodes[37] = "#;##0 ;(#;##0)";
-  formatCodes[38] = "#;##0 ;[Red](#;##0)";
-  formatCodes[39] = "#;##0.00;(#;##0.00)";
-  formatCodes[40] = "#;##0.00;[Red](#;##0.00)";
-
-  formatCodes[45] = "mm:ss";
-  formatCodes[46] = "[h]:mm:ss";
-  formatCodes[47] = "mmss.0";
-  formatCodes[48] = "##0.0E+0";
-  formatCodes[49] = "@";
-
-  isDate[0]  = false;
-  isDate[1]  = false;
-  isDate[2]  = false;
-  isDate[3]  = false;
-  isDate[4]  = false;
-
-  isDate[9]  = false;
-  isDate[10] = false;
-  isDate[11] = false;
-  isDate[12] = false;
-  isDate[13] = false;
-  isDate[14] = true;
-  isDate[15] = true;
-  isDate[16] = true;
-  isDate[17] = true;
-  isDate[18] = true;
-  isDate[19] = true;
-  isDate[20] = true;
-  isDate[21] = true;
-  isDate[22] = true;
-
-  isDate[37] = false;
-  isDate[38] = false;
-  isDate[39] = false;
-  isDate[40] = false;
-
-  isDate[45] = true;
-  isDate[46] = true;
-  isDate[47] = true;
-  isDate[48] = false;
-  isDate[49] = false;
-
-  // Iterate through custom formats again to get the format codes and to
-  // determine which of them are dates.
-  if (numFmts != NULL) {
-    for (rapidxml::xml_node<>* numFmt = numFmts->first_node("numFmt");
-        numFmt; numFmt = numFmt->next_sibling()) {
-      int id = strtol(numFmt->first_attribute("numFmtId")->value(), NULL, 10);
-      std::string formatCode = numFmt->first_attribute("formatCode")->value();
-      formatCodes[id] = unescape_numFmt(formatCode);
-      isDate[id] = isDateFormat(formatCode);
-    }
-  }
-  numFmts_ = formatCodes;
-  isDate_ = isDate;
+  applyFormats();
 }
 
 void xlsxstyles::cacheFonts(rapidxml::xml_node<>* styleSheet) {
@@ -366,30 +119,6 @@ void xlsxstyles::cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet) {
     cellStyleXfs_.push_back(xf);
     ++i;
   }
-
-  // Get the names of the styles, if available
-  rapidxml::xml_node<>* cellStyles = styleSheet->first_node("cellStyles");
-  if (cellStyles != NULL) {
-    // Get the names, which aren't necessarily in xf order
-    int index;
-    int max_index = 0;
-    for (rapidxml::xml_node<>* cellStyle = cellStyles->first_node("cellStyle");
-        cellStyle; cellStyle = cellStyle->next_sibling()) {
-      index = strtol(cellStyle->first_attribute("xfId")->value(), NULL, 10);
-      cellStyles_map_.insert({index, cellStyle->first_attribute("name")->value()});
-      if (index > max_index) {
-        max_index = index;
-      }
-    }
-    // Sort them
-    for (std::map<int, std::string>::iterator i = cellStyles_map_.begin();
-        i != cellStyles_map_.end(); i++) {
-      cellStyles_.push_back(i->second);
-    }
-  } else {
-    // Gnumeric xlsx files have a single, unnamed style
-    cellStyles_.push_back(NA_STRING);
-  }
 }
 
 void xlsxstyles::clone_color(color& from, colors& to, int& i) {
@@ -401,10 +130,10 @@ void xlsxstyles::clone_color(color& from, colors& to, int& i) {
 
 List xlsxstyles::list_color(colors& original, bool is_style) {
   if (is_style) {
-    original.rgb.attr("names") = cellStyles_;
-    original.theme.attr("names") = cellStyles_;
-    original.indexed.attr("names") = cellStyles_;
-    original.tint.attr("names") = cellStyles_;
+    original.rgb.attr("names") = style_names_;
+    original.theme.attr("names") = style_names_;
+    original.indexed.attr("names") = style_names_;
+    original.tint.attr("names") = style_names_;
   }
 
   List out = List::create(
@@ -636,7 +365,7 @@ List xlsxstyles::zipFormats(std::vector<xf> styles, bool is_style) {
     fill* fill = &fills_[styles[i].fillId_];
     border* border = &borders_[styles[i].borderId_];
 
-    numFmts[i] = numFmts_[styles[i].numFmtId_];
+    numFmts[i] = naIfEmpty(numFmts_[styles[i].numFmtId_]);
 
     fonts_b[i] = font->b_;
     fonts_i[i] = font->i_;
@@ -703,48 +432,48 @@ List xlsxstyles::zipFormats(std::vector<xf> styles, bool is_style) {
 
   if (is_style) {
     // name all the vectors using the style names
-    numFmts.attr("names") = cellStyles_;
-    fonts_b.attr("names") = cellStyles_;
-    fonts_i.attr("names") = cellStyles_;
-    fonts_u.attr("names") = cellStyles_;
-    fonts_strike.attr("names") = cellStyles_;
-    fonts_vertAlign.attr("names") = cellStyles_;
-    fonts_size.attr("names") = cellStyles_;
-    fonts_name.attr("names") = cellStyles_;
-    fonts_family.attr("names") = cellStyles_;
-    fonts_scheme.attr("names") = cellStyles_;
-    fills_patternFill_patternType.attr("names") = cellStyles_;
-    fills_gradientFill_type.attr("names") = cellStyles_;
-    fills_gradientFill_degree.attr("names") = cellStyles_;
-    fills_gradientFill_left.attr("names") = cellStyles_;
-    fills_gradientFill_right.attr("names") = cellStyles_;
-    fills_gradientFill_top.attr("names") = cellStyles_;
-    fills_gradientFill_bottom.attr("names") = cellStyles_;
-    fills_gradientFill_stop1_position.attr("names") = cellStyles_;
-    fills_gradientFill_stop2_position.attr("names") = cellStyles_;
-    borders_diagonalDown.attr("names") = cellStyles_;
-    borders_diagonalUp.attr("names") = cellStyles_;
-    borders_outline.attr("names") = cellStyles_;
-    borders_left_style.attr("names") = cellStyles_;
-    borders_right_style.attr("names") = cellStyles_;
-    borders_start_style.attr("names") = cellStyles_;
-    borders_end_style.attr("names") = cellStyles_;
-    borders_top_style.attr("names") = cellStyles_;
-    borders_bottom_style.attr("names") = cellStyles_;
-    borders_diagonal_style.attr("names") = cellStyles_;
-    borders_vertical_style.attr("names") = cellStyles_;
-    borders_horizontal_style.attr("names") = cellStyles_;
-    alignments_horizontal.attr("names") = cellStyles_;
-    alignments_vertical.attr("names") = cellStyles_;
-    alignments_wrapText.attr("names") = cellStyles_;
-    alignments_readingOrder.attr("names") = cellStyles_;
-    alignments_indent.attr("names") = cellStyles_;
-    alignments_justifyLastLine.attr("names") = cellStyles_;
-    alignments_shrinkToFit.attr("names") = cellStyles_;
-    alignments_textRotation.attr("names") = cellStyles_;
-
-    protections_locked.attr("names") = cellStyles_;
-    protections_hidden.attr("names") = cellStyles_;
+    numFmts.attr("names") = style_names_;
+    fonts_b.attr("names") = style_names_;
+    fonts_i.attr("names") = style_names_;
+    fonts_u.attr("names") = style_names_;
+    fonts_strike.attr("names") = style_names_;
+    fonts_vertAlign.attr("names") = style_names_;
+    fonts_size.attr("names") = style_names_;
+    fonts_name.attr("names") = style_names_;
+    fonts_family.attr("names") = style_names_;
+    fonts_scheme.attr("names") = style_names_;
+    fills_patternFill_patternType.attr("names") = style_names_;
+    fills_gradientFill_type.attr("names") = style_names_;
+    fills_gradientFill_degree.attr("names") = style_names_;
+    fills_gradientFill_left.attr("names") = style_names_;
+    fills_gradientFill_right.attr("names") = style_names_;
+    fills_gradientFill_top.attr("names") = style_names_;
+    fills_gradientFill_bottom.attr("names") = style_names_;
+    fills_gradientFill_stop1_position.attr("names") = style_names_;
+    fills_gradientFill_stop2_position.attr("names") = style_names_;
+    borders_diagonalDown.attr("names") = style_names_;
+    borders_diagonalUp.attr("names") = style_names_;
+    borders_outline.attr("names") = style_names_;
+    borders_left_style.attr("names") = style_names_;
+    borders_right_style.attr("names") = style_names_;
+    borders_start_style.attr("names") = style_names_;
+    borders_end_style.attr("names") = style_names_;
+    borders_top_style.attr("names") = style_names_;
+    borders_bottom_style.attr("names") = style_names_;
+    borders_diagonal_style.attr("names") = style_names_;
+    borders_vertical_style.attr("names") = style_names_;
+    borders_horizontal_style.attr("names") = style_names_;
+    alignments_horizontal.attr("names") = style_names_;
+    alignments_vertical.attr("names") = style_names_;
+    alignments_wrapText.attr("names") = style_names_;
+    alignments_readingOrder.attr("names") = style_names_;
+    alignments_indent.attr("names") = style_names_;
+    alignments_justifyLastLine.attr("names") = style_names_;
+    alignments_shrinkToFit.attr("names") = style_names_;
+    alignments_textRotation.attr("names") = style_names_;
+
+    protections_locked.attr("names") = style_names_;
+    protections_hidden.attr("names") = style_names_;
   }
 
   return List::create(
@@ -822,3 +551,192 @@ List xlsxstyles::zipFormats(std::vector<xf> styles, bool is_style) {
           _["locked"] = protections_locked,
           _["hidden"] = protections_hidden));
 }
+
+// Append a field to a key that identifies a resolved format.  Fields are
+// written as their bytes, and strings are prefixed by their length, so keys are
+// equal only if every field is.  NA strings have length -1, distinct from "NA".
+inline void appendKey(std::string& key, int x) {
+  key.append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+inline void appendKey(std::string& key, double x) {
+  key.append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+inline void appendKey(std::string& key, const String& x) {
+  if (x.get_sexp() == NA_STRING) {
+    appendKey(key, -1);
+    return;
+  }
+  const char* chars = x.get_cstring();
+  int n = strlen(chars);
+  appendKey(key, n);
+  key.append(chars, n);
+}
+
+inline void appendKey(std::string& key, const color& x) {
+  appendKey(key, x.rgb_);
+  appendKey(key, x.theme_);
+  appendKey(key, x.indexed_);
+  appendKey(key, x.tint_);
+}
+
+inline void appendKey(std::string& key, const stroke& x) {
+  appendKey(key, x.style_);
+  appendKey(key, x.color_);
+}
+
+inline void appendKey(std::string& key, const gradientStop& x) {
+  appendKey(key, x.position_);
+  appendKey(key, x.color_);
+}
+
+// Number each distinct key in order of first appearance, and return the number
+// of the given key.
+inline int internKey(std::unordered_map<std::string, int>& seen,
+                     const std::string& key) {
+  return seen.emplace(key, (int) seen.size()).first->second;
+}
+
+// Flatten the nested list of zipFormats() into columns named by their path,
+// e.g. font$color$rgb becomes font_color_rgb.
+inline void flattenFormats(List x,
+                           const std::string& prefix,
+                           std::vector<SEXP>& columns,
+                           std::vector<std::string>& names) {
+  CharacterVector x_names = x.names();
+  for (int i = 0; i < x.size(); ++i) {
+    std::string name = prefix + std::string(x_names[i]);
+    SEXP element = x[i];
+    if (TYPEOF(element) == VECSXP) {
+      flattenFormats(List(element), name + "_", columns, names);
+    } else {
+      columns.push_back(element);
+      names.push_back(name);
+    }
+  }
+}
+
+List xlsxstyles::flatFormats() {
+  // Fonts, fills and borders are often defined more than once, so number the
+  // distinct ones first, to make the keys of whole formats shorter.
+  std::string key;
+  std::unordered_map<std::string, int> seen;
+
+  std::vector<int> font_key(fonts_.size());
+  for (size_t i = 0; i < fonts_.size(); ++i) {
+    font& x = fonts_[i];
+    key.clear();
+    appendKey(key, x.b_);
+    appendKey(key, x.i_);
+    appendKey(key, x.u_);
+    appendKey(key, x.strike_);
+    appendKey(key, x.vertAlign_);
+    appendKey(key, x.size_);
+    appendKey(key, x.color_);
+    appendKey(key, x.name_);
+    appendKey(key, x.family_);
+    appendKey(key, x.scheme_);
+    font_key[i] = internKey(seen, key);
+  }
+
+  seen.clear();
+  std::vector<int> fill_key(fills_.size());
+  for (size_t i = 0; i < fills_.size(); ++i) {
+    fill& x = fills_[i];
+    key.clear();
+    appendKey(key, x.patternFill_.fgColor_);
+    appendKey(key, x.patternFill_.bgColor_);
+    appendKey(key, x.patternFill_.patternType_);
+    appendKey(key, x.gradientFill_.type_);
+    appendKey(key, x.gradientFill_.degree_);
+    appendKey(key, x.gradientFill_.left_);
+    appendKey(key, x.gradientFill_.right_);
+    appendKey(key, x.gradientFill_.top_);
+    appendKey(key, x.gradientFill_.bottom_);
+    appendKey(key, x.gradientFill_.stop1_);
+    appendKey(key, x.gradientFill_.stop2_);
+    fill_key[i] = internKey(seen, key);
+  }
+
+  seen.clear();
+  std::vector<int> border_key(borders_.size());
+  for (size_t i = 0; i < borders_.size(); ++i) {
+    border& x = borders_[i];
+    key.clear();
+    appendKey(key, x.diagonalDown_);
+    appendKey(key, x.diagonalUp_);
+    appendKey(key, x.outline_);
+    appendKey(key, x.left_);
+    appendKey(key, x.right_);
+    appendKey(key, x.start_);
+    appendKey(key, x.end_);
+    appendKey(key, x.top_);
+    appendKey(key, x.bottom_);
+    appendKey(key, x.diagonal_);
+    appendKey(key, x.vertical_);
+    appendKey(key, x.horizontal_);
+    border_key[i] = internKey(seen, key);
+  }
+
+  // Then number the distinct formats, local and style together, keeping the
+  // first of each.
+  seen.clear();
+  std::vector<xf> distinct;
+  IntegerVector local(local_formats_.size());
+  IntegerVector style(style_formats_.size());
+  for (size_t i = 0; i < local_formats_.size() + style_formats_.size(); ++i) {
+    bool is_style = i >= local_formats_.size();
+    xf& x = is_style
+      ? style_formats_[i - local_formats_.size()]
+      : local_formats_[i];
+    key.clear();
+    appendKey(key, naIfEmpty(numFmts_[x.numFmtId_]));
+    appendKey(key, font_key[x.fontId_]);
+    appendKey(key, fill_key[x.fillId_]);
+    appendKey(key, border_key[x.borderId_]);
+    appendKey(key, x.horizontal_);
+    appendKey(key, x.vertical_);
+    appendKey(key, x.wrapText_);
+    appendKey(key, x.readingOrder_);
+    appendKey(key, x.indent_);
+    appendKey(key, x.justifyLastLine_);
+    appendKey(key, x.shrinkToFit_);
+    appendKey(key, x.textRotation_);
+    appendKey(key, x.locked_);
+    appendKey(key, x.hidden_);
+    int id = internKey(seen, key);
+    if (id == (int) distinct.size()) {
+      distinct.push_back(x);
+    }
+    if (is_style) {
+      style[i - local_formats_.size()] = id + 1;
+    } else {
+      local[i] = id + 1;
+    }
+  }
+  style.attr("names") = style_names_;
+
+  // Only the distinct formats are turned inside-out
+  std::vector<SEXP> columns;
+  std::vector<std::string> names;
+  List nested = zipFormats(distinct, false);
+  int n = distinct.size();
+  IntegerVector format_id = seq_len(n);
+  columns.push_back(format_id);
+  names.push_back("format_id");
+  flattenFormats(nested, "", columns, names);
+
+  List formats(columns.size());
+  for (size_t j = 0; j < columns.size(); ++j) {
+    formats[j] = columns[j];
+  }
+  formats.attr("names") = wrap(names);
+  formats.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(formats, n);
+
+  return List::create(
+      _["formats"] = formats,
+      _["local"] = local,
+      _["style"] = style);
+}
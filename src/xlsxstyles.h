@@ -7,6 +7,7 @@
 #include "font.h"
 #include "fill.h"
 #include "border.h"
+#include "xlsxstyleindex.h"
 
 struct colors {
   Rcpp::CharacterVector rgb;
@@ -22,22 +23,16 @@ struct colors {
   {}
 };
 
-class xlsxstyles {
+// The full format model, for xlsx_formats().  xlsx_cells() only needs the
+// xlsxstyleindex.
+class xlsxstyles: public xlsxstyleindex {
 
   public:
 
-    Rcpp::CharacterVector theme_name_; // name of theme, e.g. "accent1"
-    Rcpp::CharacterVector theme_;      // rgb equivalent of theme no.
-    Rcpp::CharacterVector indexed_;    // rgb equivalent of index no.
+    Rcpp::CharacterVector style_names_; // cellStyles_, NA if unnamed
 
     std::vector<xf> cellXfs_;
-
     std::vector<xf> cellStyleXfs_;
-    Rcpp::CharacterVector cellStyles_; // names of cell styles, ordered by xfId
-    std::map<int, std::string> cellStyles_map_; // map of cell style names, for lookup by xfId
-
-    Rcpp::CharacterVector numFmts_;
-    Rcpp::LogicalVector isDate_;
 
     std::vector<font> fonts_;
     std::vector<fill> fills_;
@@ -46,17 +41,10 @@ class xlsxstyles {
     std::vector<xf> style_formats_; // built up by applyFormats() from xf definitions
     std::vector<xf> local_formats_; // built up by applyFormats() from xf definitions
 
-    Rcpp::List style_; // inside-out List version of style_formats_
-    Rcpp::List local_; // inside-out List version of local_formats_
-
-    xlsxstyles(const std::string& path);
-
-    void cacheThemeRgb(const std::string& path);
-    void cacheIndexedRgb();
+    xlsxstyles(ziparchive& archive);
 
     void cacheCellXfs(rapidxml::xml_node<>* styleSheet);
-    void cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet); // also cellStyles, if available
-    void cacheNumFmts(rapidxml::xml_node<>* styleSheet);
+    void cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet);
     void cacheFonts(rapidxml::xml_node<>* styleSheet);
     void cacheFills(rapidxml::xml_node<>* styleSheet);
     void cacheBorders(rapidxml::xml_node<>* styleSheet);
@@ -67,8 +55,7 @@ class xlsxstyles {
 
     void applyFormats(); // Build each style on top of the normal style
     Rcpp::List zipFormats(std::vector<xf> styles, bool is_style); // Turn the formats inside-out to return to R
-
-    std::string rgb_string(rapidxml::xml_node<>* node); // Extract the RGB string from a node that references a colour
+    Rcpp::List flatFormats(); // One table of the distinct formats, and maps to it
 
 };
 
@@ -0,0 +1,312 @@
+#include <cstring>
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "xlsxbook.h"
+#include "xlsxtable.h"
+#include "string.h"
+#include "date.h"
+#include "utils.h"
+#include "tibble.h"
+
+using namespace Rcpp;
+
+// Call f(c, j, k) for each cell element c of sheetData, where j and k are the
+// zero-based row and column, following the addresses of rows and cells where
+// they are given, as xlsxsheet::parseSheetData() does.
+template <typename F>
+static void forEachCell(rapidxml::xml_node<>* sheetData, F f) {
+  unsigned long long int n(0);
+  int j = 0;
+  for (rapidxml::xml_node<>* row = sheetData->first_node("row");
+      row; row = row->next_sibling("row")) {
+    rapidxml::xml_attribute<>* ref = row->first_attribute("r");
+    if (ref) {
+      j = std::atoi(ref->value()) - 1;
+    }
+    int k = 0;
+    for (rapidxml::xml_node<>* c = row->first_node("c");
+        c; c = c->next_sibling("c")) {
+      ref = c->first_attribute("r");
+      if (ref) {
+        std::pair<int, int> location = parseRef(ref->value());
+        j = location.first;
+        k = location.second;
+      }
+      f(c, j, k);
+      ++n;
+      if ((n + 1) % 1000 == 0)
+        checkUserInterrupt();
+      k++;
+    }
+    j++;
+  }
+}
+
+// The type of a column that has values of both types.  Logicals are promoted
+// to numbers, as they are by R, but any other mixture is character.
+static cell_type commonType(cell_type a, cell_type b) {
+  if (a == b || b == cell_type::BLANK) {
+    return a;
+  }
+  if (a == cell_type::BLANK) {
+    return b;
+  }
+  if ((a == cell_type::LOGICAL && b == cell_type::NUMERIC)
+      || (a == cell_type::NUMERIC && b == cell_type::LOGICAL)) {
+    return cell_type::NUMERIC;
+  }
+  return cell_type::CHARACTER;
+}
+
+// Warn about cells, naming no more than a few, as xlsxbook::convertDates()
+// does.
+static void warnCells(const std::string& message,
+                      const std::vector<std::string>& refs) {
+  if (refs.empty()) {
+    return;
+  }
+  std::string out;
+  size_t n = std::min(refs.size(), (size_t) 10);
+  for (size_t i = 0; i < n; ++i) {
+    if (i > 0) out += ", ";
+    out += "'" + refs[i] + "'";
+  }
+  if (refs.size() > n) {
+    out += " and " + std::to_string(refs.size() - n) + " more";
+  }
+  Rcpp::warning(message + out);
+}
+
+xlsxtable::xlsxtable(
+    xlsxbook& book,
+    const std::string& sheet_path,
+    int skip,
+    bool col_names,
+    int guess_max):
+  book_(book),
+  first_row_(-1),
+  data_row_(-1),
+  last_row_(-1),
+  first_col_(-1),
+  last_col_(-1),
+  nrow_(0) {
+  std::string buffer;
+  char* xml = book_.archive_.read(sheet_path, buffer);
+  rapidxml::xml_document<> doc;
+  doc.parse<rapidxml::parse_strip_xml_namespaces>(xml);
+  rapidxml::xml_node<>* worksheet = doc.first_node("worksheet");
+  rapidxml::xml_node<>* sheetData = worksheet->first_node("sheetData");
+
+  guessTypes(sheetData, skip, col_names, guess_max);
+  cacheColumns(sheetData);
+  convertDates();
+
+  warnCells("NA inserted for values that don't match the type guessed for "
+            "their column (try a larger guess_max): ", mismatched_);
+  warnCells("NA inserted for impossible 1900-02-29 datetime: ", impossible_);
+}
+
+cell_type xlsxtable::cellType(rapidxml::xml_node<>* c) {
+  // The same types as xlsxcell::cacheValue(), except that errors are NA
+  rapidxml::xml_attribute<>* t = c->first_attribute("t");
+  const char* tvalue = (t != NULL) ? t->value() : "n";
+  if (strcmp(tvalue, "inlineStr") == 0) {
+    return (c->first_node("is") != NULL) ? cell_type::CHARACTER : cell_type::BLANK;
+  }
+  if (c->first_node("v") == NULL) {
+    return cell_type::BLANK;
+  }
+  if (strcmp(tvalue, "n") == 0) {
+    rapidxml::xml_attribute<>* s = c->first_attribute("s");
+    int svalue = (s != NULL) ? strtol(s->value(), NULL, 10) : 0;
+    return book_.styles_.cellNumFmt(svalue).isDate()
+      ? cell_type::DATE
+      : cell_type::NUMERIC;
+  }
+  if (strcmp(tvalue, "s") == 0
+      || strcmp(tvalue, "str") == 0
+      || strcmp(tvalue, "d") == 0) { // ISO8601, kept as text
+    return cell_type::CHARACTER;
+  }
+  if (strcmp(tvalue, "b") == 0) {
+    return cell_type::LOGICAL;
+  }
+  return cell_type::BLANK;
+}
+
+void xlsxtable::cellText(rapidxml::xml_node<>* c, cell_type type,
+                         std::string& out) {
+  // The value of a cell as text, for names, and for character columns
+  out.clear();
+  rapidxml::xml_node<>* v = c->first_node("v");
+  switch (type) {
+    case cell_type::LOGICAL:
+      out = (strtod(v->value(), NULL) != 0) ? "TRUE" : "FALSE";
+      break;
+    case cell_type::NUMERIC:
+      out = v->value();
+      break;
+    case cell_type::DATE:
+      out = formatDate(strtod(v->value(), NULL), book_.dateSystem_,
+                       book_.dateOffset_);
+      break;
+    case cell_type::CHARACTER: {
+      rapidxml::xml_attribute<>* t = c->first_attribute("t");
+      if (strcmp(t->value(), "inlineStr") == 0) {
+        parseString(c->first_node("is"), out);
+      } else if (strcmp(t->value(), "s") == 0) {
+        size_t i = strtol(v->value(), NULL, 10);
+        if (i < book_.strings_.size()) {
+          out = book_.strings_[i];
+        }
+      } else {
+        out = v->value();
+      }
+      break;
+    }
+    case cell_type::BLANK:
+      break;
+  }
+}
+
+void xlsxtable::guessTypes(
+    rapidxml::xml_node<>* sheetData,
+    int skip,
+    bool col_names,
+    int guess_max) {
+  // Find the rectangle of cells with values, below any skipped rows, and guess
+  // the type of each column from the first guess_max rows below the header.
+  forEachCell(sheetData, [&](rapidxml::xml_node<>* c, int j, int k) {
+    if (j < skip) {
+      return;
+    }
+    cell_type type = cellType(c);
+    if (type == cell_type::BLANK) {
+      return;
+    }
+    if (first_row_ == -1) {
+      first_row_ = j;
+      data_row_ = j + col_names;
+    }
+    last_row_ = j;
+    if (first_col_ == -1 || k < first_col_) {
+      first_col_ = k;
+    }
+    if (k > last_col_) {
+      last_col_ = k;
+      types_.resize(k + 1, cell_type::BLANK);
+    }
+    if (j >= data_row_ && (long long int) j < (long long int) data_row_ + guess_max) {
+      types_[k] = commonType(types_[k], type);
+    }
+  });
+  if (first_row_ != -1 && last_row_ >= data_row_) {
+    nrow_ = last_row_ - data_row_ + 1;
+  }
+}
+
+void xlsxtable::cacheColumns(rapidxml::xml_node<>* sheetData) {
+  // Allocate each column at its final length, named by its column letter until
+  // the header says otherwise, and then fill them in a second pass.
+  int ncol = (first_col_ == -1) ? 0 : last_col_ - first_col_ + 1;
+  names_ = CharacterVector(ncol);
+  columns_ = List(ncol);
+  for (int col = 0; col < ncol; ++col) {
+    names_[col] = intToABC(first_col_ + col + 1);
+    switch (types_[first_col_ + col]) {
+      case cell_type::BLANK:
+      case cell_type::LOGICAL:
+        columns_[col] = LogicalVector(nrow_, NA_LOGICAL);
+        break;
+      case cell_type::NUMERIC:
+      case cell_type::DATE:
+        columns_[col] = NumericVector(nrow_, NA_REAL);
+        break;
+      case cell_type::CHARACTER:
+        columns_[col] = CharacterVector(nrow_, NA_STRING);
+        break;
+    }
+  }
+  if (ncol == 0) {
+    return;
+  }
+
+  std::string text; // reused for every value that is written as text
+  forEachCell(sheetData, [&](rapidxml::xml_node<>* c, int j, int k) {
+    if (j < first_row_ || j > last_row_ || k < first_col_ || k > last_col_) {
+      return;
+    }
+    cell_type type = cellType(c);
+    if (type == cell_type::BLANK) {
+      return;
+    }
+    int col = k - first_col_;
+    if (j < data_row_) { // the header
+      cellText(c, type, text);
+      SET_STRING_ELT(names_, col,
+                     Rf_mkCharLenCE(text.data(), text.size(), CE_UTF8));
+      return;
+    }
+    R_xlen_t i = j - data_row_;
+    SEXP column = VECTOR_ELT(columns_, col);
+    bool fits = true;
+    switch (types_[k]) {
+      case cell_type::BLANK:
+      case cell_type::LOGICAL:
+        fits = type == cell_type::LOGICAL;
+        if (fits) {
+          LOGICAL(column)[i] = strtod(c->first_node("v")->value(), NULL) != 0;
+        }
+        break;
+      case cell_type::NUMERIC:
+      case cell_type::DATE:
+        // Dates are serial numbers until convertDates(), so numbers and dates
+        // can be written to each other's columns
+        fits = type != cell_type::CHARACTER
+          && (type != cell_type::LOGICAL || types_[k] == cell_type::NUMERIC);
+        if (fits) {
+          REAL(column)[i] = strtod(c->first_node("v")->value(), NULL);
+        }
+        break;
+      case cell_type::CHARACTER:
+        cellText(c, type, text);
+        SET_STRING_ELT(column, i,
+                       Rf_mkCharLenCE(text.data(), text.size(), CE_UTF8));
+        break;
+    }
+    if (!fits) {
+      mismatched_.push_back(asA1(j + 1, k + 1));
+    }
+  });
+}
+
+void xlsxtable::convertDates() {
+  // Date columns hold raw serial dates until now, as cellcolumns::date_ does
+  for (R_xlen_t col = 0; col < columns_.size(); ++col) {
+    if (types_[first_col_ + col] != cell_type::DATE) {
+      continue;
+    }
+    NumericVector dates = columns_[col];
+    std::vector<R_xlen_t> impossible;
+    serialsToPOSIX(REAL(dates), nrow_, book_.dateSystem_, book_.dateOffset_,
+                   impossible, NA_REAL);
+    for (size_t i = 0; i < impossible.size(); ++i) {
+      impossible_.push_back(asA1(data_row_ + impossible[i] + 1,
+                                 first_col_ + col + 1));
+    }
+    dates.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+    dates.attr("tzone") = "UTC";
+  }
+}
+
+List xlsxtable::information() {
+  // Returns a data frame of the columns
+  List out = columns_;
+  out.attr("names") = names_;
+
+  // Turn list of vectors into a data frame without checking anything
+  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
+  setCompactRowNames(out, nrow_);
+
+  return out;
+}
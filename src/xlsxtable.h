@@ -0,0 +1,66 @@
+#ifndef XLSXTABLE_
+#define XLSXTABLE_
+
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "xlsxbook.h"
+
+// The type of a cell's value, and the type of a column, guessed from its cells
+enum class cell_type : unsigned char {
+  BLANK,     // no value, or an error, which becomes NA
+  LOGICAL,
+  NUMERIC,
+  DATE,      // a number in a date format
+  CHARACTER
+};
+
+// A sheet read straight into one typed vector per column, named by a header
+// row, rather than into one row per cell like xlsxbook does for xlsx_cells().
+// Only the values are read, so formulas, formats, comments etc. are skipped.
+//
+// The sheet is traversed twice.  The first pass finds the rectangle of cells
+// that have values, and guesses the type of each column from its first
+// guess_max values, growing the columns as cells appear further right.  The
+// second pass writes each value into its column, which is allocated once at
+// its final length.  Values that don't fit the guessed type become NA, with a
+// warning.
+class xlsxtable {
+
+  public:
+
+    xlsxtable(
+        xlsxbook& book,
+        const std::string& sheet_path,
+        int skip,       // rows to skip before looking for the header
+        bool col_names, // whether the first row is a header
+        int guess_max); // rows of values to guess the types from
+
+    Rcpp::List information(); // data frame of the columns
+
+  private:
+
+    xlsxbook& book_;
+
+    int first_row_; // zero-based, of the header, or of the values if none
+    int data_row_;  // zero-based, of the first row of values
+    int last_row_;  // zero-based, of the last row with a value
+    int first_col_; // zero-based, of the leftmost cell with a value
+    int last_col_;  // zero-based, of the rightmost cell with a value
+    R_xlen_t nrow_; // rows of values
+    std::vector<cell_type> types_; // of each column, from column A
+
+    Rcpp::CharacterVector names_;
+    Rcpp::List columns_;
+    std::vector<std::string> mismatched_; // addresses of values that became NA
+    std::vector<std::string> impossible_; // addresses of 1900-02-29 dates
+
+    cell_type cellType(rapidxml::xml_node<>* c);
+    void cellText(rapidxml::xml_node<>* c, cell_type type, std::string& out);
+    void guessTypes(rapidxml::xml_node<>* sheetData, int skip, bool col_names,
+                    int guess_max);
+    void cacheColumns(rapidxml::xml_node<>* sheetData);
+    void convertDates();
+
+};
+
+#endif
@@ -1,69 +1,83 @@
+#include <memory>
 #include <Rcpp.h>
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxvalidation.h"
-#include "xlsxbook.h"
+#include "workbookpr.h"
 #include "date.h"
+#include "fragment.h"
+#include "tibble.h"
 
 using namespace Rcpp;
 
-int count_validations(std::string& xml) {
-  // Count the number of validation rules in a file
-  int n(0);
-  rapidxml::xml_document<> doc;
-  doc.parse<rapidxml::parse_non_destructive>(&xml[0]);
-  rapidxml::xml_node<>* worksheet = doc.first_node("worksheet");
-  rapidxml::xml_node<>* dataValidations;
-  dataValidations = worksheet->first_node("dataValidations");
-  if (dataValidations == NULL) { // See if it's in extLst
-    rapidxml::xml_node<>* extLst;
-    rapidxml::xml_node<>* ext;
-    extLst = worksheet->first_node("extLst");
-    if (extLst != NULL) {
-      ext = extLst->first_node("ext");
-      if (ext != NULL) {
-        dataValidations = ext->first_node("x14:dataValidations");
-      } else {
-      }
-    } else {
-    }
+// The element of a sheet that holds its validation rules, <dataValidations>, or
+// failing that the <extLst> that might hold x14 ones, copied so that it can be
+// parsed without the rest of the sheet.  Both come after <sheetData>, so only
+// the tail of the sheet is searched.
+std::string validations_xml(const std::string& sheet_xml) {
+  fragment tail = sheetTail(sheet_xml);
+  fragment found = findElement(tail, "dataValidations");
+  if (found.empty()) {
+    found = findElement(tail, "extLst");
   }
+  return found.str();
+}
+
+// The dataValidations node of a fragment parsed with
+// parse_strip_xml_namespaces, whether it is the root, or in an x14 extension.
+rapidxml::xml_node<>* validations_node(rapidxml::xml_document<>& doc) {
+  rapidxml::xml_node<>* dataValidations = doc.first_node("dataValidations");
   if (dataValidations != NULL) {
-    // Initialize the vectors to the number of rules, using the count attribute
-    // if it exists, otherwise count the rules.
-    rapidxml::xml_attribute<>* count =
-      dataValidations->first_attribute("count");
-    if (count != NULL) {
-      n = strtol(count->value(), NULL, 10);
-    } else {
-      // No known case, so # nocov start
-      for (rapidxml::xml_node<>* dataValidation =
-          dataValidations->first_node("dataValidation");
-          dataValidation;
-          dataValidation = dataValidation->next_sibling("dataValidation")) {
-        ++n;
-        // # nocov end
-      }
+    return dataValidations;
+  }
+  rapidxml::xml_node<>* extLst = doc.first_node("extLst");
+  if (extLst == NULL) {
+    return NULL;
+  }
+  for (rapidxml::xml_node<>* ext = extLst->first_node("ext");
+       ext; ext = ext->next_sibling("ext")) {
+    dataValidations = ext->first_node("dataValidations");
+    if (dataValidations != NULL) {
+      return dataValidations;
     }
-  } else {
+  }
+  return NULL;
+}
+
+int count_validations(rapidxml::xml_node<>* dataValidations) {
+  // Count the rules themselves rather than trust the count attribute
+  int n(0);
+  if (dataValidations == NULL) {
+    return n;
+  }
+  for (rapidxml::xml_node<>* dataValidation =
+      dataValidations->first_node("dataValidation");
+      dataValidation;
+      dataValidation = dataValidation->next_sibling("dataValidation")) {
+    ++n;
   }
   return n;
 }
 
+// Format the serial date of a date or time rule, setting 'impossible' if it is
+// 1900-02-29, which becomes "NA".
+std::string validationDate(const std::string& serial,
+                           const workbookpr& properties,
+                           bool& impossible) {
+  double date_double = strtod(serial.c_str(), NULL);
+  if (lotusCorrect(date_double, properties.dateSystem_) < 0) {
+    impossible = true;
+  }
+  return formatDate(date_double, properties.dateSystem_, properties.dateOffset_);
+}
+
 void parseValidations(
     xlsxvalidation& validation,
-    xlsxbook& book,
+    const workbookpr& properties,
     std::string& sheet_name,
-    std::string& xml,
-    int& i) {
-  rapidxml::xml_document<> doc;
-  doc.parse<rapidxml::parse_strip_xml_namespaces>(&xml[0]);
-  rapidxml::xml_node<>* worksheet = doc.first_node("worksheet");
-  rapidxml::xml_node<>* dataValidations;
-  dataValidations = worksheet->first_node("dataValidations");
-  if (dataValidations == NULL) { // Get it from extLst
-    dataValidations = worksheet->first_node("extLst")->first_node("ext")->first_node("dataValidations");
-  }
+    rapidxml::xml_node<>* dataValidations,
+    int& i,
+    std::vector<std::string>& impossible) {
   for (rapidxml::xml_node<>* dataValidation =
          dataValidations->first_node("dataValidation");
         dataValidation;
@@ -81,15 +95,17 @@ void parseValidations(
       std::replace(ref.begin(), ref.end(), ' ', ',');
       validation.ref_[i] = ref;
     } else { // try x14 version
-      rapidxml::xml_node<>* sqref_node = dataValidation->first_node("xm:sqref");
+      // Namespaces are stripped, so <xm:sqref> is <sqref>
+      rapidxml::xml_node<>* sqref_node = dataValidation->first_node("sqref");
       if (sqref_node != NULL) {
-        ref = std::string(sqref->value());
+        ref = std::string(sqref_node->value());
         std::replace(ref.begin(), ref.end(), ' ', ',');
         validation.ref_[i] = ref;
       }
     }
 
     std::string type_string;
+    bool impossible_date(false);
     rapidxml::xml_attribute<>* type = dataValidation->first_attribute("type");
     if (type != NULL) {
       // operator defaults to 'between', but when type is one of list or
@@ -115,9 +131,8 @@ void parseValidations(
         f1_string = formula1->value();
       }
       if (type_string == "date" || type_string == "time") {
-        double date_double = strtod(f1_string.c_str(), NULL);
         validation.formula1_[i] =
-          formatDate(date_double, book.dateSystem_, book.dateOffset_);
+          validationDate(f1_string, properties, impossible_date);
       } else {
         validation.formula1_[i] = f1_string;
       }
@@ -133,9 +148,8 @@ void parseValidations(
         f2_string = formula2->value();
       }
       if (type_string == "date" || type_string == "time") {
-        double date_double = strtod(f2_string.c_str(), NULL);
         validation.formula2_[i] =
-          formatDate(date_double, book.dateSystem_, book.dateOffset_);
+          validationDate(f2_string, properties, impossible_date);
       } else {
         validation.formula2_[i] = f2_string;
       }
@@ -182,40 +196,52 @@ void parseValidations(
     if (errorStyle != NULL)
       validation.error_style_[i] = errorStyle->value();
 
+    if (impossible_date) {
+      impossible.push_back("'" + sheet_name + "'!" + ref);
+    }
+
     ++i;
   }
 }
 
 xlsxvalidation::xlsxvalidation(
-    std::string path,
+    ziparchive& archive,
     CharacterVector sheet_paths,
     CharacterVector sheet_names) {
-  // Parse book-level information for the date system (1900/1904)
-  xlsxbook book(path);
-
-  // Loop through sheets
-  List out(sheet_paths.size());
+  // Parse only the workbook properties, for the date system (1900/1904), not
+  // the styles or strings.
+  workbookpr properties(archive);
 
-  std::vector<std::string> sheets_xml; // xml of each sheet
-  std::vector<int> rules_count; // number of rules in individual sheets
   int n(0); // total number of rules in all sheets
   int i(0); // ith validation rule
 
-  std::vector<std::string>::iterator sheet_xml;
-  CharacterVector::iterator sheet_path;
-  CharacterVector::iterator sheet_name;
-  std::vector<int>::iterator rule_count;
-
-  // Count the total number of rules in all sheets
-  for(sheet_path = sheet_paths.begin();
+  // Keep only the part of each sheet that holds validation rules, so that the
+  // whole sheet doesn't have to be kept in memory, or parsed.
+  std::vector<std::string> fragments;
+  fragments.reserve(sheet_paths.size());
+  for(CharacterVector::iterator sheet_path = sheet_paths.begin();
       sheet_path != sheet_paths.end();
       ++sheet_path) {
-    std::string path(*sheet_path);
-    std::string xml = zip_buffer(book.path_, path);
-    sheets_xml.push_back(xml);
-    int count = count_validations(xml);
-    rules_count.push_back(count);
-    n += count;
+    std::string sheet_path_string(*sheet_path);
+    fragments.push_back(validations_xml(zip_buffer(archive, sheet_path_string)));
+  }
+
+  // Parse each fragment once, both to count the rules and to read them.  The
+  // documents refer to the text of the fragments, which mustn't move.
+  std::vector<std::unique_ptr<rapidxml::xml_document<> > > docs;
+  std::vector<rapidxml::xml_node<>*> nodes;
+  for(std::vector<std::string>::iterator fragment_xml = fragments.begin();
+      fragment_xml != fragments.end();
+      ++fragment_xml) {
+    rapidxml::xml_node<>* dataValidations = NULL;
+    if (!fragment_xml->empty()) {
+      std::unique_ptr<rapidxml::xml_document<> > doc(new rapidxml::xml_document<>);
+      doc->parse<rapidxml::parse_strip_xml_namespaces>(&(*fragment_xml)[0]);
+      dataValidations = validations_node(*doc);
+      docs.push_back(std::move(doc));
+    }
+    nodes.push_back(dataValidations);
+    n += count_validations(dataValidations);
   }
 
   // initialise output vectors
@@ -234,16 +260,26 @@ xlsxvalidation::xlsxvalidation(
   error_              = CharacterVector(n, NA_STRING);
   error_style_        = CharacterVector(n, "stop");
 
-  // Parse all the rules
-  for(sheet_xml = sheets_xml.begin(),
-      rule_count = rules_count.begin(),
-      sheet_name = sheet_names.begin();
-      sheet_xml != sheets_xml.end();
-      ++sheet_xml, ++rule_count, ++sheet_name) {
-    if (*rule_count != 0) {
-      std::string name(*sheet_name);
-      parseValidations(*this, book, name, *sheet_xml, i);
+  // Parse all the rules, and then warn about any with impossible dates, naming
+  // no more than a few.
+  std::vector<std::string> impossible;
+  for (size_t sheet = 0; sheet < nodes.size(); ++sheet) {
+    if (nodes[sheet] != NULL) {
+      std::string name(sheet_names[sheet]);
+      parseValidations(*this, properties, name, nodes[sheet], i, impossible);
+    }
+  }
+  if (!impossible.empty()) {
+    std::string refs;
+    size_t n = std::min(impossible.size(), (size_t) 10);
+    for (size_t j = 0; j < n; ++j) {
+      if (j > 0) refs += ", ";
+      refs += impossible[j];
+    }
+    if (impossible.size() > n) {
+      refs += " and " + std::to_string(impossible.size() - n) + " more";
     }
+    Rcpp::warning("NA inserted for impossible 1900-02-29 datetime: " + refs);
   }
 }
 
@@ -269,7 +305,7 @@ List xlsxvalidation::information() {
   // Turn list of vectors into a data frame without checking anything
   int n = Rf_length(out[0]);
   out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  setCompactRowNames(out, n);
 
   return out;
 }
@@ -3,7 +3,7 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
-#include "xlsxbook.h"
+#include "zip.h"
 
 class xlsxvalidation {
 
@@ -25,7 +25,7 @@ class xlsxvalidation {
     Rcpp::CharacterVector error_style_;
 
     xlsxvalidation(
-      std::string path,
+      ziparchive& archive,
       Rcpp::CharacterVector sheet_paths,
       Rcpp::CharacterVector sheet_names);
 
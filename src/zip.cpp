@@ -5,42 +5,384 @@
 // The copyright holder is the RStudio company.
 // It is licensed under GPL-3.
 
-#include <Rcpp.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <zlib.h>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
 
 #include "zip.h"
 #include "rapidxml_print.h"
 
-using namespace Rcpp;
+// Signatures of the records of a zip archive (APPNOTE.TXT 4.3)
+const unsigned int ZIP_LOCAL_HEADER = 0x04034b50;
+const unsigned int ZIP_CENTRAL_HEADER = 0x02014b50;
+const unsigned int ZIP_END_OF_CENTRAL_DIRECTORY = 0x06054b50;
+const unsigned int ZIP64_END_OF_CENTRAL_DIRECTORY = 0x06064b50;
+const unsigned int ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR = 0x07064b50;
+const unsigned int ZIP64_EXTRA_FIELD = 0x0001;
+const unsigned int ZIP64_U32_MAX = 0xFFFFFFFF; // a field is in the Zip64 extra
 
-Function tidyxl(const std::string& fun){
-  Environment env = Environment::namespace_env("tidyxlcustom");
-  return env[fun];
+// Little-endian fields
+inline unsigned int zip_u16(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8);
 }
 
-std::string zip_buffer(
-    const std::string& zip_path,
-    const std::string& file_path) {
-  Function zip_buffer = tidyxl("zip_buffer");
+inline unsigned int zip_u32(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int) u[3] << 24);
+}
+
+inline unsigned long long zip_u64(const char* p) {
+  return zip_u32(p) | ((unsigned long long) zip_u32(p + 4) << 32);
+}
+
+ziparchive::ziparchive(const std::string& path):
+  path_(path),
+  data_(NULL),
+  size_(0),
+  borrowed_(false) {
+  load();
+}
+
+ziparchive::ziparchive(const std::string& path, const char* data, size_t size):
+  path_(path),
+  data_(const_cast<char*>(data)), // never written to, because borrowed
+  size_(size),
+  borrowed_(data != NULL) {
+  load();
+}
+
+ziparchive::~ziparchive() {
+  unmap();
+}
+
+void ziparchive::load() {
+  if (!borrowed_) {
+    map();
+  }
+  try {
+    cacheEntries();
+  } catch (...) {
+    unmap();
+    throw;
+  }
+}
+
+#ifdef _WIN32
+
+void ziparchive::map() {
+  file_ = NULL;
+  mapping_ = NULL;
+  HANDLE file = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Couldn't open '" + path_ + "'");
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    throw std::runtime_error("'" + path_ + "' is not a zip archive");
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  void* data = mapping == NULL ? NULL
+    : MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  if (data == NULL) {
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::runtime_error("Couldn't map '" + path_ + "' into memory");
+  }
+  file_ = file;
+  mapping_ = mapping;
+  data_ = static_cast<char*>(data);
+  size_ = size.QuadPart;
+}
+
+void ziparchive::unmap() {
+  if (borrowed_) {
+    data_ = NULL;
+    return;
+  }
+  if (data_ != NULL) UnmapViewOfFile(data_);
+  if (mapping_ != NULL) CloseHandle(mapping_);
+  if (file_ != NULL) CloseHandle(file_);
+  data_ = NULL;
+  mapping_ = NULL;
+  file_ = NULL;
+}
+
+#else
+
+void ziparchive::map() {
+  int fd = open(path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Couldn't open '" + path_ + "'");
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("'" + path_ + "' is not a zip archive");
+  }
+  // Private, so that writes by the parser aren't carried through to the file
+  void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps its own reference to the file
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Couldn't map '" + path_ + "' into memory");
+  }
+  data_ = static_cast<char*>(data);
+  size_ = st.st_size;
+}
+
+void ziparchive::unmap() {
+  if (data_ != NULL && !borrowed_) munmap(data_, size_);
+  data_ = NULL;
+}
+
+#endif
+
+// Whether length bytes from offset are within an archive of size bytes.
+// Offsets and lengths can come from anywhere in a crafted archive, so they are
+// never added, lest they wrap around.
+static bool zip_fits(unsigned long long offset, unsigned long long length,
+                     unsigned long long size) {
+  return offset <= size && size - offset >= length;
+}
+
+void ziparchive::cacheEntries() {
+  std::string not_zip = "'" + path_ + "' is not a zip archive";
+
+  // The end of central directory record is at the end of the file, followed
+  // only by a comment of up to 65535 bytes.
+  if (size_ < 22) {
+    throw std::runtime_error(not_zip);
+  }
+  const char* eocd = NULL;
+  size_t earliest = size_ > 22 + 65535 ? size_ - 22 - 65535 : 0;
+  for (size_t i = size_ - 22; ; --i) {
+    if (zip_u32(data_ + i) == ZIP_END_OF_CENTRAL_DIRECTORY) {
+      eocd = data_ + i;
+      break;
+    }
+    if (i == earliest) break;
+  }
+  if (eocd == NULL) {
+    throw std::runtime_error(not_zip);
+  }
+
+  unsigned long long n = zip_u16(eocd + 10);
+  unsigned long long offset = zip_u32(eocd + 16);
+
+  // A Zip64 archive has a locator immediately before the end of central
+  // directory record, pointing to a Zip64 record with 64-bit counts and offsets
+  size_t eocd_offset = eocd - data_;
+  if (eocd_offset >= 20
+      && zip_u32(eocd - 20) == ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR) {
+    unsigned long long zip64_offset = zip_u64(eocd - 20 + 8);
+    if (!zip_fits(zip64_offset, 56, size_)
+        || zip_u32(data_ + zip64_offset) != ZIP64_END_OF_CENTRAL_DIRECTORY) {
+      throw std::runtime_error(not_zip);
+    }
+    n = zip_u64(data_ + zip64_offset + 32);
+    offset = zip_u64(data_ + zip64_offset + 48);
+  }
+
+  for (unsigned long long i = 0; i < n; ++i) {
+    if (!zip_fits(offset, 46, size_)
+        || zip_u32(data_ + offset) != ZIP_CENTRAL_HEADER) {
+      throw std::runtime_error(not_zip);
+    }
+    const char* header = data_ + offset;
+    zipentry entry;
+    entry.method_ = zip_u16(header + 10);
+    entry.compressed_size_ = zip_u32(header + 20);
+    entry.uncompressed_size_ = zip_u32(header + 24);
+    unsigned int name_length = zip_u16(header + 28);
+    unsigned int extra_length = zip_u16(header + 30);
+    unsigned int comment_length = zip_u16(header + 32);
+    unsigned long long local_offset = zip_u32(header + 42);
+    entry.in_place_ = false;
+    if (!zip_fits(offset + 46, name_length + extra_length, size_)) {
+      throw std::runtime_error(not_zip);
+    }
+    std::string name(header + 46, name_length);
+
+    // Sizes and offsets that don't fit in 32 bits are given as 0xFFFFFFFF, and
+    // then in the Zip64 extra field, in this order, but only those that don't
+    // fit (APPNOTE.TXT 4.5.3)
+    const char* extra = header + 46 + name_length;
+    const char* extra_end = extra + extra_length;
+    while (extra + 4 <= extra_end) {
+      unsigned int id = zip_u16(extra);
+      unsigned int length = zip_u16(extra + 2);
+      const char* field = extra + 4;
+      const char* field_end = field + length;
+      if (field_end > extra_end) {
+        break;
+      }
+      if (id == ZIP64_EXTRA_FIELD) {
+        if (entry.uncompressed_size_ == ZIP64_U32_MAX && field + 8 <= field_end) {
+          entry.uncompressed_size_ = zip_u64(field);
+          field += 8;
+        }
+        if (entry.compressed_size_ == ZIP64_U32_MAX && field + 8 <= field_end) {
+          entry.compressed_size_ = zip_u64(field);
+          field += 8;
+        }
+        if (local_offset == ZIP64_U32_MAX && field + 8 <= field_end) {
+          local_offset = zip_u64(field);
+          field += 8;
+        }
+        break;
+      }
+      extra = field_end;
+    }
 
-  RawVector xml = as<RawVector>(zip_buffer(zip_path, file_path));
-  std::string buffer(RAW(xml), RAW(xml) + xml.size());
-  buffer.push_back('\0');
+    // The data follows the local header, whose variable-length fields might
+    // differ from those in the central directory
+    if (!zip_fits(local_offset, 30, size_)
+        || zip_u32(data_ + local_offset) != ZIP_LOCAL_HEADER) {
+      throw std::runtime_error(not_zip);
+    }
+    const char* local = data_ + local_offset;
+    entry.data_offset_ =
+      local_offset + 30 + zip_u16(local + 26) + zip_u16(local + 28);
+    // A byte must follow the data, to terminate stored entries in place
+    if (entry.data_offset_ >= size_
+        || size_ - entry.data_offset_ <= entry.compressed_size_) {
+      throw std::runtime_error(not_zip);
+    }
+
+    entries_[name] = entry;
+    offset += 46 + name_length + extra_length + comment_length;
+  }
+}
+
+bool ziparchive::has_file(const std::string& file_path) const {
+  return entries_.find(file_path) != entries_.end();
+}
+
+char* ziparchive::read(const std::string& file_path, std::string& buffer) {
+  std::map<std::string, zipentry>::iterator it = entries_.find(file_path);
+  if (it == entries_.end()) {
+    throw std::runtime_error("Couldn't find '" + file_path + "' in '" + path_
+                             + "'");
+  }
+  zipentry& found = it->second;
+
+  if (found.method_ == 0) {
+    // A stored entry is followed by at least the central directory, so there
+    // is always a byte after it to overwrite.
+    char* begin = data_ + found.data_offset_;
+    if (!found.in_place_ && !borrowed_) {
+      found.in_place_ = true;
+      begin[found.compressed_size_] = '\0';
+      return begin;
+    }
+    buffer.resize(found.compressed_size_ + 1);
+    copyEntry(found, &buffer[0]);
+  } else if (found.method_ == 8) {
+    if (found.uncompressed_size_ >= buffer.max_size()) {
+      throw std::runtime_error("Couldn't read '" + file_path + "' in '" + path_
+                               + "', which is too large to inflate in memory");
+    }
+    buffer.resize(found.uncompressed_size_ + 1);
+    if (!inflate(found, &buffer[0])) {
+      throw std::runtime_error("Couldn't inflate '" + file_path + "' in '"
+                               + path_ + "'");
+    }
+  } else {
+    throw std::runtime_error("Couldn't read '" + file_path + "' in '" + path_
+                             + "', which is compressed by an unsupported method");
+  }
+  buffer[buffer.size() - 1] = '\0';
+  return &buffer[0];
+}
 
+void ziparchive::copyEntry(const zipentry& entry, char* out) const {
+  if (borrowed_) { // never written to
+    memcpy(out, data_ + entry.data_offset_, entry.compressed_size_);
+    return;
+  }
+  // From the file, because the mapping might have been parsed destructively
+  std::ifstream file(path_.c_str(), std::ios::in | std::ios::binary);
+  file.seekg(entry.data_offset_);
+  file.read(out, entry.compressed_size_);
+  if (!file) {
+    throw std::runtime_error("Couldn't read '" + path_ + "'");
+  }
+}
+
+const zipentry* ziparchive::find(const std::string& file_path) const {
+  std::map<std::string, zipentry>::const_iterator it = entries_.find(file_path);
+  return it == entries_.end() ? NULL : &it->second;
+}
+
+bool ziparchive::inflate(const zipentry& entry, char* out) const {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) { // raw deflate, no header
+    return false;
+  }
+
+  // zlib counts in unsigned ints, so feed it at most UINT_MAX at a time
+  unsigned char* in = reinterpret_cast<unsigned char*>(data_ + entry.data_offset_);
+  unsigned long long in_left = entry.compressed_size_;
+  unsigned long long out_left = entry.uncompressed_size_;
+  stream.next_out = reinterpret_cast<unsigned char*>(out);
+  int status = Z_OK;
+  while (status == Z_OK) {
+    if (stream.avail_in == 0 && in_left > 0) {
+      stream.next_in = in;
+      stream.avail_in = in_left > UINT_MAX ? UINT_MAX : in_left;
+      in += stream.avail_in;
+      in_left -= stream.avail_in;
+    }
+    if (stream.avail_out == 0 && out_left > 0) {
+      stream.avail_out = out_left > UINT_MAX ? UINT_MAX : out_left;
+      out_left -= stream.avail_out;
+    }
+    // Once the output is full, any more is an error (Z_BUF_ERROR), but the end
+    // of the stream can still be reached.
+    status = ::inflate(&stream, Z_NO_FLUSH); // zlib
+  }
+  bool complete = status == Z_STREAM_END
+    && out_left == 0 && stream.avail_out == 0;
+  inflateEnd(&stream);
+  return complete;
+}
+
+std::string zip_buffer(ziparchive& archive, const std::string& file_path) {
+  std::string buffer;
+  char* xml = archive.read(file_path, buffer);
+  if (xml != &buffer[0]) { // in place, so copy it out of the mapping
+    buffer.assign(xml);
+    buffer.push_back('\0');
+  }
   return buffer;
 }
 
-bool zip_has_file(
+std::string zip_buffer(
     const std::string& zip_path,
     const std::string& file_path) {
-  Function zip_has_file = tidyxl("zip_has_file");
-
-  LogicalVector res = wrap<LogicalVector>(zip_has_file(zip_path, file_path));
-  return res[0];
+  ziparchive archive(zip_path);
+  return zip_buffer(archive, file_path);
 }
 
-std::string extdata() {
-  Function system_file("system.file");
-  CharacterVector out =
-    system_file("extdata", Named("package") = "tidyxlcustom");
-  return as<std::string>(out);
+bool zip_has_file(
+    const std::string& zip_path,
+    const std::string& file_path) {
+  ziparchive archive(zip_path);
+  return archive.has_file(file_path);
 }
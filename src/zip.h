@@ -8,11 +8,87 @@
 #ifndef TIDYXL_ZIP_
 #define TIDYXL_ZIP_
 
+#include <map>
+#include <string>
 #include "rapidxml.h"
 
+// An entry in the central directory of a zip archive
+struct zipentry {
+  unsigned short     method_;            // 0 is stored, 8 is deflated
+  unsigned long long compressed_size_;
+  unsigned long long uncompressed_size_;
+  unsigned long long data_offset_;       // of the data, after the local header
+  bool               in_place_;          // whether a stored entry has been
+                                         // given out in place already
+};
+
+// A zip archive, memory-mapped copy-on-write, so that entries can be parsed by
+// rapidxml, which needs a writable, NUL-terminated buffer.
+//
+// The first time a stored (uncompressed) entry is read, it is given in place,
+// with the terminator written over the byte after it, which is the signature
+// of the next header.  Only that page is copied, unless the parse is
+// destructive.  Subsequent reads of the same entry copy it from the file,
+// because the mapping might have been modified.  Deflated entries are inflated
+// into a buffer provided by the caller, which can be reused, and is sized from
+// the uncompressed size in the central directory.
+//
+// An archive can also be given in memory, such as an R raw vector, which is
+// borrowed rather than copied, and must outlive the ziparchive.  It is never
+// written to, so stored entries are copied into the buffer instead of being
+// given in place.
+//
+// Errors are thrown as std::runtime_error.
+class ziparchive {
+
+  public:
+
+    explicit ziparchive(const std::string& path);
+    ziparchive(const std::string& path, // only for messages, if data is given
+               const char* data,        // in memory, or NULL to map path
+               size_t size);
+    ~ziparchive();
+
+    const std::string& path() const { return path_; } // for messages
+    bool has_file(const std::string& file_path) const;
+
+    // A NUL-terminated entry, either in the mapping or in buffer
+    char* read(const std::string& file_path, std::string& buffer);
+
+    // Lower-level access, which doesn't modify the archive, so it can be used
+    // from any thread.  find() returns NULL if there is no such entry, and inflate()
+    // returns false if a deflated entry couldn't be inflated into out, which
+    // must have room for the uncompressed size.
+    const zipentry* find(const std::string& file_path) const;
+    bool inflate(const zipentry& entry, char* out) const;
+
+  private:
+
+    std::string path_;
+    char* data_;  // the mapping, or the borrowed memory
+    size_t size_;
+    bool borrowed_; // whether data_ is borrowed, so mustn't be written
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#endif
+    std::map<std::string, zipentry> entries_;
+
+    ziparchive(const ziparchive&) = delete;
+    ziparchive& operator=(const ziparchive&) = delete;
+
+    void map();
+    void unmap();
+    void load();         // maps the file, unless borrowed, and caches entries
+    void cacheEntries(); // central directory and local headers
+    void copyEntry(const zipentry& entry, char* out) const;
+};
+
+// A copy of an entry, NUL-terminated, for parsers that need a std::string
+std::string zip_buffer(ziparchive& archive, const std::string& file_path);
+
+// Convenience for one-off reads, which map the archive each time
 std::string zip_buffer(const std::string& zip_path, const std::string& file_path);
 bool zip_has_file(const std::string& zip_path, const std::string& file_path);
-std::string extdata();
 
 #endif
-